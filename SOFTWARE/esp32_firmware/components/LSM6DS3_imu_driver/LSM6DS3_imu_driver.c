@@ -8,56 +8,437 @@
 
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 
+#include "driver/gpio.h"
 #include "driver/i2c_master.h"
+#include "esp_timer.h"
 
+#include "attitude_filter.h"
+#include "drive_base_driver.h"
+#include "pb_utils.h"
+#include "sdkconfig.h"
+#include "socket_mgr.h"
 #include "status_led_driver.h"
 
-#define IMU_TASK_STACK_SIZE (2048)
+#define IMU_TASK_STACK_SIZE CONFIG_LRR_TASK_IMU_STACK
 
 #define SCL_PIN 1
 #define SDA_PIN 2
 
+#define INT1_PIN CONFIG_LRR_IMU_INT1_GPIO
+
+// A full batch takes about 10 ms at 400 kHz
+#define I2C_TIMEOUT_MS 50
+#define I2C_QUEUE_DEPTH 2
+
+#define SAMPLE_PERIOD_US (1000000 / CONFIG_LRR_IMU_ODR_HZ)
+#define WATERMARK CONFIG_LRR_IMU_FIFO_WATERMARK
+#define BATCH_PERIOD_MS (WATERMARK * 1000 / CONFIG_LRR_IMU_ODR_HZ)
+
+// Each sample goes into the FIFO as gyro x, y, z then accel x, y, z, one
+// 16 bit word each
+#define WORDS_PER_SAMPLE 6
+#define BYTES_PER_SAMPLE (WORDS_PER_SAMPLE * 2)
+#define MAX_SAMPLES (sizeof(((Imu *)0)->samples) / sizeof(ImuSample))
+
+// +-4 g and +-500 dps, 0.122 mg and 17.5 mdps per count
+#define CTRL1_XL_FS_4G 0x08
+#define CTRL2_G_FS_500DPS 0x04
+#define ACCEL_SCALE (0.122e-3f * 9.80665f)
+#define GYRO_SCALE (17.5e-3f * 3.14159265f / 180.0f)
+
+#define CTRL3_C_BDU 0x40
+#define CTRL3_C_IF_INC 0x04
+#define FIFO_CTRL3_NO_DECIMATION 0x09 // Both gyro and accel in the FIFO
+#define FIFO_CTRL5_CONTINUOUS 0x06
+#define INT1_CTRL_FTH 0x08
+#define FIFO_STATUS2_OVER_RUN 0x40
+
 static const char *TAG = "imu driver";
 
-i2c_master_dev_handle_t imu_i2c_handle;
+static imu_stats_t stats;
+
+static uint8_t fifo_buffer[MAX_SAMPLES * BYTES_PER_SAMPLE];
+
+#if CONFIG_LRR_IMU_ATTITUDE_FILTER
+static attitude_filter_t attitude;
+#endif
+
+#if INT1_PIN >= 0
+static TaskHandle_t imu_task_handle;
+
+// When INT1 last went high, written by the ISR before it notifies the task
+static volatile int64_t watermark_us;
+#endif
+
+static i2c_master_bus_handle_t bus_handle;
+static i2c_master_dev_handle_t imu_i2c_handle;
+
+// The bus is in async mode, so transactions are queued and finish in the
+// background. Only one is ever in flight: the ISR records how it went and
+// gives i2c_done.
+static SemaphoreHandle_t i2c_done;
+static volatile bool i2c_ok;
+
+// Read by the driver after the call that queued it returns, so it can't be
+// on the stack
+static uint8_t i2c_tx[2];
+
+static bool IRAM_ATTR i2c_trans_done(i2c_master_dev_handle_t dev,
+                                     const i2c_master_event_data_t *evt,
+                                     void *arg)
+{
+    i2c_ok = evt->event == I2C_EVENT_DONE;
+
+    BaseType_t high_task_awoken = pdFALSE;
+    xSemaphoreGiveFromISR(i2c_done, &high_task_awoken);
+    return high_task_awoken == pdTRUE;
+}
+
+/*
+ * Wait for the queued transaction to finish.
+ */
+static esp_err_t i2c_finish()
+{
+    if (xSemaphoreTake(i2c_done, pdMS_TO_TICKS(I2C_TIMEOUT_MS) + 1) !=
+        pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+    return i2c_ok ? ESP_OK : ESP_FAIL;
+}
+
+/*
+ * Queue a read of length bytes starting at address, without waiting for it.
+ * data must stay untouched until i2c_finish.
+ */
+static esp_err_t start_read(uint8_t address, uint8_t *data, size_t length)
+{
+    i2c_tx[0] = address;
+    return i2c_master_transmit_receive(
+      imu_i2c_handle, i2c_tx, 1, data, length, I2C_TIMEOUT_MS);
+}
+
+static esp_err_t read_registers(uint8_t address, uint8_t *data, size_t length)
+{
+    esp_err_t err = start_read(address, data, length);
+    return err == ESP_OK ? i2c_finish() : err;
+}
+
+static esp_err_t write_register(uint8_t address, uint8_t value)
+{
+    i2c_tx[0] = address;
+    i2c_tx[1] = value;
+    esp_err_t err =
+      i2c_master_transmit(imu_i2c_handle, i2c_tx, 2, I2C_TIMEOUT_MS);
+    return err == ESP_OK ? i2c_finish() : err;
+}
+
+static int16_t read_word(const uint8_t *bytes)
+{
+    return (int16_t)(bytes[0] | (bytes[1] << 8));
+}
+
+static esp_err_t configure_fifo()
+{
+    const uint16_t threshold = WATERMARK * WORDS_PER_SAMPLE;
+    const uint8_t writes[][2] = {
+        { LSM6DS3_CTRL3_C, CTRL3_C_BDU | CTRL3_C_IF_INC },
+        // Bypass mode empties the FIFO, in case it's still running from
+        // before a reset
+        { LSM6DS3_FIFO_CTRL5, 0 },
+        { LSM6DS3_FIFO_CTRL1, threshold & 0xFF },
+        { LSM6DS3_FIFO_CTRL2, threshold >> 8 },
+        { LSM6DS3_FIFO_CTRL3, FIFO_CTRL3_NO_DECIMATION },
+        { LSM6DS3_FIFO_CTRL4, 0 },
+        { LSM6DS3_CTRL1_XL, (CONFIG_LRR_IMU_ODR_CODE << 4) | CTRL1_XL_FS_4G },
+        { LSM6DS3_CTRL2_G, (CONFIG_LRR_IMU_ODR_CODE << 4) | CTRL2_G_FS_500DPS },
+        // INT1 goes high at the watermark
+        { LSM6DS3_INT1_CTRL, INT1_CTRL_FTH },
+        { LSM6DS3_FIFO_CTRL5,
+          (CONFIG_LRR_IMU_ODR_CODE << 3) | FIFO_CTRL5_CONTINUOUS },
+    };
+
+    for (size_t i = 0; i < sizeof(writes) / sizeof(writes[0]); i++) {
+        esp_err_t err = write_register(writes[i][0], writes[i][1]);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    return ESP_OK;
+}
+
+/*
+ * Set the IMU up from the task that owns the bus, since i2c_tx and i2c_done
+ * are only good for one transaction at a time.
+ */
+static void start_sampling()
+{
+    esp_err_t err = configure_fifo();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to configure IMU: %s", esp_err_to_name(err));
+        set_status(eImuInitFailed);
+    }
+}
+
+/*
+ * Get the bus and the IMU back to a known state after a failed transaction.
+ * Whatever was in the FIFO is lost.
+ */
+static void recover_bus(esp_err_t err)
+{
+    stats.i2c_errors++;
+    ESP_LOGW(TAG, "I2C error (%s), resetting the bus", esp_err_to_name(err));
+
+    i2c_master_bus_wait_all_done(bus_handle, I2C_TIMEOUT_MS);
+    i2c_master_bus_reset(bus_handle);
+    // The failed transaction may still have finished late
+    xSemaphoreTake(i2c_done, 0);
+
+    // If the IMU itself reset it's back to power-on defaults
+    err = configure_fifo();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to reconfigure IMU: %s", esp_err_to_name(err));
+    }
+}
+
+static UdpPacket *start_packet(int64_t first_us)
+{
+    UdpPacket *packet = socket_mgr_acquire_packet(0);
+    if (packet == NULL) {
+        return NULL;
+    }
+
+    packet->has_imu = true;
+    Imu *imu = &packet->imu;
+    imu->has_time = true;
+    timestamp_from_esp_time(first_us, &imu->time);
+    imu->gyro_scale = GYRO_SCALE;
+    imu->accel_scale = ACCEL_SCALE;
+    return packet;
+}
+
+static void send_samples(UdpPacket *packet, size_t count)
+{
+    Imu *imu = &packet->imu;
+    imu->samples_count = count;
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t *raw = fifo_buffer + i * BYTES_PER_SAMPLE;
+        ImuSample *sample = &imu->samples[i];
+        sample->time_offset_us = i * SAMPLE_PERIOD_US;
+        sample->gyro_x = read_word(raw);
+        sample->gyro_y = read_word(raw + 2);
+        sample->gyro_z = read_word(raw + 4);
+        sample->accel_x = read_word(raw + 6);
+        sample->accel_y = read_word(raw + 8);
+        sample->accel_z = read_word(raw + 10);
+    }
+
+    socket_mgr_commit_packet(eTxLaneImu, packet);
+    stats.samples += count;
+}
+
+#if CONFIG_LRR_IMU_ATTITUDE_FILTER
+/*
+ * Run the attitude filter over the samples in fifo_buffer. Runs whether or
+ * not they can be sent, so the estimate never skips a sample.
+ */
+static void update_attitude(size_t count)
+{
+    // The wheels are only sampled once a batch, which is still quicker than
+    // the gyro bias ever moves
+    float v, w;
+    drive_base_get_twist(&v, &w);
+
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t *raw = fifo_buffer + i * BYTES_PER_SAMPLE;
+        float gyro[3], accel[3];
+        for (int axis = 0; axis < 3; axis++) {
+            gyro[axis] = read_word(raw + axis * 2) * GYRO_SCALE;
+            accel[axis] = read_word(raw + 6 + axis * 2) * ACCEL_SCALE;
+        }
+        attitude_filter_update(
+          &attitude, gyro, accel, w, true, SAMPLE_PERIOD_US / 1e6f);
+    }
+}
 
-void readRegisters(uint8_t address, uint8_t *data, size_t length)
+static void fill_attitude(UdpPacket *packet, int64_t newest_us)
 {
-    ESP_ERROR_CHECK(i2c_master_transmit_receive(
-      imu_i2c_handle, &address, 1, data, length, -1));
+    packet->has_attitude = true;
+    Attitude *out = &packet->attitude;
+    out->has_time = true;
+    timestamp_from_esp_time(newest_us, &out->time);
+    attitude_filter_get_euler(&attitude, &out->roll, &out->pitch, &out->yaw);
+    out->yaw_rate = attitude.yaw_rate;
+    out->gyro_bias_z = -attitude.integral[2];
 }
+#endif
 
-uint8_t readRegister(uint8_t address)
+/*
+ * Read out up to one packet's worth of samples and send them. at_us is when
+ * the FIFO held fill samples, with fill 0 meaning everything waiting now, and
+ * the samples are dated from that at the nominal rate. Returns how many are
+ * left behind.
+ */
+static size_t drain_fifo(int64_t at_us, size_t fill)
 {
-    uint8_t read;
-    readRegisters(address, &read, 1);
-    return read;
+    // Unread word count, status flags and the pattern for the next word
+    uint8_t status[4];
+    esp_err_t err =
+      read_registers(LSM6DS3_FIFO_STATUS1, status, sizeof(status));
+    if (err != ESP_OK) {
+        recover_bus(err);
+        return 0;
+    }
+    size_t words = status[0] | ((status[1] & 0x0F) << 8);
+    size_t pattern = status[2] | ((status[3] & 0x03) << 8);
+
+    if (status[1] & FIFO_STATUS2_OVER_RUN) {
+        stats.fifo_overruns++;
+        ESP_LOGW(TAG, "FIFO overrun, samples lost");
+    }
+
+    // Throw away the rest of a sample that's already been partly read, so
+    // the burst starts on a gyro x
+    size_t skip = (WORDS_PER_SAMPLE - pattern) % WORDS_PER_SAMPLE;
+    if (skip > words) {
+        return 0;
+    }
+    if (skip > 0) {
+        err = read_registers(LSM6DS3_FIFO_DATA_OUT_L, fifo_buffer, skip * 2);
+        if (err != ESP_OK) {
+            recover_bus(err);
+            return 0;
+        }
+        words -= skip;
+    }
+
+    size_t waiting = words / WORDS_PER_SAMPLE;
+    size_t count = waiting < MAX_SAMPLES ? waiting : MAX_SAMPLES;
+    if (count == 0) {
+        return 0;
+    }
+
+    // The address wraps back to FIFO_DATA_OUT_L after every word, so the
+    // whole batch comes out in one transaction
+    err = start_read(
+      LSM6DS3_FIFO_DATA_OUT_L, fifo_buffer, count * BYTES_PER_SAMPLE);
+    if (err != ESP_OK) {
+        recover_bus(err);
+        return 0;
+    }
+
+    // Get the packet ready while the samples are on the bus
+    if (fill == 0) {
+        fill = waiting;
+    }
+    int64_t first_us = at_us - (int64_t)(fill - 1) * SAMPLE_PERIOD_US;
+    UdpPacket *packet = start_packet(first_us);
+
+    err = i2c_finish();
+    if (err != ESP_OK) {
+        if (packet != NULL) {
+            socket_mgr_release_packet(packet);
+        }
+        recover_bus(err);
+        return 0;
+    }
+
+#if CONFIG_LRR_IMU_ATTITUDE_FILTER
+    update_attitude(count);
+    if (packet != NULL) {
+        fill_attitude(packet,
+                      first_us + (int64_t)(count - 1) * SAMPLE_PERIOD_US);
+    }
+#endif
+
+    if (packet == NULL) {
+        stats.dropped_batches++;
+    } else {
+        send_samples(packet, count);
+    }
+    return waiting - count;
 }
 
-void writeRegister(uint8_t address, uint8_t value)
+#if INT1_PIN >= 0
+static void IRAM_ATTR int1_isr(void *arg)
 {
-    uint8_t buff[] = { address, value };
+    watermark_us = esp_timer_get_time();
 
-    ESP_ERROR_CHECK(i2c_master_transmit(imu_i2c_handle, buff, 2, -1));
+    BaseType_t high_task_awoken = pdFALSE;
+    xTaskNotifyFromISR(imu_task_handle, 0, eIncrement, &high_task_awoken);
+    portYIELD_FROM_ISR(high_task_awoken);
 }
 
-void writeRegisters(uint8_t address, uint8_t *values, size_t length)
+static void start_int1_interrupt()
 {
-    uint8_t buff[] = { address };
+    gpio_config_t int1_config = {
+        .pin_bit_mask = 1ULL << INT1_PIN,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_DISABLE,
+        .pull_down_en = GPIO_PULLDOWN_ENABLE,
+        .intr_type = GPIO_INTR_POSEDGE,
+    };
+    ESP_ERROR_CHECK(gpio_config(&int1_config));
 
-    ESP_ERROR_CHECK(i2c_master_transmit(imu_i2c_handle, buff, 2, -1));
-    ESP_ERROR_CHECK(i2c_master_transmit(imu_i2c_handle, values, length, -1));
+    // Some other driver may have installed it already
+    esp_err_t err = gpio_install_isr_service(0);
+    if (err != ESP_ERR_INVALID_STATE) {
+        ESP_ERROR_CHECK(err);
+    }
+    ESP_ERROR_CHECK(gpio_isr_handler_add(INT1_PIN, int1_isr, NULL));
 }
 
 static void imu_driver_task(void *arg)
 {
+    // A missed edge would otherwise leave INT1 high and the FIFO full for
+    // good, so check in anyway if nothing arrives for a while
+    const TickType_t timeout = pdMS_TO_TICKS(4 * BATCH_PERIOD_MS) + 1;
+
+    // Sampling starts once init has the ISR in place to see the first
+    // watermark
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    start_sampling();
+
+    while (1) {
+        if (ulTaskNotifyTake(pdTRUE, timeout) == 0) {
+            drain_fifo(esp_timer_get_time(), 0);
+            continue;
+        }
+
+        // The watermark sample was the one that raised INT1
+        size_t left = drain_fifo(watermark_us, WATERMARK);
+
+        // INT1 only rises again once the FIFO has dropped below the
+        // watermark
+        while (left >= WATERMARK) {
+            left = drain_fifo(esp_timer_get_time(), 0);
+        }
+    }
+    vTaskDelete(NULL);
+}
+#else
+static void imu_driver_task(void *arg)
+{
+    // Check back about when the watermark should have been reached
+    const TickType_t period = pdMS_TO_TICKS(BATCH_PERIOD_MS) + 1;
+
+    start_sampling();
+    TickType_t last_wake = xTaskGetTickCount();
+
     while (1) {
-        vTaskDelay(50 / portTICK_PERIOD_MS);
+        vTaskDelayUntil(&last_wake, period);
+        drain_fifo(esp_timer_get_time(), 0);
     }
     vTaskDelete(NULL);
 }
+#endif
+
+void LSM6DS3_imu_driver_get_stats(imu_stats_t *out)
+{
+    *out = stats;
+}
 
 void LSM6DS3_imu_driver_init()
 {
@@ -67,8 +448,8 @@ void LSM6DS3_imu_driver_init()
         .scl_io_num = SCL_PIN,
         .sda_io_num = SDA_PIN,
         .glitch_ignore_cnt = 7,
+        .trans_queue_depth = I2C_QUEUE_DEPTH,
     };
-    i2c_master_bus_handle_t bus_handle;
 
     ESP_ERROR_CHECK(i2c_new_master_bus(&i2c_bus_config, &bus_handle));
 
@@ -78,21 +459,42 @@ void LSM6DS3_imu_driver_init()
     ESP_ERROR_CHECK(
       i2c_master_bus_add_device(bus_handle, &imu_i2c_conf, &imu_i2c_handle));
 
-    // i2c_master_transmit_receive();
-
-    // imu_publisher = register_publisher(
-    //   ROSIDL_GET_MSG_TYPE_SUPPORT(sensor_msgs, msg, imu), "lrr_imu");
-    // uint8_t write_addr = (0x6A << 1) | 1;
-    // uint8_t read;
-    // i2c_master_transmit_receive(
-    //   imu_i2c_handle, &DEV_READ_ADDR, 1, &read, 1, -1);
+    i2c_done = xSemaphoreCreateBinary();
+    i2c_master_event_callbacks_t callbacks = {
+        .on_trans_done = i2c_trans_done,
+    };
+    ESP_ERROR_CHECK(
+      i2c_master_register_event_callbacks(imu_i2c_handle, &callbacks, NULL));
 
-    if (readRegister(LSM6DS3_WHO_AM_I_REG) != 105) {
+    uint8_t who_am_i = 0;
+    esp_err_t err = read_registers(LSM6DS3_WHO_AM_I_REG, &who_am_i, 1);
+    if (err != ESP_OK || who_am_i != 105) {
         set_status(eImuInitFailed);
     }
 
-    ESP_LOGI(TAG, "IMU WHO_AM_I: %d", (int)readRegister(LSM6DS3_WHO_AM_I_REG));
+    ESP_LOGI(TAG, "IMU WHO_AM_I: %d", (int)who_am_i);
+
+#if CONFIG_LRR_IMU_ATTITUDE_FILTER
+    attitude_filter_init(&attitude);
+#endif
 
-    xTaskCreate(
-      imu_driver_task, "imu_driver_task", IMU_TASK_STACK_SIZE, NULL, 10, NULL);
+#if INT1_PIN >= 0
+    xTaskCreatePinnedToCore(imu_driver_task,
+                            "imu_driver_task",
+                            IMU_TASK_STACK_SIZE,
+                            NULL,
+                            CONFIG_LRR_TASK_IMU_PRIO,
+                            &imu_task_handle,
+                            CONFIG_LRR_TASK_IMU_CORE);
+    start_int1_interrupt();
+    xTaskNotifyGive(imu_task_handle);
+#else
+    xTaskCreatePinnedToCore(imu_driver_task,
+                            "imu_driver_task",
+                            IMU_TASK_STACK_SIZE,
+                            NULL,
+                            CONFIG_LRR_TASK_IMU_PRIO,
+                            NULL,
+                            CONFIG_LRR_TASK_IMU_CORE);
+#endif
 }
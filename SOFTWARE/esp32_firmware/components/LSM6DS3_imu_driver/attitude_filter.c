@@ -0,0 +1,108 @@
+// https://ahrs.readthedocs.io/en/latest/filters/mahony.html
+
+#include "attitude_filter.h"
+
+#include <math.h>
+
+#define GRAVITY 9.80665f
+
+// How hard the accelerometer pulls roll and pitch towards gravity, and how
+// fast it trims the x and y bias
+#define ACCEL_KP 1.0f
+#define ACCEL_KI 0.02f
+
+// How fast the wheels trim the z bias. Only the integral is fed, so a
+// slipping wheel can nudge the bias estimate but never the rate itself.
+#define WHEEL_KI 0.05f
+
+// Accelerometer readings further than this from 1 g are mostly the robot
+// accelerating, not gravity
+#define ACCEL_GATE (0.15f * GRAVITY)
+
+// Most bias the integral is allowed to learn, rad/s
+#define MAX_BIAS 0.2f
+
+static float clamp(float value, float limit)
+{
+    return value > limit ? limit : (value < -limit ? -limit : value);
+}
+
+void attitude_filter_init(attitude_filter_t *filter)
+{
+    *filter = (attitude_filter_t){ .q = { 1.0f, 0.0f, 0.0f, 0.0f } };
+}
+
+void attitude_filter_update(attitude_filter_t *filter,
+                            const float gyro[3],
+                            const float accel[3],
+                            float wheel_yaw_rate,
+                            bool have_wheels,
+                            float dt)
+{
+    float *q = filter->q;
+    float error[3] = { 0.0f, 0.0f, 0.0f };
+
+    float accel_norm = sqrtf(
+      accel[0] * accel[0] + accel[1] * accel[1] + accel[2] * accel[2]);
+    bool have_gravity = fabsf(accel_norm - GRAVITY) < ACCEL_GATE;
+    if (have_gravity) {
+        float ax = accel[0] / accel_norm;
+        float ay = accel[1] / accel_norm;
+        float az = accel[2] / accel_norm;
+
+        // Which way gravity should point in the body frame
+        float vx = 2.0f * (q[1] * q[3] - q[0] * q[2]);
+        float vy = 2.0f * (q[0] * q[1] + q[2] * q[3]);
+        float vz = q[0] * q[0] - q[1] * q[1] - q[2] * q[2] + q[3] * q[3];
+
+        error[0] = ay * vz - az * vy;
+        error[1] = az * vx - ax * vz;
+        error[2] = ax * vy - ay * vx;
+
+        for (int i = 0; i < 3; i++) {
+            filter->integral[i] += ACCEL_KI * error[i] * dt;
+        }
+    }
+
+    if (have_wheels) {
+        float gyro_yaw_rate = gyro[2] + filter->integral[2];
+        filter->integral[2] += WHEEL_KI * (wheel_yaw_rate - gyro_yaw_rate) * dt;
+    }
+
+    float rate[3];
+    for (int i = 0; i < 3; i++) {
+        filter->integral[i] = clamp(filter->integral[i], MAX_BIAS);
+        rate[i] = gyro[i] + filter->integral[i];
+        if (have_gravity) {
+            rate[i] += ACCEL_KP * error[i];
+        }
+    }
+    filter->yaw_rate = gyro[2] + filter->integral[2];
+
+    // q += 0.5 * q * (0, rate) * dt
+    float half_dt = 0.5f * dt;
+    float qw = q[0], qx = q[1], qy = q[2], qz = q[3];
+    q[0] += (-qx * rate[0] - qy * rate[1] - qz * rate[2]) * half_dt;
+    q[1] += (qw * rate[0] + qy * rate[2] - qz * rate[1]) * half_dt;
+    q[2] += (qw * rate[1] - qx * rate[2] + qz * rate[0]) * half_dt;
+    q[3] += (qw * rate[2] + qx * rate[1] - qy * rate[0]) * half_dt;
+
+    float norm =
+      sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+    for (int i = 0; i < 4; i++) {
+        q[i] /= norm;
+    }
+}
+
+void attitude_filter_get_euler(const attitude_filter_t *filter,
+                               float *roll,
+                               float *pitch,
+                               float *yaw)
+{
+    const float *q = filter->q;
+    *roll = atan2f(2.0f * (q[0] * q[1] + q[2] * q[3]),
+                   1.0f - 2.0f * (q[1] * q[1] + q[2] * q[2]));
+    *pitch = asinf(clamp(2.0f * (q[0] * q[2] - q[3] * q[1]), 1.0f));
+    *yaw = atan2f(2.0f * (q[0] * q[3] + q[1] * q[2]),
+                  1.0f - 2.0f * (q[2] * q[2] + q[3] * q[3]));
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+
+/*
+ * Mahony style attitude filter.
+ *
+ * The gyro is integrated into a quaternion at the IMU rate. The
+ * accelerometer pulls roll and pitch back towards gravity, and the wheel
+ * odometry yaw rate is used to learn the gyro's z bias, so heading drifts
+ * far slower than the gyro alone without inheriting wheel slip.
+ */
+typedef struct
+{
+    float q[4];        // w, x, y, z, body to odom
+    float integral[3]; // Learned gyro correction, rad/s
+    float yaw_rate;    // Corrected, from the last update
+} attitude_filter_t;
+
+void attitude_filter_init(attitude_filter_t *filter);
+
+/*
+ * Fold in one IMU sample, dt seconds after the last one. gyro is in rad/s and
+ * accel in m/s^2. wheel_yaw_rate is in rad/s, pass have_wheels false if it
+ * isn't known.
+ */
+void attitude_filter_update(attitude_filter_t *filter,
+                            const float gyro[3],
+                            const float accel[3],
+                            float wheel_yaw_rate,
+                            bool have_wheels,
+                            float dt);
+
+void attitude_filter_get_euler(const attitude_filter_t *filter,
+                               float *roll,
+                               float *pitch,
+                               float *yaw);
@@ -1,10 +1,21 @@
 #pragma once
 
+#include <stdint.h>
+
 #define LSM6DS3_ADDRESS 0b1101011
 
+#define LSM6DS3_FIFO_CTRL1 0X06
+#define LSM6DS3_FIFO_CTRL2 0X07
+#define LSM6DS3_FIFO_CTRL3 0X08
+#define LSM6DS3_FIFO_CTRL4 0X09
+#define LSM6DS3_FIFO_CTRL5 0X0A
+
+#define LSM6DS3_INT1_CTRL 0X0D
+
 #define LSM6DS3_WHO_AM_I_REG 0X0F
 #define LSM6DS3_CTRL1_XL 0X10
 #define LSM6DS3_CTRL2_G 0X11
+#define LSM6DS3_CTRL3_C 0X12
 
 #define LSM6DS3_STATUS_REG 0X1E
 
@@ -26,4 +37,24 @@
 #define LSM6DS3_OUTZ_L_XL 0X2C
 #define LSM6DS3_OUTZ_H_XL 0X2D
 
+#define LSM6DS3_FIFO_STATUS1 0X3A
+#define LSM6DS3_FIFO_STATUS2 0X3B
+#define LSM6DS3_FIFO_STATUS3 0X3C
+#define LSM6DS3_FIFO_STATUS4 0X3D
+#define LSM6DS3_FIFO_DATA_OUT_L 0X3E
+#define LSM6DS3_FIFO_DATA_OUT_H 0X3F
+
+/*
+ * Counters since boot, for diagnostics
+ */
+typedef struct
+{
+    uint32_t samples;         // Sent to the host
+    uint32_t fifo_overruns;   // Times the FIFO filled up before being drained
+    uint32_t dropped_batches; // No packet free to send a batch in
+    uint32_t i2c_errors;      // Failed transactions, each one resets the bus
+} imu_stats_t;
+
+void LSM6DS3_imu_driver_get_stats(imu_stats_t *stats);
+
 void LSM6DS3_imu_driver_init();
@@ -4,22 +4,34 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/idf_additions.h"
 #include "freertos/task.h"
+#include "freertos/timers.h"
 
+#include "driver/gptimer.h"
+#include "esp_attr.h"
 #include "esp_timer.h"
+#include "nvs.h"
 
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
-#include <time.h>
 
+#include "motor_calibration.h"
 #include "motor_driver.h"
+#include "setpoint_profile.h"
+#include "sdkconfig.h"
 #include "soc/soc.h"
 
+#include "flight_recorder.h"
 #include "messages.pb.h"
+#include "pb_utils.h"
+#include "power_mgr.h"
 #include "socket_mgr.h"
+#include "time_sync.h"
 
 #include "status_led_driver.h"
+#include "trace.h"
 
-#define DRIVE_BASE_TASK_SIZE (4096)
+#define DRIVE_BASE_TASK_SIZE CONFIG_LRR_TASK_DRIVE_BASE_STACK
 
 // PIN DEFINITIONS
 #define MOTOR_ENABLE 5
@@ -64,14 +76,129 @@
 
 static const char *TAG = "drive_base_driver";
 
+// CONTROL LOOP
+#define CONTROL_TIMER_RESOLUTION_HZ 1000000
+#define CONTROL_LOOP_PERIOD_US (1000000 / CONFIG_LRR_CONTROL_LOOP_HZ)
+#define JITTER_LOG_PERIOD_US (10 * 1000 * 1000)
+
 // PUBLISHERS
 #define PUBLISHER_LOOP_PERIOD_MS 20
+#define PUBLISHER_DECIMATION                                                   \
+    (PUBLISHER_LOOP_PERIOD_MS * 1000 / CONTROL_LOOP_PERIOD_US)
+
+static TaskHandle_t control_task_handle = NULL;
+
+// COMMANDS
+#define CMD_STATS_PERIOD_US (1000 * 1000)
+#define CMD_AGE_BUCKETS 8
+// Further than this in the future and the host clock doesn't match ours
+#define MAX_CLOCK_LEAD_US (1000 * 1000)
+
+// Upper edges of the command age histogram, the last bucket is open ended
+static const int64_t cmd_age_bucket_us[CMD_AGE_BUCKETS - 1] = {
+    2000, 5000, 10000, 20000, 50000, 100000, 200000,
+};
+
+/*
+ * Counters behind CommandStats, reset every report
+ */
+typedef struct
+{
+    uint32_t age_histogram[CMD_AGE_BUCKETS];
+    uint32_t unstamped;
+    uint32_t rejected;
+    uint32_t timeouts;
+} cmd_stats_t;
+
+// Latest accepted command, set from the RX task and applied by the control
+// loop. Everything here is under cmd_lock.
+static portMUX_TYPE cmd_lock = portMUX_INITIALIZER_UNLOCKED;
+static float cmd_v = 0;
+static float cmd_w = 0;
+static int64_t last_cmd_us = 0;
+static cmd_stats_t cmd_stats = {};
+
+#if CONFIG_LRR_CMD_VEL_PROFILE
+// References actually handed to the wheels, only touched by the control loop
+static setpoint_profile_t linear_profile;
+static setpoint_profile_t angular_profile;
+#endif
+
+// TUNING
+// Kept next to the agent IP in NVS
+#define PARAMS_NVS_NAMESPACE "storage"
+#define PARAMS_NVS_KEY "motor_params"
+#define MODELS_NVS_KEY "motor_models"
+
+// Tuning for both wheels, set from the RX task and picked up by the control
+// loop between steps. Everything here is under params_lock.
+static portMUX_TYPE params_lock = portMUX_INITIALIZER_UNLOCKED;
+static motor_params_t motor_params = MOTOR_PARAMS_DEFAULT();
+static motor_model_t motor_models[2] = { MOTOR_MODEL_DEFAULT(),
+                                          MOTOR_MODEL_DEFAULT() };
+static bool motor_params_changed = false;
+static bool calibration_requested = false;
+static bool calibration_save = false;
+// Tuning waiting for the timer task to write it to NVS
+static motor_params_t save_params;
+static motor_model_t save_models[2];
+static bool save_params_pending = false;
+static bool save_models_pending = false;
+
+// Only touched by the control loop
+static motor_calibration_t calibration[2];
+static bool calibrating = false;
+
+/*
+ * How far the loop strayed from its nominal period
+ */
+typedef struct
+{
+    uint32_t loops;
+    int64_t total_jitter_us; // Sum of |jitter|, for the mean
+    int32_t max_jitter_us;
+} loop_timing_t;
+
+// Written by the control task, snapshot and reset by whoever reports them
+static portMUX_TYPE timing_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t total_loops = 0;
+static uint32_t total_overruns = 0;
+static uint32_t worst_jitter_us = 0;
+
+// ODOMETRY
+// Wheel slip, as variance per meter a wheel travels. A guess for now.
+#define WHEEL_VARIANCE_PER_M 0.0005
+// Same guess the host side used before odometry moved here
+#define TWIST_VARIANCE 0.1f
+
+/*
+ * Pose integrated from every control step. Only the control task touches
+ * this, so there's no lock.
+ */
+typedef struct
+{
+    double x, y, yaw;     // odom frame, m and rad
+    double covariance[9]; // Row major over x, y, yaw
+    double last_left;     // Wheel travel at the last step, m
+    double last_right;
+    int64_t timestamp_us;
+} odometry_t;
+
+static odometry_t odometry = {};
 
 // MOTORS
 motor_handle_t left_motor_handle;
 motor_handle_t right_motor_handle;
 
-UdpPacket wheel_state_msg;
+/*
+ * Distance a wheel has rolled forward, in m, from an encoder reading in rad.
+ * Encoders count the way the motor turns, so this undoes mirrored mounting.
+ */
+static double wheel_travel(const motor_handle_t *motor, double radians)
+{
+    double travel = radians * (WHEEL_DIAMETER / 2.0);
+    return motor->reversed ? -travel : travel;
+}
 
 static void set_drive_base_enabled(bool enable)
 {
@@ -85,42 +212,646 @@ static void set_diff_drive(float left, float right)
     set_motor_velocity(&right_motor_handle, right);
 }
 
+/*
+ * How long ago the host sent a command, or -1 if that can't be known.
+ */
+static int64_t command_age_us(const TwistCmd *cmd)
+{
+    if (!cmd->has_time || cmd->time.sec == 0) {
+        return -1;
+    }
+
+    // Same clock the host stamped the command on
+    int64_t now_us;
+    if (!time_sync_host_time_us(esp_timer_get_time(), &now_us)) {
+        return -1;
+    }
+
+    int64_t sent_us =
+      (int64_t)cmd->time.sec * 1000000 + cmd->time.nanosec / 1000;
+    int64_t age_us = now_us - sent_us;
+    if (age_us < -MAX_CLOCK_LEAD_US) {
+        return -1;
+    }
+
+    // A little negative is just the two clocks being slightly apart
+    return age_us < 0 ? 0 : age_us;
+}
+
 void cmd_vel_callback(void *cmd)
 {
     TwistCmd twist_cmd = *((TwistCmd *)cmd);
-    double v = twist_cmd.v;
-    double w = twist_cmd.w;
+    int64_t age_us = command_age_us(&twist_cmd);
+
+#if CONFIG_LRR_RECORDER
+    recorder_twist_cmd_t record = {
+        .sec = twist_cmd.has_time ? twist_cmd.time.sec : 0,
+        .nanosec = twist_cmd.has_time ? twist_cmd.time.nanosec : 0,
+        .v = twist_cmd.v,
+        .w = twist_cmd.w,
+    };
+    flight_recorder_write(eRecordTwistCmd, &record, sizeof(record));
+#endif
+    bool stale = age_us > CONFIG_LRR_CMD_VEL_MAX_AGE_MS * 1000;
+
+    size_t bucket = 0;
+    while (bucket < CMD_AGE_BUCKETS - 1 &&
+           age_us >= cmd_age_bucket_us[bucket]) {
+        bucket++;
+    }
+
+    taskENTER_CRITICAL(&cmd_lock);
+    if (age_us < 0) {
+        cmd_stats.unstamped++;
+    } else {
+        cmd_stats.age_histogram[bucket]++;
+    }
+
+    if (stale) {
+        cmd_stats.rejected++;
+    } else {
+        cmd_v = twist_cmd.v;
+        cmd_w = twist_cmd.w;
+        last_cmd_us = esp_timer_get_time();
+    }
+    taskEXIT_CRITICAL(&cmd_lock);
+
+    // Up to full speed before the control loop picks the command up
+    if (!stale) {
+        power_mgr_note_motion(twist_cmd.v != 0.0f || twist_cmd.w != 0.0f);
+    }
+}
+
+static bool motor_params_valid(const motor_params_t *params)
+{
+    const float values[] = { params->kp,         params->ki,
+                             params->kd,         params->integral_limit,
+                             params->max_jerk,   params->hysteresis };
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        if (!isfinite(values[i]) || values[i] < 0.0f) {
+            return false;
+        }
+    }
+    return params->max_jerk > 0.0f && params->hysteresis < 1.0f;
+}
+
+static bool motor_model_valid(const motor_model_t *model)
+{
+    return isfinite(model->ks) && isfinite(model->kv) && model->ks >= 0.0f &&
+           model->ks < 1.0f && model->kv >= 0.0f;
+}
+
+/*
+ * Read a blob saved by save_tuning, if there is one of the right size.
+ */
+static bool load_tuning(const char *key, void *data, size_t size)
+{
+    nvs_handle_t handle;
+    if (nvs_open(PARAMS_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return false;
+    }
+
+    size_t len = size;
+    esp_err_t err = nvs_get_blob(handle, key, data, &len);
+    nvs_close(handle);
+
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        return false;
+    } else if (err != ESP_OK || len != size) {
+        ESP_LOGW(TAG, "Saved %s unusable, using defaults", key);
+        return false;
+    }
+    return true;
+}
+
+static esp_err_t save_tuning(const char *key, const void *data, size_t size)
+{
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(PARAMS_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error (%s) opening NVS handle", esp_err_to_name(err));
+        return err;
+    }
+
+    err = nvs_set_blob(handle, key, data, size);
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error (%s) saving %s", esp_err_to_name(err), key);
+    }
+    return err;
+}
+
+/*
+ * Start from the tuning saved by the last ControlConfig or CalibrateMotors
+ * with save set, if there is any.
+ */
+static void load_motor_params()
+{
+    motor_params_t params;
+    if (load_tuning(PARAMS_NVS_KEY, &params, sizeof(params)) &&
+        motor_params_valid(&params)) {
+        ESP_LOGI(TAG, "Loaded saved motor params");
+        motor_params = params;
+        motor_params_changed = true;
+    }
+
+    motor_model_t models[2];
+    if (load_tuning(MODELS_NVS_KEY, models, sizeof(models)) &&
+        motor_model_valid(&models[0]) && motor_model_valid(&models[1])) {
+        ESP_LOGI(TAG, "Loaded saved motor models");
+        motor_models[0] = models[0];
+        motor_models[1] = models[1];
+        motor_params_changed = true;
+    }
+}
+
+/*
+ * Runs on the timer task, so neither the control loop nor the RX task ever
+ * waits on flash.
+ */
+static void save_pending_tuning(void *arg1, uint32_t arg2)
+{
+    motor_params_t params;
+    motor_model_t models[2];
+    taskENTER_CRITICAL(&params_lock);
+    bool has_params = save_params_pending;
+    bool has_models = save_models_pending;
+    params = save_params;
+    models[0] = save_models[0];
+    models[1] = save_models[1];
+    save_params_pending = false;
+    save_models_pending = false;
+    taskEXIT_CRITICAL(&params_lock);
+
+    if (has_params) {
+        save_tuning(PARAMS_NVS_KEY, &params, sizeof(params));
+    }
+    if (has_models) {
+        save_tuning(MODELS_NVS_KEY, models, sizeof(models));
+    }
+}
+
+/*
+ * Have the timer task save params and/or models, either may be NULL. If
+ * another save is already queued it picks these up as well.
+ */
+static void queue_tuning_save(const motor_params_t *params,
+                              const motor_model_t *models)
+{
+    taskENTER_CRITICAL(&params_lock);
+    if (params != NULL) {
+        save_params = *params;
+        save_params_pending = true;
+    }
+    if (models != NULL) {
+        save_models[0] = models[0];
+        save_models[1] = models[1];
+        save_models_pending = true;
+    }
+    taskEXIT_CRITICAL(&params_lock);
+
+    if (xTimerPendFunctionCall(save_pending_tuning, NULL, 0, 0) != pdPASS) {
+        ESP_LOGE(TAG, "Couldn't queue saving the tuning");
+    }
+}
+
+/*
+ * Report the tuning in use, so the host can confirm what it sent. Sent
+ * reliably, since the host only asks until it has heard once.
+ */
+static void publish_control_config()
+{
+    UdpPacket *config_msg = socket_mgr_acquire_packet(0);
+    if (config_msg == NULL) {
+        ESP_LOGE(TAG, "Failed to get a packet for control config");
+        return;
+    }
+
+    taskENTER_CRITICAL(&params_lock);
+    motor_params_t params = motor_params;
+    motor_model_t left = motor_models[0];
+    motor_model_t right = motor_models[1];
+    taskEXIT_CRITICAL(&params_lock);
+
+    config_msg->has_control_config = true;
+    config_msg->control_config = (ControlConfig){
+        .kp = params.kp,
+        .ki = params.ki,
+        .kd = params.kd,
+        .integral_limit = params.integral_limit,
+        .max_jerk = params.max_jerk,
+        .hysteresis = params.hysteresis,
+        .loop_hz = CONFIG_LRR_CONTROL_LOOP_HZ,
+        .models_count = 2,
+        .models = {
+            { .ks = left.ks, .kv = left.kv },
+            { .ks = right.ks, .kv = right.kv },
+        },
+    };
+
+    socket_mgr_send_reliable(config_msg);
+}
+
+static void control_config_callback(void *arg)
+{
+    const ControlConfig *config = arg;
+
+    if (!config->query) {
+        motor_params_t params = {
+            .kp = config->kp,
+            .ki = config->ki,
+            .kd = config->kd,
+            .integral_limit = config->integral_limit,
+            .max_jerk = config->max_jerk,
+            .hysteresis = config->hysteresis,
+        };
+        motor_model_t models[2];
+        bool has_models = config->models_count == 2;
+        for (size_t i = 0; has_models && i < 2; i++) {
+            models[i] = (motor_model_t){
+                .ks = config->models[i].ks,
+                .kv = config->models[i].kv,
+            };
+            has_models = motor_model_valid(&models[i]);
+        }
+
+        if (!motor_params_valid(&params) ||
+            (config->models_count != 0 && !has_models)) {
+            ESP_LOGW(TAG, "Ignoring invalid control config");
+        } else {
+            taskENTER_CRITICAL(&params_lock);
+            motor_params = params;
+            if (has_models) {
+                motor_models[0] = models[0];
+                motor_models[1] = models[1];
+            }
+            motor_params_changed = true;
+            taskEXIT_CRITICAL(&params_lock);
+
+            ESP_LOGI(TAG,
+                     "Motor params set: kp %.3f ki %.3f kd %.3f",
+                     params.kp,
+                     params.ki,
+                     params.kd);
+
+            if (config->save) {
+                queue_tuning_save(&params, has_models ? models : NULL);
+            }
+        }
+    }
+
+    publish_control_config();
+}
+
+static void calibrate_motors_callback(void *arg)
+{
+    const CalibrateMotors *request = arg;
+
+    taskENTER_CRITICAL(&params_lock);
+    calibration_requested = true;
+    calibration_save = request->save;
+    taskEXIT_CRITICAL(&params_lock);
+}
+
+/*
+ * Switch both wheels over to new tuning if any has arrived.
+ */
+static void apply_motor_params()
+{
+    taskENTER_CRITICAL(&params_lock);
+    bool changed = motor_params_changed;
+    motor_params_t params = motor_params;
+    motor_model_t left = motor_models[0];
+    motor_model_t right = motor_models[1];
+    motor_params_changed = false;
+    taskEXIT_CRITICAL(&params_lock);
+
+    if (changed) {
+        set_motor_params(&left_motor_handle, &params);
+        set_motor_params(&right_motor_handle, &params);
+        set_motor_model(&left_motor_handle, &left);
+        set_motor_model(&right_motor_handle, &right);
+    }
+}
+
+static void reset_command_profile()
+{
+#if CONFIG_LRR_CMD_VEL_PROFILE
+    setpoint_profile_init(&linear_profile,
+                          CONFIG_LRR_CMD_VEL_MAX_ACCEL / 1000.0f,
+                          CONFIG_LRR_CMD_VEL_MAX_JERK / 1000.0f);
+    setpoint_profile_init(&angular_profile,
+                          CONFIG_LRR_CMD_VEL_MAX_ANGULAR_ACCEL / 1000.0f,
+                          CONFIG_LRR_CMD_VEL_MAX_ANGULAR_JERK / 1000.0f);
+#endif
+}
+
+/*
+ * Start calibrating if the host asked to. Returns whether a calibration is
+ * running, in which case it owns both motors and commands are ignored.
+ */
+static bool check_calibration(int64_t now_us)
+{
+    if (calibrating) {
+        return true;
+    }
+
+    taskENTER_CRITICAL(&params_lock);
+    bool start = calibration_requested;
+    calibration_requested = false;
+    taskEXIT_CRITICAL(&params_lock);
+
+    if (start) {
+        ESP_LOGI(TAG, "Calibrating motor models");
+        // Pick up from a standstill afterwards
+        reset_command_profile();
+        motor_calibration_start(&calibration[0], &left_motor_handle, now_us);
+        motor_calibration_start(&calibration[1], &right_motor_handle, now_us);
+        calibrating = true;
+    }
+    return calibrating;
+}
+
+/*
+ * Advance a running calibration, and use the fits once it's done. Both
+ * motors run the same schedule so they finish on the same step.
+ */
+static void update_calibration(int64_t now_us)
+{
+    bool running = motor_calibration_update(&calibration[0], now_us);
+    running |= motor_calibration_update(&calibration[1], now_us);
+    if (running) {
+        return;
+    }
+    calibrating = false;
+
+    motor_model_t left, right;
+    if (!motor_calibration_result(&calibration[0], &left) ||
+        !motor_calibration_result(&calibration[1], &right)) {
+        ESP_LOGW(TAG, "Calibration failed, keeping the old motor models");
+        publish_control_config();
+        return;
+    }
+
+    ESP_LOGI(TAG,
+             "Calibrated: left ks %.3f kv %.4f, right ks %.3f kv %.4f",
+             left.ks,
+             left.kv,
+             right.ks,
+             right.kv);
+
+    taskENTER_CRITICAL(&params_lock);
+    motor_models[0] = left;
+    motor_models[1] = right;
+    motor_params_changed = true;
+    bool save = calibration_save;
+    taskEXIT_CRITICAL(&params_lock);
+
+    if (save) {
+        motor_model_t models[2] = { left, right };
+        queue_tuning_save(NULL, models);
+    }
+    publish_control_config();
+}
+
+/*
+ * Hand the latest command to the wheels, ramping it down if commands have
+ * stopped coming. With the profile on, the wheels get a smoothed reference
+ * every step however far apart the commands arrive.
+ */
+static void apply_command(int64_t now_us, float dt)
+{
+    static bool timed_out = true; // Nothing to time out until the first one
+
+    taskENTER_CRITICAL(&cmd_lock);
+    float v = cmd_v;
+    float w = cmd_w;
+    int64_t silent_us = now_us - last_cmd_us;
+    taskEXIT_CRITICAL(&cmd_lock);
+
+#if CONFIG_LRR_CMD_VEL_TIMEOUT_MS > 0
+    int64_t late_us = silent_us - CONFIG_LRR_CMD_VEL_TIMEOUT_MS * 1000;
+    if (late_us > 0) {
+        if (!timed_out) {
+            timed_out = true;
+            ESP_LOGW(TAG,
+                     "No cmd_vel for %d ms, stopping",
+                     CONFIG_LRR_CMD_VEL_TIMEOUT_MS);
+            taskENTER_CRITICAL(&cmd_lock);
+            cmd_stats.timeouts++;
+            taskEXIT_CRITICAL(&cmd_lock);
+        }
+
+        float scale =
+          1.0f - (float)late_us / (CONFIG_LRR_CMD_VEL_RAMP_MS * 1000.0f);
+        if (scale < 0.0f) {
+            scale = 0.0f;
+        }
+        v *= scale;
+        w *= scale;
+    } else {
+        timed_out = false;
+    }
+#else
+    (void)silent_us;
+    (void)timed_out;
+#endif
+
+#if CONFIG_LRR_CMD_VEL_PROFILE
+    v = setpoint_profile_update(&linear_profile, v, dt);
+    w = setpoint_profile_update(&angular_profile, w, dt);
+#else
+    (void)dt;
+#endif
 
     // https://control.ros.org/master/doc/ros2_controllers/doc/mobile_robot_kinematics.html#differential-drive-robot
-    set_diff_drive((v - ((w * WHEEL_TRACK) / 2.0)) * (2.0 / WHEEL_DIAMETER),
-                   (v + ((w * WHEEL_TRACK) / 2.0)) * (2.0 / WHEEL_DIAMETER));
+    float left = (v - ((w * WHEEL_TRACK) / 2.0)) * (2.0 / WHEEL_DIAMETER);
+    float right = (v + ((w * WHEEL_TRACK) / 2.0)) * (2.0 / WHEEL_DIAMETER);
+    set_diff_drive(left, right);
+}
+
+static void publish_command_stats()
+{
+    UdpPacket *stats_msg = socket_mgr_acquire_packet(0);
+    if (stats_msg == NULL) {
+        ESP_LOGE(TAG, "Failed to get a packet for command stats");
+        return;
+    }
+
+    taskENTER_CRITICAL(&cmd_lock);
+    cmd_stats_t stats = cmd_stats;
+    cmd_stats = (cmd_stats_t){};
+    taskEXIT_CRITICAL(&cmd_lock);
+
+    stats_msg->has_command_stats = true;
+    CommandStats *command_stats = &stats_msg->command_stats;
+    command_stats->age_histogram_count = CMD_AGE_BUCKETS;
+    memcpy(command_stats->age_histogram,
+           stats.age_histogram,
+           sizeof(stats.age_histogram));
+    command_stats->unstamped = stats.unstamped;
+    command_stats->rejected = stats.rejected;
+    command_stats->timeouts = stats.timeouts;
+
+    socket_mgr_commit_packet(eTxLaneControl, stats_msg);
 }
 
-void wheel_state_publish_timer_callback()
+/*
+ * Add the wheel travel since the last step to the pose, and grow its
+ * covariance with the usual differential drive error model: each wheel's
+ * variance is proportional to how far it went.
+ * https://www.roboticsproceedings.org/rss01/p26.pdf
+ */
+static void update_odometry(double left_travel,
+                            double right_travel,
+                            int64_t timestamp_us)
 {
-    struct timespec ts;
-    clock_gettime(CLOCK_REALTIME, &ts);
-    wheel_state_msg.joint_states.time.sec = (int32_t)ts.tv_sec;
-    wheel_state_msg.joint_states.time.nanosec = (uint32_t)ts.tv_nsec;
+    double dl = left_travel - odometry.last_left;
+    double dr = right_travel - odometry.last_right;
+    odometry.last_left = left_travel;
+    odometry.last_right = right_travel;
+    odometry.timestamp_us = timestamp_us;
+
+    double ds = (dr + dl) / 2.0;
+    double dyaw = (dr - dl) / WHEEL_TRACK;
+    double heading = odometry.yaw + dyaw / 2.0;
+    double c = cos(heading);
+    double s = sin(heading);
+
+    odometry.x += ds * c;
+    odometry.y += ds * s;
+    odometry.yaw += dyaw;
+
+    // Jacobians with respect to the pose and to each wheel's travel
+    double fp[9] = {
+        1.0, 0.0, -ds * s, //
+        0.0, 1.0, ds * c,  //
+        0.0, 0.0, 1.0,
+    };
+    double k = ds / (2.0 * WHEEL_TRACK);
+    double fr[3] = { 0.5 * c - k * s, 0.5 * s + k * c, 1.0 / WHEEL_TRACK };
+    double fl[3] = { 0.5 * c + k * s, 0.5 * s - k * c, -1.0 / WHEEL_TRACK };
+    double var_r = WHEEL_VARIANCE_PER_M * fabs(dr);
+    double var_l = WHEEL_VARIANCE_PER_M * fabs(dl);
 
-    wheel_state_msg.joint_states.position[0] =
-      left_motor_handle.encoder.position;
-    wheel_state_msg.joint_states.velocity[0] =
-      left_motor_handle.encoder.velocity;
-    wheel_state_msg.joint_states.effort[0] =
-      (double)left_motor_handle.applied_effort;
+    // P = Fp P Fp' + Fr var_r Fr' + Fl var_l Fl'
+    double fpp[9];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            fpp[i * 3 + j] = 0.0;
+            for (int n = 0; n < 3; n++) {
+                fpp[i * 3 + j] +=
+                  fp[i * 3 + n] * odometry.covariance[n * 3 + j];
+            }
+        }
+    }
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            double sum = fr[i] * var_r * fr[j] + fl[i] * var_l * fl[j];
+            for (int n = 0; n < 3; n++) {
+                sum += fpp[i * 3 + n] * fp[j * 3 + n];
+            }
+            odometry.covariance[i * 3 + j] = sum;
+        }
+    }
+}
 
-    wheel_state_msg.joint_states.position[1] =
-      right_motor_handle.encoder.position;
-    wheel_state_msg.joint_states.velocity[1] =
-      right_motor_handle.encoder.velocity;
-    wheel_state_msg.joint_states.effort[1] =
-      (double)right_motor_handle.applied_effort;
+static void fill_odometry(Odometry *out)
+{
+    out->has_time = true;
+    timestamp_from_esp_time(odometry.timestamp_us, &out->time);
+    out->x = (float)odometry.x;
+    out->y = (float)odometry.y;
+    out->yaw = (float)atan2(sin(odometry.yaw), cos(odometry.yaw));
+    drive_base_get_twist(&out->v, &out->w);
+
+    out->pose_covariance_count = 9;
+    for (int i = 0; i < 9; i++) {
+        out->pose_covariance[i] = (float)odometry.covariance[i];
+    }
+    out->twist_covariance_count = 4;
+    out->twist_covariance[0] = TWIST_VARIANCE;
+    out->twist_covariance[1] = 0.0f;
+    out->twist_covariance[2] = 0.0f;
+    out->twist_covariance[3] = TWIST_VARIANCE;
+}
 
-    if (tx_queue != NULL &&
-        xQueueSend(tx_queue, (void *)&wheel_state_msg, 10) != pdTRUE) {
-        ESP_LOGE(TAG, "Failed to push scan onto queue");
+void publish_wheel_state()
+{
+    UdpPacket *wheel_state_msg = socket_mgr_acquire_packet(0);
+    if (wheel_state_msg == NULL) {
+        ESP_LOGE(TAG, "Failed to get a packet for joint states");
+        return;
     }
+
+    wheel_state_msg->has_joint_states = true;
+    JointStates *joint_states = &wheel_state_msg->joint_states;
+
+    motor_state_t left, right;
+    get_motor_state(&left_motor_handle, &left);
+    get_motor_state(&right_motor_handle, &right);
+
+    // Both wheels are sampled back to back, stamp with the first
+    joint_states->has_time = true;
+    timestamp_from_esp_time(left.timestamp_us, &joint_states->time);
+
+    joint_states->name_count = 2;
+    joint_states->velocity_count = 2;
+    joint_states->position_count = 2;
+    joint_states->effort_count = 2;
+
+    strcpy(joint_states->name[0], "wheel_left");
+    strcpy(joint_states->name[1], "wheel_right");
+
+    joint_states->position[0] = left.position;
+    joint_states->velocity[0] = left.velocity;
+    joint_states->effort[0] = (double)left.effort;
+
+    joint_states->position[1] = right.position;
+    joint_states->velocity[1] = right.velocity;
+    joint_states->effort[1] = (double)right.effort;
+
+    wheel_state_msg->has_odometry = true;
+    fill_odometry(&wheel_state_msg->odometry);
+
+    socket_mgr_commit_packet(eTxLaneControl, wheel_state_msg);
+}
+
+static bool IRAM_ATTR
+control_timer_isr(gptimer_handle_t timer,
+                  const gptimer_alarm_event_data_t *edata,
+                  void *user_ctx)
+{
+    BaseType_t high_task_awoken = pdFALSE;
+    vTaskNotifyGiveFromISR(control_task_handle, &high_task_awoken);
+    return high_task_awoken == pdTRUE;
+}
+
+static void start_control_timer()
+{
+    gptimer_handle_t timer = NULL;
+    gptimer_config_t timer_config = {
+        .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+        .direction = GPTIMER_COUNT_UP,
+        .resolution_hz = CONTROL_TIMER_RESOLUTION_HZ,
+    };
+    ESP_ERROR_CHECK(gptimer_new_timer(&timer_config, &timer));
+
+    gptimer_event_callbacks_t callbacks = { .on_alarm = control_timer_isr };
+    ESP_ERROR_CHECK(gptimer_register_event_callbacks(timer, &callbacks, NULL));
+    ESP_ERROR_CHECK(gptimer_enable(timer));
+
+    gptimer_alarm_config_t alarm_config = {
+        .reload_count = 0,
+        .alarm_count = CONTROL_LOOP_PERIOD_US,
+        .flags.auto_reload_on_alarm = true,
+    };
+    ESP_ERROR_CHECK(gptimer_set_alarm_action(timer, &alarm_config));
+    ESP_ERROR_CHECK(gptimer_start(timer));
 }
 
 static void drive_base_driver_task(void *arg)
@@ -130,7 +861,6 @@ static void drive_base_driver_task(void *arg)
 
     // MOTOR SETUP
     configure_motor(&left_motor_handle,
-                    "left_motor",
                     LEFT_MOTOR_PWM_A_PIN,
                     LEFT_MOTOR_PWM_A_CHANNEL,
                     LEFT_MOTOR_PWM_B_PIN,
@@ -140,7 +870,6 @@ static void drive_base_driver_task(void *arg)
                     false);
 
     configure_motor(&right_motor_handle,
-                    "right_motor",
                     RIGHT_MOTOR_PWM_A_PIN,
                     RIGHT_MOTOR_PWM_A_CHANNEL,
                     RIGHT_MOTOR_PWM_B_PIN,
@@ -149,45 +878,147 @@ static void drive_base_driver_task(void *arg)
                     RIGHT_ENCODER_PIN_B,
                     true);
 
-    esp_timer_create_args_t pub_timer_args = {
-        .callback = wheel_state_publish_timer_callback,
-        .name = "wheel_state_publish_timer"
-    };
-    esp_timer_handle_t pub_timer_handle;
-    ESP_ERROR_CHECK(esp_timer_create(&pub_timer_args, &pub_timer_handle));
-    esp_timer_start_periodic(pub_timer_handle, PUBLISHER_LOOP_PERIOD_MS * 1000);
-
     set_drive_base_enabled(true);
+    reset_command_profile();
+
+    // The timer interrupt lands on this core, next to the task it wakes.
+    control_task_handle = xTaskGetCurrentTaskHandle();
+    start_control_timer();
+
+    int64_t last_wake_us = esp_timer_get_time();
+    int64_t last_stats_us = last_wake_us;
+#if CONFIG_LRR_CONTROL_LOG_JITTER
+    int64_t last_log_us = last_wake_us;
+#endif
+    loop_timing_t timing = {};
+    uint32_t publish_count = 0;
 
     while (1) {
-        vTaskDelay(1000 / portTICK_PERIOD_MS);
+        // More than one pending notification means ticks went by while the
+        // last pass was still running.
+        uint32_t ticks = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        int64_t wake_us = esp_timer_get_time();
+        TRACE_BEGIN(eTraceControlLoop);
+        taskENTER_CRITICAL(&timing_lock);
+        total_loops++;
+        if (ticks > 1) {
+            total_overruns += ticks - 1;
+        }
+        taskEXIT_CRITICAL(&timing_lock);
+        if (ticks > 1) {
+            status_led_activity(eActivityOverrun);
+        }
+
+        // Sample both wheels back to back so they agree with each other
+        encoder_sample_t left = read_motor_encoder(&left_motor_handle);
+        encoder_sample_t right = read_motor_encoder(&right_motor_handle);
+#if CONFIG_LRR_RECORDER
+        recorder_encoders_t encoders = {
+            .edges = { left.edges, right.edges },
+            .last_edge_ticks = { left.last_edge_ticks, right.last_edge_ticks },
+        };
+        flight_recorder_write(eRecordEncoders, &encoders, sizeof(encoders));
+#endif
+        float dt = (float)(wake_us - last_wake_us) / 1e6f;
+
+        apply_motor_params();
+        if (!check_calibration(wake_us)) {
+            apply_command(wake_us, dt);
+        }
+        update_motor(&left_motor_handle, &left, dt);
+        update_motor(&right_motor_handle, &right, dt);
+        if (calibrating) {
+            power_mgr_note_motion(true);
+            update_calibration(wake_us);
+        }
+        update_odometry(
+          wheel_travel(&left_motor_handle, left_motor_handle.state.position),
+          wheel_travel(&right_motor_handle, right_motor_handle.state.position),
+          left_motor_handle.state.timestamp_us);
+
+        if (++publish_count >= PUBLISHER_DECIMATION) {
+            publish_count = 0;
+            publish_wheel_state();
+        }
+
+        if (wake_us - last_stats_us > CMD_STATS_PERIOD_US) {
+            publish_command_stats();
+            last_stats_us = wake_us;
+        }
+
+        TRACE_END(eTraceControlLoop);
+
+        int32_t jitter_us =
+          (int32_t)(wake_us - last_wake_us) - CONTROL_LOOP_PERIOD_US;
+        if (jitter_us < 0) {
+            jitter_us = -jitter_us;
+        }
+        timing.loops++;
+        timing.total_jitter_us += jitter_us;
+        if (jitter_us > timing.max_jitter_us) {
+            timing.max_jitter_us = jitter_us;
+        }
+        taskENTER_CRITICAL(&timing_lock);
+        if ((uint32_t)jitter_us > worst_jitter_us) {
+            worst_jitter_us = (uint32_t)jitter_us;
+        }
+        taskEXIT_CRITICAL(&timing_lock);
+        last_wake_us = wake_us;
+
+#if CONFIG_LRR_CONTROL_LOG_JITTER
+        if (wake_us - last_log_us > JITTER_LOG_PERIOD_US) {
+            ESP_LOGI(TAG,
+                     "Control loop at %d Hz, jitter mean %ld us, max %ld us",
+                     CONFIG_LRR_CONTROL_LOOP_HZ,
+                     (long)(timing.total_jitter_us / timing.loops),
+                     (long)timing.max_jitter_us);
+            timing = (loop_timing_t){};
+            last_log_us = wake_us;
+        }
+#endif
     }
 
     vTaskDelete(NULL);
 }
 
+void drive_base_driver_get_stats(drive_base_stats_t *stats)
+{
+    taskENTER_CRITICAL(&timing_lock);
+    stats->loops = total_loops;
+    stats->overruns = total_overruns;
+    stats->max_jitter_us = worst_jitter_us;
+    worst_jitter_us = 0;
+    taskEXIT_CRITICAL(&timing_lock);
+}
+
+void drive_base_get_twist(float *v, float *w)
+{
+    motor_state_t left, right;
+    get_motor_state(&left_motor_handle, &left);
+    get_motor_state(&right_motor_handle, &right);
+
+    double left_speed = wheel_travel(&left_motor_handle, left.velocity);
+    double right_speed = wheel_travel(&right_motor_handle, right.velocity);
+
+    *v = (right_speed + left_speed) / 2.0;
+    *w = (right_speed - left_speed) / WHEEL_TRACK;
+}
+
 void drive_base_driver_init()
 {
     // AGENT SETUP
     register_callback(cmd_vel_callback, eTwistCmd);
+    register_callback(control_config_callback, eControlConfig);
+    register_callback(calibrate_motors_callback, eCalibrateMotors);
 
-    wheel_state_msg.has_joint_states = true;
-    wheel_state_msg.joint_states.has_time = true;
-
-    wheel_state_msg.joint_states.name_count = 2;
-    wheel_state_msg.joint_states.velocity_count = 2;
-    wheel_state_msg.joint_states.position_count = 2;
-    wheel_state_msg.joint_states.effort_count = 2;
-
-    strcpy(wheel_state_msg.joint_states.name[0], "wheel_left");
-    strcpy(wheel_state_msg.joint_states.name[1], "wheel_right");
+    load_motor_params();
 
     // START TASK
     xTaskCreatePinnedToCore(drive_base_driver_task,
                             "drive_base_driver_task",
                             DRIVE_BASE_TASK_SIZE,
                             NULL,
-                            10,
+                            CONFIG_LRR_TASK_DRIVE_BASE_PRIO,
                             NULL,
-                            APP_CPU_NUM);
+                            CONFIG_LRR_TASK_DRIVE_BASE_CORE);
 }
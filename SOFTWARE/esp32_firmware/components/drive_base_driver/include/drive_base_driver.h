@@ -1,3 +1,23 @@
 #pragma once
 
+#include <stdint.h>
+
+/*
+ * Control loop health, for diagnostics
+ */
+typedef struct
+{
+    uint32_t loops;    // Since boot
+    uint32_t overruns; // Timer ticks missed because a pass ran long
+    uint32_t max_jitter_us; // Worst since the last call
+} drive_base_stats_t;
+
+void drive_base_driver_get_stats(drive_base_stats_t *stats);
+
+/*
+ * Body velocity from the latest wheel states: v in m/s, w in rad/s. Same
+ * caveat as get_motor_state about preempting the control loop.
+ */
+void drive_base_get_twist(float *v, float *w);
+
 void drive_base_driver_init();
\ No newline at end of file
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "motor_driver.h"
+
+/*
+ * Fits a motor's feedforward model from a series of open loop steps, each
+ * level once forward and once backward. The velocity each step settles at
+ * gives one point on the effort / velocity line, and a least squares fit
+ * through them gives ks and kv.
+ *
+ * Runs inside the control loop, one update per step, so the loop keeps its
+ * timing throughout. The wheel spins on its own for several seconds.
+ */
+typedef struct
+{
+    motor_handle_t *motor;
+    int64_t start_us;
+    int step;
+
+    // Velocity while the current step is settled
+    double step_velocity_sum;
+    uint32_t step_samples;
+
+    // Least squares sums over the settled steps
+    double sum_v;
+    double sum_e;
+    double sum_vv;
+    double sum_ve;
+    uint32_t points;
+} motor_calibration_t;
+
+/*
+ * Take over the motor and start the first step.
+ */
+void motor_calibration_start(motor_calibration_t *cal,
+                             motor_handle_t *motor,
+                             int64_t now_us);
+
+/*
+ * Advance the calibration, after the motor's update for this step. Returns
+ * false once it's done, at which point the motor is back to closed loop.
+ */
+bool motor_calibration_update(motor_calibration_t *cal, int64_t now_us);
+
+/*
+ * The fitted model. Returns false if the steps didn't give a usable fit,
+ * leaving model alone.
+ */
+bool motor_calibration_result(const motor_calibration_t *cal,
+                              motor_model_t *model);
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * The arithmetic half of the velocity loop: wheel velocity from encoder
+ * samples, and the feedforward model. Touches no peripherals, so it also
+ * builds for the host benchmarks in host_bench.
+ */
+
+#define PULSES_PER_ROTATION 2340.0
+#define PULSES_TO_RAD(pulses)                                                  \
+    (((float)pulses / PULSES_PER_ROTATION) * (2 * M_PI))
+
+/*
+ * Everything the velocity loop needs from an encoder, read together.
+ */
+typedef struct
+{
+    int count;
+    int32_t edges;
+    uint32_t last_edge_ticks;
+    int64_t last_edge_us;
+    int64_t sample_us;
+} encoder_sample_t;
+
+/*
+ * Where the velocity estimate left off.
+ */
+typedef struct
+{
+    int32_t sampled_edges;
+    uint32_t sampled_edge_ticks;
+    int64_t sampled_edge_us;
+    float raw_velocity; // rad / s, before filtering
+} velocity_estimate_t;
+
+/*
+ * Velocity loop tuning. Everything is per second rather than per step, so
+ * the same values work at any control loop rate.
+ */
+typedef struct
+{
+    float kp;             // Effort per rad/s of error
+    float ki;             // Effort per rad of accumulated error
+    float kd;             // Effort per rad/s^2 of error change
+    float integral_limit; // Most effort the integral term contributes
+    float max_jerk;       // Most the applied effort changes per second
+    float hysteresis;     // Efforts below this are dropped
+} motor_params_t;
+
+// Tuned by hand on the stock TT motors
+#define MOTOR_PARAMS_DEFAULT()                                                 \
+    {                                                                          \
+        .kp = 0.3f,                                                            \
+        .ki = 30.0f,                                                           \
+        .kd = 0.0f,                                                            \
+        .integral_limit = 0.09f,                                               \
+        .max_jerk = 10.0f,                                                     \
+        .hysteresis = 0.05f,                                                   \
+    }
+
+/*
+ * Steady state effort a motor needs to hold a velocity: ks to overcome
+ * friction, plus kv per rad/s. Fed forward ahead of the PID so it only has
+ * to correct what the model gets wrong. Fit per motor by motor_calibration.
+ */
+typedef struct
+{
+    float ks; // Effort
+    float kv; // Effort per rad/s
+} motor_model_t;
+
+// Rough numbers for a stock TT motor at 6 V, calibrate to do better
+#define MOTOR_MODEL_DEFAULT()                                                  \
+    {                                                                          \
+        .ks = 0.25f,                                                           \
+        .kv = 0.037f,                                                          \
+    }
+
+/*
+ * Start an estimate at rest, as of the encoder's last edge.
+ */
+void velocity_estimate_init(velocity_estimate_t *estimate,
+                            int64_t last_edge_us);
+
+/*
+ * Take a sample dt seconds after the last one, and return velocity (the
+ * previous filtered value) filtered towards the new raw estimate. Edge
+ * ticks count at tick_hz.
+ */
+float velocity_estimate_update(velocity_estimate_t *estimate,
+                               double velocity,
+                               const encoder_sample_t *sample,
+                               uint32_t tick_hz,
+                               float dt);
+
+/*
+ * Effort the model expects to hold velocity, 0 for a stop.
+ */
+float motor_feedforward(const motor_model_t *model, float velocity);
@@ -1,43 +1,88 @@
 #pragma once
 
-#include "esp_timer.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
+#include "driver/mcpwm_cap.h"
+#include "driver/mcpwm_prelude.h"
 #include "driver/pulse_cnt.h"
 #include "hal/ledc_types.h"
+#include "motor_control.h"
 #include "pid_ctrl.h"
+#include "sdkconfig.h"
 #include "soc/gpio_num.h"
 
 /*
  * Represents an encoder.
+ *
+ * The PCNT unit counts every edge for position. Velocity comes from an MCPWM
+ * capture channel on phase A, which timestamps each edge so the estimate
+ * doesn't depend on when the control loop happens to sample.
  */
 typedef struct
 {
     pcnt_channel_handle_t channel_a;
     pcnt_channel_handle_t channel_b;
     pcnt_unit_handle_t unit;
-    double velocity; // rad / s
+    double velocity; // rad / s, filtered
     double position; // rad
     int count;
+
+    mcpwm_cap_channel_handle_t capture;
+    gpio_num_t pin_b;
+    portMUX_TYPE capture_lock;
+    // Written by the capture ISR
+    int32_t edges; // Phase A edges, signed by direction
+    uint32_t last_edge_ticks;
+    int64_t last_edge_us;
+
+    velocity_estimate_t estimate;
 } encoder_handle_t;
 
+/*
+ * A consistent sample of a motor, taken at the end of a control step.
+ */
+typedef struct
+{
+    double position; // rad
+    double velocity; // rad / s
+    float effort;    // Applied, -1 to 1
+    int64_t timestamp_us; // esp_timer time the encoder was sampled
+} motor_state_t;
+
 /*
  * Represents a motor.
  */
 typedef struct
 {
+#if CONFIG_LRR_MOTOR_PWM_MCPWM
+    mcpwm_oper_handle_t pwm_operator;
+    mcpwm_cmpr_handle_t comparator;
+    mcpwm_gen_handle_t gen_a;
+    mcpwm_gen_handle_t gen_b;
+    int pwm_direction; // Which input is switching: 1 is b, -1 is a, 0 none
+#else
     ledc_channel_t chan_a;
     ledc_channel_t chan_b;
+#endif
     gpio_num_t enable_pin;
-    double cmd_velocity;
+    float cmd_velocity; // Set from other tasks, one word so it can't tear
     float cmd_effort;
     float applied_effort;
+    bool open_loop; // Apply open_loop_effort and leave the PID alone
+    float open_loop_effort;
     encoder_handle_t encoder;
     pid_ctrl_block_handle_t pid_controller;
-    esp_timer_handle_t pid_timer;
-    esp_timer_create_args_t pid_args;
+    motor_params_t params;
+    motor_model_t model;
     bool reversed;
+
+    // Seqlock around state: odd while the control loop is writing it
+    atomic_uint state_sequence;
+    motor_state_t state;
 } motor_handle_t;
 
 /*
@@ -50,17 +95,18 @@ void set_motor_enabled(motor_handle_t *motor, bool enable);
  */
 void set_motor_velocity(motor_handle_t *motor, float velocity);
 
+#if !CONFIG_LRR_MOTOR_PWM_MCPWM
 /*
  * Configure a GPIO pin for PWM control.
  */
 void configure_pwm(ledc_channel_t channel, int gpio);
+#endif
 
 /*
  * Configure a motor for use with the given control pins, pwm channels, and
- * encoder.
+ * encoder. The channels are only used by the LEDC backend.
  */
 void configure_motor(motor_handle_t *motor,
-                     char *motor_name,
                      gpio_num_t pwm_a_pin,
                      ledc_channel_t pwm_a_chan,
                      gpio_num_t pwm_b_pin,
@@ -69,6 +115,45 @@ void configure_motor(motor_handle_t *motor,
                      gpio_num_t encoder_pin_b,
                      bool reversed);
 
+/*
+ * Switch a motor to new tuning. Only call this from the control loop,
+ * between steps, so the PID never sees half of an update.
+ */
+void set_motor_params(motor_handle_t *motor, const motor_params_t *params);
+
+/*
+ * Switch a motor to a new feedforward model. Control loop only.
+ */
+void set_motor_model(motor_handle_t *motor, const motor_model_t *model);
+
+/*
+ * Drive a motor at a fixed effort, in the motor's own direction, ignoring
+ * its velocity command. The PID starts over when closed loop resumes.
+ * Control loop only.
+ */
+void set_motor_open_loop(motor_handle_t *motor, bool enable, float effort);
+
+/*
+ * Sample a motor's encoder, for passing to update_motor.
+ */
+encoder_sample_t read_motor_encoder(motor_handle_t *motor);
+
+/*
+ * Run one step of the velocity loop, dt seconds after the last one. The
+ * sample comes from read_motor_encoder, so both wheels can be sampled
+ * together before either one is updated.
+ */
+void update_motor(motor_handle_t *motor,
+                  const encoder_sample_t *sample,
+                  float dt);
+
+/*
+ * Copy out the latest state of a motor without blocking the control loop.
+ * Retries if the control loop was mid-update, so don't call this from a task
+ * that can preempt the control loop on its own core.
+ */
+void get_motor_state(motor_handle_t *motor, motor_state_t *state);
+
 /*
  * Initialize the PWM peripheral for use with motors.
  */
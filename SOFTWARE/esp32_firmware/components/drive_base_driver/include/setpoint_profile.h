@@ -0,0 +1,30 @@
+#pragma once
+
+/*
+ * Smooths a stepped velocity target into a reference the wheels can follow.
+ * Acceleration is limited to max_accel and changes no faster than max_jerk,
+ * and the profile eases into the target without passing it. Each update
+ * moves it one control step closer, so commands sent at a few tens of Hz
+ * still come out as a reference at the full control rate.
+ */
+typedef struct
+{
+    float velocity;
+    float accel;
+    float max_accel;
+    float max_jerk;
+} setpoint_profile_t;
+
+/*
+ * Start at rest with the given limits, in units per s^2 and per s^3.
+ */
+void setpoint_profile_init(setpoint_profile_t *profile,
+                           float max_accel,
+                           float max_jerk);
+
+/*
+ * Step the profile dt seconds towards target and return the new reference.
+ */
+float setpoint_profile_update(setpoint_profile_t *profile,
+                              float target,
+                              float dt);
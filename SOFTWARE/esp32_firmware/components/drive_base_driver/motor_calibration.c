@@ -0,0 +1,103 @@
+#include "motor_calibration.h"
+
+#include <math.h>
+
+// Open loop efforts, each run forward then backward so the robot ends up
+// about where it started
+static const float step_efforts[] = { 0.3f, 0.4f, 0.5f, 0.6f, 0.7f, 0.8f };
+#define STEP_LEVELS (sizeof(step_efforts) / sizeof(step_efforts[0]))
+#define STEP_COUNT (2 * STEP_LEVELS)
+
+#define STEP_US (600 * 1000)
+// Time for the wheel to get up to speed before it's measured
+#define SETTLE_US (300 * 1000)
+
+// A step slower than this didn't get past static friction, rad/s
+#define MIN_VELOCITY 0.5f
+// Fewer points and the fit is mostly noise
+#define MIN_POINTS 3
+
+static float step_effort(int step)
+{
+    float effort = step_efforts[step / 2];
+    return step % 2 == 0 ? effort : -effort;
+}
+
+static void finish_step(motor_calibration_t *cal)
+{
+    if (cal->step_samples == 0) {
+        return;
+    }
+
+    // Both directions are folded onto the same line
+    double velocity = fabs(cal->step_velocity_sum / cal->step_samples);
+    double effort = fabsf(step_effort(cal->step));
+    if (velocity >= MIN_VELOCITY) {
+        cal->sum_v += velocity;
+        cal->sum_e += effort;
+        cal->sum_vv += velocity * velocity;
+        cal->sum_ve += velocity * effort;
+        cal->points++;
+    }
+
+    cal->step_velocity_sum = 0;
+    cal->step_samples = 0;
+}
+
+void motor_calibration_start(motor_calibration_t *cal,
+                             motor_handle_t *motor,
+                             int64_t now_us)
+{
+    *cal = (motor_calibration_t){
+        .motor = motor,
+        .start_us = now_us,
+    };
+    set_motor_open_loop(motor, true, step_effort(0));
+}
+
+bool motor_calibration_update(motor_calibration_t *cal, int64_t now_us)
+{
+    int64_t elapsed_us = now_us - cal->start_us;
+    int step = (int)(elapsed_us / STEP_US);
+
+    if (step != cal->step) {
+        finish_step(cal);
+        cal->step = step;
+        if (step >= (int)STEP_COUNT) {
+            set_motor_open_loop(cal->motor, false, 0.0f);
+            return false;
+        }
+        set_motor_open_loop(cal->motor, true, step_effort(step));
+    }
+
+    if (elapsed_us % STEP_US >= SETTLE_US) {
+        cal->step_velocity_sum += cal->motor->encoder.velocity;
+        cal->step_samples++;
+    }
+    return true;
+}
+
+bool motor_calibration_result(const motor_calibration_t *cal,
+                              motor_model_t *model)
+{
+    if (cal->points < MIN_POINTS) {
+        return false;
+    }
+
+    double n = cal->points;
+    double det = n * cal->sum_vv - cal->sum_v * cal->sum_v;
+    if (det <= 0.0) {
+        return false;
+    }
+
+    // effort = ks + kv * velocity
+    double kv = (n * cal->sum_ve - cal->sum_v * cal->sum_e) / det;
+    double ks = (cal->sum_e - kv * cal->sum_v) / n;
+    if (!(kv > 0.0) || ks < 0.0 || ks >= 1.0) {
+        return false;
+    }
+
+    model->ks = (float)ks;
+    model->kv = (float)kv;
+    return true;
+}
@@ -0,0 +1,87 @@
+#include "motor_control.h"
+
+#include <math.h>
+
+#include "sdkconfig.h"
+
+// Commands smaller than this, in rad/s, are a stop and get no feedforward
+#define FEEDFORWARD_MIN_VELOCITY 0.01f
+
+// The pulse counter sees both edges of both phases, capture only sees phase A
+#define EDGES_PER_ROTATION (PULSES_PER_ROTATION / 2.0)
+#define EDGES_TO_RAD(edges)                                                    \
+    (((float)edges / EDGES_PER_ROTATION) * (2 * M_PI))
+
+// No edge for this long and the wheel is considered stopped
+#define ENCODER_STOP_TIMEOUT_US 100000
+
+#define VELOCITY_FILTER_TAU                                                    \
+    (1.0f / (2.0f * (float)M_PI * CONFIG_LRR_ENCODER_VELOCITY_CUTOFF_HZ))
+
+static float clampf(float x, float min, float max)
+{
+    return x < min ? min : (x > max ? max : x);
+}
+
+void velocity_estimate_init(velocity_estimate_t *estimate,
+                            int64_t last_edge_us)
+{
+    *estimate = (velocity_estimate_t){
+        .sampled_edges = 0,
+        .sampled_edge_ticks = 0,
+        .sampled_edge_us = last_edge_us,
+        .raw_velocity = 0.0f,
+    };
+}
+
+/*
+ * Velocity from edge timestamps. With new edges it's the distance covered
+ * between the first and last edge over the exact time between them. Without
+ * any, the wheel can't be going faster than one edge since the last one, so
+ * the previous estimate is capped by that until it times out to zero.
+ */
+float velocity_estimate_update(velocity_estimate_t *estimate,
+                               double velocity,
+                               const encoder_sample_t *sample,
+                               uint32_t tick_hz,
+                               float dt)
+{
+    int32_t edges = sample->edges - estimate->sampled_edges;
+
+    if (edges != 0) {
+        if (sample->last_edge_us - estimate->sampled_edge_us >
+            ENCODER_STOP_TIMEOUT_US) {
+            // Starting from rest, there's no recent edge to measure from
+            estimate->raw_velocity = EDGES_TO_RAD(edges) / dt;
+        } else {
+            uint32_t ticks =
+              sample->last_edge_ticks - estimate->sampled_edge_ticks;
+            estimate->raw_velocity =
+              EDGES_TO_RAD(edges) * (float)tick_hz / (float)ticks;
+        }
+
+        estimate->sampled_edges = sample->edges;
+        estimate->sampled_edge_ticks = sample->last_edge_ticks;
+        estimate->sampled_edge_us = sample->last_edge_us;
+    } else {
+        int64_t since_edge_us = sample->sample_us - sample->last_edge_us;
+        if (since_edge_us > ENCODER_STOP_TIMEOUT_US) {
+            estimate->raw_velocity = 0;
+        } else {
+            float bound = EDGES_TO_RAD(1) * 1e6f / (float)since_edge_us;
+            estimate->raw_velocity =
+              clampf(estimate->raw_velocity, -bound, bound);
+        }
+    }
+
+    float alpha = dt / (VELOCITY_FILTER_TAU + dt);
+    return velocity + alpha * (estimate->raw_velocity - velocity);
+}
+
+float motor_feedforward(const motor_model_t *model, float velocity)
+{
+    if (fabsf(velocity) < FEEDFORWARD_MIN_VELOCITY) {
+        return 0.0f;
+    }
+    return copysignf(model->ks, velocity) + model->kv * velocity;
+}
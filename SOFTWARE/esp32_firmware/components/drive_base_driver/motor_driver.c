@@ -12,6 +12,9 @@
  *
  * PULSE COUNTER:
  * https://github.com/espressif/esp-idf/blob/master/examples/peripherals/pcnt/rotary_encoder/main/rotary_encoder_example_main.c
+ *
+ * EDGE CAPTURE:
+ * https://github.com/espressif/esp-idf/blob/master/examples/peripherals/mcpwm/mcpwm_capture_hc_sr04/main/mcpwm_capture_hc_sr04.c
  */
 
 #include "motor_driver.h"
@@ -21,33 +24,44 @@
 
 #include "driver/gpio.h"
 #include "driver/ledc.h"
+#include "driver/mcpwm_cap.h"
+#include "driver/mcpwm_prelude.h"
 #include "driver/pulse_cnt.h"
+#include "esp_attr.h"
 #include "esp_timer.h"
+#include "trace.h"
+#include "hal/gpio_ll.h"
 #include "hal/gpio_types.h"
 #include "hal/pcnt_types.h"
 #include "pid_ctrl.h"
+#include "sdkconfig.h"
+#include "soc/gpio_struct.h"
 
 #include <math.h>
 #include <stdlib.h>
 
-#define PWM_TIMER_RESOLUTION LEDC_TIMER_10_BIT
-
 // Anything above audible is fine
 #define PWM_FREQ_HZ 25000
 
-// Max change to motor power per pid cycle
-// Reduces current surges
-#define MAX_JERK 0.1
+#if CONFIG_LRR_MOTOR_PWM_MCPWM
+// Drive gets the second group, the encoders capture on the first
+#define PWM_GROUP 1
+#define PWM_RESOLUTION_HZ 80000000
+// 3200 steps at 25 kHz
+#define PWM_PERIOD_TICKS (PWM_RESOLUTION_HZ / PWM_FREQ_HZ)
 
-// Minimum % duty that must be applied to affect any motion
-// Inputs below this level are ignored
-#define HYSTERESIS 0.25
+// One timer for every motor, so all of them switch in step
+static mcpwm_timer_handle_t pwm_timer = NULL;
+#else
+#define PWM_TIMER_RESOLUTION LEDC_TIMER_10_BIT
+#endif
 
-#define PID_LOOP_PERIOD_MS 10.0
+// The PID block works per call, motor_params_t works per second
+#define CONTROL_LOOP_DT (1.0f / (float)CONFIG_LRR_CONTROL_LOOP_HZ)
 
-#define PULSES_PER_ROTATION 2340.0
-#define PULSES_TO_RAD(pulses)                                                  \
-    (((float)pulses / PULSES_PER_ROTATION) * (2 * M_PI))
+// Shared by every capture channel, there's only one per MCPWM group
+static mcpwm_cap_timer_handle_t capture_timer = NULL;
+static uint32_t capture_resolution_hz;
 
 double clamp(float d, float min, float max)
 {
@@ -71,15 +85,45 @@ void set_motor_enabled(motor_handle_t *motor, bool enable)
     }
 }
 
+#if CONFIG_LRR_MOTOR_PWM_MCPWM
+static void set_motor_power(motor_handle_t *motor, float power)
+{
+    power = clamp(power, -1.0, 1.0);
+    int direction = 0;
+    if (power > motor->params.hysteresis) {
+        direction = 1;
+    } else if (power < -motor->params.hysteresis) {
+        direction = -1;
+    }
+
+    // The DRV8212 wants one input switching and the other held low. That
+    // only changes with direction, so most steps are just the compare value.
+    if (direction != motor->pwm_direction) {
+        // -1 releases the force and lets the generator switch
+        int level_a = direction < 0 ? -1 : 0;
+        int level_b = direction > 0 ? -1 : 0;
+        ESP_ERROR_CHECK(
+          mcpwm_generator_set_force_level(motor->gen_a, level_a, true));
+        ESP_ERROR_CHECK(
+          mcpwm_generator_set_force_level(motor->gen_b, level_b, true));
+        motor->pwm_direction = direction;
+    }
+
+    uint32_t duty =
+      direction == 0 ? 0 : (uint32_t)(fabsf(power) * PWM_PERIOD_TICKS);
+    ESP_ERROR_CHECK(
+      mcpwm_comparator_set_compare_value(motor->comparator, duty));
+}
+#else
 static void set_motor_power(motor_handle_t *motor, float power)
 {
     power = clamp(power, -1.0, 1.0);
-    if (power > HYSTERESIS) {
+    if (power > motor->params.hysteresis) {
         ledc_set_duty(LEDC_LOW_SPEED_MODE,
                       motor->chan_b,
                       (uint32_t)(power * (float)(1 << PWM_TIMER_RESOLUTION)));
         ledc_set_duty(LEDC_LOW_SPEED_MODE, motor->chan_a, 0);
-    } else if (power < HYSTERESIS) {
+    } else if (power < -motor->params.hysteresis) {
         ledc_set_duty(LEDC_LOW_SPEED_MODE, motor->chan_b, 0);
         ledc_set_duty(LEDC_LOW_SPEED_MODE,
                       motor->chan_a,
@@ -92,6 +136,7 @@ static void set_motor_power(motor_handle_t *motor, float power)
     ledc_update_duty(LEDC_LOW_SPEED_MODE, motor->chan_a);
     ledc_update_duty(LEDC_LOW_SPEED_MODE, motor->chan_b);
 }
+#endif
 
 void set_motor_velocity(motor_handle_t *motor, float velocity)
 {
@@ -101,6 +146,57 @@ void set_motor_velocity(motor_handle_t *motor, float velocity)
     motor->cmd_velocity = velocity;
 }
 
+#if CONFIG_LRR_MOTOR_PWM_MCPWM
+static void configure_generator(mcpwm_gen_handle_t *gen,
+                                mcpwm_oper_handle_t oper,
+                                mcpwm_cmpr_handle_t comparator,
+                                int gpio)
+{
+    mcpwm_generator_config_t gen_config = { .gen_gpio_num = gpio };
+    ESP_ERROR_CHECK(mcpwm_new_generator(oper, &gen_config, gen));
+
+    // High from the start of each period until the compare value
+    ESP_ERROR_CHECK(mcpwm_generator_set_action_on_timer_event(
+      *gen,
+      MCPWM_GEN_TIMER_EVENT_ACTION(MCPWM_TIMER_DIRECTION_UP,
+                                   MCPWM_TIMER_EVENT_EMPTY,
+                                   MCPWM_GEN_ACTION_HIGH)));
+    ESP_ERROR_CHECK(mcpwm_generator_set_action_on_compare_event(
+      *gen,
+      MCPWM_GEN_COMPARE_EVENT_ACTION(
+        MCPWM_TIMER_DIRECTION_UP, comparator, MCPWM_GEN_ACTION_LOW)));
+
+    // Held low until the motor is first driven
+    ESP_ERROR_CHECK(mcpwm_generator_set_force_level(*gen, 0, true));
+}
+
+/*
+ * One operator per motor, with one comparator shared by both inputs since
+ * only one of them switches at a time.
+ */
+static void configure_motor_pwm(motor_handle_t *motor, int pin_a, int pin_b)
+{
+    mcpwm_operator_config_t operator_config = { .group_id = PWM_GROUP };
+    ESP_ERROR_CHECK(mcpwm_new_operator(&operator_config, &motor->pwm_operator));
+    ESP_ERROR_CHECK(
+      mcpwm_operator_connect_timer(motor->pwm_operator, pwm_timer));
+
+    // New duties latch when the shared timer wraps, so every motor changes
+    // at the same period boundary and never mid-pulse.
+    mcpwm_comparator_config_t comparator_config = {
+        .flags.update_cmp_on_tez = true,
+    };
+    ESP_ERROR_CHECK(mcpwm_new_comparator(
+      motor->pwm_operator, &comparator_config, &motor->comparator));
+    ESP_ERROR_CHECK(mcpwm_comparator_set_compare_value(motor->comparator, 0));
+
+    configure_generator(
+      &motor->gen_a, motor->pwm_operator, motor->comparator, pin_a);
+    configure_generator(
+      &motor->gen_b, motor->pwm_operator, motor->comparator, pin_b);
+    motor->pwm_direction = 0;
+}
+#else
 void configure_pwm(ledc_channel_t channel, int gpio)
 {
     ledc_channel_config_t pwm_channel = { .speed_mode = LEDC_LOW_SPEED_MODE,
@@ -113,33 +209,202 @@ void configure_pwm(ledc_channel_t channel, int gpio)
 
     ESP_ERROR_CHECK(ledc_channel_config(&pwm_channel));
 }
+#endif
 
-void pid_callback(void *arg)
+static bool IRAM_ATTR
+encoder_capture_isr(mcpwm_cap_channel_handle_t channel,
+                    const mcpwm_capture_event_data_t *edata,
+                    void *user_data)
 {
-    motor_handle_t *motor = (motor_handle_t *)arg;
+    encoder_handle_t *encoder = (encoder_handle_t *)user_data;
 
-    int current_encoder_count;
-    pcnt_unit_get_count(motor->encoder.unit, &current_encoder_count);
-    int pulses_elapsed = current_encoder_count - motor->encoder.count;
-    motor->encoder.velocity =
-      PULSES_TO_RAD(pulses_elapsed) * (1000.0 / PID_LOOP_PERIOD_MS);
-    motor->encoder.position = PULSES_TO_RAD(current_encoder_count);
-    double error = motor->cmd_velocity - motor->encoder.velocity;
+    // Same direction convention as the pulse counter: phase A edges count up
+    // when A ends up at the same level as B. B is read straight from the
+    // register, gpio_get_level lives in flash.
+    int a = edata->cap_edge == MCPWM_CAP_EDGE_POS;
+    int b = gpio_ll_get_level(&GPIO, encoder->pin_b);
 
-    ESP_ERROR_CHECK(
-      pid_compute(motor->pid_controller, error, &motor->cmd_effort));
+    portENTER_CRITICAL_ISR(&encoder->capture_lock);
+    encoder->edges += a == b ? 1 : -1;
+    encoder->last_edge_ticks = edata->cap_value;
+    encoder->last_edge_us = esp_timer_get_time();
+    portEXIT_CRITICAL_ISR(&encoder->capture_lock);
+
+    return false;
+}
+
+encoder_sample_t read_motor_encoder(motor_handle_t *motor)
+{
+    encoder_sample_t sample;
+    pcnt_unit_get_count(motor->encoder.unit, &sample.count);
+
+    portENTER_CRITICAL(&motor->encoder.capture_lock);
+    sample.edges = motor->encoder.edges;
+    sample.last_edge_ticks = motor->encoder.last_edge_ticks;
+    sample.last_edge_us = motor->encoder.last_edge_us;
+    portEXIT_CRITICAL(&motor->encoder.capture_lock);
+
+    sample.sample_us = esp_timer_get_time();
+    return sample;
+}
+
+static void store_motor_state(motor_handle_t *motor,
+                              const motor_state_t *state)
+{
+    unsigned sequence =
+      atomic_load_explicit(&motor->state_sequence, memory_order_relaxed);
+
+    atomic_store_explicit(
+      &motor->state_sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    motor->state = *state;
+
+    atomic_store_explicit(
+      &motor->state_sequence, sequence + 2, memory_order_release);
+}
+
+void get_motor_state(motor_handle_t *motor, motor_state_t *state)
+{
+    unsigned before, after;
+    do {
+        before =
+          atomic_load_explicit(&motor->state_sequence, memory_order_acquire);
+        *state = motor->state;
+        atomic_thread_fence(memory_order_acquire);
+        after =
+          atomic_load_explicit(&motor->state_sequence, memory_order_relaxed);
+    } while ((before & 1) || before != after);
+}
+
+void update_motor(motor_handle_t *motor,
+                  const encoder_sample_t *sample,
+                  float dt)
+{
+    TRACE_BEGIN(eTraceUpdateMotor);
 
+    motor->encoder.velocity =
+      velocity_estimate_update(&motor->encoder.estimate,
+                               motor->encoder.velocity,
+                               sample,
+                               capture_resolution_hz,
+                               dt);
+    motor->encoder.position = PULSES_TO_RAD(sample->count);
+    if (motor->open_loop) {
+        motor->cmd_effort = motor->open_loop_effort;
+    } else {
+        // The model gets close to the right effort straight away, the PID
+        // only has to make up the difference
+        float error = motor->cmd_velocity - motor->encoder.velocity;
+        float feedback;
+        ESP_ERROR_CHECK(pid_compute(motor->pid_controller, error, &feedback));
+        motor->cmd_effort = clamp(
+          motor_feedforward(&motor->model, motor->cmd_velocity) + feedback,
+          -1.0,
+          1.0);
+    }
+
+    float max_change = motor->params.max_jerk * dt;
     motor->applied_effort = clamp(motor->cmd_effort,
-                                  motor->applied_effort - MAX_JERK,
-                                  motor->applied_effort + MAX_JERK);
+                                  motor->applied_effort - max_change,
+                                  motor->applied_effort + max_change);
 
     set_motor_power(motor, motor->applied_effort);
 
-    motor->encoder.count = current_encoder_count;
-};
+    motor->encoder.count = sample->count;
+
+    motor_state_t state = {
+        .position = motor->encoder.position,
+        .velocity = motor->encoder.velocity,
+        .effort = motor->applied_effort,
+        .timestamp_us = sample->sample_us,
+    };
+    store_motor_state(motor, &state);
+
+    TRACE_END(eTraceUpdateMotor);
+}
+
+static pid_ctrl_parameter_t pid_parameters(const motor_params_t *params)
+{
+    float ki = params->ki * CONTROL_LOOP_DT;
+    // The PID block bounds the sum of errors, not what it contributes
+    float max_integral = ki > 0.0f ? params->integral_limit / ki : 0.0f;
+
+    return (pid_ctrl_parameter_t){
+        .kp = params->kp,
+        .ki = ki,
+        .kd = params->kd / CONTROL_LOOP_DT,
+        .cal_type = PID_CAL_TYPE_POSITIONAL,
+        .max_output = 1.0,
+        .min_output = -1.0,
+        .max_integral = max_integral,
+        .min_integral = -max_integral,
+    };
+}
+
+void set_motor_params(motor_handle_t *motor, const motor_params_t *params)
+{
+    pid_ctrl_parameter_t pid_params = pid_parameters(params);
+    ESP_ERROR_CHECK(
+      pid_update_parameters(motor->pid_controller, &pid_params));
+    motor->params = *params;
+}
+
+void set_motor_model(motor_handle_t *motor, const motor_model_t *model)
+{
+    motor->model = *model;
+}
+
+void set_motor_open_loop(motor_handle_t *motor, bool enable, float effort)
+{
+    if (motor->open_loop && !enable) {
+        ESP_ERROR_CHECK(pid_reset_ctrl_block(motor->pid_controller));
+    }
+    motor->open_loop = enable;
+    motor->open_loop_effort = effort;
+}
+
+static void configure_capture(encoder_handle_t *encoder,
+                              gpio_num_t encoder_pin_a,
+                              gpio_num_t encoder_pin_b)
+{
+    if (capture_timer == NULL) {
+        mcpwm_capture_timer_config_t timer_config = {
+            .group_id = 0,
+            .clk_src = MCPWM_CAPTURE_CLK_SRC_DEFAULT,
+        };
+        ESP_ERROR_CHECK(mcpwm_new_capture_timer(&timer_config, &capture_timer));
+        ESP_ERROR_CHECK(mcpwm_capture_timer_get_resolution(
+          capture_timer, &capture_resolution_hz));
+        ESP_ERROR_CHECK(mcpwm_capture_timer_enable(capture_timer));
+        ESP_ERROR_CHECK(mcpwm_capture_timer_start(capture_timer));
+    }
+
+    encoder->pin_b = encoder_pin_b;
+    encoder->capture_lock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+    encoder->edges = 0;
+    encoder->last_edge_us = esp_timer_get_time();
+    velocity_estimate_init(&encoder->estimate, encoder->last_edge_us);
+
+    // Phase A is also routed to the pulse counter, the GPIO matrix lets
+    // both peripherals read the same pin.
+    mcpwm_capture_channel_config_t channel_config = {
+        .gpio_num = encoder_pin_a,
+        .prescale = 1,
+        .flags = { .pos_edge = 1, .neg_edge = 1, .pull_up = 1 },
+    };
+    ESP_ERROR_CHECK(mcpwm_new_capture_channel(
+      capture_timer, &channel_config, &encoder->capture));
+
+    mcpwm_capture_event_callbacks_t callbacks = {
+        .on_cap = encoder_capture_isr,
+    };
+    ESP_ERROR_CHECK(mcpwm_capture_channel_register_event_callbacks(
+      encoder->capture, &callbacks, encoder));
+    ESP_ERROR_CHECK(mcpwm_capture_channel_enable(encoder->capture));
+}
 
 void configure_motor(motor_handle_t *motor,
-                     char *motor_name,
                      gpio_num_t pwm_a_pin,
                      ledc_channel_t pwm_a_chan,
                      gpio_num_t pwm_b_pin,
@@ -149,13 +414,24 @@ void configure_motor(motor_handle_t *motor,
                      bool reversed)
 {
     // PWM
+#if CONFIG_LRR_MOTOR_PWM_MCPWM
+    (void)pwm_a_chan;
+    (void)pwm_b_chan;
+    configure_motor_pwm(motor, pwm_a_pin, pwm_b_pin);
+#else
     configure_pwm(pwm_a_chan, pwm_a_pin);
     configure_pwm(pwm_b_chan, pwm_b_pin);
 
     motor->chan_a = pwm_a_chan;
     motor->chan_b = pwm_b_chan;
+#endif
 
     motor->reversed = reversed;
+    motor->model = (motor_model_t)MOTOR_MODEL_DEFAULT();
+    motor->open_loop = false;
+    motor->open_loop_effort = 0.0f;
+    atomic_init(&motor->state_sequence, 0);
+    motor->state = (motor_state_t){};
 
     // ENCODER
     pcnt_unit_config_t unit_config = { .low_limit = INT16_MIN,
@@ -202,34 +478,33 @@ void configure_motor(motor_handle_t *motor,
     ESP_ERROR_CHECK(pcnt_unit_clear_count(motor->encoder.unit));
     ESP_ERROR_CHECK(pcnt_unit_start(motor->encoder.unit));
 
-    // PID
-    pid_ctrl_parameter_t pid_runtime_param = {
-        .kp = 0.3, // TODO: tune these (maybe make them uROS controlled?)
-        .ki = 0.3,
-        .kd = 0.0,
-        .cal_type = PID_CAL_TYPE_POSITIONAL,
-        .max_output = 1.0,
-        .min_output = -1.0,
-        .max_integral = 0.3,
-        .min_integral = -0.3,
-    };
+    configure_capture(&motor->encoder, encoder_pin_a, encoder_pin_b);
+
+    // PID, the drive base swaps in saved or host tuning later
+    motor->params = (motor_params_t)MOTOR_PARAMS_DEFAULT();
     pid_ctrl_block_handle_t pid_ctrl = NULL;
     pid_ctrl_config_t pid_config = {
-        .init_param = pid_runtime_param,
+        .init_param = pid_parameters(&motor->params),
     };
     ESP_ERROR_CHECK(pid_new_control_block(&pid_config, &pid_ctrl));
     motor->pid_controller = pid_ctrl;
-
-    motor->pid_args = (esp_timer_create_args_t){ .callback = pid_callback,
-                                                 .arg = motor,
-                                                 .name = motor_name };
-    motor->pid_timer = NULL;
-    ESP_ERROR_CHECK(esp_timer_create(&motor->pid_args, &motor->pid_timer));
-    esp_timer_start_periodic(motor->pid_timer, PID_LOOP_PERIOD_MS * 1000);
 }
 
 void init_motor_pwm()
 {
+#if CONFIG_LRR_MOTOR_PWM_MCPWM
+    mcpwm_timer_config_t timer_config = {
+        .group_id = PWM_GROUP,
+        .clk_src = MCPWM_TIMER_CLK_SRC_DEFAULT,
+        .resolution_hz = PWM_RESOLUTION_HZ,
+        .count_mode = MCPWM_TIMER_COUNT_MODE_UP,
+        .period_ticks = PWM_PERIOD_TICKS,
+    };
+    ESP_ERROR_CHECK(mcpwm_new_timer(&timer_config, &pwm_timer));
+    ESP_ERROR_CHECK(mcpwm_timer_enable(pwm_timer));
+    ESP_ERROR_CHECK(
+      mcpwm_timer_start_stop(pwm_timer, MCPWM_TIMER_START_NO_STOP));
+#else
     ledc_timer_config_t pwm_timer = { .speed_mode = LEDC_LOW_SPEED_MODE,
                                       .duty_resolution = PWM_TIMER_RESOLUTION,
                                       .timer_num = LEDC_TIMER_0,
@@ -237,4 +512,5 @@ void init_motor_pwm()
                                       .clk_cfg = LEDC_AUTO_CLK };
 
     ESP_ERROR_CHECK(ledc_timer_config(&pwm_timer));
+#endif
 }
@@ -0,0 +1,47 @@
+#include "setpoint_profile.h"
+
+#include <math.h>
+
+static float clampf(float x, float min, float max)
+{
+    return x < min ? min : (x > max ? max : x);
+}
+
+void setpoint_profile_init(setpoint_profile_t *profile,
+                           float max_accel,
+                           float max_jerk)
+{
+    *profile = (setpoint_profile_t){
+        .velocity = 0.0f,
+        .accel = 0.0f,
+        .max_accel = max_accel,
+        .max_jerk = max_jerk,
+    };
+}
+
+float setpoint_profile_update(setpoint_profile_t *profile,
+                              float target,
+                              float dt)
+{
+    float error = target - profile->velocity;
+
+    // Bringing the acceleration back to zero at max_jerk covers a^2 / 2j of
+    // velocity, so past this it couldn't stop in time.
+    float reachable = sqrtf(2.0f * profile->max_jerk * fabsf(error));
+    float wanted = copysignf(fminf(profile->max_accel, reachable), error);
+
+    float max_change = profile->max_jerk * dt;
+    profile->accel =
+      clampf(wanted, profile->accel - max_change, profile->accel + max_change);
+
+    float velocity = profile->velocity + profile->accel * dt;
+
+    // Land on the target rather than oscillate around it
+    if ((target - velocity) * error <= 0.0f) {
+        velocity = target;
+        profile->accel = 0.0f;
+    }
+
+    profile->velocity = velocity;
+    return velocity;
+}
@@ -0,0 +1,284 @@
+#include "flight_recorder.h"
+
+#if CONFIG_LRR_RECORDER
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/ringbuf.h"
+#include "freertos/task.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PARTITION_NAME "recorder"
+#define PARTITION_SUBTYPE 0x40
+
+#define STAGING_SIZE CONFIG_LRR_RECORDER_BUFFER_SIZE
+// A sector only goes to flash once it's full, or its oldest record is this
+// old, so a quiet rover still gets written out now and then
+#define FLUSH_PERIOD_US (CONFIG_LRR_RECORDER_FLUSH_MS * 1000)
+#define DROP_LOG_PERIOD_US (10 * 1000 * 1000)
+#define MAX_PAYLOAD_LEN UINT8_MAX
+#define RECORDS_SIZE (RECORDER_SECTOR_SIZE - sizeof(recorder_sector_t))
+
+#define RECORDER_TASK_STACK_SIZE CONFIG_LRR_TASK_RECORDER_STACK
+
+static const char *TAG = "flight recorder";
+
+static const esp_partition_t *partition = NULL;
+// All of it, read through the cache so scanning and dumps don't touch the
+// flash driver
+static const uint8_t *mapped = NULL;
+static esp_partition_mmap_handle_t mapped_handle;
+static size_t sector_count = 0;
+
+// Records on their way to flash. Producers copy in, the writer task copies
+// out.
+static EXT_RAM_BSS_ATTR uint8_t staging_storage[STAGING_SIZE];
+static StaticRingbuffer_t staging_struct;
+static RingbufHandle_t staging = NULL;
+static atomic_uint dropped;
+
+// Being filled by the writer task, and only touched by it. Stays in internal
+// RAM, the flash driver can't read PSRAM while it has the cache off.
+static uint8_t sector[RECORDER_SECTOR_SIZE];
+static size_t fill = 0; // Record bytes after the header
+static int64_t opened_us = 0;
+static uint32_t boot = 0;
+
+// Where the writer goes next. Read by dumps, which only need a hint.
+static volatile size_t next_sector = 0;
+static volatile uint32_t next_seq = 0;
+
+static bool after(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) > 0;
+}
+
+/*
+ * Copy out a sector's header, returning whether it looks like one of ours.
+ */
+static bool read_header(size_t index, recorder_sector_t *header)
+{
+    memcpy(header, mapped + index * RECORDER_SECTOR_SIZE, sizeof(*header));
+    return header->magic == RECORDER_MAGIC &&
+           header->version == RECORDER_VERSION && header->used <= RECORDS_SIZE;
+}
+
+static void flush_sector()
+{
+    recorder_sector_t header = {
+        .magic = RECORDER_MAGIC,
+        .version = RECORDER_VERSION,
+        .used = fill,
+        .seq = next_seq,
+        .boot = boot,
+        .start_us = opened_us,
+        .crc = esp_rom_crc32_le(0, sector + sizeof(header), fill),
+    };
+    memcpy(sector, &header, sizeof(header));
+
+    // The rest of the sector is left erased
+    size_t len = (sizeof(header) + fill + 3) & ~(size_t)3;
+    size_t offset = next_sector * RECORDER_SECTOR_SIZE;
+    esp_err_t err =
+      esp_partition_erase_range(partition, offset, RECORDER_SECTOR_SIZE);
+    if (err == ESP_OK) {
+        err = esp_partition_write(partition, offset, sector, len);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG,
+                 "Failed to write sector %u: %s",
+                 (unsigned)next_sector,
+                 esp_err_to_name(err));
+    }
+
+    next_sector = (next_sector + 1) % sector_count;
+    next_seq++;
+    fill = 0;
+}
+
+static void flight_recorder_task(void *arg)
+{
+    int64_t last_drop_log_us = 0;
+    unsigned logged_drops = 0;
+
+    while (1) {
+        size_t size;
+        uint8_t *item = (uint8_t *)xRingbufferReceive(
+          staging, &size, pdMS_TO_TICKS(CONFIG_LRR_RECORDER_FLUSH_MS));
+        int64_t now_us = esp_timer_get_time();
+
+        if (item != NULL) {
+            if (fill + size > RECORDS_SIZE) {
+                flush_sector();
+            }
+            if (fill == 0) {
+                // Put back the high half of the first record's time
+                recorder_record_t record;
+                memcpy(&record, item, sizeof(record));
+                opened_us = now_us - (uint32_t)((uint32_t)now_us -
+                                                record.time_us);
+            }
+            memcpy(sector + sizeof(recorder_sector_t) + fill, item, size);
+            fill += size;
+            vRingbufferReturnItem(staging, item);
+        }
+
+        if (fill > 0 && now_us - opened_us > FLUSH_PERIOD_US) {
+            flush_sector();
+        }
+
+        unsigned drops = atomic_load_explicit(&dropped, memory_order_relaxed);
+        if (drops != logged_drops &&
+            now_us - last_drop_log_us > DROP_LOG_PERIOD_US) {
+            ESP_LOGW(TAG,
+                     "Dropped %u records, flash can't keep up",
+                     drops - logged_drops);
+            logged_drops = drops;
+            last_drop_log_us = now_us;
+        }
+    }
+}
+
+void flight_recorder_write(eRecordType type, const void *data, size_t len)
+{
+    if (staging == NULL || len > MAX_PAYLOAD_LEN) {
+        return;
+    }
+
+    void *item;
+    size_t size = sizeof(recorder_record_t) + len;
+    if (xRingbufferSendAcquire(staging, &item, size, 0) != pdTRUE) {
+        atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+        return;
+    }
+    recorder_record_t record = {
+        .type = type,
+        .len = len,
+        .time_us = (uint32_t)esp_timer_get_time(),
+    };
+    memcpy(item, &record, sizeof(record));
+    memcpy((uint8_t *)item + sizeof(record), data, len);
+    xRingbufferSendComplete(staging, item);
+}
+
+esp_err_t flight_recorder_dump(bool (*out)(const uint8_t *data,
+                                           size_t len,
+                                           void *ctx),
+                               void *ctx)
+{
+    if (mapped == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    uint8_t *buffer = malloc(RECORDER_SECTOR_SIZE);
+    if (buffer == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Ring order is oldest first. Anything written from here on would come
+    // out of order, so it's left for the next dump.
+    size_t first = next_sector;
+    uint32_t end_seq = next_seq;
+    for (size_t i = 0; i < sector_count; i++) {
+        size_t index = (first + i) % sector_count;
+        recorder_sector_t header;
+        if (!read_header(index, &header) || !after(end_seq, header.seq)) {
+            continue;
+        }
+
+        // Copy first, the writer may be rewriting it
+        size_t len = sizeof(header) + header.used;
+        memcpy(buffer, mapped + index * RECORDER_SECTOR_SIZE, len);
+        memcpy(&header, buffer, sizeof(header));
+        if (len != sizeof(header) + header.used ||
+            esp_rom_crc32_le(0, buffer + sizeof(header), header.used) !=
+              header.crc) {
+            continue;
+        }
+        if (!out(buffer, len, ctx)) {
+            break;
+        }
+    }
+
+    free(buffer);
+    return ESP_OK;
+}
+
+void flight_recorder_init()
+{
+    partition = esp_partition_find_first(
+      ESP_PARTITION_TYPE_DATA, PARTITION_SUBTYPE, PARTITION_NAME);
+    if (partition == NULL) {
+        ESP_LOGE(TAG, "No %s partition, not recording", PARTITION_NAME);
+        return;
+    }
+    esp_err_t err = esp_partition_mmap(partition,
+                                       0,
+                                       partition->size,
+                                       ESP_PARTITION_MMAP_DATA,
+                                       (const void **)&mapped,
+                                       &mapped_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to map partition: %s", esp_err_to_name(err));
+        mapped = NULL;
+        return;
+    }
+    sector_count = partition->size / RECORDER_SECTOR_SIZE;
+
+    // Carry on after the newest sector from earlier boots
+    bool found = false;
+    recorder_sector_t newest = {};
+    for (size_t i = 0; i < sector_count; i++) {
+        recorder_sector_t header;
+        if (read_header(i, &header) &&
+            (!found || after(header.seq, newest.seq))) {
+            found = true;
+            newest = header;
+            next_sector = (i + 1) % sector_count;
+        }
+    }
+    if (found) {
+        next_seq = newest.seq + 1;
+        boot = newest.boot + 1;
+    }
+
+    staging = xRingbufferCreateStatic(STAGING_SIZE,
+                                      RINGBUF_TYPE_NOSPLIT,
+                                      staging_storage,
+                                      &staging_struct);
+    xTaskCreatePinnedToCore(flight_recorder_task,
+                            "flight_recorder_task",
+                            RECORDER_TASK_STACK_SIZE,
+                            NULL,
+                            CONFIG_LRR_TASK_RECORDER_PRIO,
+                            NULL,
+                            CONFIG_LRR_TASK_RECORDER_CORE);
+
+    ESP_LOGI(TAG,
+             "Recording boot %lu to %u KB of flash, from sector %u",
+             (unsigned long)boot,
+             (unsigned)(partition->size / 1024),
+             (unsigned)next_sector);
+}
+
+#else
+
+esp_err_t flight_recorder_dump(bool (*out)(const uint8_t *data,
+                                           size_t len,
+                                           void *ctx),
+                               void *ctx)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void flight_recorder_init()
+{
+}
+
+#endif
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+/*
+ * Raw sensor input and commands, kept in a ring on the "recorder" flash
+ * partition so a bad run can be looked at afterwards, reboots included.
+ * GET /recording on the rover's web server downloads it.
+ *
+ * The partition is a run of 4 KB sectors, each a recorder_sector_t followed
+ * by records, all little endian. A record is a recorder_record_t and then
+ * len bytes of payload. Sectors are streamed oldest first, each cut to
+ * sizeof(recorder_sector_t) + used bytes.
+ */
+
+#define RECORDER_SECTOR_SIZE 4096
+#define RECORDER_MAGIC 0x4652524c // "LRRF"
+#define RECORDER_VERSION 1
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t used;    // Record bytes after the header
+    uint32_t seq;     // One more than the sector written before it
+    uint32_t boot;    // One more each time the rover starts
+    int64_t start_us; // esp_timer at the first record
+    uint32_t crc;     // CRC-32 of the record bytes
+} __attribute__((packed)) recorder_sector_t;
+
+typedef struct
+{
+    uint8_t type; // eRecordType
+    uint8_t len;
+    uint32_t time_us; // Low half of esp_timer, start_us gives the rest
+} __attribute__((packed)) recorder_record_t;
+
+typedef enum RECORD_TYPES
+{
+    eRecordLidarFrame = 1, // LiDARFrame as it came off the UART
+    eRecordEncoders = 2,   // recorder_encoders_t, every control loop pass
+    eRecordTwistCmd = 3,   // recorder_twist_cmd_t, as it arrived
+} eRecordType;
+
+typedef struct
+{
+    int32_t edges[2]; // Left then right, as counted
+    uint32_t last_edge_ticks[2];
+} __attribute__((packed)) recorder_encoders_t;
+
+typedef struct
+{
+    int32_t sec; // Host stamp, zero if there wasn't one
+    uint32_t nanosec;
+    float v;
+    float w;
+} __attribute__((packed)) recorder_twist_cmd_t;
+
+#if CONFIG_LRR_RECORDER
+
+/*
+ * Add a record stamped with the current time. Never blocks: if the writer
+ * has fallen behind the record is dropped and counted. Tasks only.
+ */
+void flight_recorder_write(eRecordType type, const void *data, size_t len);
+
+#else
+
+static inline void flight_recorder_write(eRecordType type,
+                                         const void *data,
+                                         size_t len)
+{
+}
+
+#endif
+
+/*
+ * Pass the recording to out a piece at a time, oldest sector first, until
+ * out returns false. Sectors overwritten while this runs are skipped.
+ * ESP_ERR_NOT_SUPPORTED if the recorder is off, ESP_ERR_NOT_FOUND if there
+ * is no partition for it.
+ */
+esp_err_t flight_recorder_dump(bool (*out)(const uint8_t *data,
+                                           size_t len,
+                                           void *ctx),
+                               void *ctx);
+
+/*
+ * Find where the last boot stopped and start the writer task. Before
+ * anything records.
+ */
+void flight_recorder_init();
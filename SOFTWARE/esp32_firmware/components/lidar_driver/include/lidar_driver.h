@@ -1,3 +1,18 @@
 #pragma once
 
+#include <stdint.h>
+
+/*
+ * Counters since boot, for diagnostics
+ */
+typedef struct
+{
+    uint32_t frames; // Frames that passed the checksum
+    uint32_t crc_errors;
+    uint32_t resyncs;
+    uint32_t uart_overflows;
+} lidar_stats_t;
+
+void lidar_driver_get_stats(lidar_stats_t *stats);
+
 void lidar_driver_init();
@@ -2,28 +2,46 @@
 // https://github.com/ldrobotSensorTeam/ldlidar_sl_sdk/tree/master/ldlidar_driver/src
 
 #include "driver/gpio.h"
+#include "driver/ledc.h"
 #include "driver/uart.h"
+#include "esp_cpu.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/idf_additions.h"
 #include "freertos/projdefs.h"
+#include "freertos/queue.h"
 #include "freertos/task.h"
 #include <stdint.h>
 #include <stdio.h>
-#include <time.h>
+#include <string.h>
 
 #include "lidar_driver.h"
+#include "lidar_frame.h"
+#include "point_codec.h"
 #include "portmacro.h"
+#include "sdkconfig.h"
 #include "soc/soc.h"
 
+#include "flight_recorder.h"
 #include "messages.pb.h"
+#include "pb_utils.h"
 #include "socket_mgr.h"
+#include "trace.h"
 
 #include <math.h>
 
-#define deg_2_rad(angleInDegrees) ((angleInDegrees) * M_PI / 180.0)
+// Folded at compile time, so only single precision math runs on the device
+#define CENTIDEG_TO_RAD ((float)(M_PI / 18000.0))
 
 #define LIDAR_PWM (47)
+// The LD20 takes a 20 to 50 kHz PWM on its speed input. LEDC timer 0 and
+// channels 0 to 3 belong to the motors.
+#define LIDAR_PWM_FREQ_HZ 30000
+#define LIDAR_PWM_TIMER LEDC_TIMER_1
+#define LIDAR_PWM_CHANNEL LEDC_CHANNEL_4
+#define LIDAR_PWM_RESOLUTION LEDC_TIMER_10_BIT
+#define LIDAR_PWM_MAX_DUTY ((1 << 10) - 1)
 
 #define LIDAR_TXD (17)
 #define LIDAR_RXD (18)
@@ -32,104 +50,622 @@
 
 #define LIDAR_UART_PORT_NUM (1)
 #define LIDAR_UART_BAUD_RATE (230400)
-#define LIDAR_TASK_STACK_SIZE (4098)
+#define LIDAR_TASK_STACK_SIZE CONFIG_LRR_TASK_LIDAR_STACK
 #define BUF_SIZE 2048
+#define UART_EVENT_QUEUE_SIZE 20
 
 static const char *TAG = "lidar driver";
 
-#define POINT_PER_UART_PACKET 12
-#define POINT_PER_UDP_PACKET 120
-#define HEADER 0x54
-#define VERLEN 0x2C
-
-UdpPacket scan_msg;
-
-typedef struct
-{
-    uint16_t distance;
-    uint8_t intensity;
-} __attribute__((packed)) LidarPoint;
-
-typedef struct
-{
-    uint8_t header;
-    uint8_t ver_len;
-    uint16_t speed;
-    uint16_t start_angle;
-    LidarPoint points[POINT_PER_UART_PACKET];
-    uint16_t end_angle;
-    uint16_t timestamp;
-    uint8_t crc8;
-} __attribute__((packed)) LiDARFrame;
-
-static const uint8_t CrcTable[256] = {
-    0x00, 0x4d, 0x9a, 0xd7, 0x79, 0x34, 0xe3, 0xae, 0xf2, 0xbf, 0x68, 0x25,
-    0x8b, 0xc6, 0x11, 0x5c, 0xa9, 0xe4, 0x33, 0x7e, 0xd0, 0x9d, 0x4a, 0x07,
-    0x5b, 0x16, 0xc1, 0x8c, 0x22, 0x6f, 0xb8, 0xf5, 0x1f, 0x52, 0x85, 0xc8,
-    0x66, 0x2b, 0xfc, 0xb1, 0xed, 0xa0, 0x77, 0x3a, 0x94, 0xd9, 0x0e, 0x43,
-    0xb6, 0xfb, 0x2c, 0x61, 0xcf, 0x82, 0x55, 0x18, 0x44, 0x09, 0xde, 0x93,
-    0x3d, 0x70, 0xa7, 0xea, 0x3e, 0x73, 0xa4, 0xe9, 0x47, 0x0a, 0xdd, 0x90,
-    0xcc, 0x81, 0x56, 0x1b, 0xb5, 0xf8, 0x2f, 0x62, 0x97, 0xda, 0x0d, 0x40,
-    0xee, 0xa3, 0x74, 0x39, 0x65, 0x28, 0xff, 0xb2, 0x1c, 0x51, 0x86, 0xcb,
-    0x21, 0x6c, 0xbb, 0xf6, 0x58, 0x15, 0xc2, 0x8f, 0xd3, 0x9e, 0x49, 0x04,
-    0xaa, 0xe7, 0x30, 0x7d, 0x88, 0xc5, 0x12, 0x5f, 0xf1, 0xbc, 0x6b, 0x26,
-    0x7a, 0x37, 0xe0, 0xad, 0x03, 0x4e, 0x99, 0xd4, 0x7c, 0x31, 0xe6, 0xab,
-    0x05, 0x48, 0x9f, 0xd2, 0x8e, 0xc3, 0x14, 0x59, 0xf7, 0xba, 0x6d, 0x20,
-    0xd5, 0x98, 0x4f, 0x02, 0xac, 0xe1, 0x36, 0x7b, 0x27, 0x6a, 0xbd, 0xf0,
-    0x5e, 0x13, 0xc4, 0x89, 0x63, 0x2e, 0xf9, 0xb4, 0x1a, 0x57, 0x80, 0xcd,
-    0x91, 0xdc, 0x0b, 0x46, 0xe8, 0xa5, 0x72, 0x3f, 0xca, 0x87, 0x50, 0x1d,
-    0xb3, 0xfe, 0x29, 0x64, 0x38, 0x75, 0xa2, 0xef, 0x41, 0x0c, 0xdb, 0x96,
-    0x42, 0x0f, 0xd8, 0x95, 0x3b, 0x76, 0xa1, 0xec, 0xb0, 0xfd, 0x2a, 0x67,
-    0xc9, 0x84, 0x53, 0x1e, 0xeb, 0xa6, 0x71, 0x3c, 0x92, 0xdf, 0x08, 0x45,
-    0x19, 0x54, 0x83, 0xce, 0x60, 0x2d, 0xfa, 0xb7, 0x5d, 0x10, 0xc7, 0x8a,
-    0x24, 0x69, 0xbe, 0xf3, 0xaf, 0xe2, 0x35, 0x78, 0xd6, 0x9b, 0x4c, 0x01,
-    0xf4, 0xb9, 0x6e, 0x23, 0x8d, 0xc0, 0x17, 0x5a, 0x06, 0x4b, 0x9c, 0xd1,
-    0x7f, 0x32, 0xe5, 0xa8
-};
-
-uint8_t CalCRC8(const uint8_t *data, uint16_t data_len)
-{
-    uint8_t crc = 0;
-    while (data_len--) {
-        crc = CrcTable[(crc ^ *data) & 0xff];
-        data++;
-    }
-    return crc;
-}
+// Packet currently being filled, owned by us until it's committed.
+static UdpPacket *scan_msg = NULL;
+
+// Most points that fit in one packet, set by the nanopb options
+#if CONFIG_LRR_LIDAR_SCAN_COMPACT
+#define MAX_POINTS_PER_PACKET                                                  \
+    (sizeof(((CompactLaserScan *)0)->points.bytes) / sizeof(LidarPoint))
+#else
+#define MAX_POINTS_PER_PACKET (sizeof(((LaserScan *)0)->ranges) / sizeof(float))
+#endif
+
+_Static_assert(MAX_POINTS_PER_PACKET >= POINT_PER_UART_PACKET,
+               "Scan packets can't hold a single frame");
 
 static size_t point_num = 0;
+// Points the packet being filled covers, kept or not
+static size_t swept_num = 0;
+
+// Requested by the host, 0 means as many as fit. Read once per packet.
+static volatile uint32_t points_per_packet = CONFIG_LRR_LIDAR_POINTS_PER_PACKET;
+// Limit for the packet being filled, in whole frames
+static size_t packet_limit = 0;
+
+static uint32_t scan_id = 0;
+static uint32_t fragment = 0;
+static bool first_packet_sent = false;
+
+// LD20 timestamps count milliseconds and wrap at 30 s
+#define LIDAR_TIMESTAMP_WRAP 30000
+// Longer than this without a frame and the unwrapped count can't be trusted
+#define LIDAR_CLOCK_TIMEOUT_US (10 * 1000 * 1000)
+
+static bool clock_started = false;
+static uint16_t last_timestamp;
+static int64_t last_arrival_us;
+static int64_t sensor_time_us;   // Unwrapped LD20 clock
+static int64_t sensor_offset_us; // esp_timer time minus LD20 time
+
+// When the first and last frames of the packet being filled were measured
+static int64_t first_frame_us;
+static int64_t last_frame_us;
+
+// FILTERING
+// CompactLaserScan.kept has a bit per swept point, set by the nanopb options
+#define KEPT_MASK_BYTES (sizeof(((CompactLaserScan *)0)->kept.bytes))
+#define MAX_SWEPT_PER_PACKET (KEPT_MASK_BYTES * 8)
+// Leaves room for the mask without growing the datagram
+#define MAX_FILTERED_POINTS_PER_PACKET                                         \
+    (MAX_POINTS_PER_PACKET - KEPT_MASK_BYTES / sizeof(LidarPoint))
+#define DEGREES_PER_REV 360
+
+// Written by the RX task, picked up at the start of each revolution so a
+// scan is never split between two settings
+static portMUX_TYPE config_lock = portMUX_INITIALIZER_UNLOCKED;
+static LidarConfig pending_config = LidarConfig_init_zero;
+static LidarConfig active_config = LidarConfig_init_zero;
+
+// Whether anything this revolution can drop points
+static bool filtering = false;
+// LidarSector.keep_every for each whole degree, 1 outside every sector
+static uint16_t keep_every[DEGREES_PER_REV];
+// Points swept so far this revolution, decimation counts off of this
+static uint32_t scan_point = 0;
+
+// SCAN SPEED
+// Slowest and fastest the LD20 is specified to turn
+#define MIN_SCAN_HZ 5.0f
+#define MAX_SCAN_HZ 13.0f
+// Duty counts per deg/s of error, applied once per revolution. Full duty is
+// close to MAX_SCAN_HZ, so this takes out about a fifth of the error each
+// turn.
+#define SCAN_SPEED_GAIN 0.05f
+
+static float scan_duty = LIDAR_PWM_MAX_DUTY;
+static float scan_target_hz = 0.0f;
+
+/*
+ * Map a frame's timestamp onto esp_timer time, given when it showed up.
+ */
+static int64_t frame_time_us(const LiDARFrame *frame, int64_t arrival_us)
+{
+    if (!clock_started ||
+        arrival_us - last_arrival_us > LIDAR_CLOCK_TIMEOUT_US) {
+        clock_started = true;
+        sensor_time_us = 0;
+        sensor_offset_us = arrival_us;
+    } else {
+        uint16_t delta_ms =
+          (frame->timestamp + LIDAR_TIMESTAMP_WRAP - last_timestamp) %
+          LIDAR_TIMESTAMP_WRAP;
+        sensor_time_us += (int64_t)delta_ms * 1000;
+
+        // Frames always show up late (transfer time plus however long they
+        // sat in the UART buffer), so the smallest lag is the best estimate.
+        // Follow it down right away, and creep up to track crystal drift.
+        int64_t observed = arrival_us - sensor_time_us;
+        if (observed < sensor_offset_us) {
+            sensor_offset_us = observed;
+        } else {
+            sensor_offset_us += (observed - sensor_offset_us) / 256;
+        }
+    }
+
+    last_timestamp = frame->timestamp;
+    last_arrival_us = arrival_us;
+    return sensor_time_us + sensor_offset_us;
+}
+
+/*
+ * Seconds between points in the packet being filled. Measured from the frame
+ * timestamps when there's more than one frame, from the rotation speed when
+ * there isn't.
+ */
+static float packet_time_increment(uint32_t span_centideg, uint16_t speed)
+{
+    if (swept_num > POINT_PER_UART_PACKET) {
+        return (float)(last_frame_us - first_frame_us) /
+               (float)(swept_num - POINT_PER_UART_PACKET) / 1e6f;
+    }
+    if (speed == 0 || swept_num < 2) {
+        return 0.0f;
+    }
+    return (float)span_centideg / 100.0f / (float)speed /
+           (float)(swept_num - 1);
+}
+
+static size_t get_packet_limit()
+{
+    size_t limit = points_per_packet;
+    if (limit == 0 || limit > MAX_POINTS_PER_PACKET) {
+        limit = MAX_POINTS_PER_PACKET;
+    }
+
+#if CONFIG_LRR_LIDAR_SCAN_COMPACT
+    if (filtering && limit > MAX_FILTERED_POINTS_PER_PACKET) {
+        limit = MAX_FILTERED_POINTS_PER_PACKET;
+    }
+#endif
 
-void add_to_packet(const LiDARFrame *scan)
+    limit -= limit % POINT_PER_UART_PACKET;
+    if (limit < POINT_PER_UART_PACKET) {
+        limit = POINT_PER_UART_PACKET;
+    }
+    return limit;
+}
+
+/*
+ * Pick up the host's latest settings for the revolution that's starting.
+ */
+static void start_revolution()
+{
+    taskENTER_CRITICAL(&config_lock);
+    active_config = pending_config;
+    taskEXIT_CRITICAL(&config_lock);
+
+    filtering = active_config.min_range_mm != 0 ||
+                active_config.max_range_mm != 0 ||
+                active_config.min_intensity != 0;
+
+    for (size_t deg = 0; deg < DEGREES_PER_REV; deg++) {
+        keep_every[deg] = 1;
+    }
+    for (size_t i = 0; i < active_config.sectors_count; i++) {
+        const LidarSector *sector = &active_config.sectors[i];
+        uint32_t every = sector->keep_every > UINT16_MAX ? UINT16_MAX
+                                                         : sector->keep_every;
+        size_t end = sector->end_deg % DEGREES_PER_REV;
+        size_t deg = sector->start_deg % DEGREES_PER_REV;
+        do {
+            keep_every[deg] = every;
+            deg = (deg + 1) % DEGREES_PER_REV;
+        } while (deg != end);
+        filtering |= every != 1;
+    }
+
+    scan_point = 0;
+}
+
+/*
+ * Whether the next point swept this revolution should be sent.
+ */
+static bool point_kept(const LidarPoint *point, uint32_t angle_centideg)
 {
-    scan_msg.laser.angle_max = deg_2_rad((float)(scan->end_angle) / 100.0);
-    if (scan_msg.laser.angle_max < scan_msg.laser.angle_min) {
-        scan_msg.laser.angle_max = scan_msg.laser.angle_max + 2 * M_PI;
+    uint32_t every = keep_every[(angle_centideg / 100) % DEGREES_PER_REV];
+    uint32_t index = scan_point++;
+    if (every == 0 || index % every != 0) {
+        return false;
+    }
+
+    if (point->distance < active_config.min_range_mm) {
+        return false;
     }
+    if (active_config.max_range_mm != 0 &&
+        point->distance > active_config.max_range_mm) {
+        return false;
+    }
+    return point->intensity >= active_config.min_intensity;
+}
+
+/*
+ * Nudge the PWM duty towards the requested scan rate, given the speed the
+ * LD20 last reported. Called once per revolution.
+ */
+static void update_scan_speed(uint16_t speed)
+{
+    float target_hz = active_config.scan_hz;
+    if (target_hz <= 0.0f) {
+        scan_duty = LIDAR_PWM_MAX_DUTY;
+    } else {
+        if (target_hz < MIN_SCAN_HZ) {
+            target_hz = MIN_SCAN_HZ;
+        } else if (target_hz > MAX_SCAN_HZ) {
+            target_hz = MAX_SCAN_HZ;
+        }
+
+        if (target_hz != scan_target_hz) {
+            // Start from a proportional guess, the loop fixes the rest
+            scan_duty = LIDAR_PWM_MAX_DUTY * target_hz / MAX_SCAN_HZ;
+        } else if (speed > 0) {
+            scan_duty +=
+              SCAN_SPEED_GAIN * (target_hz * DEGREES_PER_REV - (float)speed);
+        }
 
+        if (scan_duty < 0.0f) {
+            scan_duty = 0.0f;
+        } else if (scan_duty > LIDAR_PWM_MAX_DUTY) {
+            scan_duty = LIDAR_PWM_MAX_DUTY;
+        }
+    }
+    scan_target_hz = target_hz;
+
+    ledc_set_duty(LEDC_LOW_SPEED_MODE, LIDAR_PWM_CHANNEL, (uint32_t)scan_duty);
+    ledc_update_duty(LEDC_LOW_SPEED_MODE, LIDAR_PWM_CHANNEL);
+}
+
+#if CONFIG_LRR_LIDAR_MATH_BENCHMARK
+#define BENCHMARK_FRAMES 64
+#define BENCHMARK_ROUNDS 100
+
+#define deg_2_rad(angleInDegrees) ((angleInDegrees) * M_PI / 180.0)
+
+// How add_to_packet used to convert a frame, kept for comparison
+static void convert_points_double(const LiDARFrame *scan,
+                                  float *ranges,
+                                  float *intensities,
+                                  float *angle)
+{
+    *angle = deg_2_rad((float)(scan->end_angle) / 100.0);
     for (uint16_t i = 0; i < POINT_PER_UART_PACKET; i++) {
-        scan_msg.laser.ranges[point_num] =
-          (float)(scan->points[i].distance) / 1000.0;
-        scan_msg.laser.intensities[point_num] =
-          (float)(scan->points[i].intensity);
-        point_num++;
+        ranges[i] = (float)(scan->points[i].distance) / 1000.0;
+        intensities[i] = (float)(scan->points[i].intensity);
+    }
+}
+
+static void lidar_math_benchmark()
+{
+    static LiDARFrame frames[BENCHMARK_FRAMES];
+    static float ranges[POINT_PER_UART_PACKET];
+    static float intensities[POINT_PER_UART_PACKET];
+    static uint8_t packed[sizeof(((LiDARFrame *)0)->points)];
+    volatile float angle;
+
+    uint32_t seed = 0x2C54;
+    for (size_t i = 0; i < BENCHMARK_FRAMES; i++) {
+        uint8_t *bytes = (uint8_t *)&frames[i];
+        for (size_t j = 0; j < sizeof(LiDARFrame); j++) {
+            seed = seed * 1664525 + 1013904223;
+            bytes[j] = seed >> 24;
+        }
+    }
+
+    uint32_t start = esp_cpu_get_cycle_count();
+    for (size_t r = 0; r < BENCHMARK_ROUNDS; r++) {
+        for (size_t i = 0; i < BENCHMARK_FRAMES; i++) {
+            float a;
+            convert_points_double(&frames[i], ranges, intensities, &a);
+            angle = a;
+        }
+    }
+    uint32_t double_cycles = esp_cpu_get_cycle_count() - start;
+
+    start = esp_cpu_get_cycle_count();
+    for (size_t r = 0; r < BENCHMARK_ROUNDS; r++) {
+        for (size_t i = 0; i < BENCHMARK_FRAMES; i++) {
+            lidar_frame_convert(&frames[i], ranges, intensities);
+            angle = (float)frames[i].end_angle * CENTIDEG_TO_RAD;
+        }
+    }
+    uint32_t float_cycles = esp_cpu_get_cycle_count() - start;
+
+    start = esp_cpu_get_cycle_count();
+    for (size_t r = 0; r < BENCHMARK_ROUNDS; r++) {
+        for (size_t i = 0; i < BENCHMARK_FRAMES; i++) {
+            memcpy(packed, frames[i].points, sizeof(packed));
+            angle = frames[i].end_angle;
+        }
+    }
+    uint32_t compact_cycles = esp_cpu_get_cycle_count() - start;
+    (void)angle;
+
+    uint32_t n = BENCHMARK_FRAMES * BENCHMARK_ROUNDS;
+    ESP_LOGI(TAG,
+             "Frame conversion cycles: double %lu, float %lu, compact %lu",
+             (unsigned long)(double_cycles / n),
+             (unsigned long)(float_cycles / n),
+             (unsigned long)(compact_cycles / n));
+}
+#endif
+
+#if CONFIG_LRR_LIDAR_SCAN_COMPACT
+#define POINTS_CAPACITY (sizeof(((CompactLaserScan *)0)->points.bytes))
+// Worst case for a frame under POINT_ENCODING_DELTA_VARINT
+#define MAX_ENCODED_FRAME_BYTES                                                \
+    (POINT_PER_UART_PACKET * (POINT_CODEC_MAX_DISTANCE_BYTES + 1))
+
+// Encoded distances so far. Intensities wait here until the packet goes
+// out, then follow the distances.
+static size_t encoded_len = 0;
+static uint16_t previous_distance = 0;
+static uint8_t packed_intensities[MAX_POINTS_PER_PACKET];
+
+static bool delta_encoding()
+{
+    return active_config.encoding == PointEncoding_POINT_ENCODING_DELTA_VARINT;
+}
+
+static void pack_point(CompactLaserScan *compact, const LidarPoint *point)
+{
+    if (delta_encoding()) {
+        uint8_t *out = compact->points.bytes + encoded_len;
+        encoded_len +=
+          point_codec_put_distance(out, point->distance, &previous_distance);
+        packed_intensities[point_num] = point->intensity;
+    } else {
+        memcpy(compact->points.bytes + point_num * sizeof(LidarPoint),
+               point,
+               sizeof(LidarPoint));
+    }
+    point_num++;
+}
+
+/*
+ * Whether another frame might not fit in the packet being filled.
+ */
+static bool packet_full()
+{
+    if (point_num + POINT_PER_UART_PACKET > packet_limit ||
+        swept_num + POINT_PER_UART_PACKET > MAX_SWEPT_PER_PACKET) {
+        return true;
+    }
+    if (!delta_encoding()) {
+        return false;
+    }
+
+    // Same room for the kept mask as get_packet_limit leaves
+    size_t capacity = POINTS_CAPACITY - (filtering ? KEPT_MASK_BYTES : 0);
+    return encoded_len + point_num + MAX_ENCODED_FRAME_BYTES > capacity;
+}
+
+static void add_to_packet(const LiDARFrame *scan, int64_t time_us)
+{
+    CompactLaserScan *compact = &scan_msg->compact_laser;
+
+    if (swept_num == 0) {
+        compact->start_angle = scan->start_angle;
+        first_frame_us = time_us;
+    }
+    last_frame_us = time_us;
+
+    // Keep end_angle ahead of start_angle so the host can interpolate
+    // without caring about the wrap.
+    compact->end_angle = scan->end_angle;
+    if (compact->end_angle < compact->start_angle) {
+        compact->end_angle += 36000;
+    }
+    compact->speed = scan->speed;
+
+    if (!filtering && !delta_encoding()) {
+        memcpy(compact->points.bytes + point_num * sizeof(LidarPoint),
+               scan->points,
+               sizeof(scan->points));
+        point_num += POINT_PER_UART_PACKET;
+        swept_num += POINT_PER_UART_PACKET;
+    } else {
+        for (size_t i = 0; i < POINT_PER_UART_PACKET; i++) {
+            const LidarPoint *point = &scan->points[i];
+            bool kept =
+              !filtering || point_kept(point, lidar_point_angle(scan, i));
+            if (kept) {
+                if (filtering) {
+                    compact->kept.bytes[swept_num / 8] |= 1 << (swept_num % 8);
+                }
+                pack_point(compact, point);
+            }
+            swept_num++;
+        }
+    }
+}
+
+static bool start_packet()
+{
+    scan_msg = socket_mgr_acquire_packet(0);
+    if (scan_msg == NULL) {
+        return false;
+    }
+
+    scan_msg->has_compact_laser = true;
+    scan_msg->compact_laser.has_time = true;
+    scan_msg->compact_laser.points.size = 0;
+    scan_msg->compact_laser.kept.size = 0;
+    encoded_len = 0;
+    previous_distance = 0;
+    if (filtering) {
+        memset(scan_msg->compact_laser.kept.bytes, 0, KEPT_MASK_BYTES);
+    }
+    packet_limit = get_packet_limit();
+
+    return true;
+}
+#else
+static uint16_t last_speed = 0;
+static uint32_t start_centideg;
+static uint32_t end_centideg; // Unwrapped, like CompactLaserScan.end_angle
+
+static void add_to_packet(const LiDARFrame *scan, int64_t time_us)
+{
+    if (swept_num == 0) {
+        start_centideg = scan->start_angle;
+        first_frame_us = time_us;
     }
+    last_frame_us = time_us;
+    last_speed = scan->speed;
 
-    scan_msg.laser.angle_increment =
-      (scan_msg.laser.angle_max - scan_msg.laser.angle_min) / (point_num - 1);
-    scan_msg.laser.time_increment =
-      scan_msg.laser.angle_increment / deg_2_rad((float)(scan->speed));
+    // Angles stay in integer centidegrees until the packet goes out
+    end_centideg = scan->end_angle;
+    if (end_centideg < start_centideg) {
+        end_centideg += 36000;
+    }
+
+    float *ranges = scan_msg->laser.ranges + point_num;
+    float *intensities = scan_msg->laser.intensities + point_num;
+    lidar_frame_convert(scan, ranges, intensities);
+
+    // Points stay evenly spaced here, so dropped ones go out as 0 range
+    if (filtering) {
+        for (size_t i = 0; i < POINT_PER_UART_PACKET; i++) {
+            if (!point_kept(&scan->points[i], lidar_point_angle(scan, i))) {
+                ranges[i] = 0.0f;
+                intensities[i] = 0.0f;
+            }
+        }
+    }
+    point_num += POINT_PER_UART_PACKET;
+    swept_num += POINT_PER_UART_PACKET;
+}
+
+static bool start_packet()
+{
+    scan_msg = socket_mgr_acquire_packet(0);
+    if (scan_msg == NULL) {
+        return false;
+    }
 
-    struct timespec ts;
-    clock_gettime(CLOCK_REALTIME, &ts);
-    scan_msg.laser.time.sec = (int32_t)ts.tv_sec;
-    scan_msg.laser.time.nanosec = (uint32_t)ts.tv_nsec;
+    scan_msg->has_laser = true;
+    scan_msg->laser.has_time = true;
+
+    // Pulled this from a logic analyzer, can't find it in the documentation
+    scan_msg->laser.scan_time = 0.001f;
+
+    scan_msg->laser.range_min = 0.1f;
+    scan_msg->laser.range_max = 8.0f;
+    packet_limit = get_packet_limit();
+
+    return true;
 }
+#endif
 
-void publish_packet()
+static void publish_packet(bool end_of_scan)
 {
-    if (tx_queue != NULL &&
-        xQueueSend(tx_queue, (void *)&scan_msg, 10) != pdTRUE) {
-        ESP_LOGE(TAG, "Failed to push scan onto queue");
+#if CONFIG_LRR_LIDAR_SCAN_COMPACT
+    CompactLaserScan *compact = &scan_msg->compact_laser;
+    compact->scan_id = scan_id;
+    compact->fragment = fragment;
+    compact->end_of_scan = end_of_scan;
+    if (point_num < swept_num) {
+        compact->kept.size = (swept_num + 7) / 8;
+        compact->swept_points = swept_num;
+    } else {
+        compact->kept.size = 0;
+        compact->swept_points = 0;
+    }
+    if (delta_encoding()) {
+        memcpy(
+          compact->points.bytes + encoded_len, packed_intensities, point_num);
+        compact->points.size = encoded_len + point_num;
+        compact->encoding = PointEncoding_POINT_ENCODING_DELTA_VARINT;
+        compact->point_count = point_num;
+    } else {
+        compact->points.size = point_num * sizeof(LidarPoint);
+        compact->encoding = PointEncoding_POINT_ENCODING_RAW;
+        compact->point_count = 0;
+    }
+    compact->time_increment = packet_time_increment(
+      compact->end_angle - compact->start_angle, compact->speed);
+    timestamp_from_esp_time(first_frame_us, &compact->time);
+#else
+    scan_msg->laser.ranges_count = point_num;
+    scan_msg->laser.intensities_count = point_num;
+    scan_msg->laser.angle_min = (float)start_centideg * CENTIDEG_TO_RAD;
+    scan_msg->laser.angle_max = (float)end_centideg * CENTIDEG_TO_RAD;
+    scan_msg->laser.angle_increment =
+      (scan_msg->laser.angle_max - scan_msg->laser.angle_min) /
+      (float)(point_num - 1);
+    scan_msg->laser.time_increment =
+      packet_time_increment(end_centideg - start_centideg, last_speed);
+    timestamp_from_esp_time(first_frame_us, &scan_msg->laser.time);
+#endif
+
+    // A sector that's dropped entirely only needs the end of scan marker
+    if (point_num == 0 && !end_of_scan) {
+        socket_mgr_release_packet(scan_msg);
+    } else {
+        if (!first_packet_sent) {
+            // For the boot timeline
+            ESP_LOGI(TAG,
+                     "First scan packet at %lld ms",
+                     (long long)(esp_timer_get_time() / 1000));
+            first_packet_sent = true;
+        }
+        socket_mgr_commit_packet(eTxLaneLidar, scan_msg);
+    }
+    scan_msg = NULL;
+    point_num = 0;
+    swept_num = 0;
+    fragment++;
+}
+
+#if !CONFIG_LRR_LIDAR_SCAN_COMPACT
+static bool packet_full()
+{
+    return point_num + POINT_PER_UART_PACKET > packet_limit;
+}
+#endif
+
+static void lidar_config_callback(void *arg)
+{
+    const LidarConfig *config = arg;
+
+    // The host resends this periodically, only log changes. Without it the
+    // Kconfig default stands.
+    if (config->has_points_per_packet) {
+        if (config->points_per_packet != points_per_packet) {
+            ESP_LOGI(TAG,
+                     "Points per packet set to %lu",
+                     (unsigned long)config->points_per_packet);
+        }
+        points_per_packet = config->points_per_packet;
+    }
+
+    if (config->scan_hz != pending_config.scan_hz) {
+        ESP_LOGI(TAG, "Scan rate set to %.1f Hz", config->scan_hz);
+    }
+
+    // Only this task writes it, so the read above needs no lock
+    taskENTER_CRITICAL(&config_lock);
+    pending_config = *config;
+    taskEXIT_CRITICAL(&config_lock);
+}
+
+static lidar_parser_t parser;
+static uint32_t frame_count = 0;
+static uint32_t uart_overflows = 0;
+
+static void handle_frame(const LiDARFrame *frame, int64_t arrival_us)
+{
+    frame_count++;
+#if CONFIG_LRR_RECORDER_LIDAR
+    flight_recorder_write(eRecordLidarFrame, frame, sizeof(*frame));
+#endif
+
+    // Keep the clock mapping going even when frames get dropped below
+    int64_t time_us = frame_time_us(frame, arrival_us);
+
+    // Start angles are always in [0, 36000), so a frame that starts behind
+    // the last one begins a new revolution.
+    static uint16_t last_start_angle = UINT16_MAX;
+    if (frame->start_angle < last_start_angle) {
+        if (scan_msg != NULL) {
+            publish_packet(true);
+        }
+        scan_id++;
+        fragment = 0;
+
+        start_revolution();
+        update_scan_speed(frame->speed);
+    }
+    last_start_angle = frame->start_angle;
+
+    if (scan_msg == NULL && !start_packet()) {
+        // TX pool is exhausted (or the socket isn't up yet), drop frames
+        // until a packet frees up.
+        return;
+    }
+
+    TRACE_BEGIN(eTraceAddToPacket);
+    add_to_packet(frame, time_us);
+    TRACE_END(eTraceAddToPacket);
+
+    if (packet_full()) {
+        publish_packet(false);
     }
 }
 
@@ -144,83 +680,131 @@ static void lidar_driver_task(void *arg)
         .source_clk = UART_SCLK_DEFAULT,
     };
     int intr_alloc_flags = 0;
-
-    ESP_ERROR_CHECK(uart_driver_install(
-      LIDAR_UART_PORT_NUM, BUF_SIZE * 2, 0, 0, NULL, intr_alloc_flags));
+#if CONFIG_UART_ISR_IN_IRAM
+    // Keeps draining the FIFO while flash writes have the cache off
+    intr_alloc_flags = ESP_INTR_FLAG_IRAM;
+#endif
+    QueueHandle_t uart_queue;
+
+    ESP_ERROR_CHECK(uart_driver_install(LIDAR_UART_PORT_NUM,
+                                        BUF_SIZE * 2,
+                                        0,
+                                        UART_EVENT_QUEUE_SIZE,
+                                        &uart_queue,
+                                        intr_alloc_flags));
 
     ESP_ERROR_CHECK(uart_param_config(LIDAR_UART_PORT_NUM, &uart_config));
 
     ESP_ERROR_CHECK(uart_set_pin(
       LIDAR_UART_PORT_NUM, LIDAR_TXD, LIDAR_RXD, LIDAR_RTS, LIDAR_CTS));
 
-    uint8_t start_chars[2] = { 0x00, 0x00 };
-    static LiDARFrame scan_data;
+    // Wake up about once per frame instead of once per 120 bytes
+    ESP_ERROR_CHECK(
+      uart_set_rx_full_threshold(LIDAR_UART_PORT_NUM, sizeof(LiDARFrame)));
 
-    scan_data.header = HEADER;
-    scan_data.ver_len = VERLEN;
+    lidar_parser_init(&parser);
+    uint32_t reported_crc_errors = 0;
 
     while (1) {
-        uart_read_bytes(
-          LIDAR_UART_PORT_NUM, &start_chars, 1, 20 / portTICK_PERIOD_MS);
-        // Look for start bytes, 0x54 0x2C
-        if (start_chars[1] != HEADER || start_chars[0] != VERLEN) {
-            start_chars[1] = start_chars[0];
+        uart_event_t event;
+        if (xQueueReceive(uart_queue, &event, portMAX_DELAY) != pdTRUE) {
             continue;
         }
 
-        uart_read_bytes(LIDAR_UART_PORT_NUM,
-                        ((uint8_t *)&scan_data) + 2,
-                        sizeof(scan_data) - 2,
-                        20 / portTICK_PERIOD_MS);
+        switch (event.type) {
+            case UART_DATA:
+                break;
+            case UART_FIFO_OVF:
+            case UART_BUFFER_FULL:
+                // We fell behind and bytes were lost, start clean.
+                ESP_LOGW(TAG, "UART overflow, flushing");
+                uart_overflows++;
+                uart_flush_input(LIDAR_UART_PORT_NUM);
+                xQueueReset(uart_queue);
+                lidar_parser_reset(&parser);
+                continue;
+            default:
+                continue;
+        }
 
-        uint8_t checksum =
-          CalCRC8((uint8_t *)&(scan_data), sizeof(scan_data) - 1);
-        if (checksum != scan_data.crc8) {
-            ESP_LOGI(TAG,
-                     "Invalid checksum, got %d, expected %d",
-                     checksum,
-                     scan_data.crc8);
-        } else {
-            if (point_num == 0) {
-                scan_msg.laser.angle_min =
-                  deg_2_rad((float)(scan_data.start_angle) / 100.0);
+        // Read everything that's buffered, not just what this event covers,
+        // so queued events for the same bytes come back short and cheap.
+        size_t buffered = 0;
+        uart_get_buffered_data_len(LIDAR_UART_PORT_NUM, &buffered);
+        while (buffered > 0) {
+            size_t space;
+            uint8_t *dest = lidar_parser_write_ptr(&parser, &space);
+            int len = uart_read_bytes(LIDAR_UART_PORT_NUM,
+                                      dest,
+                                      buffered < space ? buffered : space,
+                                      0);
+            if (len <= 0) {
+                break;
             }
+            lidar_parser_commit(&parser, len);
+            buffered -= (size_t)len;
+            int64_t arrival_us = esp_timer_get_time();
 
-            add_to_packet(&scan_data);
-
-            if (point_num > POINT_PER_UDP_PACKET - POINT_PER_UART_PACKET) {
-                point_num = 0;
-                publish_packet();
+            const LiDARFrame *frame;
+            while ((frame = lidar_parser_next(&parser)) != NULL) {
+                handle_frame(frame, arrival_us);
             }
         }
+
+        if (parser.crc_errors != reported_crc_errors) {
+            ESP_LOGI(TAG,
+                     "%lu invalid checksums",
+                     (unsigned long)(parser.crc_errors - reported_crc_errors));
+            reported_crc_errors = parser.crc_errors;
+        }
     }
 
     vTaskDelete(NULL);
 }
 
-void lidar_driver_init()
+void lidar_driver_get_stats(lidar_stats_t *stats)
 {
-    // Highest scanning frequency
-    gpio_set_direction(LIDAR_PWM, GPIO_MODE_OUTPUT);
-    gpio_set_level(LIDAR_PWM, 1);
-
-    scan_msg.has_laser = true;
-    scan_msg.laser.has_time = true;
-
-    // Pulled this from a logic analyzer, can't find it in the documentation
-    scan_msg.laser.scan_time = 0.001;
-
-    scan_msg.laser.range_min = 0.1;
-    scan_msg.laser.range_max = 8.0;
+    stats->frames = frame_count;
+    stats->crc_errors = parser.crc_errors;
+    stats->resyncs = parser.resyncs;
+    stats->uart_overflows = uart_overflows;
+}
 
-    scan_msg.laser.ranges_count = POINT_PER_UDP_PACKET;
-    scan_msg.laser.intensities_count = POINT_PER_UDP_PACKET;
+void lidar_driver_init()
+{
+    lidar_crc_init();
+#if CONFIG_LRR_LIDAR_CRC_BENCHMARK
+    lidar_crc_benchmark();
+#endif
+#if CONFIG_LRR_LIDAR_MATH_BENCHMARK
+    lidar_math_benchmark();
+#endif
+
+    register_callback(lidar_config_callback, eLidarConfig);
+
+    // Full duty is the highest scanning frequency, until the host asks for
+    // something else
+    ledc_timer_config_t pwm_timer = { .speed_mode = LEDC_LOW_SPEED_MODE,
+                                      .duty_resolution = LIDAR_PWM_RESOLUTION,
+                                      .timer_num = LIDAR_PWM_TIMER,
+                                      .freq_hz = LIDAR_PWM_FREQ_HZ,
+                                      .clk_cfg = LEDC_AUTO_CLK };
+    ESP_ERROR_CHECK(ledc_timer_config(&pwm_timer));
+
+    ledc_channel_config_t pwm_channel = { .speed_mode = LEDC_LOW_SPEED_MODE,
+                                          .channel = LIDAR_PWM_CHANNEL,
+                                          .timer_sel = LIDAR_PWM_TIMER,
+                                          .intr_type = LEDC_INTR_DISABLE,
+                                          .gpio_num = LIDAR_PWM,
+                                          .duty = LIDAR_PWM_MAX_DUTY,
+                                          .hpoint = 0 };
+    ESP_ERROR_CHECK(ledc_channel_config(&pwm_channel));
 
     xTaskCreatePinnedToCore(lidar_driver_task,
                             "lidar_driver_task",
                             LIDAR_TASK_STACK_SIZE,
                             NULL,
-                            10,
+                            CONFIG_LRR_TASK_LIDAR_PRIO,
                             NULL,
-                            APP_CPU_NUM);
+                            CONFIG_LRR_TASK_LIDAR_CORE);
 }
@@ -0,0 +1,219 @@
+// https://wiki.youyeetoo.com/en/Lidar/LD20
+
+#include "lidar_frame.h"
+
+#include <string.h>
+
+#include "esp_attr.h"
+#include "trace.h"
+#if CONFIG_LRR_LIDAR_CRC_BENCHMARK
+#include "esp_cpu.h"
+#include "esp_log.h"
+
+static const char *TAG = "lidar frame";
+#endif
+
+#define MM_TO_M 0.001f
+
+static const uint8_t CrcTable[256] = {
+    0x00, 0x4d, 0x9a, 0xd7, 0x79, 0x34, 0xe3, 0xae, 0xf2, 0xbf, 0x68, 0x25,
+    0x8b, 0xc6, 0x11, 0x5c, 0xa9, 0xe4, 0x33, 0x7e, 0xd0, 0x9d, 0x4a, 0x07,
+    0x5b, 0x16, 0xc1, 0x8c, 0x22, 0x6f, 0xb8, 0xf5, 0x1f, 0x52, 0x85, 0xc8,
+    0x66, 0x2b, 0xfc, 0xb1, 0xed, 0xa0, 0x77, 0x3a, 0x94, 0xd9, 0x0e, 0x43,
+    0xb6, 0xfb, 0x2c, 0x61, 0xcf, 0x82, 0x55, 0x18, 0x44, 0x09, 0xde, 0x93,
+    0x3d, 0x70, 0xa7, 0xea, 0x3e, 0x73, 0xa4, 0xe9, 0x47, 0x0a, 0xdd, 0x90,
+    0xcc, 0x81, 0x56, 0x1b, 0xb5, 0xf8, 0x2f, 0x62, 0x97, 0xda, 0x0d, 0x40,
+    0xee, 0xa3, 0x74, 0x39, 0x65, 0x28, 0xff, 0xb2, 0x1c, 0x51, 0x86, 0xcb,
+    0x21, 0x6c, 0xbb, 0xf6, 0x58, 0x15, 0xc2, 0x8f, 0xd3, 0x9e, 0x49, 0x04,
+    0xaa, 0xe7, 0x30, 0x7d, 0x88, 0xc5, 0x12, 0x5f, 0xf1, 0xbc, 0x6b, 0x26,
+    0x7a, 0x37, 0xe0, 0xad, 0x03, 0x4e, 0x99, 0xd4, 0x7c, 0x31, 0xe6, 0xab,
+    0x05, 0x48, 0x9f, 0xd2, 0x8e, 0xc3, 0x14, 0x59, 0xf7, 0xba, 0x6d, 0x20,
+    0xd5, 0x98, 0x4f, 0x02, 0xac, 0xe1, 0x36, 0x7b, 0x27, 0x6a, 0xbd, 0xf0,
+    0x5e, 0x13, 0xc4, 0x89, 0x63, 0x2e, 0xf9, 0xb4, 0x1a, 0x57, 0x80, 0xcd,
+    0x91, 0xdc, 0x0b, 0x46, 0xe8, 0xa5, 0x72, 0x3f, 0xca, 0x87, 0x50, 0x1d,
+    0xb3, 0xfe, 0x29, 0x64, 0x38, 0x75, 0xa2, 0xef, 0x41, 0x0c, 0xdb, 0x96,
+    0x42, 0x0f, 0xd8, 0x95, 0x3b, 0x76, 0xa1, 0xec, 0xb0, 0xfd, 0x2a, 0x67,
+    0xc9, 0x84, 0x53, 0x1e, 0xeb, 0xa6, 0x71, 0x3c, 0x92, 0xdf, 0x08, 0x45,
+    0x19, 0x54, 0x83, 0xce, 0x60, 0x2d, 0xfa, 0xb7, 0x5d, 0x10, 0xc7, 0x8a,
+    0x24, 0x69, 0xbe, 0xf3, 0xaf, 0xe2, 0x35, 0x78, 0xd6, 0x9b, 0x4c, 0x01,
+    0xf4, 0xb9, 0x6e, 0x23, 0x8d, 0xc0, 0x17, 0x5a, 0x06, 0x4b, 0x9c, 0xd1,
+    0x7f, 0x32, 0xe5, 0xa8
+};
+
+uint32_t lidar_point_angle(const LiDARFrame *frame, size_t i)
+{
+    uint32_t span = (frame->end_angle + 36000 - frame->start_angle) % 36000;
+    return frame->start_angle + span * i / (POINT_PER_UART_PACKET - 1);
+}
+
+void lidar_frame_convert(const LiDARFrame *frame,
+                         float *ranges,
+                         float *intensities)
+{
+    for (uint16_t i = 0; i < POINT_PER_UART_PACKET; i++) {
+        ranges[i] = (float)(frame->points[i].distance) * MM_TO_M;
+        intensities[i] = (float)(frame->points[i].intensity);
+    }
+}
+
+uint8_t CalCRC8(const uint8_t *data, uint16_t data_len)
+{
+    uint8_t crc = 0;
+    while (data_len--) {
+        crc = CrcTable[(crc ^ *data) & 0xff];
+        data++;
+    }
+    return crc;
+}
+
+// crc_slices[k][x] is CrcTable applied k + 1 times. The table is linear over
+// XOR, so four steps of crc = CrcTable[crc ^ d] fold into one step of
+// crc = T4[crc ^ d0] ^ T3[d1] ^ T2[d2] ^ T1[d3]. Kept in DRAM so the lookups
+// never miss the flash cache.
+static DRAM_ATTR uint8_t crc_slices[4][256];
+
+void lidar_crc_init()
+{
+    for (size_t x = 0; x < 256; x++) {
+        crc_slices[0][x] = CrcTable[x];
+    }
+    for (size_t k = 1; k < 4; k++) {
+        for (size_t x = 0; x < 256; x++) {
+            crc_slices[k][x] = CrcTable[crc_slices[k - 1][x]];
+        }
+    }
+}
+
+uint8_t lidar_frame_crc(const uint8_t *data, size_t len)
+{
+    uint8_t crc = 0;
+    while (len >= 4) {
+        crc = crc_slices[3][crc ^ data[0]] ^ crc_slices[2][data[1]] ^
+              crc_slices[1][data[2]] ^ crc_slices[0][data[3]];
+        data += 4;
+        len -= 4;
+    }
+    while (len--) {
+        crc = crc_slices[0][crc ^ *data];
+        data++;
+    }
+    return crc;
+}
+
+#if CONFIG_LRR_LIDAR_CRC_BENCHMARK
+#define BENCHMARK_FRAMES 64
+#define BENCHMARK_ROUNDS 100
+
+void lidar_crc_benchmark()
+{
+    static uint8_t frames[BENCHMARK_FRAMES][sizeof(LiDARFrame)];
+
+    uint32_t seed = 0x2C54;
+    for (size_t i = 0; i < BENCHMARK_FRAMES; i++) {
+        for (size_t j = 0; j < sizeof(LiDARFrame); j++) {
+            seed = seed * 1664525 + 1013904223;
+            frames[i][j] = seed >> 24;
+        }
+    }
+
+    // Fold the results together so neither loop gets optimized out
+    volatile uint8_t sink = 0;
+    uint8_t table_crc = 0;
+    uint8_t sliced_crc = 0;
+
+    uint32_t start = esp_cpu_get_cycle_count();
+    for (size_t r = 0; r < BENCHMARK_ROUNDS; r++) {
+        for (size_t i = 0; i < BENCHMARK_FRAMES; i++) {
+            table_crc ^= CalCRC8(frames[i], sizeof(LiDARFrame) - 1);
+        }
+    }
+    uint32_t table_cycles = esp_cpu_get_cycle_count() - start;
+
+    start = esp_cpu_get_cycle_count();
+    for (size_t r = 0; r < BENCHMARK_ROUNDS; r++) {
+        for (size_t i = 0; i < BENCHMARK_FRAMES; i++) {
+            sliced_crc ^= lidar_frame_crc(frames[i], sizeof(LiDARFrame) - 1);
+        }
+    }
+    uint32_t sliced_cycles = esp_cpu_get_cycle_count() - start;
+    sink = table_crc ^ sliced_crc;
+    (void)sink;
+
+    if (table_crc != sliced_crc) {
+        ESP_LOGE(TAG, "Sliced CRC disagrees with the table CRC");
+    }
+
+    uint32_t n = BENCHMARK_FRAMES * BENCHMARK_ROUNDS;
+    ESP_LOGI(TAG,
+             "CRC8 cycles per frame: table %lu, sliced %lu",
+             (unsigned long)(table_cycles / n),
+             (unsigned long)(sliced_cycles / n));
+}
+#endif
+
+void lidar_parser_init(lidar_parser_t *parser)
+{
+    lidar_parser_reset(parser);
+    parser->crc_errors = 0;
+    parser->resyncs = 0;
+}
+
+void lidar_parser_reset(lidar_parser_t *parser)
+{
+    parser->start = 0;
+    parser->end = 0;
+}
+
+uint8_t *lidar_parser_write_ptr(lidar_parser_t *parser, size_t *space)
+{
+    if (parser->start == parser->end) {
+        lidar_parser_reset(parser);
+    } else if (sizeof(parser->buffer) - parser->end < sizeof(LiDARFrame)) {
+        // Whatever is left is less than a frame, move it to the front.
+        size_t pending = parser->end - parser->start;
+        memmove(parser->buffer, parser->buffer + parser->start, pending);
+        parser->start = 0;
+        parser->end = pending;
+    }
+
+    *space = sizeof(parser->buffer) - parser->end;
+    return parser->buffer + parser->end;
+}
+
+void lidar_parser_commit(lidar_parser_t *parser, size_t len)
+{
+    parser->end += len;
+}
+
+const LiDARFrame *lidar_parser_next(lidar_parser_t *parser)
+{
+    while (parser->end - parser->start >= sizeof(LiDARFrame)) {
+        const uint8_t *data = parser->buffer + parser->start;
+
+        // Look for start bytes, 0x54 0x2C
+        if (data[0] != HEADER || data[1] != VERLEN) {
+            const uint8_t *next =
+              memchr(data + 1, HEADER, parser->end - parser->start - 1);
+            parser->start = next != NULL ? (size_t)(next - parser->buffer)
+                                         : parser->end;
+            parser->resyncs++;
+            continue;
+        }
+
+        const LiDARFrame *frame = (const LiDARFrame *)data;
+        TRACE_BEGIN(eTraceLidarCrc);
+        uint8_t crc = lidar_frame_crc(data, sizeof(LiDARFrame) - 1);
+        TRACE_END(eTraceLidarCrc);
+        if (crc != frame->crc8) {
+            // 0x54 0x2C can show up in point data, so only skip the header
+            parser->crc_errors++;
+            parser->start++;
+            continue;
+        }
+
+        parser->start += sizeof(LiDARFrame);
+        return frame;
+    }
+
+    return NULL;
+}
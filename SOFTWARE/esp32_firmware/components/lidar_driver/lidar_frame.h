@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+#define POINT_PER_UART_PACKET 12
+#define HEADER 0x54
+#define VERLEN 0x2C
+
+typedef struct
+{
+    uint16_t distance;
+    uint8_t intensity;
+} __attribute__((packed)) LidarPoint;
+
+typedef struct
+{
+    uint8_t header;
+    uint8_t ver_len;
+    uint16_t speed;
+    uint16_t start_angle;
+    LidarPoint points[POINT_PER_UART_PACKET];
+    uint16_t end_angle;
+    uint16_t timestamp;
+    uint8_t crc8;
+} __attribute__((packed)) LiDARFrame;
+
+/*
+ * Angle of a frame's i-th point in centidegrees. Points are evenly spaced
+ * from start_angle to end_angle, which may wrap past 0.
+ */
+uint32_t lidar_point_angle(const LiDARFrame *frame, size_t i);
+
+/*
+ * A frame's distances in meters and intensities as floats, for LaserScan.
+ */
+void lidar_frame_convert(const LiDARFrame *frame,
+                         float *ranges,
+                         float *intensities);
+
+uint8_t CalCRC8(const uint8_t *data, uint16_t data_len);
+
+/*
+ * Build the tables for lidar_frame_crc. Call once before parsing.
+ */
+void lidar_crc_init();
+
+/*
+ * Same result as CalCRC8, but takes four bytes per step using slicing
+ * tables, so the lookups don't all wait on each other.
+ */
+uint8_t lidar_frame_crc(const uint8_t *data, size_t len);
+
+#if CONFIG_LRR_LIDAR_CRC_BENCHMARK
+/*
+ * Time CalCRC8 against lidar_frame_crc on random frames and log the result.
+ */
+void lidar_crc_benchmark();
+#endif
+
+// Room for about 20 frames, a little more than the UART delivers per event
+#define LIDAR_PARSER_BUFFER_SIZE 1024
+
+/*
+ * Streaming LD20 frame parser.
+ *
+ * Bytes are read from the UART straight into the parser's buffer, and frames
+ * are checked and handed out in place. The only copy is moving a partial
+ * frame back to the front when the buffer runs out of room.
+ */
+typedef struct
+{
+    uint8_t buffer[LIDAR_PARSER_BUFFER_SIZE];
+    size_t start; // First unparsed byte
+    size_t end;   // One past the last byte read
+    uint32_t crc_errors;
+    uint32_t resyncs; // Times garbage was skipped looking for a header
+} lidar_parser_t;
+
+void lidar_parser_init(lidar_parser_t *parser);
+
+/*
+ * Drop everything buffered, for when the UART has lost bytes.
+ */
+void lidar_parser_reset(lidar_parser_t *parser);
+
+/*
+ * Where the next bytes should be read to, and how many fit.
+ */
+uint8_t *lidar_parser_write_ptr(lidar_parser_t *parser, size_t *space);
+
+/*
+ * Mark len bytes at the write pointer as read.
+ */
+void lidar_parser_commit(lidar_parser_t *parser, size_t len);
+
+/*
+ * Get the next frame with a valid checksum, or NULL if no complete frame is
+ * buffered. The frame points into the parser's buffer and is only valid until
+ * the next call to lidar_parser_write_ptr.
+ */
+const LiDARFrame *lidar_parser_next(lidar_parser_t *parser);
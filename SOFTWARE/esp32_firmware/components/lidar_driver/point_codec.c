@@ -0,0 +1,20 @@
+#include "point_codec.h"
+
+size_t point_codec_put_distance(uint8_t *out,
+                                uint16_t distance,
+                                uint16_t *previous)
+{
+    int32_t delta = (int32_t)distance - (int32_t)*previous;
+    *previous = distance;
+
+    // Small steps either way come out as small numbers
+    uint32_t zigzag = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+
+    size_t len = 0;
+    while (zigzag >= 0x80) {
+        out[len++] = (uint8_t)(zigzag | 0x80);
+        zigzag >>= 7;
+    }
+    out[len++] = (uint8_t)zigzag;
+    return len;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Most bytes one distance can take. A delta needs 17 bits once zigzagged.
+#define POINT_CODEC_MAX_DISTANCE_BYTES 3
+
+/*
+ * Append distance to a POINT_ENCODING_DELTA_VARINT stream, as the zigzag
+ * varint of its difference from previous, which is updated. Start each
+ * packet with previous at 0. Returns the bytes written.
+ */
+size_t point_codec_put_distance(uint8_t *out,
+                                uint16_t distance,
+                                uint16_t *previous);
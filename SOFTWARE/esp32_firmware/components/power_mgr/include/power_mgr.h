@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+/*
+ * Decides how fast the CPU needs to run, from whether a host is connected
+ * and whether the rover has been told to move lately, and holds esp_pm locks
+ * to match. Same order as PowerState in messages.proto.
+ */
+typedef enum POWER_STATES
+{
+    ePowerIdle,    // No host, the clock can drop and light sleep is allowed
+    ePowerParked,  // Host connected, nothing moving, the clock can drop
+    ePowerDriving, // Full speed
+    ePowerStateCount
+} ePowerState;
+
+typedef struct
+{
+    ePowerState state;
+    uint32_t cpu_freq_mhz;
+    uint32_t state_ms[ePowerStateCount]; // Since boot
+} power_stats_t;
+
+/*
+ * Called by the discovery code as the host comes and goes.
+ */
+void power_mgr_set_host(bool connected);
+
+/*
+ * Called with every accepted cmd_vel, and from anything else that moves the
+ * wheels. Motion switches to full speed at once. It's timed out back to
+ * parked.
+ */
+void power_mgr_note_motion(bool moving);
+
+void power_mgr_get_stats(power_stats_t *stats);
+
+/*
+ * Configure esp_pm. Before anything that could call the above.
+ */
+void power_mgr_init();
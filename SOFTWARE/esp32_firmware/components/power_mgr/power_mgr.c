@@ -0,0 +1,178 @@
+#include "power_mgr.h"
+
+#include "esp_log.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#if CONFIG_LRR_POWER_MGMT
+#include "esp_pm.h"
+#endif
+
+// How often parked and idle are checked for
+#define CHECK_PERIOD_US (250 * 1000)
+
+#if CONFIG_LRR_POWER_MGMT
+#define PARK_TIMEOUT_US (CONFIG_LRR_POWER_PARK_TIMEOUT_MS * 1000)
+// APB stays at 80 MHz down to here, which the UART baud rates and PWM
+// frequencies are worked out from
+#define MIN_FREQ_MHZ 80
+#else
+// Still tracked for telemetry
+#define PARK_TIMEOUT_US (3000 * 1000)
+#endif
+
+static const char *TAG = "power";
+
+static const char *state_names[ePowerStateCount] = {
+    [ePowerIdle] = "idle",
+    [ePowerParked] = "parked",
+    [ePowerDriving] = "driving",
+};
+
+// Taken by the RX tasks, the control loop and the check timer. Everything
+// below is under it.
+static SemaphoreHandle_t lock = NULL;
+static ePowerState state = ePowerIdle;
+static bool host_connected = false;
+static bool moved = false; // Ever, so last_motion_us means something
+static int64_t last_motion_us = 0;
+static int64_t entered_us = 0;
+static int64_t state_us[ePowerStateCount] = {};
+
+static esp_timer_handle_t check_timer;
+
+#if CONFIG_LRR_POWER_MGMT
+static esp_pm_lock_handle_t full_speed_lock; // CPU_FREQ_MAX while driving
+static esp_pm_lock_handle_t awake_lock;      // NO_LIGHT_SLEEP unless idle
+#endif
+
+static ePowerState wanted_state(int64_t now_us)
+{
+    if (moved && now_us - last_motion_us < PARK_TIMEOUT_US) {
+        return ePowerDriving;
+    }
+    return host_connected ? ePowerParked : ePowerIdle;
+}
+
+/*
+ * Switch locks over to new_state. Only called with the lock held.
+ */
+static void enter(ePowerState new_state, int64_t now_us)
+{
+    if (new_state == state) {
+        return;
+    }
+
+#if CONFIG_LRR_POWER_MGMT
+    // New locks go on before old ones come off, so the clock never dips on
+    // the way up
+    if (new_state == ePowerDriving) {
+        esp_pm_lock_acquire(full_speed_lock);
+    }
+    if (new_state != ePowerIdle && state == ePowerIdle) {
+        esp_pm_lock_acquire(awake_lock);
+    }
+    if (state == ePowerDriving) {
+        esp_pm_lock_release(full_speed_lock);
+    }
+    if (new_state == ePowerIdle && state != ePowerIdle) {
+        esp_pm_lock_release(awake_lock);
+    }
+#endif
+
+    // Logging here would hold up whichever command caused it
+    ESP_LOGD(TAG, "%s -> %s", state_names[state], state_names[new_state]);
+    state_us[state] += now_us - entered_us;
+    entered_us = now_us;
+    state = new_state;
+}
+
+static void check_timer_callback(void *arg)
+{
+    int64_t now_us = esp_timer_get_time();
+    xSemaphoreTake(lock, portMAX_DELAY);
+    enter(wanted_state(now_us), now_us);
+    xSemaphoreGive(lock);
+}
+
+void power_mgr_set_host(bool connected)
+{
+    if (lock == NULL) {
+        return;
+    }
+    int64_t now_us = esp_timer_get_time();
+    xSemaphoreTake(lock, portMAX_DELAY);
+    host_connected = connected;
+    enter(wanted_state(now_us), now_us);
+    xSemaphoreGive(lock);
+}
+
+void power_mgr_note_motion(bool moving)
+{
+    // Stopping just lets the timeout run out
+    if (lock == NULL || !moving) {
+        return;
+    }
+    int64_t now_us = esp_timer_get_time();
+    xSemaphoreTake(lock, portMAX_DELAY);
+    moved = true;
+    last_motion_us = now_us;
+    enter(ePowerDriving, now_us);
+    xSemaphoreGive(lock);
+}
+
+void power_mgr_get_stats(power_stats_t *stats)
+{
+    int64_t now_us = esp_timer_get_time();
+    xSemaphoreTake(lock, portMAX_DELAY);
+    stats->state = state;
+    for (int i = 0; i < ePowerStateCount; i++) {
+        int64_t total_us = state_us[i];
+        if (i == state) {
+            total_us += now_us - entered_us;
+        }
+        stats->state_ms[i] = (uint32_t)(total_us / 1000);
+    }
+    xSemaphoreGive(lock);
+    stats->cpu_freq_mhz = esp_rom_get_cpu_ticks_per_us();
+}
+
+void power_mgr_init()
+{
+    lock = xSemaphoreCreateMutex();
+    entered_us = esp_timer_get_time();
+
+#if CONFIG_LRR_POWER_MGMT
+    ESP_ERROR_CHECK(esp_pm_lock_create(
+      ESP_PM_CPU_FREQ_MAX, 0, "lrr_driving", &full_speed_lock));
+    ESP_ERROR_CHECK(
+      esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "lrr_host", &awake_lock));
+
+    esp_pm_config_t config = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = MIN_FREQ_MHZ,
+#if CONFIG_LRR_POWER_LIGHT_SLEEP
+        .light_sleep_enable = true,
+#endif
+    };
+    esp_err_t err = esp_pm_configure(&config);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to configure esp_pm: %s", esp_err_to_name(err));
+    } else {
+        ESP_LOGI(TAG,
+                 "CPU at %d to %d MHz, light sleep %s",
+                 config.min_freq_mhz,
+                 config.max_freq_mhz,
+                 config.light_sleep_enable ? "on" : "off");
+    }
+#endif
+
+    const esp_timer_create_args_t check_timer_args = {
+        .callback = check_timer_callback,
+        .name = "power_check",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&check_timer_args, &check_timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(check_timer, CHECK_PERIOD_US));
+}
@@ -0,0 +1,222 @@
+#include "discovery.h"
+
+#include "esp_log.h"
+#include "esp_netif.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "nvs.h"
+#include <string.h>
+
+#include "messages.pb.h"
+#include "pb_encode.h"
+#include "power_mgr.h"
+#include "sdkconfig.h"
+#include "socket_mgr.h"
+#include "status_led_driver.h"
+#include "time_sync.h"
+
+#define PORT 8001
+// Requests go out quickly for the first couple of seconds of a search, then
+// settle down so a rover with no host around isn't flooding the network
+#define FAST_PERIOD_US (100 * 1000)
+#define FAST_REQUESTS 20
+#define SLOW_PERIOD_MULTIPLE 10
+#define AGENT_TIMEOUT_US (CONFIG_LRR_DISCOVERY_TIMEOUT_MS * 1000LL)
+
+static const char *TAG = "discovery";
+
+static int socket_id;
+
+// Written by the RX task, read by the TX task and the request timer
+static portMUX_TYPE agent_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct sockaddr_in agent;
+static bool have_agent = false;
+static int64_t last_heard_us = 0;
+static bool searching = true;
+// Set by the RX task when the agent changes, saved from the request timer
+// so a flash write never holds up receiving
+static bool save_pending = false;
+
+static esp_timer_handle_t request_timer;
+static uint32_t requests = 0;
+// Encoded once, it never changes
+static uint8_t request[16];
+static size_t request_len = 0;
+
+static void load_cached_agent()
+{
+    nvs_handle_t handle;
+    if (nvs_open("storage", NVS_READONLY, &handle) != ESP_OK) {
+        return;
+    }
+    char ip[16];
+    size_t len = sizeof(ip);
+    esp_err_t err = nvs_get_str(handle, "uros_ag_ip", ip, &len);
+    nvs_close(handle);
+    if (err != ESP_OK) {
+        return;
+    }
+
+    // Streams straight away, but still searches until it answers
+    ESP_LOGI(TAG, "Starting with saved agent %s", ip);
+    agent.sin_family = AF_INET;
+    agent.sin_port = htons(PORT);
+    agent.sin_addr.s_addr = inet_addr(ip);
+    have_agent = true;
+}
+
+static void save_agent(const struct sockaddr_in *addr)
+{
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open("storage", NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error (%s) opening NVS handle", esp_err_to_name(err));
+        return;
+    }
+    err = nvs_set_str(handle, "uros_ag_ip", inet_ntoa(addr->sin_addr));
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error (%s) saving agent", esp_err_to_name(err));
+    }
+    nvs_close(handle);
+}
+
+/*
+ * Send a request to the subnet broadcast address of one interface, if it
+ * has an address.
+ */
+static void broadcast_request(const char *ifkey)
+{
+    esp_netif_t *netif = esp_netif_get_handle_from_ifkey(ifkey);
+    esp_netif_ip_info_t info;
+    if (netif == NULL || esp_netif_get_ip_info(netif, &info) != ESP_OK ||
+        info.ip.addr == 0) {
+        return;
+    }
+
+    struct sockaddr_in broadcast = {};
+    broadcast.sin_family = AF_INET;
+    broadcast.sin_port = htons(PORT);
+    broadcast.sin_addr.s_addr = info.ip.addr | ~info.netmask.addr;
+    sendto(socket_id,
+           request,
+           request_len,
+           0,
+           (struct sockaddr *)&broadcast,
+           sizeof(broadcast));
+}
+
+static void request_timer_callback(void *arg)
+{
+    int64_t now_us = esp_timer_get_time();
+    taskENTER_CRITICAL(&agent_lock);
+    bool lost = !searching && now_us - last_heard_us > AGENT_TIMEOUT_US;
+    if (lost) {
+        searching = true;
+        requests = 0;
+    }
+    bool search = searching;
+    bool save = save_pending;
+    struct sockaddr_in found = agent;
+    save_pending = false;
+    taskEXIT_CRITICAL(&agent_lock);
+
+    if (save) {
+        save_agent(&found);
+    }
+
+    if (lost) {
+        // Keep streaming to the old address in case it comes back
+        ESP_LOGW(TAG, "Agent went quiet, searching");
+        set_status(eAgentDisconnected);
+        power_mgr_set_host(false);
+    }
+    if (!search || (++requests > FAST_REQUESTS &&
+                    requests % SLOW_PERIOD_MULTIPLE != 0)) {
+        return;
+    }
+
+    broadcast_request("WIFI_STA_DEF");
+    broadcast_request("WIFI_AP_DEF");
+}
+
+bool discovery_get_agent(struct sockaddr_in *out)
+{
+    taskENTER_CRITICAL(&agent_lock);
+    bool known = have_agent;
+    *out = agent;
+    taskEXIT_CRITICAL(&agent_lock);
+    return known;
+}
+
+void discovery_heard_from(const struct sockaddr_in *source, bool answer)
+{
+    taskENTER_CRITICAL(&agent_lock);
+    bool from_agent = have_agent &&
+                      source->sin_addr.s_addr == agent.sin_addr.s_addr &&
+                      source->sin_port == agent.sin_port;
+    // Only the first answer to a search counts. Requests go out on every
+    // interface, and with two hosts up the second answer would otherwise
+    // take the agent straight back. It changes again once the agent times
+    // out and another search starts.
+    bool found = answer && searching;
+    bool moved = found && !from_agent;
+    if (moved) {
+        agent = *source;
+        have_agent = true;
+        save_pending = true;
+    }
+    if (answer || from_agent) {
+        last_heard_us = esp_timer_get_time();
+    }
+    if (found) {
+        searching = false;
+    }
+    taskEXIT_CRITICAL(&agent_lock);
+
+    if (moved) {
+        ESP_LOGI(TAG, "Found agent %s", inet_ntoa(source->sin_addr));
+        // A different host has a different clock
+        time_sync_restart();
+    }
+    if (found) {
+        set_status(eAgentConnected);
+        power_mgr_set_host(true);
+    }
+}
+
+const uint8_t *discovery_request(size_t *len)
+{
+    *len = request_len;
+    return request;
+}
+
+void discovery_init(int sock)
+{
+    socket_id = sock;
+    int broadcast = 1;
+    setsockopt(
+      socket_id, SOL_SOCKET, SO_BROADCAST, &broadcast, sizeof(broadcast));
+    load_cached_agent();
+
+    // A UdpPacket is too big for the timer task's stack, so the request is
+    // put together by hand
+    Discovery discovery = Discovery_init_zero;
+    pb_ostream_t stream = pb_ostream_from_buffer(request, sizeof(request));
+    pb_encode_tag(&stream, PB_WT_VARINT, UdpPacket_robot_id_tag);
+    pb_encode_varint(&stream, socket_mgr_robot_id());
+    pb_encode_tag(&stream, PB_WT_STRING, UdpPacket_discovery_tag);
+    pb_encode_submessage(&stream, Discovery_fields, &discovery);
+    request_len = stream.bytes_written;
+
+    const esp_timer_create_args_t request_timer_args = {
+        .callback = request_timer_callback,
+        .name = "discovery",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&request_timer_args, &request_timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(request_timer, FAST_PERIOD_US));
+    // No need to wait a whole period for the first one
+    request_timer_callback(NULL);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lwip/sockets.h"
+
+/*
+ * Finds the host without any setup. Until a host has answered, and again
+ * whenever it goes quiet, the rover broadcasts a Discovery request on every
+ * interface it has an address on. The first host to answer becomes the
+ * agent until it goes quiet, everything is sent there, and its address is
+ * saved as the starting guess for the next boot. The address set through
+ * /set-agent-ip is used the same way.
+ */
+
+/*
+ * Where to send, false if no host is known yet.
+ */
+bool discovery_get_agent(struct sockaddr_in *agent);
+
+/*
+ * Called by the RX task for every datagram, with whether it carried a
+ * Discovery answer. Traffic from the agent keeps it current.
+ */
+void discovery_heard_from(const struct sockaddr_in *source, bool answer);
+
+/*
+ * The encoded request, set up by discovery_init. Other transports can send
+ * it to find a host the same way.
+ */
+const uint8_t *discovery_request(size_t *len);
+
+void discovery_init(int sock);
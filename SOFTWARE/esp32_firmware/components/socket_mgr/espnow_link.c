@@ -0,0 +1,173 @@
+#include "espnow_link.h"
+
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_now.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+#include "discovery.h"
+#include "sdkconfig.h"
+
+// Shares the socket RX task's slot in the task table
+#define ESPNOW_RX_TASK_STACK_SIZE CONFIG_LRR_TASK_SOCKET_RX_STACK
+#define ESPNOW_RX_QUEUE_DEPTH 4
+// A hopping dongle sits on each channel a little longer than this, so it
+// hears at least one request wherever it is
+#define REQUEST_PERIOD_US (200 * 1000)
+#define PEER_TIMEOUT_US (CONFIG_LRR_DISCOVERY_TIMEOUT_MS * 1000LL)
+
+static const char *TAG = "espnow";
+
+static const uint8_t broadcast_mac[ESP_NOW_ETH_ALEN] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
+typedef struct
+{
+    uint8_t mac[ESP_NOW_ETH_ALEN];
+    uint8_t len;
+    uint8_t data[ESPNOW_LINK_MAX_LEN];
+} espnow_frame_t;
+
+static QueueHandle_t rx_queue;
+static void (*receive_callback)(const uint8_t *data, size_t len);
+
+// Written by the RX task, read by the TX task and the request timer
+static portMUX_TYPE peer_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t peer[ESP_NOW_ETH_ALEN];
+static bool have_peer = false;
+static int64_t last_heard_us = 0;
+
+static esp_timer_handle_t request_timer;
+
+static bool peer_current(uint8_t *mac)
+{
+    taskENTER_CRITICAL(&peer_lock);
+    bool current =
+      have_peer && esp_timer_get_time() - last_heard_us < PEER_TIMEOUT_US;
+    if (current && mac != NULL) {
+        memcpy(mac, peer, sizeof(peer));
+    }
+    taskEXIT_CRITICAL(&peer_lock);
+    return current;
+}
+
+static void add_peer(const uint8_t *mac)
+{
+    esp_now_peer_info_t info = {
+        // 0 follows whatever channel the STA is on
+        .channel = 0,
+        .ifidx = WIFI_IF_STA,
+        .encrypt = false,
+    };
+    memcpy(info.peer_addr, mac, sizeof(info.peer_addr));
+    esp_err_t err = esp_now_add_peer(&info);
+    if (err != ESP_OK && err != ESP_ERR_ESPNOW_EXIST) {
+        ESP_LOGE(TAG, "Failed to add peer: %s", esp_err_to_name(err));
+    }
+}
+
+static void request_timer_callback(void *arg)
+{
+    if (peer_current(NULL)) {
+        return;
+    }
+    size_t len;
+    const uint8_t *request = discovery_request(&len);
+    if (len > 0) {
+        esp_now_send(broadcast_mac, request, len);
+    }
+}
+
+/*
+ * Runs in the Wi-Fi task, so only copies the frame out.
+ */
+static void espnow_receive_callback(const esp_now_recv_info_t *info,
+                                    const uint8_t *data,
+                                    int len)
+{
+    // Other rovers' requests are broadcast, a dongle only ever sends to us
+    if (len <= 0 || len > ESPNOW_LINK_MAX_LEN ||
+        memcmp(info->des_addr, broadcast_mac, sizeof(broadcast_mac)) == 0) {
+        return;
+    }
+    espnow_frame_t frame;
+    memcpy(frame.mac, info->src_addr, sizeof(frame.mac));
+    frame.len = (uint8_t)len;
+    memcpy(frame.data, data, len);
+    xQueueSend(rx_queue, &frame, 0);
+}
+
+static void espnow_rx_task(void *arg)
+{
+    espnow_frame_t frame;
+    while (1) {
+        if (xQueueReceive(rx_queue, &frame, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+
+        taskENTER_CRITICAL(&peer_lock);
+        bool known = have_peer && memcmp(frame.mac, peer, sizeof(peer)) == 0;
+        uint8_t old_peer[ESP_NOW_ETH_ALEN];
+        bool had_peer = have_peer;
+        memcpy(old_peer, peer, sizeof(peer));
+        taskEXIT_CRITICAL(&peer_lock);
+
+        if (!known) {
+            if (had_peer) {
+                esp_now_del_peer(old_peer);
+            }
+            add_peer(frame.mac);
+            ESP_LOGI(TAG, "Found dongle " MACSTR, MAC2STR(frame.mac));
+        }
+
+        taskENTER_CRITICAL(&peer_lock);
+        memcpy(peer, frame.mac, sizeof(peer));
+        have_peer = true;
+        last_heard_us = esp_timer_get_time();
+        taskEXIT_CRITICAL(&peer_lock);
+
+        receive_callback(frame.data, frame.len);
+    }
+}
+
+bool espnow_link_send(const uint8_t *data, size_t len)
+{
+    uint8_t mac[ESP_NOW_ETH_ALEN];
+    if (len > ESPNOW_LINK_MAX_LEN || !peer_current(mac)) {
+        return false;
+    }
+    // Delivery is acknowledged and retried by the MAC, like any unicast
+    return esp_now_send(mac, data, len) == ESP_OK;
+}
+
+void espnow_link_init(void (*receive)(const uint8_t *data, size_t len))
+{
+    receive_callback = receive;
+    rx_queue = xQueueCreate(ESPNOW_RX_QUEUE_DEPTH, sizeof(espnow_frame_t));
+
+    ESP_ERROR_CHECK(esp_now_init());
+    ESP_ERROR_CHECK(esp_now_register_recv_cb(espnow_receive_callback));
+    add_peer(broadcast_mac);
+
+    xTaskCreatePinnedToCore(espnow_rx_task,
+                            "espnow_rx_task",
+                            ESPNOW_RX_TASK_STACK_SIZE,
+                            NULL,
+                            CONFIG_LRR_TASK_SOCKET_RX_PRIO,
+                            NULL,
+                            CONFIG_LRR_TASK_SOCKET_RX_CORE);
+
+    const esp_timer_create_args_t request_timer_args = {
+        .callback = request_timer_callback,
+        .name = "espnow_discovery",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&request_timer_args, &request_timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(request_timer, REQUEST_PERIOD_US));
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * ESP-NOW link to a dongle plugged into the host (SOFTWARE/espnow_dongle),
+ * which hands every frame to the HAL over USB serial. Frames go straight to
+ * the dongle, so they skip the AP, the NAT and most of lwIP. They carry the
+ * same encoded UdpPackets as the socket.
+ *
+ * Until a dongle is heard from, the rover broadcasts discovery requests over
+ * ESP-NOW on its channel. The host answers through the dongle like it would
+ * over UDP, and whichever dongle sends to the rover directly becomes the
+ * peer. It's dropped again once it has been quiet for
+ * CONFIG_LRR_DISCOVERY_TIMEOUT_MS, and traffic goes back to UDP.
+ */
+
+// Largest ESP-NOW payload
+#define ESPNOW_LINK_MAX_LEN 250
+
+/*
+ * Send a datagram to the dongle. Returns false if there's no dongle or the
+ * datagram is too big, and it should go by UDP instead.
+ */
+bool espnow_link_send(const uint8_t *data, size_t len);
+
+/*
+ * Start ESP-NOW. Wi-Fi has to be started first. Every frame received from a
+ * dongle is passed to receive, from the link's own task.
+ */
+void espnow_link_init(void (*receive)(const uint8_t *data, size_t len));
@@ -0,0 +1,493 @@
+#include "fast_encode.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "pb.h"
+
+#if CONFIG_LRR_SOCKET_ENCODE_BENCHMARK
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "pb_encode.h"
+
+static const char *TAG = "fast encode";
+#endif
+
+// Floats and doubles go on the wire little endian, same as in memory here
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "fast_encode copies arrays as they are in memory"
+#endif
+
+// Every field number written here is below 16, so each tag is one byte
+#define TAG(field, wire_type) (uint8_t)(((field) << 3) | (wire_type))
+
+// This is a hand written copy of the messages it encodes. Fingerprint each
+// one's generated field list, so a change to messages.proto breaks the build
+// until the encoder (and has_other_fields) are updated to match.
+#define FIELD_COUNT(a, allocation, label, type, name, tag) +1
+#define FIELD_TAG_SUM(a, allocation, label, type, name, tag) +(tag)
+#define CHECK_FIELDS(message, count, tag_sum)                                  \
+    _Static_assert((0 message##_FIELDLIST(FIELD_COUNT, 0)) == (count) &&       \
+                     (0 message##_FIELDLIST(FIELD_TAG_SUM, 0)) == (tag_sum),   \
+                   #message " changed, update fast_encode.c to match")
+
+CHECK_FIELDS(TimeStamp, 2, 3);
+CHECK_FIELDS(LaserScan, 10, 55);
+CHECK_FIELDS(JointStates, 5, 15);
+CHECK_FIELDS(Odometry, 8, 36);
+CHECK_FIELDS(UdpPacket, 16, 138);
+
+static inline size_t varint_size(uint32_t value)
+{
+    size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+static inline uint8_t *put_varint(uint8_t *p, uint32_t value)
+{
+    while (value >= 0x80) {
+        *p++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (uint8_t)value;
+    return p;
+}
+
+// Negative int32s are sign extended to 64 bits, so they always take ten
+static inline size_t int32_size(int32_t value)
+{
+    return value < 0 ? 10 : varint_size((uint32_t)value);
+}
+
+static inline uint8_t *put_int32(uint8_t *p, int32_t value)
+{
+    if (value >= 0) {
+        return put_varint(p, (uint32_t)value);
+    }
+    uint64_t extended = (uint64_t)(int64_t)value;
+    for (int i = 0; i < 9; i++) {
+        *p++ = (uint8_t)(extended | 0x80);
+        extended >>= 7;
+    }
+    *p++ = (uint8_t)extended;
+    return p;
+}
+
+static inline size_t submessage_size(size_t contents)
+{
+    return 1 + varint_size(contents) + contents;
+}
+
+// proto3 leaves out scalars that are all zero bits, so -0.0 is still sent
+static inline bool float_is_default(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits == 0;
+}
+
+static inline size_t float_size(float value)
+{
+    return float_is_default(value) ? 0 : 1 + sizeof(float);
+}
+
+static inline uint8_t *put_float(uint8_t *p, uint32_t field, float value)
+{
+    if (!float_is_default(value)) {
+        *p++ = TAG(field, PB_WT_32BIT);
+        memcpy(p, &value, sizeof(value));
+        p += sizeof(value);
+    }
+    return p;
+}
+
+static inline size_t packed_size(size_t count, size_t element_size)
+{
+    return count == 0 ? 0 : submessage_size(count * element_size);
+}
+
+static inline uint8_t *put_packed(uint8_t *p,
+                                  uint32_t field,
+                                  const void *data,
+                                  size_t count,
+                                  size_t element_size)
+{
+    if (count > 0) {
+        size_t len = count * element_size;
+        *p++ = TAG(field, PB_WT_STRING);
+        p = put_varint(p, len);
+        memcpy(p, data, len);
+        p += len;
+    }
+    return p;
+}
+
+static size_t timestamp_size(const TimeStamp *stamp)
+{
+    size_t size = 0;
+    if (stamp->sec != 0) {
+        size += 1 + int32_size(stamp->sec);
+    }
+    if (stamp->nanosec != 0) {
+        size += 1 + varint_size(stamp->nanosec);
+    }
+    return size;
+}
+
+static uint8_t *put_timestamp(uint8_t *p,
+                              uint32_t field,
+                              const TimeStamp *stamp)
+{
+    size_t contents = timestamp_size(stamp);
+    *p++ = TAG(field, PB_WT_STRING);
+    p = put_varint(p, contents);
+    if (stamp->sec != 0) {
+        *p++ = TAG(TimeStamp_sec_tag, PB_WT_VARINT);
+        p = put_int32(p, stamp->sec);
+    }
+    if (stamp->nanosec != 0) {
+        *p++ = TAG(TimeStamp_nanosec_tag, PB_WT_VARINT);
+        p = put_varint(p, stamp->nanosec);
+    }
+    return p;
+}
+
+static size_t laser_scan_size(const LaserScan *scan)
+{
+    size_t size = 0;
+    if (scan->has_time) {
+        size += submessage_size(timestamp_size(&scan->time));
+    }
+    size += float_size(scan->angle_min) + float_size(scan->angle_max) +
+            float_size(scan->angle_increment) +
+            float_size(scan->time_increment) + float_size(scan->scan_time) +
+            float_size(scan->range_min) + float_size(scan->range_max);
+    size += packed_size(scan->ranges_count, sizeof(float));
+    size += packed_size(scan->intensities_count, sizeof(float));
+    return size;
+}
+
+static uint8_t *put_laser_scan(uint8_t *p, const LaserScan *scan)
+{
+    if (scan->has_time) {
+        p = put_timestamp(p, LaserScan_time_tag, &scan->time);
+    }
+    p = put_float(p, LaserScan_angle_min_tag, scan->angle_min);
+    p = put_float(p, LaserScan_angle_max_tag, scan->angle_max);
+    p = put_float(p, LaserScan_angle_increment_tag, scan->angle_increment);
+    p = put_float(p, LaserScan_time_increment_tag, scan->time_increment);
+    p = put_float(p, LaserScan_scan_time_tag, scan->scan_time);
+    p = put_float(p, LaserScan_range_min_tag, scan->range_min);
+    p = put_float(p, LaserScan_range_max_tag, scan->range_max);
+    p = put_packed(p,
+                   LaserScan_ranges_tag,
+                   scan->ranges,
+                   scan->ranges_count,
+                   sizeof(float));
+    p = put_packed(p,
+                   LaserScan_intensities_tag,
+                   scan->intensities,
+                   scan->intensities_count,
+                   sizeof(float));
+    return p;
+}
+
+static bool laser_scan_valid(const LaserScan *scan)
+{
+    return scan->ranges_count <= sizeof(scan->ranges) / sizeof(float) &&
+           scan->intensities_count <= sizeof(scan->intensities) / sizeof(float);
+}
+
+static size_t joint_states_size(const JointStates *joints)
+{
+    size_t size = 0;
+    if (joints->has_time) {
+        size += submessage_size(timestamp_size(&joints->time));
+    }
+    for (pb_size_t i = 0; i < joints->name_count; i++) {
+        size += submessage_size(strlen(joints->name[i]));
+    }
+    size += packed_size(joints->position_count, sizeof(double));
+    size += packed_size(joints->velocity_count, sizeof(double));
+    size += packed_size(joints->effort_count, sizeof(double));
+    return size;
+}
+
+static uint8_t *put_joint_states(uint8_t *p, const JointStates *joints)
+{
+    if (joints->has_time) {
+        p = put_timestamp(p, JointStates_time_tag, &joints->time);
+    }
+    for (pb_size_t i = 0; i < joints->name_count; i++) {
+        size_t len = strlen(joints->name[i]);
+        *p++ = TAG(JointStates_name_tag, PB_WT_STRING);
+        p = put_varint(p, len);
+        memcpy(p, joints->name[i], len);
+        p += len;
+    }
+    p = put_packed(p,
+                   JointStates_position_tag,
+                   joints->position,
+                   joints->position_count,
+                   sizeof(double));
+    p = put_packed(p,
+                   JointStates_velocity_tag,
+                   joints->velocity,
+                   joints->velocity_count,
+                   sizeof(double));
+    p = put_packed(p,
+                   JointStates_effort_tag,
+                   joints->effort,
+                   joints->effort_count,
+                   sizeof(double));
+    return p;
+}
+
+static bool joint_states_valid(const JointStates *joints)
+{
+    const size_t max_count = sizeof(joints->position) / sizeof(double);
+    if (joints->name_count > max_count || joints->position_count > max_count ||
+        joints->velocity_count > max_count ||
+        joints->effort_count > max_count) {
+        return false;
+    }
+    // pb_encode refuses names that fill their array with no terminator
+    for (pb_size_t i = 0; i < joints->name_count; i++) {
+        if (memchr(joints->name[i], 0, sizeof(joints->name[i])) == NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static size_t odometry_size(const Odometry *odom)
+{
+    size_t size = 0;
+    if (odom->has_time) {
+        size += submessage_size(timestamp_size(&odom->time));
+    }
+    size += float_size(odom->x) + float_size(odom->y) + float_size(odom->yaw) +
+            float_size(odom->v) + float_size(odom->w);
+    size += packed_size(odom->pose_covariance_count, sizeof(float));
+    size += packed_size(odom->twist_covariance_count, sizeof(float));
+    return size;
+}
+
+static uint8_t *put_odometry(uint8_t *p, const Odometry *odom)
+{
+    if (odom->has_time) {
+        p = put_timestamp(p, Odometry_time_tag, &odom->time);
+    }
+    p = put_float(p, Odometry_x_tag, odom->x);
+    p = put_float(p, Odometry_y_tag, odom->y);
+    p = put_float(p, Odometry_yaw_tag, odom->yaw);
+    p = put_float(p, Odometry_v_tag, odom->v);
+    p = put_float(p, Odometry_w_tag, odom->w);
+    p = put_packed(p,
+                   Odometry_pose_covariance_tag,
+                   odom->pose_covariance,
+                   odom->pose_covariance_count,
+                   sizeof(float));
+    p = put_packed(p,
+                   Odometry_twist_covariance_tag,
+                   odom->twist_covariance,
+                   odom->twist_covariance_count,
+                   sizeof(float));
+    return p;
+}
+
+static bool odometry_valid(const Odometry *odom)
+{
+    return odom->pose_covariance_count <=
+             sizeof(odom->pose_covariance) / sizeof(float) &&
+           odom->twist_covariance_count <=
+             sizeof(odom->twist_covariance) / sizeof(float);
+}
+
+static bool has_other_fields(const UdpPacket *packet)
+{
+    return packet->has_cmd_vel || packet->has_compact_laser ||
+           packet->has_lidar_config || packet->has_command_stats ||
+           packet->has_diagnostics || packet->has_imu ||
+           packet->has_attitude || packet->has_control_config ||
+           packet->has_calibrate_motors || packet->has_time_sync ||
+           packet->has_discovery || packet->has_reliable;
+}
+
+size_t fast_encode_packet(const UdpPacket *packet, uint8_t *buf, size_t size)
+{
+    if (has_other_fields(packet) ||
+        (packet->has_laser && !laser_scan_valid(&packet->laser)) ||
+        (packet->has_joint_states &&
+         !joint_states_valid(&packet->joint_states)) ||
+        (packet->has_odometry && !odometry_valid(&packet->odometry))) {
+        return 0;
+    }
+
+    // Sized up front, so each submessage length is known before its contents
+    size_t laser = 0, joints = 0, odom = 0;
+    size_t total = 0;
+    if (packet->has_laser) {
+        laser = laser_scan_size(&packet->laser);
+        total += submessage_size(laser);
+    }
+    if (packet->has_joint_states) {
+        joints = joint_states_size(&packet->joint_states);
+        total += submessage_size(joints);
+    }
+    if (packet->has_odometry) {
+        odom = odometry_size(&packet->odometry);
+        total += submessage_size(odom);
+    }
+    if (packet->robot_id != 0) {
+        total += 1 + varint_size(packet->robot_id);
+    }
+    if (total == 0 || total > size) {
+        return 0;
+    }
+
+    // Same order as pb_encode, which goes by field number
+    uint8_t *p = buf;
+    if (packet->has_laser) {
+        *p++ = TAG(UdpPacket_laser_tag, PB_WT_STRING);
+        p = put_varint(p, laser);
+        p = put_laser_scan(p, &packet->laser);
+    }
+    if (packet->has_joint_states) {
+        *p++ = TAG(UdpPacket_joint_states_tag, PB_WT_STRING);
+        p = put_varint(p, joints);
+        p = put_joint_states(p, &packet->joint_states);
+    }
+    if (packet->has_odometry) {
+        *p++ = TAG(UdpPacket_odometry_tag, PB_WT_STRING);
+        p = put_varint(p, odom);
+        p = put_odometry(p, &packet->odometry);
+    }
+    if (packet->robot_id != 0) {
+        *p++ = TAG(UdpPacket_robot_id_tag, PB_WT_VARINT);
+        p = put_varint(p, packet->robot_id);
+    }
+    return total;
+}
+
+#if CONFIG_LRR_SOCKET_ENCODE_BENCHMARK
+#define BENCHMARK_ROUNDS 200
+
+static uint32_t benchmark_seed = 0x2C54;
+
+static float random_float(float scale)
+{
+    benchmark_seed = benchmark_seed * 1664525 + 1013904223;
+    return scale * (float)(benchmark_seed >> 8) / (float)(1 << 24);
+}
+
+static void fill_scan(UdpPacket *packet)
+{
+    packet->has_laser = true;
+    LaserScan *scan = &packet->laser;
+    scan->has_time = true;
+    scan->time.sec = 1700000000;
+    scan->time.nanosec = 123456789;
+    scan->angle_min = 0.0f;
+    scan->angle_max = 0.5f;
+    scan->angle_increment = 0.5f / 120;
+    scan->time_increment = 1.0f / 4500;
+    scan->scan_time = 0.001f;
+    scan->range_min = 0.1f;
+    scan->range_max = 8.0f;
+    scan->ranges_count = sizeof(scan->ranges) / sizeof(float);
+    scan->intensities_count = scan->ranges_count;
+    for (size_t i = 0; i < scan->ranges_count; i++) {
+        scan->ranges[i] = random_float(8.0f);
+        scan->intensities[i] = random_float(255.0f);
+    }
+}
+
+static void fill_control(UdpPacket *packet)
+{
+    packet->has_joint_states = true;
+    JointStates *joints = &packet->joint_states;
+    joints->has_time = true;
+    joints->time.sec = 1700000000;
+    joints->time.nanosec = 987654321;
+    joints->name_count = 2;
+    joints->position_count = 2;
+    joints->velocity_count = 2;
+    joints->effort_count = 2;
+    strcpy(joints->name[0], "wheel_left");
+    strcpy(joints->name[1], "wheel_right");
+    for (size_t i = 0; i < 2; i++) {
+        joints->position[i] = random_float(100.0f);
+        joints->velocity[i] = random_float(20.0f) - 10.0f;
+        joints->effort[i] = random_float(2.0f) - 1.0f;
+    }
+
+    packet->has_odometry = true;
+    Odometry *odom = &packet->odometry;
+    odom->has_time = true;
+    odom->time = joints->time;
+    odom->x = random_float(5.0f);
+    odom->y = random_float(5.0f);
+    odom->yaw = random_float(6.0f) - 3.0f;
+    odom->v = random_float(1.0f);
+    odom->w = 0.0f;
+    odom->pose_covariance_count = 9;
+    for (size_t i = 0; i < 9; i++) {
+        odom->pose_covariance[i] = random_float(0.01f);
+    }
+    odom->twist_covariance_count = 4;
+    odom->twist_covariance[0] = 0.01f;
+    odom->twist_covariance[3] = 0.01f;
+}
+
+static void benchmark_packet(const char *name, const UdpPacket *packet)
+{
+    static uint8_t generic[UdpPacket_size];
+    static uint8_t fast[UdpPacket_size];
+
+    size_t generic_len = 0;
+    uint32_t start = esp_cpu_get_cycle_count();
+    for (size_t r = 0; r < BENCHMARK_ROUNDS; r++) {
+        pb_ostream_t stream = pb_ostream_from_buffer(generic, sizeof(generic));
+        pb_encode(&stream, UdpPacket_fields, packet);
+        generic_len = stream.bytes_written;
+    }
+    uint32_t generic_cycles = esp_cpu_get_cycle_count() - start;
+
+    size_t fast_len = 0;
+    start = esp_cpu_get_cycle_count();
+    for (size_t r = 0; r < BENCHMARK_ROUNDS; r++) {
+        fast_len = fast_encode_packet(packet, fast, sizeof(fast));
+    }
+    uint32_t fast_cycles = esp_cpu_get_cycle_count() - start;
+
+    if (fast_len != generic_len || memcmp(fast, generic, fast_len) != 0) {
+        ESP_LOGE(TAG, "%s: fast encoder disagrees with pb_encode", name);
+    }
+    ESP_LOGI(TAG,
+             "%s (%u bytes) cycles per packet: pb_encode %lu, fast %lu",
+             name,
+             (unsigned)generic_len,
+             (unsigned long)(generic_cycles / BENCHMARK_ROUNDS),
+             (unsigned long)(fast_cycles / BENCHMARK_ROUNDS));
+}
+
+void fast_encode_benchmark()
+{
+    static UdpPacket packet;
+
+    memset(&packet, 0, sizeof(packet));
+    packet.robot_id = 0x2c54a1;
+    fill_scan(&packet);
+    benchmark_packet("LaserScan", &packet);
+
+    memset(&packet, 0, sizeof(packet));
+    packet.robot_id = 0x2c54a1;
+    fill_control(&packet);
+    benchmark_packet("JointStates + Odometry", &packet);
+}
+#endif
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "messages.pb.h"
+#include "sdkconfig.h"
+
+/*
+ * Straight line encoders for the packets sent at the highest rates: legacy
+ * float scans, and joint states with odometry from the control loop.
+ *
+ * pb_encode walks the field descriptors for every field of every message and
+ * pushes each array element through a stream callback. These know the shape
+ * of their messages up front, so they write tags as constants and copy the
+ * packed float and double arrays with one memcpy each. The output is byte for
+ * byte what pb_encode writes for the same packet.
+ */
+
+/*
+ * Encode a packet carrying only laser, joint_states and odometry (any of
+ * them) into buf. Returns the encoded length, or 0 if the packet has other
+ * fields set, breaks a nanopb limit or wouldn't fit, in which case encode it
+ * with pb_encode instead.
+ */
+size_t fast_encode_packet(const UdpPacket *packet, uint8_t *buf, size_t size);
+
+#if CONFIG_LRR_SOCKET_ENCODE_BENCHMARK
+/*
+ * Time fast_encode_packet against pb_encode on a full float scan and on a
+ * control loop packet, check they agree, and log the result.
+ */
+void fast_encode_benchmark();
+#endif
@@ -1,5 +1,9 @@
 #include "pb.h"
 
+#include <stdint.h>
+
+#include "messages.pb.h"
+
 bool encode_unionmessage(pb_ostream_t *stream,
                          const pb_msgdesc_t *messagetype,
                          void *message);
@@ -8,8 +12,14 @@ pb_ostream_t pb_ostream_from_socket(int fd);
 
 pb_istream_t pb_istream_from_socket(int fd);
 
-const pb_msgdesc_t *decode_unionmessage_type(pb_istream_t *stream);
-
 bool decode_unionmessage_contents(pb_istream_t *stream,
                                   const pb_msgdesc_t *messagetype,
                                   void *dest_struct);
+
+/*
+ * Fill in a TimeStamp for something that happened at the given esp_timer
+ * time, on the host's clock (see time_sync.h). Converting at the last moment
+ * means a clock step never gets baked into anything measured with esp_timer.
+ * Defined in time_sync.c, which leaves pb_utils.c free of the RTOS.
+ */
+void timestamp_from_esp_time(int64_t time_us, TimeStamp *stamp);
@@ -2,13 +2,98 @@
 
 #include "freertos/idf_additions.h"
 
+#include "messages.pb.h"
+
+/*
+ * Messages the host can send. Each one is the number of the UdpPacket field
+ * that carries it, which is what the RX task dispatches on, so adding a
+ * command only takes a new field in messages.proto and an entry here.
+ */
 typedef enum RX_MSG_TYPES
 {
-    eTwistCmd
+    eTwistCmd = UdpPacket_cmd_vel_tag,
+    eLidarConfig = UdpPacket_lidar_config_tag,
+    eControlConfig = UdpPacket_control_config_tag,
+    eCalibrateMotors = UdpPacket_calibrate_motors_tag,
+    eTimeSync = UdpPacket_time_sync_tag,
 } eRxMsgTypes;
 
-extern QueueHandle_t tx_queue;
+/*
+ * Outgoing traffic is split into lanes, one per producer, so each one gets
+ * its own buffer. Lanes are listed in priority order: the TX task always
+ * sends from the first one with anything waiting. When the lidar lane is
+ * full its oldest packets are dropped, the other lanes drop the new packet.
+ * Producers never block either way.
+ */
+typedef enum TX_LANES
+{
+    eTxLaneControl,
+    eTxLaneImu,
+    eTxLaneLidar,
+    eTxLaneDiagnostics,
+    eTxLaneCount
+} eTxLane;
+
+/*
+ * Counters since boot, for diagnostics. Lane usage is in bytes when
+ * CONFIG_LRR_SOCKET_PRE_ENCODE is set and in packets otherwise.
+ */
+typedef struct
+{
+    uint32_t sendto_failures;
+    uint32_t rx_decode_errors;
+    uint32_t pool_exhausted; // Producers that found no free packet
+    uint32_t lane_dropped[eTxLaneCount];
+    uint32_t lane_high_water[eTxLaneCount];
+    uint32_t lidar_shed; // Scan packets dropped on a poor link
+    uint32_t espnow_sent;
+    uint32_t espnow_received;
+    uint32_t reliable_retransmits;
+    uint32_t reliable_expired; // Given up on after too many tries
+    uint32_t reliable_duplicates;
+} socket_mgr_stats_t;
+
+/*
+ * Take an empty packet from the TX pool. The has_* flags are cleared, every
+ * other field holds whatever the last user left there. Returns NULL if the
+ * socket manager hasn't started or no packet frees up within the timeout.
+ */
+UdpPacket *socket_mgr_acquire_packet(TickType_t timeout);
 
+/*
+ * Queue a filled packet for transmission on the given lane. The packet goes
+ * back to the pool once it has been encoded, which happens right here when
+ * CONFIG_LRR_SOCKET_PRE_ENCODE is set and in the TX task otherwise.
+ */
+void socket_mgr_commit_packet(eTxLane lane, UdpPacket *packet);
+
+/*
+ * Send a packet that has to arrive, like the answer to a config change.
+ * Sensor data should be committed to a lane instead. The packet goes out
+ * straight away and again until the host acknowledges it, and back to the
+ * pool either way. Returns false if it was dropped because too many are
+ * already waiting on the host.
+ */
+bool socket_mgr_send_reliable(UdpPacket *packet);
+
+/*
+ * Return a packet to the pool without sending it.
+ */
+void socket_mgr_release_packet(UdpPacket *packet);
+
+/*
+ * Call callback from the RX task with a pointer to the decoded message each
+ * time the host sends one of the given type. The message is only valid for
+ * the duration of the call. One callback per type, the last one wins.
+ */
 void register_callback(void (*callback)(void *), eRxMsgTypes type);
 
+/*
+ * What this rover calls itself in every packet it sends. Valid once
+ * socket_mgr_init has returned.
+ */
+uint32_t socket_mgr_robot_id();
+
+void socket_mgr_get_stats(socket_mgr_stats_t *stats);
+
 void socket_mgr_init();
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Keeps track of how the host's clock lines up with esp_timer. The rover
+ * sends a TimeSync request on the control lane, the host answers with when
+ * it received and sent it, and the exchange with the shortest round trip
+ * out of the last few sets the offset. Starts with the socket manager.
+ */
+
+typedef struct
+{
+    uint32_t samples;  // Answers accepted since boot
+    uint32_t rejected; // Answers with an impossible or too long round trip
+    // Of the exchange the offset currently comes from, 0 before the first
+    uint32_t round_trip_us;
+} time_sync_stats_t;
+
+/*
+ * Convert an esp_timer time to microseconds since the epoch on the host's
+ * clock. Until the host has answered, this falls back to the SNTP
+ * synchronized wall clock. Returns false if neither is available, host_us
+ * is filled in regardless.
+ */
+bool time_sync_host_time_us(int64_t esp_us, int64_t *host_us);
+
+void time_sync_get_stats(time_sync_stats_t *stats);
+
+/*
+ * Start sampling over, for when the host changes. The current offset stays
+ * in use until the new host answers. Only call from the RX task.
+ */
+void time_sync_restart();
+
+void time_sync_init();
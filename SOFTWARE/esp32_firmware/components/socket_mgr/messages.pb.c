@@ -9,19 +9,69 @@
 PB_BIND(TimeStamp, TimeStamp, AUTO)
 
 
+PB_BIND(TimeSync, TimeSync, AUTO)
+
+
+PB_BIND(Discovery, Discovery, AUTO)
+
+
 PB_BIND(TwistCmd, TwistCmd, AUTO)
 
 
 PB_BIND(LaserScan, LaserScan, 2)
 
 
+PB_BIND(CompactLaserScan, CompactLaserScan, 2)
+
+
+PB_BIND(LidarSector, LidarSector, AUTO)
+
+
+PB_BIND(LidarConfig, LidarConfig, AUTO)
+
+
+PB_BIND(MotorModel, MotorModel, AUTO)
+
+
+PB_BIND(ControlConfig, ControlConfig, AUTO)
+
+
+PB_BIND(CalibrateMotors, CalibrateMotors, AUTO)
+
+
+PB_BIND(CommandStats, CommandStats, AUTO)
+
+
+PB_BIND(TaskUsage, TaskUsage, AUTO)
+
+
+PB_BIND(Diagnostics, Diagnostics, 2)
+
+
+PB_BIND(ImuSample, ImuSample, AUTO)
+
+
+PB_BIND(Imu, Imu, 2)
+
+
+PB_BIND(Attitude, Attitude, AUTO)
+
+
+PB_BIND(Odometry, Odometry, AUTO)
+
+
 PB_BIND(JointStates, JointStates, AUTO)
 
 
+PB_BIND(Reliable, Reliable, AUTO)
+
+
 PB_BIND(UdpPacket, UdpPacket, 2)
 
 
 
+
+
 #ifndef PB_CONVERT_DOUBLE_FLOAT
 /* On some platforms (such as AVR), double is really float.
  * To be able to encode/decode double on these platforms, you need.
@@ -9,12 +9,53 @@
 #error Regenerate this file with the current version of nanopb generator.
 #endif
 
+/* Enum definitions */
+/* How CompactLaserScan.points is laid out */
+typedef enum _PointEncoding {
+    PointEncoding_POINT_ENCODING_RAW = 0,
+    /* Each point's distance, less the one before it (0 for the first), as a
+ zigzag varint. Then every point's intensity byte, in the same order.
+ Neighbouring LD20 points are close together, so most distances fit
+ in one byte. */
+    PointEncoding_POINT_ENCODING_DELTA_VARINT = 1
+} PointEncoding;
+
+/* What the power manager is letting the CPU do (see power_mgr.h) */
+typedef enum _PowerState {
+    /* No host. The clock can drop and the chip can light sleep. */
+    PowerState_POWER_STATE_IDLE = 0,
+    /* Host connected but no motion for a while. The clock can drop. */
+    PowerState_POWER_STATE_PARKED = 1,
+    /* Full speed */
+    PowerState_POWER_STATE_DRIVING = 2
+} PowerState;
+
 /* Struct definitions */
 typedef struct _TimeStamp {
     int32_t sec;
     uint32_t nanosec;
 } TimeStamp;
 
+/* NTP style clock sync. The rover sends rover_send_us, the host answers
+ with the same message and both host times filled in, and the rover notes
+ when the answer arrives. Every TimeStamp the rover sends is then on the
+ host's clock. */
+typedef struct _TimeSync {
+    /* esp_timer time the request left the rover */
+    int64_t rover_send_us;
+    /* Host clock, ns since the epoch, when the request arrived and when the
+ answer left */
+    int64_t host_receive_ns;
+    int64_t host_send_ns;
+} TimeSync;
+
+/* Rovers broadcast this until a host answers it, and again whenever the
+ host goes quiet. The host answers with answer set, and the rover then
+ sends everything to wherever the answer came from. */
+typedef struct _Discovery {
+    bool answer;
+} Discovery;
+
 typedef struct _TwistCmd {
     bool has_time;
     TimeStamp time;
@@ -38,6 +79,254 @@ typedef struct _LaserScan {
     float intensities[120];
 } LaserScan;
 
+typedef PB_BYTES_ARRAY_T(1404) CompactLaserScan_points_t;
+typedef PB_BYTES_ARRAY_T(64) CompactLaserScan_kept_t;
+/* Same data as LaserScan, but points stay in the LD20's native format. */
+typedef struct _CompactLaserScan {
+    /* When the first point was measured, from the LD20's own clock */
+    bool has_time;
+    TimeStamp time;
+    /* Hundredths of a degree. end_angle is unwrapped, so it can go past 36000. */
+    uint32_t start_angle;
+    uint32_t end_angle;
+    /* Degrees per second */
+    uint32_t speed;
+    /* Laid out as encoding says. Raw is 3 bytes per point: distance in mm
+ (uint16, little endian), intensity. */
+    CompactLaserScan_points_t points;
+    /* Counts up once per revolution */
+    uint32_t scan_id;
+    /* Index of this packet within the revolution */
+    uint32_t fragment;
+    /* Set on the last fragment of a revolution */
+    bool end_of_scan;
+    /* Seconds between points */
+    float time_increment;
+    /* Set when the firmware filtered points out (see LidarConfig). One bit
+ per point swept between start_angle and end_angle, lowest bit first,
+ set for the ones in points. */
+    CompactLaserScan_kept_t kept;
+    uint32_t swept_points;
+    PointEncoding encoding;
+    /* Points in points, only set when they're encoded */
+    uint32_t point_count;
+} CompactLaserScan;
+
+/* A slice of the revolution to thin out. Filtering only saves bandwidth in
+ the compact format, the float format sends dropped points as 0 range. */
+typedef struct _LidarSector {
+    /* Whole degrees, running from start up to end. end may be below start
+ to cover 0, and equal to it for the whole revolution. */
+    uint32_t start_deg;
+    uint32_t end_deg;
+    /* Send one point in this many, 0 drops the sector altogether */
+    uint32_t keep_every;
+} LidarSector;
+
+/* Sent by the host to change how scans are taken and split up */
+typedef struct _LidarConfig {
+    /* Points per datagram, rounded down to whole LD20 frames. 0 sends as much
+ of each revolution as fits in one datagram. Left out, the rover keeps
+ CONFIG_LRR_LIDAR_POINTS_PER_PACKET. */
+    bool has_points_per_packet;
+    uint32_t points_per_packet;
+    /* Revolutions per second, held with the LD20's PWM input. 0 runs the
+ motor flat out. */
+    float scan_hz;
+    /* Points nearer or further than these are dropped, 0 turns either off */
+    uint32_t min_range_mm;
+    uint32_t max_range_mm;
+    /* Points weaker than this are dropped */
+    uint32_t min_intensity;
+    /* Angles outside every sector are sent in full. Later sectors win where
+ they overlap. */
+    pb_size_t sectors_count;
+    LidarSector sectors[8];
+    /* How CompactLaserScan.points should be encoded */
+    PointEncoding encoding;
+} LidarConfig;
+
+/* Feedforward for one motor: the effort to hold a velocity is ks plus kv
+ per rad/s */
+typedef struct _MotorModel {
+    float ks;
+    float kv;
+} MotorModel;
+
+/* Velocity loop tuning. The host sends one to change the active values, the
+ firmware answers every one with what is in use afterwards. */
+typedef struct _ControlConfig {
+    /* Only report the active values, ignore everything else */
+    bool query;
+    /* Keep the new values across reboots */
+    bool save;
+    /* Effort per rad/s of error, effort per rad of accumulated error and
+ effort per rad/s^2 of error change */
+    float kp;
+    float ki;
+    float kd;
+    /* Most effort the integral term may contribute */
+    float integral_limit;
+    /* Most the applied effort may change per second */
+    float max_jerk;
+    /* Efforts smaller than this can't overcome static friction and are
+ dropped */
+    float hysteresis;
+    /* Fixed at build time, read only */
+    uint32_t loop_hz;
+    /* Left then right. Leave empty to keep the current ones. */
+    pb_size_t models_count;
+    MotorModel models[2];
+} ControlConfig;
+
+/* Sent by the host to fit both motor models. The wheels spin on their own
+ for about seven seconds, so lift them off the ground first. Answered with
+ a ControlConfig once done. */
+typedef struct _CalibrateMotors {
+    /* Keep the fitted models across reboots */
+    bool save;
+} CalibrateMotors;
+
+/* What happened to cmd_vel since the last report, sent once a second */
+typedef struct _CommandStats {
+    /* Commands by age on arrival in milliseconds: under 2, 5, 10, 20, 50,
+ 100, 200, and everything older */
+    pb_size_t age_histogram_count;
+    uint32_t age_histogram[8];
+    /* Commands whose age couldn't be measured, because they weren't stamped
+ or the clocks don't agree */
+    uint32_t unstamped;
+    /* Commands too old to act on */
+    uint32_t rejected;
+    /* Times the drive base ramped down because commands stopped coming */
+    uint32_t timeouts;
+} CommandStats;
+
+typedef struct _TaskUsage {
+    char name[16];
+    /* -1 if the task can run on either core */
+    int32_t core;
+    uint32_t priority;
+    /* Share of one core since the last report */
+    float cpu_percent;
+    /* Least stack ever left, in bytes */
+    uint32_t stack_free;
+} TaskUsage;
+
+/* Health of the whole firmware, sent periodically on the lowest priority
+ lane. Counters are totals since boot, so a lost report loses nothing. */
+typedef struct _Diagnostics {
+    uint32_t uptime_ms;
+    /* Comms. Lanes are control, IMU, lidar, diagnostics. */
+    uint32_t sendto_failures;
+    uint32_t rx_decode_errors;
+    uint32_t tx_pool_exhausted;
+    pb_size_t lane_dropped_count;
+    uint32_t lane_dropped[4];
+    pb_size_t lane_high_water_count;
+    uint32_t lane_high_water[4];
+    /* Lidar */
+    uint32_t lidar_frames;
+    uint32_t lidar_crc_errors;
+    uint32_t lidar_resyncs;
+    uint32_t lidar_uart_overflows;
+    /* Control loop. Worst jitter is since the last report. */
+    uint32_t control_loops;
+    uint32_t control_overruns;
+    uint32_t control_max_jitter_us;
+    /* Memory, in bytes */
+    uint32_t free_heap;
+    uint32_t min_free_heap;
+    /* Empty unless FreeRTOS run time stats are enabled */
+    pb_size_t tasks_count;
+    TaskUsage tasks[24];
+    /* IMU */
+    uint32_t imu_samples;
+    uint32_t imu_fifo_overruns;
+    uint32_t imu_dropped_batches;
+    uint32_t imu_i2c_errors;
+    /* Clock sync with the host */
+    uint32_t time_sync_samples;
+    uint32_t time_sync_rejected;
+    /* Of the exchange the offset currently comes from */
+    uint32_t time_sync_round_trip_us;
+    /* Wi-Fi. RSSI is smoothed, in dBm. */
+    int32_t wifi_rssi;
+    uint32_t wifi_reconnects;
+    uint32_t wifi_poor_link_events;
+    /* Scan packets dropped while the link was poor */
+    uint32_t lidar_shed;
+    /* Datagrams through the ESP-NOW dongle, each way */
+    uint32_t espnow_sent;
+    uint32_t espnow_received;
+    /* Reliable packets sent again, given up on, and received more than once */
+    uint32_t reliable_retransmits;
+    uint32_t reliable_expired;
+    uint32_t reliable_duplicates;
+    /* Power. Time in each state is since boot, indexed by PowerState. */
+    PowerState power_state;
+    uint32_t cpu_freq_mhz;
+    pb_size_t power_state_ms_count;
+    uint32_t power_state_ms[3];
+} Diagnostics;
+
+/* One reading in the LSM6DS3's raw counts */
+typedef struct _ImuSample {
+    /* Microseconds after Imu.time */
+    uint32_t time_offset_us;
+    int32_t gyro_x;
+    int32_t gyro_y;
+    int32_t gyro_z;
+    int32_t accel_x;
+    int32_t accel_y;
+    int32_t accel_z;
+} ImuSample;
+
+/* A batch of samples drained from the IMU's FIFO, oldest first */
+typedef struct _Imu {
+    /* When the first sample was taken */
+    bool has_time;
+    TimeStamp time;
+    /* rad/s and m/s^2 per count */
+    float gyro_scale;
+    float accel_scale;
+    pb_size_t samples_count;
+    ImuSample samples[32];
+} Imu;
+
+/* On-board orientation estimate, sent along with each IMU batch */
+typedef struct _Attitude {
+    /* When the newest sample in the batch was taken */
+    bool has_time;
+    TimeStamp time;
+    /* rad, about the fixed x, y and z axes in that order */
+    float roll;
+    float pitch;
+    float yaw;
+    /* rad/s, with the estimated gyro bias removed */
+    float yaw_rate;
+    float gyro_bias_z;
+} Attitude;
+
+/* Wheel odometry, integrated on board at the control loop rate */
+typedef struct _Odometry {
+    bool has_time;
+    TimeStamp time;
+    /* Pose in the odom frame, m and rad */
+    float x;
+    float y;
+    float yaw;
+    /* Body velocity, m/s and rad/s */
+    float v;
+    float w;
+    /* Row major, over x, y and yaw */
+    pb_size_t pose_covariance_count;
+    float pose_covariance[9];
+    /* Row major, over v and w */
+    pb_size_t twist_covariance_count;
+    float twist_covariance[4];
+} Odometry;
+
 typedef struct _JointStates {
     bool has_time;
     TimeStamp time;
@@ -51,6 +340,27 @@ typedef struct _JointStates {
     double effort[2];
 } JointStates;
 
+/* Header on packets that have to arrive: configuration, commands and the
+ answers to them. Everything else is fire and forget. The receiver handles
+ each sender's packets once and in order, and acknowledges every one it
+ gets, repeats included. The sender keeps sending whatever hasn't been
+ acknowledged, a few packets at most, until it is or it's given up on. */
+typedef struct _Reliable {
+    /* Picked at random when the sender starts, so a restart isn't taken for
+ repeats */
+    uint32_t session;
+    /* Counts up from 1 for each packet sent reliably. 0 on a packet that
+ only acknowledges. */
+    uint32_t seq;
+    /* Oldest packet the sender is still sending. Everything before it was
+ acknowledged or given up on, so the receiver stops waiting for it. */
+    uint32_t base;
+    /* The other side's session, and the newest of its packets to arrive
+ with everything before it. Both 0 until one has. */
+    uint32_t ack_session;
+    uint32_t ack;
+} Reliable;
+
 typedef struct _UdpPacket {
     bool has_laser;
     LaserScan laser;
@@ -58,6 +368,33 @@ typedef struct _UdpPacket {
     JointStates joint_states;
     bool has_cmd_vel;
     TwistCmd cmd_vel;
+    bool has_compact_laser;
+    CompactLaserScan compact_laser;
+    bool has_lidar_config;
+    LidarConfig lidar_config;
+    bool has_command_stats;
+    CommandStats command_stats;
+    bool has_diagnostics;
+    Diagnostics diagnostics;
+    bool has_imu;
+    Imu imu;
+    bool has_attitude;
+    Attitude attitude;
+    bool has_odometry;
+    Odometry odometry;
+    bool has_control_config;
+    ControlConfig control_config;
+    bool has_calibrate_motors;
+    CalibrateMotors calibrate_motors;
+    bool has_time_sync;
+    TimeSync time_sync;
+    /* Which rover sent this, so one host can serve several. On a batch it's
+ set on the datagram as well as every packet in it. */
+    uint32_t robot_id;
+    bool has_discovery;
+    Discovery discovery;
+    bool has_reliable;
+    Reliable reliable;
 } UdpPacket;
 
 
@@ -65,21 +402,91 @@ typedef struct _UdpPacket {
 extern "C" {
 #endif
 
+/* Helper constants for enums */
+#define _PointEncoding_MIN PointEncoding_POINT_ENCODING_RAW
+#define _PointEncoding_MAX PointEncoding_POINT_ENCODING_DELTA_VARINT
+#define _PointEncoding_ARRAYSIZE ((PointEncoding)(PointEncoding_POINT_ENCODING_DELTA_VARINT+1))
+
+#define _PowerState_MIN PowerState_POWER_STATE_IDLE
+#define _PowerState_MAX PowerState_POWER_STATE_DRIVING
+#define _PowerState_ARRAYSIZE ((PowerState)(PowerState_POWER_STATE_DRIVING+1))
+
+
+
+
+
+
+#define CompactLaserScan_encoding_ENUMTYPE PointEncoding
+
+
+#define LidarConfig_encoding_ENUMTYPE PointEncoding
+
+
+
+
+
+
+#define Diagnostics_power_state_ENUMTYPE PowerState
+
+
+
+
+
+
+
+
+
 /* Initializer values for message structs */
 #define TimeStamp_init_default                   {0, 0}
+#define TimeSync_init_default                    {0, 0, 0}
+#define Discovery_init_default                   {0}
 #define TwistCmd_init_default                    {false, TimeStamp_init_default, 0, 0}
 #define LaserScan_init_default                   {false, TimeStamp_init_default, 0, 0, 0, 0, 0, 0, 0, 0, {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}, 0, {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}}
+#define CompactLaserScan_init_default            {false, TimeStamp_init_default, 0, 0, 0, {0, {0}}, 0, 0, 0, 0, {0, {0}}, 0, _PointEncoding_MIN, 0}
+#define LidarSector_init_default                 {0, 0, 0}
+#define LidarConfig_init_default                 {false, 0, 0, 0, 0, 0, 0, {LidarSector_init_default, LidarSector_init_default, LidarSector_init_default, LidarSector_init_default, LidarSector_init_default, LidarSector_init_default, LidarSector_init_default, LidarSector_init_default}, _PointEncoding_MIN}
+#define MotorModel_init_default                  {0, 0}
+#define ControlConfig_init_default               {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, {MotorModel_init_default, MotorModel_init_default}}
+#define CalibrateMotors_init_default             {0}
+#define CommandStats_init_default                {0, {0, 0, 0, 0, 0, 0, 0, 0}, 0, 0, 0}
+#define TaskUsage_init_default                   {"", 0, 0, 0, 0}
+#define Diagnostics_init_default                 {0, 0, 0, 0, 0, {0, 0, 0, 0}, 0, {0, 0, 0, 0}, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, {TaskUsage_init_default, TaskUsage_init_default, TaskUsage_init_default, TaskUsage_init_default, TaskUsage_init_default, TaskUsage_init_default, TaskUsage_init_default, TaskUsage_init_default, TaskUsage_init_default, TaskUsage_init_default, TaskUsage_init_default, TaskUsage_init_default, TaskUsage_init_default, TaskUsage_init_default, TaskUsage_init_default, TaskUsage_init_default, TaskUsage_init_default, TaskUsage_init_default, TaskUsage_init_default, TaskUsage_init_default, TaskUsage_init_default, TaskUsage_init_default, TaskUsage_init_default, TaskUsage_init_default}, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, _PowerState_MIN, 0, 0, {0, 0, 0}}
+#define ImuSample_init_default                   {0, 0, 0, 0, 0, 0, 0}
+#define Imu_init_default                         {false, TimeStamp_init_default, 0, 0, 0, {ImuSample_init_default, ImuSample_init_default, ImuSample_init_default, ImuSample_init_default, ImuSample_init_default, ImuSample_init_default, ImuSample_init_default, ImuSample_init_default, ImuSample_init_default, ImuSample_init_default, ImuSample_init_default, ImuSample_init_default, ImuSample_init_default, ImuSample_init_default, ImuSample_init_default, ImuSample_init_default, ImuSample_init_default, ImuSample_init_default, ImuSample_init_default, ImuSample_init_default, ImuSample_init_default, ImuSample_init_default, ImuSample_init_default, ImuSample_init_default, ImuSample_init_default, ImuSample_init_default, ImuSample_init_default, ImuSample_init_default, ImuSample_init_default, ImuSample_init_default, ImuSample_init_default, ImuSample_init_default}}
+#define Attitude_init_default                    {false, TimeStamp_init_default, 0, 0, 0, 0, 0}
+#define Odometry_init_default                    {false, TimeStamp_init_default, 0, 0, 0, 0, 0, 0, {0, 0, 0, 0, 0, 0, 0, 0, 0}, 0, {0, 0, 0, 0}}
 #define JointStates_init_default                 {false, TimeStamp_init_default, 0, {"", ""}, 0, {0, 0}, 0, {0, 0}, 0, {0, 0}}
-#define UdpPacket_init_default                   {false, LaserScan_init_default, false, JointStates_init_default, false, TwistCmd_init_default}
+#define Reliable_init_default                    {0, 0, 0, 0, 0}
+#define UdpPacket_init_default                   {false, LaserScan_init_default, false, JointStates_init_default, false, TwistCmd_init_default, false, CompactLaserScan_init_default, false, LidarConfig_init_default, false, CommandStats_init_default, false, Diagnostics_init_default, false, Imu_init_default, false, Attitude_init_default, false, Odometry_init_default, false, ControlConfig_init_default, false, CalibrateMotors_init_default, false, TimeSync_init_default, 0, false, Discovery_init_default, false, Reliable_init_default}
 #define TimeStamp_init_zero                      {0, 0}
+#define TimeSync_init_zero                       {0, 0, 0}
+#define Discovery_init_zero                      {0}
 #define TwistCmd_init_zero                       {false, TimeStamp_init_zero, 0, 0}
 #define LaserScan_init_zero                      {false, TimeStamp_init_zero, 0, 0, 0, 0, 0, 0, 0, 0, {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}, 0, {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}}
+#define CompactLaserScan_init_zero               {false, TimeStamp_init_zero, 0, 0, 0, {0, {0}}, 0, 0, 0, 0, {0, {0}}, 0, _PointEncoding_MIN, 0}
+#define LidarSector_init_zero                    {0, 0, 0}
+#define LidarConfig_init_zero                    {false, 0, 0, 0, 0, 0, 0, {LidarSector_init_zero, LidarSector_init_zero, LidarSector_init_zero, LidarSector_init_zero, LidarSector_init_zero, LidarSector_init_zero, LidarSector_init_zero, LidarSector_init_zero}, _PointEncoding_MIN}
+#define MotorModel_init_zero                     {0, 0}
+#define ControlConfig_init_zero                  {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, {MotorModel_init_zero, MotorModel_init_zero}}
+#define CalibrateMotors_init_zero                {0}
+#define CommandStats_init_zero                   {0, {0, 0, 0, 0, 0, 0, 0, 0}, 0, 0, 0}
+#define TaskUsage_init_zero                      {"", 0, 0, 0, 0}
+#define Diagnostics_init_zero                    {0, 0, 0, 0, 0, {0, 0, 0, 0}, 0, {0, 0, 0, 0}, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, {TaskUsage_init_zero, TaskUsage_init_zero, TaskUsage_init_zero, TaskUsage_init_zero, TaskUsage_init_zero, TaskUsage_init_zero, TaskUsage_init_zero, TaskUsage_init_zero, TaskUsage_init_zero, TaskUsage_init_zero, TaskUsage_init_zero, TaskUsage_init_zero, TaskUsage_init_zero, TaskUsage_init_zero, TaskUsage_init_zero, TaskUsage_init_zero, TaskUsage_init_zero, TaskUsage_init_zero, TaskUsage_init_zero, TaskUsage_init_zero, TaskUsage_init_zero, TaskUsage_init_zero, TaskUsage_init_zero, TaskUsage_init_zero}, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, _PowerState_MIN, 0, 0, {0, 0, 0}}
+#define ImuSample_init_zero                      {0, 0, 0, 0, 0, 0, 0}
+#define Imu_init_zero                            {false, TimeStamp_init_zero, 0, 0, 0, {ImuSample_init_zero, ImuSample_init_zero, ImuSample_init_zero, ImuSample_init_zero, ImuSample_init_zero, ImuSample_init_zero, ImuSample_init_zero, ImuSample_init_zero, ImuSample_init_zero, ImuSample_init_zero, ImuSample_init_zero, ImuSample_init_zero, ImuSample_init_zero, ImuSample_init_zero, ImuSample_init_zero, ImuSample_init_zero, ImuSample_init_zero, ImuSample_init_zero, ImuSample_init_zero, ImuSample_init_zero, ImuSample_init_zero, ImuSample_init_zero, ImuSample_init_zero, ImuSample_init_zero, ImuSample_init_zero, ImuSample_init_zero, ImuSample_init_zero, ImuSample_init_zero, ImuSample_init_zero, ImuSample_init_zero, ImuSample_init_zero, ImuSample_init_zero}}
+#define Attitude_init_zero                       {false, TimeStamp_init_zero, 0, 0, 0, 0, 0}
+#define Odometry_init_zero                       {false, TimeStamp_init_zero, 0, 0, 0, 0, 0, 0, {0, 0, 0, 0, 0, 0, 0, 0, 0}, 0, {0, 0, 0, 0}}
 #define JointStates_init_zero                    {false, TimeStamp_init_zero, 0, {"", ""}, 0, {0, 0}, 0, {0, 0}, 0, {0, 0}}
-#define UdpPacket_init_zero                      {false, LaserScan_init_zero, false, JointStates_init_zero, false, TwistCmd_init_zero}
+#define Reliable_init_zero                       {0, 0, 0, 0, 0}
+#define UdpPacket_init_zero                      {false, LaserScan_init_zero, false, JointStates_init_zero, false, TwistCmd_init_zero, false, CompactLaserScan_init_zero, false, LidarConfig_init_zero, false, CommandStats_init_zero, false, Diagnostics_init_zero, false, Imu_init_zero, false, Attitude_init_zero, false, Odometry_init_zero, false, ControlConfig_init_zero, false, CalibrateMotors_init_zero, false, TimeSync_init_zero, 0, false, Discovery_init_zero, false, Reliable_init_zero}
 
 /* Field tags (for use in manual encoding/decoding) */
 #define TimeStamp_sec_tag                        1
 #define TimeStamp_nanosec_tag                    2
+#define TimeSync_rover_send_us_tag               1
+#define TimeSync_host_receive_ns_tag             2
+#define TimeSync_host_send_ns_tag                3
+#define Discovery_answer_tag                     1
 #define TwistCmd_time_tag                        1
 #define TwistCmd_v_tag                           2
 #define TwistCmd_w_tag                           3
@@ -93,14 +500,137 @@ extern "C" {
 #define LaserScan_range_max_tag                  8
 #define LaserScan_ranges_tag                     9
 #define LaserScan_intensities_tag                10
+#define CompactLaserScan_time_tag                1
+#define CompactLaserScan_start_angle_tag         2
+#define CompactLaserScan_end_angle_tag           3
+#define CompactLaserScan_speed_tag               4
+#define CompactLaserScan_points_tag              5
+#define CompactLaserScan_scan_id_tag             6
+#define CompactLaserScan_fragment_tag            7
+#define CompactLaserScan_end_of_scan_tag         8
+#define CompactLaserScan_time_increment_tag      9
+#define CompactLaserScan_kept_tag                10
+#define CompactLaserScan_swept_points_tag        11
+#define CompactLaserScan_encoding_tag            12
+#define CompactLaserScan_point_count_tag         13
+#define LidarSector_start_deg_tag                1
+#define LidarSector_end_deg_tag                  2
+#define LidarSector_keep_every_tag               3
+#define LidarConfig_points_per_packet_tag        1
+#define LidarConfig_scan_hz_tag                  2
+#define LidarConfig_min_range_mm_tag             3
+#define LidarConfig_max_range_mm_tag             4
+#define LidarConfig_min_intensity_tag            5
+#define LidarConfig_sectors_tag                  6
+#define LidarConfig_encoding_tag                 7
+#define MotorModel_ks_tag                        1
+#define MotorModel_kv_tag                        2
+#define ControlConfig_query_tag                  1
+#define ControlConfig_save_tag                   2
+#define ControlConfig_kp_tag                     3
+#define ControlConfig_ki_tag                     4
+#define ControlConfig_kd_tag                     5
+#define ControlConfig_integral_limit_tag         6
+#define ControlConfig_max_jerk_tag               7
+#define ControlConfig_hysteresis_tag             8
+#define ControlConfig_loop_hz_tag                9
+#define ControlConfig_models_tag                 10
+#define CalibrateMotors_save_tag                 1
+#define CommandStats_age_histogram_tag           1
+#define CommandStats_unstamped_tag               2
+#define CommandStats_rejected_tag                3
+#define CommandStats_timeouts_tag                4
+#define TaskUsage_name_tag                       1
+#define TaskUsage_core_tag                       2
+#define TaskUsage_priority_tag                   3
+#define TaskUsage_cpu_percent_tag                4
+#define TaskUsage_stack_free_tag                 5
+#define Diagnostics_uptime_ms_tag                1
+#define Diagnostics_sendto_failures_tag          2
+#define Diagnostics_rx_decode_errors_tag         3
+#define Diagnostics_tx_pool_exhausted_tag        4
+#define Diagnostics_lane_dropped_tag             5
+#define Diagnostics_lane_high_water_tag          6
+#define Diagnostics_lidar_frames_tag             7
+#define Diagnostics_lidar_crc_errors_tag         8
+#define Diagnostics_lidar_resyncs_tag            9
+#define Diagnostics_lidar_uart_overflows_tag     10
+#define Diagnostics_control_loops_tag            11
+#define Diagnostics_control_overruns_tag         12
+#define Diagnostics_control_max_jitter_us_tag    13
+#define Diagnostics_free_heap_tag                14
+#define Diagnostics_min_free_heap_tag            15
+#define Diagnostics_tasks_tag                    16
+#define Diagnostics_imu_samples_tag              17
+#define Diagnostics_imu_fifo_overruns_tag        18
+#define Diagnostics_imu_dropped_batches_tag      19
+#define Diagnostics_imu_i2c_errors_tag           20
+#define Diagnostics_time_sync_samples_tag        21
+#define Diagnostics_time_sync_rejected_tag       22
+#define Diagnostics_time_sync_round_trip_us_tag  23
+#define Diagnostics_wifi_rssi_tag                24
+#define Diagnostics_wifi_reconnects_tag          25
+#define Diagnostics_wifi_poor_link_events_tag    26
+#define Diagnostics_lidar_shed_tag               27
+#define Diagnostics_espnow_sent_tag              28
+#define Diagnostics_espnow_received_tag          29
+#define Diagnostics_reliable_retransmits_tag     30
+#define Diagnostics_reliable_expired_tag         31
+#define Diagnostics_reliable_duplicates_tag      32
+#define Diagnostics_power_state_tag              33
+#define Diagnostics_cpu_freq_mhz_tag             34
+#define Diagnostics_power_state_ms_tag           35
+#define ImuSample_time_offset_us_tag             1
+#define ImuSample_gyro_x_tag                     2
+#define ImuSample_gyro_y_tag                     3
+#define ImuSample_gyro_z_tag                     4
+#define ImuSample_accel_x_tag                    5
+#define ImuSample_accel_y_tag                    6
+#define ImuSample_accel_z_tag                    7
+#define Imu_time_tag                             1
+#define Imu_gyro_scale_tag                       2
+#define Imu_accel_scale_tag                      3
+#define Imu_samples_tag                          4
+#define Attitude_time_tag                        1
+#define Attitude_roll_tag                        2
+#define Attitude_pitch_tag                       3
+#define Attitude_yaw_tag                         4
+#define Attitude_yaw_rate_tag                    5
+#define Attitude_gyro_bias_z_tag                 6
+#define Odometry_time_tag                        1
+#define Odometry_x_tag                           2
+#define Odometry_y_tag                           3
+#define Odometry_yaw_tag                         4
+#define Odometry_v_tag                           5
+#define Odometry_w_tag                           6
+#define Odometry_pose_covariance_tag             7
+#define Odometry_twist_covariance_tag            8
 #define JointStates_time_tag                     1
 #define JointStates_name_tag                     2
 #define JointStates_position_tag                 3
 #define JointStates_velocity_tag                 4
 #define JointStates_effort_tag                   5
+#define Reliable_session_tag                     1
+#define Reliable_seq_tag                         2
+#define Reliable_base_tag                        3
+#define Reliable_ack_session_tag                 4
+#define Reliable_ack_tag                         5
 #define UdpPacket_laser_tag                      1
 #define UdpPacket_joint_states_tag               2
 #define UdpPacket_cmd_vel_tag                    3
+#define UdpPacket_compact_laser_tag              4
+#define UdpPacket_lidar_config_tag               5
+#define UdpPacket_command_stats_tag              6
+#define UdpPacket_diagnostics_tag                7
+#define UdpPacket_imu_tag                        8
+#define UdpPacket_attitude_tag                   9
+#define UdpPacket_odometry_tag                   10
+#define UdpPacket_control_config_tag             11
+#define UdpPacket_calibrate_motors_tag           12
+#define UdpPacket_time_sync_tag                  13
+#define UdpPacket_robot_id_tag                   14
+#define UdpPacket_discovery_tag                  16
+#define UdpPacket_reliable_tag                   17
 
 /* Struct field encoding specification for nanopb */
 #define TimeStamp_FIELDLIST(X, a) \
@@ -109,6 +639,18 @@ X(a, STATIC,   SINGULAR, UINT32,   nanosec,           2)
 #define TimeStamp_CALLBACK NULL
 #define TimeStamp_DEFAULT NULL
 
+#define TimeSync_FIELDLIST(X, a) \
+X(a, STATIC,   SINGULAR, INT64,    rover_send_us,     1) \
+X(a, STATIC,   SINGULAR, INT64,    host_receive_ns,   2) \
+X(a, STATIC,   SINGULAR, INT64,    host_send_ns,      3)
+#define TimeSync_CALLBACK NULL
+#define TimeSync_DEFAULT NULL
+
+#define Discovery_FIELDLIST(X, a) \
+X(a, STATIC,   SINGULAR, BOOL,     answer,            1)
+#define Discovery_CALLBACK NULL
+#define Discovery_DEFAULT NULL
+
 #define TwistCmd_FIELDLIST(X, a) \
 X(a, STATIC,   OPTIONAL, MESSAGE,  time,              1) \
 X(a, STATIC,   SINGULAR, FLOAT,    v,                 2) \
@@ -132,6 +674,171 @@ X(a, STATIC,   REPEATED, FLOAT,    intensities,      10)
 #define LaserScan_DEFAULT NULL
 #define LaserScan_time_MSGTYPE TimeStamp
 
+#define CompactLaserScan_FIELDLIST(X, a) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  time,              1) \
+X(a, STATIC,   SINGULAR, UINT32,   start_angle,       2) \
+X(a, STATIC,   SINGULAR, UINT32,   end_angle,         3) \
+X(a, STATIC,   SINGULAR, UINT32,   speed,             4) \
+X(a, STATIC,   SINGULAR, BYTES,    points,            5) \
+X(a, STATIC,   SINGULAR, UINT32,   scan_id,           6) \
+X(a, STATIC,   SINGULAR, UINT32,   fragment,          7) \
+X(a, STATIC,   SINGULAR, BOOL,     end_of_scan,       8) \
+X(a, STATIC,   SINGULAR, FLOAT,    time_increment,    9) \
+X(a, STATIC,   SINGULAR, BYTES,    kept,             10) \
+X(a, STATIC,   SINGULAR, UINT32,   swept_points,     11) \
+X(a, STATIC,   SINGULAR, UENUM,    encoding,         12) \
+X(a, STATIC,   SINGULAR, UINT32,   point_count,      13)
+#define CompactLaserScan_CALLBACK NULL
+#define CompactLaserScan_DEFAULT NULL
+#define CompactLaserScan_time_MSGTYPE TimeStamp
+
+#define LidarSector_FIELDLIST(X, a) \
+X(a, STATIC,   SINGULAR, UINT32,   start_deg,         1) \
+X(a, STATIC,   SINGULAR, UINT32,   end_deg,           2) \
+X(a, STATIC,   SINGULAR, UINT32,   keep_every,        3)
+#define LidarSector_CALLBACK NULL
+#define LidarSector_DEFAULT NULL
+
+#define LidarConfig_FIELDLIST(X, a) \
+X(a, STATIC,   OPTIONAL, UINT32,   points_per_packet,   1) \
+X(a, STATIC,   SINGULAR, FLOAT,    scan_hz,           2) \
+X(a, STATIC,   SINGULAR, UINT32,   min_range_mm,      3) \
+X(a, STATIC,   SINGULAR, UINT32,   max_range_mm,      4) \
+X(a, STATIC,   SINGULAR, UINT32,   min_intensity,     5) \
+X(a, STATIC,   REPEATED, MESSAGE,  sectors,           6) \
+X(a, STATIC,   SINGULAR, UENUM,    encoding,          7)
+#define LidarConfig_CALLBACK NULL
+#define LidarConfig_DEFAULT NULL
+#define LidarConfig_sectors_MSGTYPE LidarSector
+
+#define MotorModel_FIELDLIST(X, a) \
+X(a, STATIC,   SINGULAR, FLOAT,    ks,                1) \
+X(a, STATIC,   SINGULAR, FLOAT,    kv,                2)
+#define MotorModel_CALLBACK NULL
+#define MotorModel_DEFAULT NULL
+
+#define ControlConfig_FIELDLIST(X, a) \
+X(a, STATIC,   SINGULAR, BOOL,     query,             1) \
+X(a, STATIC,   SINGULAR, BOOL,     save,              2) \
+X(a, STATIC,   SINGULAR, FLOAT,    kp,                3) \
+X(a, STATIC,   SINGULAR, FLOAT,    ki,                4) \
+X(a, STATIC,   SINGULAR, FLOAT,    kd,                5) \
+X(a, STATIC,   SINGULAR, FLOAT,    integral_limit,    6) \
+X(a, STATIC,   SINGULAR, FLOAT,    max_jerk,          7) \
+X(a, STATIC,   SINGULAR, FLOAT,    hysteresis,        8) \
+X(a, STATIC,   SINGULAR, UINT32,   loop_hz,           9) \
+X(a, STATIC,   REPEATED, MESSAGE,  models,           10)
+#define ControlConfig_CALLBACK NULL
+#define ControlConfig_DEFAULT NULL
+#define ControlConfig_models_MSGTYPE MotorModel
+
+#define CalibrateMotors_FIELDLIST(X, a) \
+X(a, STATIC,   SINGULAR, BOOL,     save,              1)
+#define CalibrateMotors_CALLBACK NULL
+#define CalibrateMotors_DEFAULT NULL
+
+#define CommandStats_FIELDLIST(X, a) \
+X(a, STATIC,   REPEATED, UINT32,   age_histogram,     1) \
+X(a, STATIC,   SINGULAR, UINT32,   unstamped,         2) \
+X(a, STATIC,   SINGULAR, UINT32,   rejected,          3) \
+X(a, STATIC,   SINGULAR, UINT32,   timeouts,          4)
+#define CommandStats_CALLBACK NULL
+#define CommandStats_DEFAULT NULL
+
+#define TaskUsage_FIELDLIST(X, a) \
+X(a, STATIC,   SINGULAR, STRING,   name,              1) \
+X(a, STATIC,   SINGULAR, SINT32,   core,              2) \
+X(a, STATIC,   SINGULAR, UINT32,   priority,          3) \
+X(a, STATIC,   SINGULAR, FLOAT,    cpu_percent,       4) \
+X(a, STATIC,   SINGULAR, UINT32,   stack_free,        5)
+#define TaskUsage_CALLBACK NULL
+#define TaskUsage_DEFAULT NULL
+
+#define Diagnostics_FIELDLIST(X, a) \
+X(a, STATIC,   SINGULAR, UINT32,   uptime_ms,         1) \
+X(a, STATIC,   SINGULAR, UINT32,   sendto_failures,   2) \
+X(a, STATIC,   SINGULAR, UINT32,   rx_decode_errors,   3) \
+X(a, STATIC,   SINGULAR, UINT32,   tx_pool_exhausted,   4) \
+X(a, STATIC,   REPEATED, UINT32,   lane_dropped,      5) \
+X(a, STATIC,   REPEATED, UINT32,   lane_high_water,   6) \
+X(a, STATIC,   SINGULAR, UINT32,   lidar_frames,      7) \
+X(a, STATIC,   SINGULAR, UINT32,   lidar_crc_errors,   8) \
+X(a, STATIC,   SINGULAR, UINT32,   lidar_resyncs,     9) \
+X(a, STATIC,   SINGULAR, UINT32,   lidar_uart_overflows,  10) \
+X(a, STATIC,   SINGULAR, UINT32,   control_loops,    11) \
+X(a, STATIC,   SINGULAR, UINT32,   control_overruns,  12) \
+X(a, STATIC,   SINGULAR, UINT32,   control_max_jitter_us,  13) \
+X(a, STATIC,   SINGULAR, UINT32,   free_heap,        14) \
+X(a, STATIC,   SINGULAR, UINT32,   min_free_heap,    15) \
+X(a, STATIC,   REPEATED, MESSAGE,  tasks,            16) \
+X(a, STATIC,   SINGULAR, UINT32,   imu_samples,      17) \
+X(a, STATIC,   SINGULAR, UINT32,   imu_fifo_overruns,  18) \
+X(a, STATIC,   SINGULAR, UINT32,   imu_dropped_batches,  19) \
+X(a, STATIC,   SINGULAR, UINT32,   imu_i2c_errors,   20) \
+X(a, STATIC,   SINGULAR, UINT32,   time_sync_samples,  21) \
+X(a, STATIC,   SINGULAR, UINT32,   time_sync_rejected,  22) \
+X(a, STATIC,   SINGULAR, UINT32,   time_sync_round_trip_us,  23) \
+X(a, STATIC,   SINGULAR, SINT32,   wifi_rssi,        24) \
+X(a, STATIC,   SINGULAR, UINT32,   wifi_reconnects,  25) \
+X(a, STATIC,   SINGULAR, UINT32,   wifi_poor_link_events,  26) \
+X(a, STATIC,   SINGULAR, UINT32,   lidar_shed,       27) \
+X(a, STATIC,   SINGULAR, UINT32,   espnow_sent,      28) \
+X(a, STATIC,   SINGULAR, UINT32,   espnow_received,  29) \
+X(a, STATIC,   SINGULAR, UINT32,   reliable_retransmits,  30) \
+X(a, STATIC,   SINGULAR, UINT32,   reliable_expired,  31) \
+X(a, STATIC,   SINGULAR, UINT32,   reliable_duplicates,  32) \
+X(a, STATIC,   SINGULAR, UENUM,    power_state,      33) \
+X(a, STATIC,   SINGULAR, UINT32,   cpu_freq_mhz,     34) \
+X(a, STATIC,   REPEATED, UINT32,   power_state_ms,   35)
+#define Diagnostics_CALLBACK NULL
+#define Diagnostics_DEFAULT NULL
+#define Diagnostics_tasks_MSGTYPE TaskUsage
+
+#define ImuSample_FIELDLIST(X, a) \
+X(a, STATIC,   SINGULAR, UINT32,   time_offset_us,    1) \
+X(a, STATIC,   SINGULAR, SINT32,   gyro_x,            2) \
+X(a, STATIC,   SINGULAR, SINT32,   gyro_y,            3) \
+X(a, STATIC,   SINGULAR, SINT32,   gyro_z,            4) \
+X(a, STATIC,   SINGULAR, SINT32,   accel_x,           5) \
+X(a, STATIC,   SINGULAR, SINT32,   accel_y,           6) \
+X(a, STATIC,   SINGULAR, SINT32,   accel_z,           7)
+#define ImuSample_CALLBACK NULL
+#define ImuSample_DEFAULT NULL
+
+#define Imu_FIELDLIST(X, a) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  time,              1) \
+X(a, STATIC,   SINGULAR, FLOAT,    gyro_scale,        2) \
+X(a, STATIC,   SINGULAR, FLOAT,    accel_scale,       3) \
+X(a, STATIC,   REPEATED, MESSAGE,  samples,           4)
+#define Imu_CALLBACK NULL
+#define Imu_DEFAULT NULL
+#define Imu_time_MSGTYPE TimeStamp
+#define Imu_samples_MSGTYPE ImuSample
+
+#define Attitude_FIELDLIST(X, a) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  time,              1) \
+X(a, STATIC,   SINGULAR, FLOAT,    roll,              2) \
+X(a, STATIC,   SINGULAR, FLOAT,    pitch,             3) \
+X(a, STATIC,   SINGULAR, FLOAT,    yaw,               4) \
+X(a, STATIC,   SINGULAR, FLOAT,    yaw_rate,          5) \
+X(a, STATIC,   SINGULAR, FLOAT,    gyro_bias_z,       6)
+#define Attitude_CALLBACK NULL
+#define Attitude_DEFAULT NULL
+#define Attitude_time_MSGTYPE TimeStamp
+
+#define Odometry_FIELDLIST(X, a) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  time,              1) \
+X(a, STATIC,   SINGULAR, FLOAT,    x,                 2) \
+X(a, STATIC,   SINGULAR, FLOAT,    y,                 3) \
+X(a, STATIC,   SINGULAR, FLOAT,    yaw,               4) \
+X(a, STATIC,   SINGULAR, FLOAT,    v,                 5) \
+X(a, STATIC,   SINGULAR, FLOAT,    w,                 6) \
+X(a, STATIC,   REPEATED, FLOAT,    pose_covariance,   7) \
+X(a, STATIC,   REPEATED, FLOAT,    twist_covariance,   8)
+#define Odometry_CALLBACK NULL
+#define Odometry_DEFAULT NULL
+#define Odometry_time_MSGTYPE TimeStamp
+
 #define JointStates_FIELDLIST(X, a) \
 X(a, STATIC,   OPTIONAL, MESSAGE,  time,              1) \
 X(a, STATIC,   REPEATED, STRING,   name,              2) \
@@ -142,36 +849,118 @@ X(a, STATIC,   REPEATED, DOUBLE,   effort,            5)
 #define JointStates_DEFAULT NULL
 #define JointStates_time_MSGTYPE TimeStamp
 
+#define Reliable_FIELDLIST(X, a) \
+X(a, STATIC,   SINGULAR, UINT32,   session,           1) \
+X(a, STATIC,   SINGULAR, UINT32,   seq,               2) \
+X(a, STATIC,   SINGULAR, UINT32,   base,              3) \
+X(a, STATIC,   SINGULAR, UINT32,   ack_session,       4) \
+X(a, STATIC,   SINGULAR, UINT32,   ack,               5)
+#define Reliable_CALLBACK NULL
+#define Reliable_DEFAULT NULL
+
 #define UdpPacket_FIELDLIST(X, a) \
 X(a, STATIC,   OPTIONAL, MESSAGE,  laser,             1) \
 X(a, STATIC,   OPTIONAL, MESSAGE,  joint_states,      2) \
-X(a, STATIC,   OPTIONAL, MESSAGE,  cmd_vel,           3)
+X(a, STATIC,   OPTIONAL, MESSAGE,  cmd_vel,           3) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  compact_laser,     4) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  lidar_config,      5) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  command_stats,     6) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  diagnostics,       7) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  imu,               8) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  attitude,          9) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  odometry,         10) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  control_config,   11) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  calibrate_motors,  12) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  time_sync,        13) \
+X(a, STATIC,   SINGULAR, UINT32,   robot_id,         14) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  discovery,        16) \
+X(a, STATIC,   OPTIONAL, MESSAGE,  reliable,         17)
 #define UdpPacket_CALLBACK NULL
 #define UdpPacket_DEFAULT NULL
 #define UdpPacket_laser_MSGTYPE LaserScan
 #define UdpPacket_joint_states_MSGTYPE JointStates
 #define UdpPacket_cmd_vel_MSGTYPE TwistCmd
+#define UdpPacket_compact_laser_MSGTYPE CompactLaserScan
+#define UdpPacket_lidar_config_MSGTYPE LidarConfig
+#define UdpPacket_command_stats_MSGTYPE CommandStats
+#define UdpPacket_diagnostics_MSGTYPE Diagnostics
+#define UdpPacket_imu_MSGTYPE Imu
+#define UdpPacket_attitude_MSGTYPE Attitude
+#define UdpPacket_odometry_MSGTYPE Odometry
+#define UdpPacket_control_config_MSGTYPE ControlConfig
+#define UdpPacket_calibrate_motors_MSGTYPE CalibrateMotors
+#define UdpPacket_time_sync_MSGTYPE TimeSync
+#define UdpPacket_discovery_MSGTYPE Discovery
+#define UdpPacket_reliable_MSGTYPE Reliable
 
 extern const pb_msgdesc_t TimeStamp_msg;
+extern const pb_msgdesc_t TimeSync_msg;
+extern const pb_msgdesc_t Discovery_msg;
 extern const pb_msgdesc_t TwistCmd_msg;
 extern const pb_msgdesc_t LaserScan_msg;
+extern const pb_msgdesc_t CompactLaserScan_msg;
+extern const pb_msgdesc_t LidarSector_msg;
+extern const pb_msgdesc_t LidarConfig_msg;
+extern const pb_msgdesc_t MotorModel_msg;
+extern const pb_msgdesc_t ControlConfig_msg;
+extern const pb_msgdesc_t CalibrateMotors_msg;
+extern const pb_msgdesc_t CommandStats_msg;
+extern const pb_msgdesc_t TaskUsage_msg;
+extern const pb_msgdesc_t Diagnostics_msg;
+extern const pb_msgdesc_t ImuSample_msg;
+extern const pb_msgdesc_t Imu_msg;
+extern const pb_msgdesc_t Attitude_msg;
+extern const pb_msgdesc_t Odometry_msg;
 extern const pb_msgdesc_t JointStates_msg;
+extern const pb_msgdesc_t Reliable_msg;
 extern const pb_msgdesc_t UdpPacket_msg;
 
 /* Defines for backwards compatibility with code written before nanopb-0.4.0 */
 #define TimeStamp_fields &TimeStamp_msg
+#define TimeSync_fields &TimeSync_msg
+#define Discovery_fields &Discovery_msg
 #define TwistCmd_fields &TwistCmd_msg
 #define LaserScan_fields &LaserScan_msg
+#define CompactLaserScan_fields &CompactLaserScan_msg
+#define LidarSector_fields &LidarSector_msg
+#define LidarConfig_fields &LidarConfig_msg
+#define MotorModel_fields &MotorModel_msg
+#define ControlConfig_fields &ControlConfig_msg
+#define CalibrateMotors_fields &CalibrateMotors_msg
+#define CommandStats_fields &CommandStats_msg
+#define TaskUsage_fields &TaskUsage_msg
+#define Diagnostics_fields &Diagnostics_msg
+#define ImuSample_fields &ImuSample_msg
+#define Imu_fields &Imu_msg
+#define Attitude_fields &Attitude_msg
+#define Odometry_fields &Odometry_msg
 #define JointStates_fields &JointStates_msg
+#define Reliable_fields &Reliable_msg
 #define UdpPacket_fields &UdpPacket_msg
 
 /* Maximum encoded size of messages (where known) */
+#define Attitude_size                            44
+#define CalibrateMotors_size                     2
+#define CommandStats_size                        66
+#define CompactLaserScan_size                    1543
+#define ControlConfig_size                       64
+#define Diagnostics_size                         1301
+#define Discovery_size                           2
+#define ImuSample_size                           42
+#define Imu_size                                 1437
 #define JointStates_size                         107
 #define LaserScan_size                           1254
+#define LidarConfig_size                         191
+#define LidarSector_size                         18
 #define MESSAGES_PB_H_MAX_SIZE                   UdpPacket_size
+#define MotorModel_size                          10
+#define Odometry_size                            109
+#define Reliable_size                            30
+#define TaskUsage_size                           40
 #define TimeStamp_size                           17
+#define TimeSync_size                            33
 #define TwistCmd_size                            29
-#define UdpPacket_size                           1397
+#define UdpPacket_size                           6255
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -0,0 +1,227 @@
+#include "reliable.h"
+
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <string.h>
+
+#include "pb_encode.h"
+#include "socket_mgr.h"
+
+// Packets waiting on the host at once
+#define WINDOW 4
+// Everything in flight goes out again once the oldest has waited this long.
+// A round trip is a few milliseconds on a good link.
+#define RETRANSMIT_US (100 * 1000)
+#define CHECK_PERIOD_US (25 * 1000)
+// About two seconds of trying before a packet is given up on
+#define MAX_TRIES 20
+// A ControlConfig answer is around 80 bytes
+#define MAX_PACKET_LEN 256
+// Two bytes of tag for field 17, one of length
+#define HEADER_OVERHEAD 3
+// Tag plus a varint of up to five bytes
+#define ROBOT_ID_SIZE 6
+
+static const char *TAG = "reliable";
+
+typedef struct
+{
+    uint32_t seq;
+    size_t len;
+    // Encoded without the header, which changes every time it's sent
+    uint8_t data[MAX_PACKET_LEN];
+} slot_t;
+
+static void (*send_callback)(const uint8_t *data, size_t len);
+// Taken by producers, the RX tasks and the retransmit timer
+static SemaphoreHandle_t lock;
+
+// Sending
+static uint32_t session;
+static uint32_t next_seq = 1;
+static slot_t slots[WINDOW];
+static size_t first_slot = 0; // Oldest in flight
+static size_t in_flight = 0;
+static int64_t sent_us = 0; // When the window last went out
+static uint32_t tries = 0;  // Of the oldest
+
+// Receiving
+static bool have_peer = false;
+static uint32_t peer_session;
+static uint32_t expected; // Next seq to handle
+
+// An acknowledgement is just the robot id and a header
+static uint8_t ack_prefix[ROBOT_ID_SIZE];
+static size_t ack_prefix_len = 0;
+
+static reliable_stats_t stats = {};
+static esp_timer_handle_t retransmit_timer;
+
+/*
+ * Whether sequence number a comes after b, allowing for wrap around.
+ */
+static bool after(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) > 0;
+}
+
+/*
+ * Send data with a current header appended, seq 0 for just an
+ * acknowledgement. Fields can come in any order, so the header doesn't have
+ * to be first. Only called with the lock held.
+ */
+static void transmit(const uint8_t *data, size_t len, uint32_t seq)
+{
+    static uint8_t buffer[MAX_PACKET_LEN + HEADER_OVERHEAD + Reliable_size];
+    memcpy(buffer, data, len);
+
+    Reliable header = {
+        .session = session,
+        .seq = seq,
+        .base = in_flight > 0 ? slots[first_slot].seq : next_seq,
+        .ack_session = have_peer ? peer_session : 0,
+        .ack = have_peer ? expected - 1 : 0,
+    };
+    pb_ostream_t stream =
+      pb_ostream_from_buffer(buffer + len, sizeof(buffer) - len);
+    if (!pb_encode_tag(&stream, PB_WT_STRING, UdpPacket_reliable_tag) ||
+        !pb_encode_submessage(&stream, Reliable_fields, &header)) {
+        return;
+    }
+    send_callback(buffer, len + stream.bytes_written);
+}
+
+static void retransmit_timer_callback(void *arg)
+{
+    uint32_t expired_seq = 0;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    int64_t now_us = esp_timer_get_time();
+    if (in_flight > 0 && now_us - sent_us >= RETRANSMIT_US) {
+        if (++tries >= MAX_TRIES) {
+            // The host stops waiting for it once base moves past
+            expired_seq = slots[first_slot].seq;
+            first_slot = (first_slot + 1) % WINDOW;
+            in_flight--;
+            tries = 0;
+            stats.expired++;
+        }
+        // Anything after a lost packet was dropped too, so send them all
+        for (size_t i = 0; i < in_flight; i++) {
+            const slot_t *slot = &slots[(first_slot + i) % WINDOW];
+            transmit(slot->data, slot->len, slot->seq);
+            stats.retransmits++;
+        }
+        sent_us = now_us;
+    }
+    xSemaphoreGive(lock);
+
+    if (expired_seq != 0) {
+        ESP_LOGW(TAG,
+                 "Gave up on packet %lu, the host never acknowledged it",
+                 (unsigned long)expired_seq);
+    }
+}
+
+bool reliable_send(const UdpPacket *packet)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (in_flight == WINDOW) {
+        xSemaphoreGive(lock);
+        return false;
+    }
+
+    slot_t *slot = &slots[(first_slot + in_flight) % WINDOW];
+    pb_ostream_t stream = pb_ostream_from_buffer(slot->data, MAX_PACKET_LEN);
+    if (!pb_encode(&stream, UdpPacket_fields, packet)) {
+        xSemaphoreGive(lock);
+        ESP_LOGE(TAG, "Failed to serialize message: %s", PB_GET_ERROR(&stream));
+        return false;
+    }
+    slot->seq = next_seq++;
+    slot->len = stream.bytes_written;
+    if (in_flight == 0) {
+        sent_us = esp_timer_get_time();
+        tries = 0;
+    }
+    in_flight++;
+    transmit(slot->data, slot->len, slot->seq);
+    xSemaphoreGive(lock);
+    return true;
+}
+
+bool reliable_receive(const Reliable *header)
+{
+    bool handle = true;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (header->ack_session == session) {
+        while (in_flight > 0 && !after(slots[first_slot].seq, header->ack)) {
+            first_slot = (first_slot + 1) % WINDOW;
+            in_flight--;
+            // The next one gets a full timeout of its own
+            sent_us = esp_timer_get_time();
+            tries = 0;
+        }
+    }
+
+    if (header->seq != 0) {
+        if (!have_peer || header->session != peer_session) {
+            // A new host, or the same one restarted
+            have_peer = true;
+            peer_session = header->session;
+            expected = header->base;
+        } else if (after(header->base, expected)) {
+            // The host gave up on those
+            expected = header->base;
+        }
+
+        handle = header->seq == expected;
+        if (handle) {
+            expected++;
+        } else if (!after(header->seq, expected)) {
+            stats.duplicates++;
+        }
+        // Repeats get answered too, it may be the acknowledgement that was
+        // lost
+        transmit(ack_prefix, ack_prefix_len, 0);
+    }
+    xSemaphoreGive(lock);
+    return handle;
+}
+
+void reliable_get_stats(reliable_stats_t *out)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    *out = stats;
+    xSemaphoreGive(lock);
+}
+
+void reliable_init(void (*send)(const uint8_t *data, size_t len))
+{
+    send_callback = send;
+    lock = xSemaphoreCreateMutex();
+    session = esp_random();
+    if (session == 0) {
+        // 0 means no session in an acknowledgement
+        session = 1;
+    }
+
+    pb_ostream_t stream =
+      pb_ostream_from_buffer(ack_prefix, sizeof(ack_prefix));
+    pb_encode_tag(&stream, PB_WT_VARINT, UdpPacket_robot_id_tag);
+    pb_encode_varint(&stream, socket_mgr_robot_id());
+    ack_prefix_len = stream.bytes_written;
+
+    const esp_timer_create_args_t retransmit_timer_args = {
+        .callback = retransmit_timer_callback,
+        .name = "reliable",
+    };
+    ESP_ERROR_CHECK(
+      esp_timer_create(&retransmit_timer_args, &retransmit_timer));
+    ESP_ERROR_CHECK(
+      esp_timer_start_periodic(retransmit_timer, CHECK_PERIOD_US));
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "messages.pb.h"
+
+/*
+ * Acknowledged delivery for configuration and commands, over the same
+ * transports as everything else (see Reliable in messages.proto). Only a
+ * handful of packets are ever waiting on the host, so the whole window is
+ * sent again whenever the oldest goes unacknowledged for a while, and the
+ * host drops anything that arrives out of order. Sensor streams never come
+ * through here and stay fire and forget.
+ */
+
+typedef struct
+{
+    uint32_t retransmits;
+    uint32_t expired;    // Given up on after too many tries
+    uint32_t duplicates; // Host packets that had already been handled
+} reliable_stats_t;
+
+/*
+ * Send a packet now, and again until the host acknowledges it. Returns
+ * false if too many are already waiting or it doesn't encode.
+ */
+bool reliable_send(const UdpPacket *packet);
+
+/*
+ * Called by the RX tasks with the header on a datagram from the host.
+ * Acknowledges it, and returns whether the rest of the datagram should be
+ * handled, which it shouldn't be if it's a repeat or something before it
+ * is still missing.
+ */
+bool reliable_receive(const Reliable *header);
+
+void reliable_get_stats(reliable_stats_t *stats);
+
+/*
+ * Start with a new session. Everything, acknowledgements included, goes
+ * out through send.
+ */
+void reliable_init(void (*send)(const uint8_t *data, size_t len));
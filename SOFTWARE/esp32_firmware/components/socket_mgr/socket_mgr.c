@@ -4,101 +4,535 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
 #include <freertos/task.h>
+#include <string.h>
 #include <time.h>
 
+#include "esp_attr.h"
 #include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_timer.h"
 #include "freertos/projdefs.h"
 #include "lwip/sockets.h"
-#include "nvs.h"
 
 #include "messages.pb.h"
 #include "pb.h"
+#include "pb_common.h"
 #include "pb_decode.h"
 #include "pb_encode.h"
 #include "pb_utils.h"
 #include "portmacro.h"
+#include "discovery.h"
+#include "espnow_link.h"
+#include "fast_encode.h"
+#include "reliable.h"
+#include "sdkconfig.h"
 #include "status_led_driver.h"
+#include "time_sync.h"
+#include "trace.h"
+#include "tx_ring.h"
+#include "wifi_mgr.h"
+
+#define SOCKET_TX_TASK_STACK_SIZE CONFIG_LRR_TASK_SOCKET_TX_STACK
+#define SOCKET_RX_TASK_STACK_SIZE CONFIG_LRR_TASK_SOCKET_RX_STACK
+// UdpPacket field numbers below this can have RX handlers
+#define MAX_RX_TAG 32
+
+// Number of packets producers can have in flight at once. The queues only
+// carry pointers into this pool, so nothing gets copied on the way to the
+// socket. When pre-encoding, packets come back as soon as they're committed.
+#if CONFIG_LRR_SOCKET_PRE_ENCODE
+#define TX_POOL_SIZE 4
+#else
+#define CONTROL_QUEUE_DEPTH 3
+#define IMU_QUEUE_DEPTH 2
+#define LIDAR_QUEUE_DEPTH 2
+#define DIAGNOSTICS_QUEUE_DEPTH 1
+// Everything queued, plus one being filled by each producer
+#define TX_POOL_SIZE                                                           \
+    (CONTROL_QUEUE_DEPTH + IMU_QUEUE_DEPTH + LIDAR_QUEUE_DEPTH +               \
+     DIAGNOSTICS_QUEUE_DEPTH + eTxLaneCount)
+#endif
 
-#define SOCKET_TX_TASK_STACK_SIZE 4096
-#define SOCKET_RX_TASK_STACK_SIZE 4096
-#define MAX_RX_CALLBACKS 1
+#define PORT 8001
+
+// Tag plus up to two bytes of length for each submessage
+#define SUBMESSAGE_OVERHEAD 3
+// Tag plus a varint of up to five bytes
+#define ROBOT_ID_SIZE 6
 
 static const char *TAG = "SOCKET_MGR";
 
-static char AGENT_IP[16];
-#define PORT 8001
+static uint32_t robot_id;
+
+static int socket_id;
+
+// Bulk buffers go in PSRAM on modules that have it (see sdkconfig.psram),
+// which leaves internal RAM to Wi-Fi and lwIP. No ISR touches them, and
+// they're filled and read front to back, so the cache hides most of the
+// slower memory. The control lane, the batch and the socket buffers stay
+// internal.
+static EXT_RAM_BSS_ATTR UdpPacket tx_pool[TX_POOL_SIZE];
+static QueueHandle_t tx_free_queue = NULL;
+static TaskHandle_t tx_task_handle = NULL;
+
+// Lanes where a fresh packet is worth more than a stale one. Everywhere else
+// a full lane turns new packets away.
+static const bool lane_drops_oldest[eTxLaneCount] = {
+    [eTxLaneControl] = false,
+    [eTxLaneImu] = false,
+    [eTxLaneLidar] = true,
+    [eTxLaneDiagnostics] = true,
+};
+
+static socket_mgr_stats_t stats = {};
+
+#if CONFIG_LRR_SOCKET_PRE_ENCODE
+static uint8_t control_ring_buffer[CONFIG_LRR_SOCKET_CONTROL_RING_SIZE];
+static EXT_RAM_BSS_ATTR uint8_t
+  imu_ring_buffer[CONFIG_LRR_SOCKET_IMU_RING_SIZE];
+static EXT_RAM_BSS_ATTR uint8_t
+  lidar_ring_buffer[CONFIG_LRR_SOCKET_LIDAR_RING_SIZE];
+static EXT_RAM_BSS_ATTR uint8_t
+  diagnostics_ring_buffer[CONFIG_LRR_SOCKET_DIAGNOSTICS_RING_SIZE];
+static tx_ring_t tx_rings[eTxLaneCount];
+
+#if CONFIG_LRR_SOCKET_BATCH
+// Field number of UdpPacket.batch
+#define BATCH_FIELD_NUMBER 15
+
+static uint8_t batch_buffer[CONFIG_LRR_SOCKET_BATCH_MAX_BYTES];
+// Every batch starts with the datagram's robot_id, written once at init
+static size_t batch_prefix_len = 0;
+static size_t batch_len = 0;
+static size_t batch_count = 0;
+static size_t batch_first_offset = 0; // Where the first packet's bytes start
+static int64_t batch_deadline_us = 0;
+static esp_timer_handle_t flush_timer;
+#endif
+#else
+static QueueHandle_t tx_queues[eTxLaneCount];
+static unsigned char tx_buffer[1500];
+#endif
+
+/*
+ * Encode a packet into buf, returning its length or 0 on failure.
+ */
+static size_t encode_packet(const UdpPacket *packet, uint8_t *buf, size_t size)
+{
+#if CONFIG_LRR_SOCKET_FAST_ENCODE
+    size_t len = fast_encode_packet(packet, buf, size);
+    if (len > 0) {
+        return len;
+    }
+#endif
+    pb_ostream_t stream = pb_ostream_from_buffer(buf, size);
+    if (!pb_encode(&stream, UdpPacket_fields, packet)) {
+        return 0;
+    }
+    return stream.bytes_written;
+}
 
-esp_err_t get_agent_ip()
+static void send_datagram(const uint8_t *data, size_t len)
 {
-    nvs_handle_t my_handle;
-    esp_err_t err = nvs_open("storage", NVS_READWRITE, &my_handle);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error (%s) opening NVS handle!\n", esp_err_to_name(err));
+    struct sockaddr_in dest_addr;
+    if (!discovery_get_agent(&dest_addr)) {
+        // Nobody to send to yet
+        return;
+    }
+
+    TRACE_BEGIN(eTraceSendto);
+    ssize_t sent = sendto(socket_id,
+                          data,
+                          len,
+                          0,
+                          (struct sockaddr *)&dest_addr,
+                          sizeof(dest_addr));
+    TRACE_END(eTraceSendto);
+
+    // This fails whenever a client isn't emptying the network buffer, so
+    // it's counted rather than logged.
+    if (sent != (ssize_t)len) {
+        stats.sendto_failures++;
     } else {
-        size_t l = sizeof(AGENT_IP);
-        err = nvs_get_str(my_handle, "uros_ag_ip", AGENT_IP, &l);
-        switch (err) {
-            case ESP_OK:
-                ESP_LOGI(TAG, "Retrieved IP (%s) for agent IP.", AGENT_IP);
-                break;
-            case ESP_ERR_NVS_NOT_FOUND:
-                ESP_LOGI(TAG, "Agent IP has not been set.");
-                nvs_close(my_handle);
-                return ESP_FAIL;
-                break;
-            default:
-                ESP_LOGI(TAG, "Error (%s) reading!\n", esp_err_to_name(err));
-                nvs_close(my_handle);
-                return ESP_FAIL;
-        }
+        status_led_activity(eActivityTx);
+    }
+}
 
-        nvs_close(my_handle);
+/*
+ * Control traffic goes straight to the dongle whenever there is one. Returns
+ * false if the datagram should go by UDP instead.
+ */
+static bool send_espnow(eTxLane lane, const uint8_t *data, size_t len)
+{
+#if CONFIG_LRR_SOCKET_ESPNOW
+    if (lane == eTxLaneControl && espnow_link_send(data, len)) {
+        stats.espnow_sent++;
+        return true;
     }
-    return ESP_OK;
+#endif
+    return false;
 }
 
-static int socket_id;
+/*
+ * Reliable packets and their acknowledgements skip the lanes, they're few
+ * and small. They go the same way as control traffic.
+ */
+static void send_reliable_datagram(const uint8_t *data, size_t len)
+{
+    if (!send_espnow(eTxLaneControl, data, len)) {
+        send_datagram(data, len);
+    }
+}
 
-QueueHandle_t tx_queue = NULL;
+#if CONFIG_LRR_SOCKET_PRE_ENCODE
+#if CONFIG_LRR_SOCKET_BATCH
+static void flush_timer_callback(void *arg)
+{
+    xTaskNotifyGive(tx_task_handle);
+}
 
-static unsigned char tx_buffer[1500];
-struct sockaddr_in dest_addr;
+static void flush_batch()
+{
+    if (batch_count == 1) {
+        // No point wrapping a lone packet, send it as is.
+        send_datagram(batch_buffer + batch_first_offset,
+                      batch_len - batch_first_offset);
+    } else if (batch_count > 1) {
+        send_datagram(batch_buffer, batch_len);
+    }
+
+    batch_len = batch_prefix_len;
+    batch_count = 0;
+}
+
+/*
+ * Append an encoded packet to the batch as one UdpPacket.batch entry, sending
+ * the batch first if there isn't room. Returns false if the packet is too
+ * big to ever be batched.
+ */
+static bool add_to_batch(const uint8_t *packet, size_t len)
+{
+    uint8_t header[SUBMESSAGE_OVERHEAD];
+    pb_ostream_t stream = pb_ostream_from_buffer(header, sizeof(header));
+    if (!pb_encode_tag(&stream, PB_WT_STRING, BATCH_FIELD_NUMBER) ||
+        !pb_encode_varint(&stream, len) ||
+        batch_prefix_len + stream.bytes_written + len > sizeof(batch_buffer)) {
+        return false;
+    }
+
+    if (batch_len + stream.bytes_written + len > sizeof(batch_buffer)) {
+        flush_batch();
+    }
+
+    memcpy(batch_buffer + batch_len, header, stream.bytes_written);
+    batch_len += stream.bytes_written;
+
+    if (batch_count == 0) {
+        batch_first_offset = batch_len;
+        batch_deadline_us =
+          esp_timer_get_time() + CONFIG_LRR_SOCKET_BATCH_FLUSH_US;
+#if CONFIG_LRR_SOCKET_BATCH_FLUSH_US > 0
+        // The tick is too coarse for the deadline, so wake up on a timer.
+        esp_timer_stop(flush_timer);
+        esp_timer_start_once(flush_timer, CONFIG_LRR_SOCKET_BATCH_FLUSH_US);
+#endif
+    }
+
+    memcpy(batch_buffer + batch_len, packet, len);
+    batch_len += len;
+    batch_count++;
+    return true;
+}
+#endif
 
 static void socket_tx_task(void *arg)
 {
-    UdpPacket msg;
+    while (1) {
+        // Lanes are in priority order, always serve the first one that has
+        // something waiting.
+        bool sent_any = false;
+        for (size_t lane = 0; lane < eTxLaneCount && !sent_any; lane++) {
+            size_t len;
+            const uint8_t *span = tx_ring_peek(&tx_rings[lane], &len);
+            if (span == NULL) {
+                continue;
+            }
+
+            if (send_espnow(lane, span, len)) {
+                // Skips the batch, it's not going the same way
+            } else {
+#if CONFIG_LRR_SOCKET_BATCH
+                if (!add_to_batch(span, len)) {
+                    flush_batch();
+                    send_datagram(span, len);
+                }
+#else
+                send_datagram(span, len);
+#endif
+            }
+            tx_ring_pop(&tx_rings[lane]);
+            sent_any = true;
+        }
+
+        if (sent_any) {
+            continue;
+        }
+
+#if CONFIG_LRR_SOCKET_BATCH
+        // Everything queued is in the batch, send it once the first packet
+        // has waited long enough.
+        if (batch_count > 0 && esp_timer_get_time() >= batch_deadline_us) {
+            flush_batch();
+            continue;
+        }
+#endif
+
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+}
+
+/*
+ * Worst case encoded size of a packet, based on which fields it carries.
+ */
+static size_t packet_size_bound(const UdpPacket *packet)
+{
+    size_t size = ROBOT_ID_SIZE;
+    if (packet->has_laser) {
+        size += SUBMESSAGE_OVERHEAD + LaserScan_size;
+    }
+    if (packet->has_joint_states) {
+        size += SUBMESSAGE_OVERHEAD + JointStates_size;
+    }
+    if (packet->has_cmd_vel) {
+        size += SUBMESSAGE_OVERHEAD + TwistCmd_size;
+    }
+    if (packet->has_compact_laser) {
+        size += SUBMESSAGE_OVERHEAD + CompactLaserScan_size;
+    }
+    if (packet->has_lidar_config) {
+        size += SUBMESSAGE_OVERHEAD + LidarConfig_size;
+    }
+    if (packet->has_command_stats) {
+        size += SUBMESSAGE_OVERHEAD + CommandStats_size;
+    }
+    if (packet->has_diagnostics) {
+        size += SUBMESSAGE_OVERHEAD + Diagnostics_size;
+    }
+    if (packet->has_imu) {
+        size += SUBMESSAGE_OVERHEAD + Imu_size;
+    }
+    if (packet->has_attitude) {
+        size += SUBMESSAGE_OVERHEAD + Attitude_size;
+    }
+    if (packet->has_odometry) {
+        size += SUBMESSAGE_OVERHEAD + Odometry_size;
+    }
+    if (packet->has_control_config) {
+        size += SUBMESSAGE_OVERHEAD + ControlConfig_size;
+    }
+    if (packet->has_time_sync) {
+        size += SUBMESSAGE_OVERHEAD + TimeSync_size;
+    }
+    if (packet->has_discovery) {
+        size += SUBMESSAGE_OVERHEAD + Discovery_size;
+    }
+    return size;
+}
+
+static void encode_to_ring(eTxLane lane, const UdpPacket *packet)
+{
+    tx_ring_t *ring = &tx_rings[lane];
+    size_t max_size = packet_size_bound(packet);
+
+    uint8_t *span = tx_ring_reserve(ring, max_size);
+    if (span == NULL) {
+        ESP_LOGE(TAG, "TX lane %d is full, dropping packet", (int)lane);
+        return;
+    }
+    // Dropping old records to make room is expected, so that's silent.
+
+    TRACE_BEGIN(eTracePbEncode);
+    size_t len = encode_packet(packet, span, max_size);
+    TRACE_END(eTracePbEncode);
+    if (len == 0) {
+        ESP_LOGE(TAG, "Failed to serialize message.");
+        tx_ring_cancel(ring);
+        return;
+    }
 
+    tx_ring_commit(ring, len);
+    xTaskNotifyGive(tx_task_handle);
+}
+#else
+static void socket_tx_task(void *arg)
+{
     while (1) {
-        if (xQueueReceive(tx_queue, (void *)&msg, portMAX_DELAY) == pdTRUE) {
-            pb_ostream_t stream =
-              pb_ostream_from_buffer(tx_buffer, sizeof(tx_buffer));
-            bool status = pb_encode(&stream, UdpPacket_fields, &msg);
-            if (!status) {
-                ESP_LOGE(TAG, "Failed to serialize message.");
+        // Lanes are in priority order, take from the first non-empty one.
+        UdpPacket *msg = NULL;
+        eTxLane lane;
+        for (lane = 0; lane < eTxLaneCount; lane++) {
+            if (xQueueReceive(tx_queues[lane], (void *)&msg, 0) == pdTRUE) {
+                break;
             }
+            msg = NULL;
+        }
+
+        if (msg == NULL) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        TRACE_BEGIN(eTracePbEncode);
+        size_t len = encode_packet(msg, tx_buffer, sizeof(tx_buffer));
+        TRACE_END(eTracePbEncode);
+        socket_mgr_release_packet(msg);
+        if (len == 0) {
+            ESP_LOGE(TAG, "Failed to serialize message.");
+            continue;
+        }
 
-            ssize_t sent = sendto(socket_id,
-                                  tx_buffer,
-                                  stream.bytes_written,
-                                  0,
-                                  (struct sockaddr *)&dest_addr,
-                                  sizeof(dest_addr));
+        if (!send_espnow(lane, tx_buffer, len)) {
+            send_datagram(tx_buffer, len);
+        }
+    }
+}
+
+static void queue_packet(eTxLane lane, UdpPacket *packet)
+{
+    QueueHandle_t queue = tx_queues[lane];
+    if (xQueueSend(queue, (void *)&packet, 0) != pdTRUE) {
+        UdpPacket *oldest;
+        if (!lane_drops_oldest[lane] ||
+            xQueueReceive(queue, (void *)&oldest, 0) != pdTRUE) {
+            ESP_LOGE(TAG, "TX lane %d is full, dropping packet", (int)lane);
+            socket_mgr_release_packet(packet);
+            stats.lane_dropped[lane]++;
+            return;
+        }
 
-            // This fails whenever a client isn't emptying the network buffer,
-            // commented out for now.
-            // if (sent != stream.bytes_written) {
-            //     ESP_LOGE(TAG,
-            //              "Failed to write full packet data. Wrote %ld, "
-            //              "expected %zu.",
-            //              (long)sent,
-            //              stream.bytes_written);
-            // }
+        socket_mgr_release_packet(oldest);
+        stats.lane_dropped[lane]++;
+        if (xQueueSend(queue, (void *)&packet, 0) != pdTRUE) {
+            socket_mgr_release_packet(packet);
+            stats.lane_dropped[lane]++;
+            return;
         }
     }
+
+    UBaseType_t waiting = uxQueueMessagesWaiting(queue);
+    if (waiting > stats.lane_high_water[lane]) {
+        stats.lane_high_water[lane] = waiting;
+    }
+    xTaskNotifyGive(tx_task_handle);
 }
+#endif
+
+typedef struct
+{
+    const pb_msgdesc_t *fields;
+    void *message; // Decode target, inside rx_packet
+    void (*callback)(void *);
+} rx_handler_t;
 
 static unsigned char rx_buffer[1500];
-static void (*rx_callbacks[MAX_RX_CALLBACKS])(void *);
+// Mostly room for scans, which the host never sends
+static EXT_RAM_BSS_ATTR UdpPacket rx_packet;
+static rx_handler_t rx_handlers[MAX_RX_TAG];
+
+#if CONFIG_LRR_SOCKET_ESPNOW
+// The ESP-NOW task decodes into the same handler messages
+static SemaphoreHandle_t rx_lock;
+#endif
+
+/*
+ * Find the Reliable header in a datagram, if it has one. It decides whether
+ * anything else gets handled, so it's looked for before dispatching.
+ */
+static bool find_reliable(const uint8_t *data, size_t len, Reliable *header)
+{
+    pb_istream_t stream = pb_istream_from_buffer(data, len);
+    pb_wire_type_t wire_type;
+    uint32_t tag;
+    bool eof = false;
+    while (pb_decode_tag(&stream, &wire_type, &tag, &eof)) {
+        if (tag == UdpPacket_reliable_tag && wire_type == PB_WT_STRING) {
+            *header = (Reliable)Reliable_init_zero;
+            return decode_unionmessage_contents(
+              &stream, Reliable_fields, header);
+        }
+        if (!pb_skip_field(&stream, wire_type)) {
+            return false;
+        }
+    }
+    return false;
+}
+
+/*
+ * Decode a datagram and hand each submessage to its handler. Returns
+ * whether it carried a Discovery answer.
+ */
+static bool dispatch_datagram(const uint8_t *data, size_t len)
+{
+    Reliable header;
+    if (find_reliable(data, len, &header) && !reliable_receive(&header)) {
+        // Already handled, or out of order. Either way it's been answered.
+        return false;
+    }
+
+    pb_istream_t stream = pb_istream_from_buffer(data, len);
+    pb_wire_type_t wire_type;
+    uint32_t tag;
+    bool eof = false;
+    bool status = true;
+    bool answer = false;
+
+#if CONFIG_LRR_SOCKET_ESPNOW
+    xSemaphoreTake(rx_lock, portMAX_DELAY);
+#endif
+    // Hand each submessage straight to its handler by field number.
+    // Anything nobody registered for is skipped.
+    while (status && pb_decode_tag(&stream, &wire_type, &tag, &eof)) {
+        if (tag == UdpPacket_discovery_tag && wire_type == PB_WT_STRING) {
+            // Other rovers' requests reach us too, only answers count
+            Discovery discovery = Discovery_init_zero;
+            status = decode_unionmessage_contents(
+              &stream, Discovery_fields, &discovery);
+            answer = answer || discovery.answer;
+            continue;
+        }
+
+        rx_handler_t *handler = tag < MAX_RX_TAG ? &rx_handlers[tag] : NULL;
+        if (handler == NULL || handler->callback == NULL ||
+            wire_type != PB_WT_STRING) {
+            status = pb_skip_field(&stream, wire_type);
+            continue;
+        }
+
+        status = decode_unionmessage_contents(
+          &stream, handler->fields, handler->message);
+        if (status) {
+            handler->callback(handler->message);
+        }
+    }
+#if CONFIG_LRR_SOCKET_ESPNOW
+    xSemaphoreGive(rx_lock);
+#endif
+
+    if (!status || !eof) {
+        ESP_LOGE(TAG, "Decode failed: %s\n", PB_GET_ERROR(&stream));
+        stats.rx_decode_errors++;
+    }
+    return answer;
+}
+
+#if CONFIG_LRR_SOCKET_ESPNOW
+static void espnow_receive(const uint8_t *data, size_t len)
+{
+    stats.espnow_received++;
+    // Answers only matter for finding the UDP agent
+    dispatch_datagram(data, len);
+}
+#endif
 
 static void socket_rx_task(void *arg)
 {
@@ -115,42 +549,115 @@ static void socket_rx_task(void *arg)
         if (len < 0) {
             ESP_LOGE(TAG, "recvfrom failed: errno %d", errno);
             return;
-        } else {
-            pb_istream_t stream = pb_istream_from_buffer(rx_buffer, len);
-
-            // TODO: Get rid of the union stuff, just pass the UdpPacket message
-            const pb_msgdesc_t *type = decode_unionmessage_type(&stream);
-            bool status = false;
-
-            if (type == TwistCmd_fields) {
-                TwistCmd msg = {};
-                status =
-                  decode_unionmessage_contents(&stream, TwistCmd_fields, &msg);
-                (*(rx_callbacks[eTwistCmd]))(&msg);
-            }
+        }
 
-            if (!status) {
-                ESP_LOGE(TAG, "Decode failed: %s\n", PB_GET_ERROR(&stream));
-            }
+        bool answer = dispatch_datagram(rx_buffer, len);
+        if (source_addr.ss_family == AF_INET) {
+            discovery_heard_from((struct sockaddr_in *)&source_addr, answer);
         }
     }
 }
 
+UdpPacket *socket_mgr_acquire_packet(TickType_t timeout)
+{
+    UdpPacket *packet;
+    if (tx_free_queue == NULL) {
+        return NULL;
+    }
+    if (xQueueReceive(tx_free_queue, (void *)&packet, timeout) != pdTRUE) {
+        stats.pool_exhausted++;
+        return NULL;
+    }
+
+    // Clear every has_ flag so the caller only sends what it fills in.
+    pb_field_iter_t iter;
+    if (pb_field_iter_begin(&iter, UdpPacket_fields, packet)) {
+        do {
+            if (PB_HTYPE(iter.type) == PB_HTYPE_OPTIONAL) {
+                *(bool *)iter.pSize = false;
+            }
+        } while (pb_field_iter_next(&iter));
+    }
+    return packet;
+}
+
+void socket_mgr_commit_packet(eTxLane lane, UdpPacket *packet)
+{
+#if CONFIG_LRR_SOCKET_SHED_LIDAR
+    // Scans are the bulk of the airtime. On a weak link, sending them anyway
+    // just backs up the control and IMU packets behind them.
+    if (lane == eTxLaneLidar && wifi_mgr_link_poor()) {
+        stats.lidar_shed++;
+        socket_mgr_release_packet(packet);
+        return;
+    }
+#endif
+
+#if CONFIG_LRR_SOCKET_PRE_ENCODE
+    encode_to_ring(lane, packet);
+    socket_mgr_release_packet(packet);
+#else
+    queue_packet(lane, packet);
+#endif
+}
+
+bool socket_mgr_send_reliable(UdpPacket *packet)
+{
+    bool sent = reliable_send(packet);
+    socket_mgr_release_packet(packet);
+    if (!sent) {
+        ESP_LOGE(TAG, "Too many packets waiting on the host, dropping one");
+    }
+    return sent;
+}
+
+void socket_mgr_release_packet(UdpPacket *packet)
+{
+    xQueueSend(tx_free_queue, (void *)&packet, 0);
+}
+
+uint32_t socket_mgr_robot_id()
+{
+    return robot_id;
+}
+
+void socket_mgr_get_stats(socket_mgr_stats_t *out)
+{
+    *out = stats;
+    reliable_stats_t reliable;
+    reliable_get_stats(&reliable);
+    out->reliable_retransmits = reliable.retransmits;
+    out->reliable_expired = reliable.expired;
+    out->reliable_duplicates = reliable.duplicates;
+#if CONFIG_LRR_SOCKET_PRE_ENCODE
+    for (size_t lane = 0; lane < eTxLaneCount; lane++) {
+        out->lane_dropped[lane] = tx_rings[lane].dropped;
+        out->lane_high_water[lane] = tx_rings[lane].high_water;
+    }
+#endif
+}
+
 void register_callback(void (*callback)(void *), eRxMsgTypes type)
 {
-    rx_callbacks[type] = callback;
+    pb_field_iter_t iter;
+    if ((unsigned)type >= MAX_RX_TAG ||
+        !pb_field_iter_begin(&iter, UdpPacket_fields, &rx_packet) ||
+        !pb_field_iter_find(&iter, type) || iter.submsg_desc == NULL) {
+        ESP_LOGE(TAG, "No message field %d in UdpPacket", (int)type);
+        return;
+    }
+
+    rx_handler_t *handler = &rx_handlers[type];
+    handler->fields = iter.submsg_desc;
+    handler->message = iter.pData;
+    // The RX task only looks at a handler once it has a callback.
+    handler->callback = callback;
 }
 
 void socket_mgr_init()
 {
+    // Until discovery finds the host
     set_status(eAgentDisconnected);
-    while (get_agent_ip() != ESP_OK) {
-        vTaskDelay(500 / portTICK_PERIOD_MS);
-    }
-
-    dest_addr.sin_addr.s_addr = inet_addr(AGENT_IP);
-    dest_addr.sin_family = AF_INET;
-    dest_addr.sin_port = htons(PORT);
 
     struct sockaddr_in src_addr;
     src_addr.sin_addr.s_addr = htonl(INADDR_ANY);
@@ -167,27 +674,95 @@ void socket_mgr_init()
     if (err < 0) {
         ESP_LOGE(TAG, "Socket unable to bind: errno %d", errno);
     } else {
-        set_status(eAgentConnected);
         ESP_LOGI(TAG, "Socket bound, port %d", PORT);
     }
 
-    ESP_LOGI(TAG, "Socket created, communicating with %s:%d", AGENT_IP, PORT);
-
-    tx_queue = xQueueCreate(25, sizeof(UdpPacket));
+    robot_id = CONFIG_LRR_ROBOT_ID;
+    if (robot_id == 0) {
+        uint8_t mac[6];
+        ESP_ERROR_CHECK(esp_read_mac(mac, ESP_MAC_WIFI_STA));
+        robot_id = (mac[3] << 16) | (mac[4] << 8) | mac[5];
+    }
+    ESP_LOGI(TAG, "Robot ID %06lx", (unsigned long)robot_id);
+
+#if CONFIG_LRR_SOCKET_ENCODE_BENCHMARK
+    fast_encode_benchmark();
+#endif
+
+    discovery_init(socket_id);
+    reliable_init(send_reliable_datagram);
+#if CONFIG_LRR_SOCKET_ESPNOW
+    rx_lock = xSemaphoreCreateMutex();
+    espnow_link_init(espnow_receive);
+#endif
+
+#if CONFIG_LRR_SOCKET_PRE_ENCODE
+    tx_ring_init(&tx_rings[eTxLaneControl],
+                 control_ring_buffer,
+                 sizeof(control_ring_buffer),
+                 lane_drops_oldest[eTxLaneControl]);
+    tx_ring_init(&tx_rings[eTxLaneImu],
+                 imu_ring_buffer,
+                 sizeof(imu_ring_buffer),
+                 lane_drops_oldest[eTxLaneImu]);
+    tx_ring_init(&tx_rings[eTxLaneLidar],
+                 lidar_ring_buffer,
+                 sizeof(lidar_ring_buffer),
+                 lane_drops_oldest[eTxLaneLidar]);
+    tx_ring_init(&tx_rings[eTxLaneDiagnostics],
+                 diagnostics_ring_buffer,
+                 sizeof(diagnostics_ring_buffer),
+                 lane_drops_oldest[eTxLaneDiagnostics]);
+
+#if CONFIG_LRR_SOCKET_BATCH
+    const esp_timer_create_args_t flush_timer_args = {
+        .callback = flush_timer_callback,
+        .name = "socket_flush",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&flush_timer_args, &flush_timer));
+
+    pb_ostream_t prefix =
+      pb_ostream_from_buffer(batch_buffer, sizeof(batch_buffer));
+    pb_encode_tag(&prefix, PB_WT_VARINT, UdpPacket_robot_id_tag);
+    pb_encode_varint(&prefix, robot_id);
+    batch_prefix_len = prefix.bytes_written;
+    batch_len = batch_prefix_len;
+#endif
+#else
+    tx_queues[eTxLaneControl] =
+      xQueueCreate(CONTROL_QUEUE_DEPTH, sizeof(UdpPacket *));
+    tx_queues[eTxLaneImu] = xQueueCreate(IMU_QUEUE_DEPTH, sizeof(UdpPacket *));
+    tx_queues[eTxLaneLidar] =
+      xQueueCreate(LIDAR_QUEUE_DEPTH, sizeof(UdpPacket *));
+    tx_queues[eTxLaneDiagnostics] =
+      xQueueCreate(DIAGNOSTICS_QUEUE_DEPTH, sizeof(UdpPacket *));
+#endif
 
     xTaskCreatePinnedToCore(socket_tx_task,
                             "socket_tx_task",
                             SOCKET_TX_TASK_STACK_SIZE,
                             NULL,
-                            10,
-                            NULL,
-                            APP_CPU_NUM);
+                            CONFIG_LRR_TASK_SOCKET_TX_PRIO,
+                            &tx_task_handle,
+                            CONFIG_LRR_TASK_SOCKET_TX_CORE);
 
     xTaskCreatePinnedToCore(socket_rx_task,
                             "socket_rx_task",
-                            SOCKET_TX_TASK_STACK_SIZE,
+                            SOCKET_RX_TASK_STACK_SIZE,
                             NULL,
-                            10,
+                            CONFIG_LRR_TASK_SOCKET_RX_PRIO,
                             NULL,
-                            APP_CPU_NUM);
+                            CONFIG_LRR_TASK_SOCKET_RX_CORE);
+
+    // Producers test tx_free_queue to see if we're up, so fill it last.
+    QueueHandle_t free_queue = xQueueCreate(TX_POOL_SIZE, sizeof(UdpPacket *));
+    for (size_t i = 0; i < TX_POOL_SIZE; i++) {
+        UdpPacket *packet = &tx_pool[i];
+        // Producers never touch it, so it's set once here
+        packet->robot_id = robot_id;
+        xQueueSend(free_queue, (void *)&packet, 0);
+    }
+    tx_free_queue = free_queue;
+
+    time_sync_init();
 }
@@ -0,0 +1,168 @@
+#include "time_sync.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include <time.h>
+
+#include "messages.pb.h"
+#include "pb_utils.h"
+#include "socket_mgr.h"
+
+// Requests go out quickly until the window is full, then settle down
+#define FAST_PERIOD_US (100 * 1000)
+#define SLOW_PERIOD_MULTIPLE 10
+// Exchanges considered when picking the offset. Both crystals are good to
+// about 20 ppm, so a window this short keeps drift under a few hundred us.
+#define WINDOW_SIZE 8
+// Anything slower than this went through a queue somewhere
+#define MAX_ROUND_TRIP_US (50 * 1000)
+// Anything before this and SNTP hasn't set the clock yet
+#define MIN_SYNCED_EPOCH 1700000000
+
+static const char *TAG = "time_sync";
+
+typedef struct
+{
+    int64_t offset_us; // Host time minus esp_timer time
+    int64_t round_trip_us;
+} sync_sample_t;
+
+static sync_sample_t window[WINDOW_SIZE];
+static size_t window_count = 0;
+static size_t window_next = 0;
+
+// Written by the RX task, read by everything that stamps a message
+static portMUX_TYPE offset_lock = portMUX_INITIALIZER_UNLOCKED;
+static int64_t offset_us;
+static bool synced = false;
+static time_sync_stats_t stats = {};
+
+static esp_timer_handle_t request_timer;
+static uint32_t request_ticks = 0;
+
+static void request_timer_callback(void *arg)
+{
+    if (window_count == WINDOW_SIZE &&
+        ++request_ticks % SLOW_PERIOD_MULTIPLE != 0) {
+        return;
+    }
+
+    UdpPacket *packet = socket_mgr_acquire_packet(0);
+    if (packet == NULL) {
+        return;
+    }
+    packet->has_time_sync = true;
+    packet->time_sync = (TimeSync)TimeSync_init_zero;
+    packet->time_sync.rover_send_us = esp_timer_get_time();
+    socket_mgr_commit_packet(eTxLaneControl, packet);
+}
+
+static void time_sync_callback(void *msg)
+{
+    int64_t rover_receive_us = esp_timer_get_time();
+    const TimeSync *answer = (const TimeSync *)msg;
+
+    // Time spent on the network, without the time the host sat on it
+    int64_t host_receive_us = answer->host_receive_ns / 1000;
+    int64_t host_send_us = answer->host_send_ns / 1000;
+    int64_t round_trip_us = (rover_receive_us - answer->rover_send_us) -
+                            (host_send_us - host_receive_us);
+    if (answer->rover_send_us <= 0 || answer->host_receive_ns <= 0 ||
+        round_trip_us < 0 || round_trip_us > MAX_ROUND_TRIP_US) {
+        taskENTER_CRITICAL(&offset_lock);
+        stats.rejected++;
+        taskEXIT_CRITICAL(&offset_lock);
+        return;
+    }
+
+    sync_sample_t *sample = &window[window_next];
+    sample->offset_us = ((host_receive_us - answer->rover_send_us) +
+                         (host_send_us - rover_receive_us)) /
+                        2;
+    sample->round_trip_us = round_trip_us;
+    window_next = (window_next + 1) % WINDOW_SIZE;
+    if (window_count < WINDOW_SIZE) {
+        window_count++;
+    }
+
+    // The quickest exchange had the least time to be delayed one way more
+    // than the other, so its offset is the one to trust
+    const sync_sample_t *best = &window[0];
+    for (size_t i = 1; i < window_count; i++) {
+        if (window[i].round_trip_us < best->round_trip_us) {
+            best = &window[i];
+        }
+    }
+
+    taskENTER_CRITICAL(&offset_lock);
+    bool first = !synced;
+    offset_us = best->offset_us;
+    synced = true;
+    stats.samples++;
+    stats.round_trip_us = (uint32_t)best->round_trip_us;
+    taskEXIT_CRITICAL(&offset_lock);
+
+    // Logging isn't allowed inside a critical section
+    if (first) {
+        ESP_LOGI(TAG,
+                 "Synced to host, round trip %lld us",
+                 (long long)best->round_trip_us);
+    }
+}
+
+bool time_sync_host_time_us(int64_t esp_us, int64_t *host_us)
+{
+    taskENTER_CRITICAL(&offset_lock);
+    bool have_offset = synced;
+    int64_t offset = offset_us;
+    taskEXIT_CRITICAL(&offset_lock);
+
+    if (have_offset) {
+        *host_us = esp_us + offset;
+        return true;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    int64_t now_us = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    *host_us = now_us - (esp_timer_get_time() - esp_us);
+    return ts.tv_sec >= MIN_SYNCED_EPOCH;
+}
+
+void timestamp_from_esp_time(int64_t time_us, TimeStamp *stamp)
+{
+    int64_t real_us;
+    time_sync_host_time_us(time_us, &real_us);
+
+    stamp->sec = (int32_t)(real_us / 1000000);
+    stamp->nanosec = (uint32_t)(real_us % 1000000) * 1000;
+}
+
+void time_sync_get_stats(time_sync_stats_t *out)
+{
+    taskENTER_CRITICAL(&offset_lock);
+    *out = stats;
+    taskEXIT_CRITICAL(&offset_lock);
+}
+
+void time_sync_restart()
+{
+    // The window is only touched by the RX task, request_ticks going back
+    // to 0 at the wrong moment only moves one request
+    window_count = 0;
+    window_next = 0;
+    request_ticks = 0;
+}
+
+void time_sync_init()
+{
+    register_callback(time_sync_callback, eTimeSync);
+
+    const esp_timer_create_args_t request_timer_args = {
+        .callback = request_timer_callback,
+        .name = "time_sync",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&request_timer_args, &request_timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(request_timer, FAST_PERIOD_US));
+}
@@ -0,0 +1,188 @@
+#include "tx_ring.h"
+
+#include <string.h>
+
+// Every record starts with its length
+#define HEADER_SIZE sizeof(uint16_t)
+
+// Written in place of a length when the rest of the buffer is skipped
+#define WRAP_MARKER 0xFFFF
+
+static uint16_t read_header(const tx_ring_t *ring, size_t offset)
+{
+    uint16_t len;
+    memcpy(&len, ring->buffer + offset, HEADER_SIZE);
+    return len;
+}
+
+static void write_header(tx_ring_t *ring, size_t offset, uint16_t len)
+{
+    memcpy(ring->buffer + offset, &len, HEADER_SIZE);
+}
+
+/*
+ * Point reserved at a gap of at least needed bytes. Write lock held.
+ */
+static bool find_space(tx_ring_t *ring, size_t needed)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    // head == tail means empty, so the writer may never catch up to the
+    // reader. All the comparisons against tail are strict for that reason.
+    if (head >= tail) {
+        if (ring->size - head >= needed) {
+            ring->reserved = head;
+            return true;
+        } else if (tail > needed) {
+            // Not enough room before the end, start over at the front. If
+            // there isn't even room for the marker the reader wraps anyway.
+            if (ring->size - head >= HEADER_SIZE) {
+                write_header(ring, head, WRAP_MARKER);
+            }
+            ring->reserved = 0;
+            return true;
+        }
+        return false;
+    }
+
+    if (tail - head > needed) {
+        ring->reserved = head;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Offset of the oldest record, skipping past the wrap, or -1 if the ring is
+ * empty. Read lock held.
+ */
+static ptrdiff_t find_oldest(tx_ring_t *ring)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    while (tail != head) {
+        if (ring->size - tail < HEADER_SIZE ||
+            read_header(ring, tail) == WRAP_MARKER) {
+            tail = 0;
+            atomic_store_explicit(&ring->tail, tail, memory_order_release);
+            continue;
+        }
+
+        return (ptrdiff_t)tail;
+    }
+
+    return -1;
+}
+
+/*
+ * Throw away the oldest record. Both locks held.
+ */
+static bool drop_oldest_record(tx_ring_t *ring)
+{
+    ptrdiff_t oldest = find_oldest(ring);
+    if (oldest < 0) {
+        return false;
+    }
+
+    size_t tail = (size_t)oldest + HEADER_SIZE + read_header(ring, oldest);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (tail == head) {
+        // Emptied it, so the whole buffer is free again.
+        tail = 0;
+        atomic_store_explicit(&ring->head, 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    ring->dropped++;
+    return true;
+}
+
+void tx_ring_init(tx_ring_t *ring,
+                  uint8_t *buffer,
+                  size_t size,
+                  bool drop_oldest)
+{
+    ring->buffer = buffer;
+    ring->size = size;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    ring->reserved = 0;
+    ring->drop_oldest = drop_oldest;
+    ring->dropped = 0;
+    ring->high_water = 0;
+    ring->write_lock = xSemaphoreCreateMutex();
+    ring->read_lock = xSemaphoreCreateMutex();
+}
+
+uint8_t *tx_ring_reserve(tx_ring_t *ring, size_t max_len)
+{
+    size_t needed = HEADER_SIZE + max_len;
+    if (max_len >= WRAP_MARKER || needed > ring->size) {
+        return NULL;
+    }
+
+    xSemaphoreTake(ring->write_lock, portMAX_DELAY);
+
+    bool found = find_space(ring, needed);
+
+    // If the consumer is busy with the oldest record, give up rather than
+    // wait for it.
+    if (!found && ring->drop_oldest &&
+        xSemaphoreTake(ring->read_lock, 0) == pdTRUE) {
+        while (!found && drop_oldest_record(ring)) {
+            found = find_space(ring, needed);
+        }
+        xSemaphoreGive(ring->read_lock);
+    }
+
+    if (!found) {
+        ring->dropped++;
+        xSemaphoreGive(ring->write_lock);
+        return NULL;
+    }
+
+    return ring->buffer + ring->reserved + HEADER_SIZE;
+}
+
+void tx_ring_commit(tx_ring_t *ring, size_t len)
+{
+    size_t head = ring->reserved + HEADER_SIZE + len;
+    write_header(ring, ring->reserved, (uint16_t)len);
+    atomic_store_explicit(&ring->head, head, memory_order_release);
+
+    // Ignores the gap left at the end when wrapping, close enough.
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t used = head >= tail ? head - tail : ring->size - tail + head;
+    if (used > ring->high_water) {
+        ring->high_water = used;
+    }
+    xSemaphoreGive(ring->write_lock);
+}
+
+void tx_ring_cancel(tx_ring_t *ring)
+{
+    xSemaphoreGive(ring->write_lock);
+}
+
+const uint8_t *tx_ring_peek(tx_ring_t *ring, size_t *len)
+{
+    xSemaphoreTake(ring->read_lock, portMAX_DELAY);
+
+    ptrdiff_t oldest = find_oldest(ring);
+    if (oldest < 0) {
+        xSemaphoreGive(ring->read_lock);
+        return NULL;
+    }
+
+    *len = read_header(ring, oldest);
+    return ring->buffer + oldest + HEADER_SIZE;
+}
+
+void tx_ring_pop(tx_ring_t *ring)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    tail += HEADER_SIZE + read_header(ring, tail);
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    xSemaphoreGive(ring->read_lock);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+/*
+ * Byte ring of encoded datagrams.
+ *
+ * Any number of producers reserve space, encode straight into it and commit
+ * the final length. A single consumer (the TX task) peeks the oldest record
+ * and pops it once it has been sent. Records are never split across the end
+ * of the buffer, so every peek is one contiguous span ready for sendto.
+ *
+ * A ring set to drop_oldest makes room for a new record by throwing away the
+ * oldest ones instead of refusing it. The consumer holds read_lock from peek
+ * to pop, and a producer only drops records if it can take that lock without
+ * waiting, so neither side ever blocks on the other for long.
+ */
+typedef struct
+{
+    uint8_t *buffer;
+    size_t size;
+    atomic_size_t head; // Next write offset, only moved by producers
+    atomic_size_t tail; // Next read offset, only moved by the consumer
+    size_t reserved;    // Start of the record being written
+    bool drop_oldest;
+    uint32_t dropped;  // Records lost to a full ring, either old or new
+    size_t high_water; // Most bytes ever waiting at once
+    SemaphoreHandle_t write_lock;
+    SemaphoreHandle_t read_lock;
+} tx_ring_t;
+
+void tx_ring_init(tx_ring_t *ring,
+                  uint8_t *buffer,
+                  size_t size,
+                  bool drop_oldest);
+
+/*
+ * Reserve room for a record of at most max_len bytes. On success the write
+ * lock is held until tx_ring_commit or tx_ring_cancel. Returns NULL (without
+ * the lock) if the space can't be found without blocking.
+ */
+uint8_t *tx_ring_reserve(tx_ring_t *ring, size_t max_len);
+
+/*
+ * Publish the reserved record, trimmed to len bytes.
+ */
+void tx_ring_commit(tx_ring_t *ring, size_t len);
+
+/*
+ * Give up on the reserved record.
+ */
+void tx_ring_cancel(tx_ring_t *ring);
+
+/*
+ * Get the oldest record without removing it. Returns NULL if the ring is
+ * empty. Otherwise the record stays put until tx_ring_pop, which must follow
+ * promptly. Consumer only.
+ */
+const uint8_t *tx_ring_peek(tx_ring_t *ring, size_t *len);
+
+/*
+ * Remove the record returned by the last peek. Consumer only.
+ */
+void tx_ring_pop(tx_ring_t *ring);
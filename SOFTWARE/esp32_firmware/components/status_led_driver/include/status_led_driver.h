@@ -14,6 +14,26 @@ enum eStatus
     eSystemGood
 };
 
+/*
+ * Things that make an LED blink for as long as they keep happening.
+ */
+enum eActivity
+{
+    eActivityTx,      // Datagram sent, flickers the agent LED
+    eActivityOverrun, // Control loop tick missed, system LED goes amber
+    eActivityCount
+};
+
+/*
+ * Queue a status change for the LED task. Never blocks, and changes that
+ * arrive close together go out in one write.
+ */
 void set_status(enum eStatus status);
 
+/*
+ * Count an activity. Only an atomic increment, so it's fine on hot paths
+ * and from ISRs.
+ */
+void status_led_activity(enum eActivity activity);
+
 void status_led_driver_init();
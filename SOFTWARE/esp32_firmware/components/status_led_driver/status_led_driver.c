@@ -1,81 +1,157 @@
 #include "status_led_driver.h"
 
 #include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
 #include <freertos/task.h>
 
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+
 #include "neopixel.h"
 
 #define STATUS_LED_DRIVER_TASK_STACK_SIZE 2048
+#define STATUS_LED_DRIVER_TASK_PRIO 1
 
 #define BRIGHTNESS 10
 
-static void status_led_driver_task(void *arg) {}
+#define STATUS_QUEUE_DEPTH 16
+// Patterns move on once per frame, and the strip is only written when a
+// frame differs from the last
+#define FRAME_MS 50
+// The system LED goes dark for a frame this often, so a hung LED task shows
+#define HEARTBEAT_PERIOD_MS 2000
+// How long an overrun, or a run of them, leaves the system LED amber
+#define OVERRUN_HOLD_MS 250
+
+#define PIXEL_COUNT 3
+#define PIXEL_SYSTEM 0
+#define PIXEL_AGENT 1
+#define PIXEL_WIFI 2
+
+static const tNeopixel status_pixels[] = {
+    [eWifiDisconnected] = { PIXEL_WIFI, NP_RGB(BRIGHTNESS, 0, 0) },
+    [eWifiProvisioning] = { PIXEL_WIFI, NP_RGB(BRIGHTNESS, BRIGHTNESS, 0) },
+    [eWifiConnected] = { PIXEL_WIFI, NP_RGB(0, BRIGHTNESS, 0) },
+    [eAgentDisconnected] = { PIXEL_AGENT, NP_RGB(BRIGHTNESS, 0, 0) },
+    [eAgentConnected] = { PIXEL_AGENT, NP_RGB(0, BRIGHTNESS, 0) },
+    [eSystemError] = { PIXEL_SYSTEM, NP_RGB(BRIGHTNESS, 0, 0) },
+    [eImuInitFailed] = { PIXEL_SYSTEM, NP_RGB(BRIGHTNESS, 0, BRIGHTNESS) },
+    [eLidarInitFailed] = { PIXEL_SYSTEM, NP_RGB(0, BRIGHTNESS, BRIGHTNESS) },
+    [eDriveBaseInitFailed] = { PIXEL_SYSTEM,
+                               NP_RGB(BRIGHTNESS, BRIGHTNESS, 0) },
+    [eSystemGood] = { PIXEL_SYSTEM, NP_RGB(0, BRIGHTNESS, 0) },
+};
+#define STATUS_COUNT (sizeof(status_pixels) / sizeof(status_pixels[0]))
+
+#define OVERRUN_COLOR NP_RGB(BRIGHTNESS, BRIGHTNESS / 2, 0)
 
 tNeopixelContext neopixels;
+// Drivers come up in parallel, and any of them may report at once. Only the
+// LED task touches the strip.
+static QueueHandle_t status_queue = NULL;
+static atomic_uint activity_counts[eActivityCount];
+
+/*
+ * Colors to show this frame, from the latest statuses and whatever has been
+ * happening since the last one.
+ */
+static void render(const uint32_t *base,
+                   uint32_t frame,
+                   const bool *active,
+                   uint32_t *out)
+{
+    memcpy(out, base, PIXEL_COUNT * sizeof(uint32_t));
+
+    static uint32_t overrun_frames = 0;
+    if (active[eActivityOverrun]) {
+        overrun_frames = OVERRUN_HOLD_MS / FRAME_MS;
+    }
+    if (overrun_frames > 0) {
+        overrun_frames--;
+        out[PIXEL_SYSTEM] = OVERRUN_COLOR;
+    } else if (frame % (HEARTBEAT_PERIOD_MS / FRAME_MS) == 0) {
+        out[PIXEL_SYSTEM] = NP_RGB(0, 0, 0);
+    }
+
+    // Flickers at up to half the frame rate while packets are going out
+    if (active[eActivityTx] && frame % 2 == 0) {
+        out[PIXEL_AGENT] = NP_RGB(0, 0, 0);
+    }
+}
+
+static void status_led_driver_task(void *arg)
+{
+    uint32_t base[PIXEL_COUNT] = {};
+    uint32_t shown[PIXEL_COUNT] = {};
+    unsigned last_counts[eActivityCount] = {};
+    bool first = true;
+
+    for (uint32_t frame = 0;; frame++) {
+        // Wait out the frame, taking every status that arrives meanwhile so a
+        // burst becomes one write
+        TickType_t frame_start = xTaskGetTickCount();
+        TickType_t frame_ticks = pdMS_TO_TICKS(FRAME_MS);
+        enum eStatus status;
+        TickType_t elapsed;
+        while ((elapsed = xTaskGetTickCount() - frame_start) < frame_ticks &&
+               xQueueReceive(status_queue, &status, frame_ticks - elapsed) ==
+                 pdTRUE) {
+            if (status < STATUS_COUNT) {
+                base[status_pixels[status].index] = status_pixels[status].rgb;
+            }
+        }
+
+        bool active[eActivityCount];
+        for (int i = 0; i < eActivityCount; i++) {
+            unsigned count =
+              atomic_load_explicit(&activity_counts[i], memory_order_relaxed);
+            active[i] = count != last_counts[i];
+            last_counts[i] = count;
+        }
+
+        uint32_t colors[PIXEL_COUNT];
+        render(base, frame, active, colors);
+        if (!first && memcmp(colors, shown, sizeof(colors)) == 0) {
+            continue;
+        }
+        first = false;
+        memcpy(shown, colors, sizeof(colors));
+
+        tNeopixel pixels[PIXEL_COUNT];
+        for (int i = 0; i < PIXEL_COUNT; i++) {
+            pixels[i] = (tNeopixel){ i, colors[i] };
+        }
+        neopixel_SetPixel(neopixels, pixels, PIXEL_COUNT);
+    }
+}
 
 void set_status(enum eStatus status)
 {
-    switch (status) {
-        case eWifiDisconnected:
-            neopixel_SetPixel(
-              neopixels, (tNeopixel[1]){ { 2, NP_RGB(BRIGHTNESS, 0, 0) } }, 1);
-            break;
-        case eWifiProvisioning:
-            neopixel_SetPixel(
-              neopixels,
-              (tNeopixel[1]){ { 2, NP_RGB(BRIGHTNESS, BRIGHTNESS, 0) } },
-              1);
-            break;
-        case eWifiConnected:
-            neopixel_SetPixel(
-              neopixels, (tNeopixel[1]){ { 2, NP_RGB(0, BRIGHTNESS, 0) } }, 1);
-            break;
-        case eAgentDisconnected:
-            neopixel_SetPixel(
-              neopixels, (tNeopixel[1]){ { 1, NP_RGB(BRIGHTNESS, 0, 0) } }, 1);
-            break;
-        case eAgentConnected:
-            neopixel_SetPixel(
-              neopixels, (tNeopixel[1]){ { 1, NP_RGB(0, BRIGHTNESS, 0) } }, 1);
-            break;
-        case eSystemError:
-            neopixel_SetPixel(
-              neopixels, (tNeopixel[1]){ { 0, NP_RGB(BRIGHTNESS, 0, 0) } }, 1);
-            break;
-        case eImuInitFailed:
-            neopixel_SetPixel(
-              neopixels,
-              (tNeopixel[1]){ { 0, NP_RGB(BRIGHTNESS, 0, BRIGHTNESS) } },
-              1);
-            break;
-        case eLidarInitFailed:
-            neopixel_SetPixel(
-              neopixels,
-              (tNeopixel[1]){ { 0, NP_RGB(0, BRIGHTNESS, BRIGHTNESS) } },
-              1);
-            break;
-        case eDriveBaseInitFailed:
-            neopixel_SetPixel(
-              neopixels,
-              (tNeopixel[1]){ { 0, NP_RGB(BRIGHTNESS, BRIGHTNESS, 0) } },
-              1);
-            break;
-        case eSystemGood:
-            neopixel_SetPixel(
-              neopixels, (tNeopixel[1]){ { 0, NP_RGB(0, BRIGHTNESS, 0) } }, 1);
-            break;
+    if (status_queue == NULL) {
+        return;
     }
+    // Only full if the LED task is starved, and then the next status will
+    // fix the picture anyway
+    xQueueSend(status_queue, &status, 0);
+}
+
+void status_led_activity(enum eActivity activity)
+{
+    atomic_fetch_add_explicit(
+      &activity_counts[activity], 1, memory_order_relaxed);
 }
 
 void status_led_driver_init()
 {
-    neopixels = neopixel_Init(3, 10);
-
-    neopixel_SetPixel(neopixels,
-                      (tNeopixel[3]){
-                        { 0, NP_RGB(0, 0, 0) }, /* red */
-                        { 1, NP_RGB(0, 0, 0) }, /* green */
-                        { 2, NP_RGB(0, 0, 0) }, /* blue */
-                      },
-                      3);
+    neopixels = neopixel_Init(PIXEL_COUNT, 10);
+    status_queue = xQueueCreate(STATUS_QUEUE_DEPTH, sizeof(enum eStatus));
+
+    // The task's first frame turns everything off until a status arrives
+    xTaskCreate(status_led_driver_task,
+                "status_led_driver_task",
+                STATUS_LED_DRIVER_TASK_STACK_SIZE,
+                NULL,
+                STATUS_LED_DRIVER_TASK_PRIO,
+                NULL);
 }
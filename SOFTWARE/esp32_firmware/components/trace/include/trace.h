@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+/*
+ * Code paths that can be timed. Add new ones before eTraceProbeCount and
+ * give them a name in trace.c.
+ */
+typedef enum TRACE_PROBES
+{
+    eTraceControlLoop, // One pass of the drive base loop
+    eTraceUpdateMotor, // Velocity estimate and PID for one wheel
+    eTraceLidarCrc,    // Checksum of one LD20 frame
+    eTraceAddToPacket, // One LD20 frame into the scan packet
+    eTracePbEncode,    // Serializing one UdpPacket
+    eTraceSendto,      // One datagram through lwIP
+    eTraceProbeCount
+} eTraceProbe;
+
+#if CONFIG_LRR_TRACE
+
+#include "esp_cpu.h"
+
+/*
+ * Time the code between TRACE_BEGIN(probe) and TRACE_END(probe) in the same
+ * scope. A probe can only appear once per scope.
+ */
+#define TRACE_BEGIN(probe)                                                     \
+    uint32_t trace_start_##probe = esp_cpu_get_cycle_count()
+#define TRACE_END(probe)                                                       \
+    trace_record((probe), esp_cpu_get_cycle_count() - trace_start_##probe)
+
+/*
+ * Add a sample to the current core's ring. Safe from tasks and ISRs.
+ */
+void trace_record(eTraceProbe probe, uint32_t cycles);
+
+#else
+
+#define TRACE_BEGIN(probe)
+#define TRACE_END(probe)
+
+#endif
+
+/*
+ * Write a text table of min, mean, p99 and max for every probe over the
+ * samples currently in the rings. Returns the length written, not counting
+ * the terminator.
+ */
+size_t trace_dump(char *buffer, size_t size);
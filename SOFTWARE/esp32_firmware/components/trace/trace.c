@@ -0,0 +1,133 @@
+#include "trace.h"
+
+#include <stdio.h>
+
+#if CONFIG_LRR_TRACE
+
+#include "esp_attr.h"
+#include "esp_cpu.h"
+#include "esp_rom_sys.h"
+#include "freertos/FreeRTOS.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RING_SIZE CONFIG_LRR_TRACE_RING_SIZE
+_Static_assert((RING_SIZE & (RING_SIZE - 1)) == 0,
+               "LRR_TRACE_RING_SIZE must be a power of two");
+
+// Probe in the top bits and cycles in the rest, so a sample is one word and
+// can't be read half written.
+#define PROBE_BITS 4
+#define CYCLE_BITS (32 - PROBE_BITS)
+#define CYCLE_MASK ((1u << CYCLE_BITS) - 1)
+_Static_assert(eTraceProbeCount <= (1 << PROBE_BITS), "Too many probes");
+
+static const char *probe_names[eTraceProbeCount] = {
+    [eTraceControlLoop] = "control_loop",
+    [eTraceUpdateMotor] = "update_motor",
+    [eTraceLidarCrc] = "lidar_crc",
+    [eTraceAddToPacket] = "add_to_packet",
+    [eTracePbEncode] = "pb_encode",
+    [eTraceSendto] = "sendto",
+};
+
+// Zero means empty. A real zero cycle sample is stored as one.
+static uint32_t rings[portNUM_PROCESSORS][RING_SIZE];
+static atomic_uint ring_next[portNUM_PROCESSORS];
+
+void IRAM_ATTR trace_record(eTraceProbe probe, uint32_t cycles)
+{
+    // A task that migrates between these two lines just lands in the other
+    // core's ring, which costs at most one overwritten sample.
+    int core = esp_cpu_get_core_id();
+    unsigned slot =
+      atomic_fetch_add_explicit(&ring_next[core], 1, memory_order_relaxed);
+
+    if (cycles > CYCLE_MASK) {
+        cycles = CYCLE_MASK;
+    } else if (cycles == 0) {
+        cycles = 1;
+    }
+    rings[core][slot & (RING_SIZE - 1)] =
+      ((uint32_t)probe << CYCLE_BITS) | cycles;
+}
+
+static int compare_cycles(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+size_t trace_dump(char *buffer, size_t size)
+{
+    size_t total = portNUM_PROCESSORS * RING_SIZE;
+    uint32_t *cycles = malloc(total * sizeof(uint32_t));
+    if (cycles == NULL) {
+        return snprintf(buffer, size, "Out of memory\n");
+    }
+
+    // Copy everything first so the rings keep filling while we sort.
+    uint32_t *snapshot = malloc(total * sizeof(uint32_t));
+    if (snapshot == NULL) {
+        free(cycles);
+        return snprintf(buffer, size, "Out of memory\n");
+    }
+    memcpy(snapshot, rings, total * sizeof(uint32_t));
+
+    uint32_t mhz = esp_rom_get_cpu_ticks_per_us();
+    size_t len = snprintf(buffer,
+                          size,
+                          "%-14s %6s %8s %8s %8s %8s  (cycles @ %lu MHz)\n",
+                          "probe",
+                          "count",
+                          "min",
+                          "mean",
+                          "p99",
+                          "max",
+                          (unsigned long)mhz);
+
+    for (int probe = 0; probe < eTraceProbeCount && len < size; probe++) {
+        size_t count = 0;
+        uint64_t sum = 0;
+        for (size_t i = 0; i < total; i++) {
+            uint32_t sample = snapshot[i];
+            if (sample != 0 && (sample >> CYCLE_BITS) == (uint32_t)probe) {
+                cycles[count++] = sample & CYCLE_MASK;
+                sum += sample & CYCLE_MASK;
+            }
+        }
+
+        if (count == 0) {
+            len += snprintf(
+              buffer + len, size - len, "%-14s %6u\n", probe_names[probe], 0);
+            continue;
+        }
+
+        qsort(cycles, count, sizeof(uint32_t), compare_cycles);
+        len += snprintf(buffer + len,
+                        size - len,
+                        "%-14s %6u %8lu %8lu %8lu %8lu\n",
+                        probe_names[probe],
+                        (unsigned)count,
+                        (unsigned long)cycles[0],
+                        (unsigned long)(sum / count),
+                        (unsigned long)cycles[(count * 99) / 100],
+                        (unsigned long)cycles[count - 1]);
+    }
+
+    free(snapshot);
+    free(cycles);
+    return len < size ? len : size - 1;
+}
+
+#else
+
+size_t trace_dump(char *buffer, size_t size)
+{
+    return snprintf(buffer, size, "Tracing is off, enable CONFIG_LRR_TRACE\n");
+}
+
+#endif
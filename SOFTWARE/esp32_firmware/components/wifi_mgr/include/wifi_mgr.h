@@ -1,3 +1,25 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct
+{
+    // Smoothed, dBm. 0 until the first sample after connecting.
+    int8_t rssi;
+    bool link_poor;
+    // Times the link came back after being lost
+    uint32_t reconnects;
+    // Times the RSSI fell below CONFIG_LRR_WIFI_POOR_RSSI
+    uint32_t poor_link_events;
+} wifi_mgr_stats_t;
+
 void wifi_mgr_init();
+
+/*
+ * True while the smoothed RSSI is under CONFIG_LRR_WIFI_POOR_RSSI, and until
+ * it climbs back past the hysteresis band. Producers of bulky, best effort
+ * traffic should back off while it's set.
+ */
+bool wifi_mgr_link_poor();
+void wifi_mgr_get_stats(wifi_mgr_stats_t *stats);
@@ -5,12 +5,15 @@
 #include <freertos/event_groups.h>
 #include <freertos/task.h>
 
+#include "driver/gpio.h"
 #include "esp_event.h"
+#include "esp_heap_caps.h"
 #include "esp_http_server.h"
 #include "esp_log.h"
 #include "esp_netif.h"
 #include "esp_sntp.h"
 #include "esp_spiffs.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
 #include "esp_wifi_default.h"
 #include "nvs_flash.h"
@@ -29,9 +32,19 @@
 
 #include "wifi_mgr.h"
 
+#include "flight_recorder.h"
+#include "sdkconfig.h"
 #include "status_led_driver.h"
+#include "trace.h"
 
 #define REPROVISION_PIN 11
+// Held this long, so a knock doesn't wipe the credentials
+#define REPROVISION_HOLD_US (3 * 1000 * 1000)
+#define REPROVISION_POLL_US (100 * 1000)
+
+// Provisioning is torn down this long after the credentials work, which
+// leaves esp_prov.py time to read back the result
+#define PROV_STOP_DELAY_US (5 * 1000 * 1000)
 
 #define WIFI_CONNECTION_TIMEOUT_MS 10000
 
@@ -43,6 +56,28 @@ esp_netif_t *esp_netif_sta;
 esp_netif_t *esp_netif_ap;
 
 static const char *TAG = "wifi_mgr";
+
+static wifi_config_t softap_config = {
+    .ap = {
+        .ssid = "little_red_rover",
+        .ssid_len = 0,
+        .channel = 0,
+        .password = "",
+        .max_connection = 14,
+        .authmode = WIFI_AUTH_OPEN,
+        .pmf_cfg = {
+                .required = true,
+        },
+    },
+};
+
+static esp_timer_handle_t prov_stop_timer;
+// Internal heap free before provisioning came down, for the log
+static size_t prov_heap_before = 0;
+
+static void release_provisioning();
+static void resume_after_provisioning();
+
 static void wifi_prov_event_handler(void *arg,
                                     esp_event_base_t event_base,
                                     int event_id,
@@ -81,10 +116,13 @@ static void wifi_prov_event_handler(void *arg,
             }
             case WIFI_PROV_CRED_SUCCESS:
                 ESP_LOGI(TAG, "Provisioning successful");
+                esp_timer_stop(prov_stop_timer);
+                esp_timer_start_once(prov_stop_timer, PROV_STOP_DELAY_US);
                 break;
             case WIFI_PROV_END:
                 /* De-initialize manager once provisioning is finished */
-                // wifi_prov_mgr_deinit();
+                release_provisioning();
+                resume_after_provisioning();
                 break;
             default:
                 break;
@@ -137,9 +175,64 @@ static const char *TAG_STA = "WiFi Sta";
 
 static int s_retry_num = 0;
 
+// Reconnect attempts back off from the first delay to the last. The first
+// few go straight back to the AP we lost, on its channel, skipping the scan.
+#define RECONNECT_MIN_DELAY_US (50 * 1000)
+#define RECONNECT_MAX_DELAY_US (2 * 1000 * 1000)
+#define FAST_RECONNECT_ATTEMPTS 3
+
+// RSSI is sampled this often while connected, and smoothed over a few
+// samples so one bad packet doesn't flip the link state
+#define RSSI_PERIOD_US (500 * 1000)
+#define RSSI_SMOOTHING 4
+
+static esp_timer_handle_t reconnect_timer;
+static esp_timer_handle_t rssi_timer;
+#if CONFIG_LRR_WIFI_REPROVISION_BUTTON
+static esp_timer_handle_t reprovision_timer;
+#endif
+// Once the STA has had an IP, auth failures are taken as a flaky link
+// rather than wrong credentials
+static bool ever_connected = false;
+static bool sta_connected = false;
+static uint8_t last_bssid[6];
+static uint8_t last_channel = 0;
+
+static volatile bool link_poor = false;
+static wifi_mgr_stats_t stats = {};
+static int32_t smoothed_rssi = 0;
+
 /* FreeRTOS event group to signal when we are connected/disconnected */
 static EventGroupHandle_t s_wifi_event_group;
 
+/*
+ * Apply a STA config for this boot only. The copy in NVS is what the
+ * rover was provisioned with, and a BSSID or channel pinned for a fast
+ * reconnect mustn't outlive the AP it was pinned to.
+ */
+static void set_sta_config_transient(wifi_config_t *config)
+{
+    esp_wifi_set_storage(WIFI_STORAGE_RAM);
+    esp_wifi_set_config(WIFI_IF_STA, config);
+    esp_wifi_set_storage(WIFI_STORAGE_FLASH);
+}
+
+/*
+ * Drop a fast reconnect pin once it has done its job, so the next
+ * reconnect that goes on to scan finds the AP wherever it is.
+ */
+static void unpin_sta()
+{
+    wifi_config_t config;
+    if (esp_wifi_get_config(WIFI_IF_STA, &config) != ESP_OK ||
+        (!config.sta.bssid_set && config.sta.channel == 0)) {
+        return;
+    }
+    config.sta.bssid_set = false;
+    config.sta.channel = 0;
+    set_sta_config_transient(&config);
+}
+
 static void wifi_event_handler(void *arg,
                                esp_event_base_t event_base,
                                int32_t event_id,
@@ -163,27 +256,60 @@ static void wifi_event_handler(void *arg,
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
         esp_wifi_connect();
         ESP_LOGI(TAG_STA, "Station started");
+    } else if (event_base == WIFI_EVENT &&
+               event_id == WIFI_EVENT_STA_CONNECTED) {
+        // Remembered so a reconnect can skip the scan
+        wifi_event_sta_connected_t *event =
+          (wifi_event_sta_connected_t *)event_data;
+        memcpy(last_bssid, event->bssid, sizeof(last_bssid));
+        last_channel = event->channel;
     } else if (event_base == WIFI_EVENT &&
                event_id == WIFI_EVENT_STA_DISCONNECTED) {
         wifi_err_reason_t reason =
           (*(wifi_event_sta_disconnected_t *)event_data).reason;
-        if (reason == WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT ||
-            reason == WIFI_REASON_NO_AP_FOUND ||
-            reason == WIFI_REASON_NO_AP_FOUND_W_COMPATIBLE_SECURITY ||
-            reason == WIFI_REASON_HANDSHAKE_TIMEOUT ||
-            reason == WIFI_REASON_AUTH_EXPIRE ||
-            reason == WIFI_REASON_AUTH_FAIL) {
+        // An AP that isn't there right now says nothing about the
+        // credentials, so that only ever leads to another attempt
+        if (!ever_connected &&
+            (reason == WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT ||
+             reason == WIFI_REASON_HANDSHAKE_TIMEOUT ||
+             reason == WIFI_REASON_AUTH_EXPIRE ||
+             reason == WIFI_REASON_AUTH_FAIL)) {
             wifi_prov_mgr_reset_provisioning();
             ESP_LOGI(
               TAG_STA,
               "Authentication failed. Resetting provisioning and restarting.");
             esp_restart();
         }
+
+        if (sta_connected) {
+            ESP_LOGW(TAG_STA, "Disconnected (reason %d)", (int)reason);
+            set_status(eWifiDisconnected);
+        }
+        sta_connected = false;
+        link_poor = false;
+        xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+
+        int shift = s_retry_num < 6 ? s_retry_num : 6;
+        int64_t delay_us = RECONNECT_MIN_DELAY_US << shift;
+        if (delay_us > RECONNECT_MAX_DELAY_US) {
+            delay_us = RECONNECT_MAX_DELAY_US;
+        }
+        s_retry_num++;
+        esp_timer_stop(reconnect_timer);
+        esp_timer_start_once(reconnect_timer, delay_us);
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
         STA_IP = event->ip_info.ip;
         ESP_LOGI(TAG_STA, "Got IP:" IPSTR, IP2STR(&STA_IP));
+        if (ever_connected) {
+            stats.reconnects++;
+            set_status(eWifiConnected);
+        }
         s_retry_num = 0;
+        ever_connected = true;
+        sta_connected = true;
+        unpin_sta();
+        smoothed_rssi = 0;
         esp_netif_dns_info_t dns;
         if (esp_netif_get_dns_info(esp_netif_sta, ESP_NETIF_DNS_MAIN, &dns) ==
             ESP_OK) {
@@ -194,6 +320,116 @@ static void wifi_event_handler(void *arg,
     }
 }
 
+static void reconnect_timer_callback(void *arg)
+{
+    wifi_config_t config;
+    if (esp_wifi_get_config(WIFI_IF_STA, &config) == ESP_OK) {
+        // Straight back to the AP we had first. If that keeps failing, it
+        // may have moved channel or we may have roamed, so scan again.
+        bool fast = last_channel != 0 && s_retry_num <= FAST_RECONNECT_ATTEMPTS;
+        config.sta.bssid_set = fast;
+        memcpy(config.sta.bssid, last_bssid, sizeof(config.sta.bssid));
+        config.sta.channel = fast ? last_channel : 0;
+        set_sta_config_transient(&config);
+    }
+    esp_wifi_connect();
+}
+
+static void rssi_timer_callback(void *arg)
+{
+    wifi_ap_record_t ap;
+    if (!sta_connected || esp_wifi_sta_get_ap_info(&ap) != ESP_OK) {
+        return;
+    }
+
+    if (smoothed_rssi == 0) {
+        smoothed_rssi = ap.rssi;
+    } else {
+        smoothed_rssi += (ap.rssi - smoothed_rssi) / RSSI_SMOOTHING;
+    }
+    stats.rssi = (int8_t)smoothed_rssi;
+
+    // Hysteresis, so a link sitting on the threshold doesn't flap
+    if (!link_poor && smoothed_rssi < CONFIG_LRR_WIFI_POOR_RSSI) {
+        link_poor = true;
+        stats.poor_link_events++;
+        ESP_LOGW(TAG_STA, "Link is poor, RSSI %ld", (long)smoothed_rssi);
+    } else if (link_poor &&
+               smoothed_rssi >=
+                 CONFIG_LRR_WIFI_POOR_RSSI + CONFIG_LRR_WIFI_RSSI_HYSTERESIS) {
+        link_poor = false;
+        ESP_LOGI(TAG_STA, "Link recovered, RSSI %ld", (long)smoothed_rssi);
+    }
+}
+
+#if CONFIG_LRR_WIFI_REPROVISION_BUTTON
+static void reprovision_timer_callback(void *arg)
+{
+    static int64_t held_us = 0;
+    // Active low, the board pulls it up
+    if (gpio_get_level(REPROVISION_PIN) != 0) {
+        held_us = 0;
+        return;
+    }
+    held_us += REPROVISION_POLL_US;
+    if (held_us >= REPROVISION_HOLD_US) {
+        ESP_LOGW(TAG, "Reprovision button held. Resetting provisioning.");
+        wifi_prov_mgr_reset_provisioning();
+        esp_restart();
+    }
+}
+#endif
+
+static void prov_stop_timer_callback(void *arg)
+{
+    prov_heap_before = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    // WIFI_PROV_END follows once it's down
+    wifi_prov_mgr_stop_provisioning();
+}
+
+/*
+ * Free the provisioning manager, along with protocomm, its security session
+ * and its endpoints on the web server. The server itself is ours and stays.
+ */
+static void release_provisioning()
+{
+    if (prov_heap_before == 0) {
+        prov_heap_before = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    }
+    wifi_prov_mgr_deinit();
+    size_t heap_after = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    ESP_LOGI(TAG,
+             "Provisioning released, internal heap %u -> %u free",
+             (unsigned)prov_heap_before,
+             (unsigned)heap_after);
+}
+
+/*
+ * Stopping provisioning leaves Wi-Fi as a station, driven by nobody. Put
+ * the SoftAP back unless it's not wanted, and take over reconnecting.
+ */
+static void resume_after_provisioning()
+{
+#if CONFIG_LRR_WIFI_STA_ONLY
+    ESP_LOGI(TAG, "Provisioned, leaving the SoftAP down");
+#else
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_APSTA));
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_AP, &softap_config));
+#endif
+    ESP_ERROR_CHECK(esp_event_handler_register(
+      WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler, NULL));
+}
+
+bool wifi_mgr_link_poor()
+{
+    return link_poor;
+}
+
+void wifi_mgr_get_stats(wifi_mgr_stats_t *out)
+{
+    *out = stats;
+}
+
 static esp_err_t get_ip_handler(httpd_req_t *req)
 {
     ESP_LOGI(TAG, "Got request for IP. Sending " IPSTR, IP2STR(&STA_IP));
@@ -258,6 +494,50 @@ static esp_err_t get_agent_ip_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
+#define TRACE_DUMP_SIZE 1024
+
+static esp_err_t get_trace_handler(httpd_req_t *req)
+{
+    char *dump = (char *)malloc(TRACE_DUMP_SIZE);
+    if (dump == NULL) {
+        return ESP_FAIL;
+    }
+    trace_dump(dump, TRACE_DUMP_SIZE);
+    httpd_resp_set_type(req, "text/plain");
+    httpd_resp_sendstr(req, dump);
+    free(dump);
+    return ESP_OK;
+}
+
+static bool send_recording_chunk(const uint8_t *data, size_t len, void *ctx)
+{
+    httpd_req_t *req = (httpd_req_t *)ctx;
+    return httpd_resp_send_chunk(req, (const char *)data, len) == ESP_OK;
+}
+
+/*
+ * Streams the flight recorder a sector at a time, as written to flash. See
+ * flight_recorder.h for the format.
+ */
+static esp_err_t get_recording_handler(httpd_req_t *req)
+{
+    httpd_resp_set_type(req, "application/octet-stream");
+    esp_err_t err = flight_recorder_dump(send_recording_chunk, req);
+    if (err == ESP_ERR_NOT_SUPPORTED) {
+        httpd_resp_set_type(req, "text/plain");
+        httpd_resp_sendstr(req,
+                           "Recording is off, enable CONFIG_LRR_RECORDER\n");
+        return ESP_OK;
+    }
+    if (err != ESP_OK) {
+        httpd_resp_send_err(
+          req, HTTPD_500_INTERNAL_SERVER_ERROR, esp_err_to_name(err));
+        return ESP_OK;
+    }
+    // An empty chunk ends the response
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
 /* Save the server handle here */
 static int *_server_context = NULL;
 static httpd_handle_t _server = NULL;
@@ -266,6 +546,8 @@ static esp_err_t start_webserver()
 {
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.uri_match_fn = httpd_uri_match_wildcard;
+    // Ours plus the five provisioning registers on this server
+    config.max_uri_handlers = 12;
 
     ESP_LOGI(TAG, "Starting HTTP Server");
     ESP_ERROR_CHECK(httpd_start(&_server, &config));
@@ -279,8 +561,18 @@ static esp_err_t start_webserver()
                                      .method = HTTP_GET,
                                      .handler = get_agent_ip_handler,
                                      .user_ctx = "" };
+    httpd_uri_t trace_get_uri = { .uri = "/trace",
+                                  .method = HTTP_GET,
+                                  .handler = get_trace_handler,
+                                  .user_ctx = "" };
+    httpd_uri_t recording_get_uri = { .uri = "/recording",
+                                      .method = HTTP_GET,
+                                      .handler = get_recording_handler,
+                                      .user_ctx = "" };
     httpd_register_uri_handler(_server, &common_get_uri);
     httpd_register_uri_handler(_server, &agent_ip_get_uri);
+    httpd_register_uri_handler(_server, &trace_get_uri);
+    httpd_register_uri_handler(_server, &recording_get_uri);
     httpd_register_err_handler(_server, HTTPD_404_NOT_FOUND, get_ip_handler);
 
     return ESP_OK;
@@ -290,14 +582,6 @@ void wifi_mgr_init()
 {
     set_status(eWifiDisconnected);
 
-    /* NVS INIT */
-    esp_err_t ret = nvs_flash_init();
-    if (ret == ESP_ERR_NVS_NO_FREE_PAGES ||
-        ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-        ESP_ERROR_CHECK(nvs_flash_erase());
-        ESP_ERROR_CHECK(nvs_flash_init());
-    }
-
     /* EVENT LOOP INIT */
     ESP_ERROR_CHECK(esp_event_loop_create_default());
 
@@ -308,22 +592,11 @@ void wifi_mgr_init()
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_APSTA));
+#if CONFIG_LRR_WIFI_PROFILE_REALTIME
+    ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_NONE));
+#endif
 
-    wifi_config_t wifi_config = {
-        .ap = {
-            .ssid = "little_red_rover",
-            .ssid_len = 0,
-            .channel = 0,
-            .password = "",
-            .max_connection = 14,
-            .authmode = WIFI_AUTH_OPEN,
-            .pmf_cfg = {
-                    .required = true,
-            },
-        },
-    };
-
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_AP, &wifi_config));
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_AP, &softap_config));
 
     ESP_LOGI("AP", "ESP_WIFI_MODE_AP");
     esp_netif_ap = esp_netif_create_default_wifi_ap();
@@ -352,6 +625,41 @@ void wifi_mgr_init()
     /* PROVISIONING INIT */
     s_wifi_event_group = xEventGroupCreate();
 
+    const esp_timer_create_args_t reconnect_timer_args = {
+        .callback = reconnect_timer_callback,
+        .name = "wifi_reconnect",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&reconnect_timer_args, &reconnect_timer));
+    const esp_timer_create_args_t rssi_timer_args = {
+        .callback = rssi_timer_callback,
+        .name = "wifi_rssi",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&rssi_timer_args, &rssi_timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(rssi_timer, RSSI_PERIOD_US));
+    const esp_timer_create_args_t prov_stop_timer_args = {
+        .callback = prov_stop_timer_callback,
+        .name = "wifi_prov_stop",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&prov_stop_timer_args, &prov_stop_timer));
+
+#if CONFIG_LRR_WIFI_REPROVISION_BUTTON
+    gpio_config_t reprovision_config = {
+        .pin_bit_mask = 1ULL << REPROVISION_PIN,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE,
+        .intr_type = GPIO_INTR_DISABLE,
+    };
+    ESP_ERROR_CHECK(gpio_config(&reprovision_config));
+    const esp_timer_create_args_t reprovision_timer_args = {
+        .callback = reprovision_timer_callback,
+        .name = "wifi_reprovision",
+    };
+    ESP_ERROR_CHECK(
+      esp_timer_create(&reprovision_timer_args, &reprovision_timer));
+    ESP_ERROR_CHECK(
+      esp_timer_start_periodic(reprovision_timer, REPROVISION_POLL_US));
+#endif
+
     ESP_ERROR_CHECK(esp_event_handler_register(
       WIFI_PROV_EVENT, ESP_EVENT_ANY_ID, &wifi_prov_event_handler, NULL));
 
@@ -367,6 +675,7 @@ void wifi_mgr_init()
 
     bool provisioned = false;
     ESP_ERROR_CHECK(wifi_prov_mgr_is_provisioned(&provisioned));
+    bool softap = true;
 
     if (!provisioned) {
         set_status(eWifiProvisioning);
@@ -377,12 +686,19 @@ void wifi_mgr_init()
           WIFI_PROV_SECURITY_1, NULL, "little_red_rover", NULL));
     } else {
         ESP_LOGI(TAG, "Already provisioned, starting Wi-Fi STA");
+        // Only needed to find that out, the SoftAP below is our own
+        release_provisioning();
 
         ESP_ERROR_CHECK(esp_event_handler_register(
           WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler, NULL));
         ESP_ERROR_CHECK(esp_event_handler_register(
           IP_EVENT, IP_EVENT_STA_GOT_IP, &wifi_event_handler, NULL));
 
+#if CONFIG_LRR_WIFI_STA_ONLY
+        ESP_LOGI(TAG, "Provisioned, dropping the SoftAP");
+        ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+        softap = false;
+#endif
         ESP_ERROR_CHECK(esp_wifi_start());
     }
 
@@ -392,8 +708,10 @@ void wifi_mgr_init()
     vTaskDelay(100 / portTICK_PERIOD_MS);
 
     ESP_LOGI(TAG, "Wifi started successfully");
-    ip_napt_enable(esp_ip4addr_aton(DEFAULT_AP_IP), 1);
-    ESP_LOGI(TAG, "ip_napt enabled");
+    if (softap) {
+        ip_napt_enable(esp_ip4addr_aton(DEFAULT_AP_IP), 1);
+        ESP_LOGI(TAG, "ip_napt enabled");
+    }
 
     // Set up time sync
     esp_sntp_setoperatingmode(ESP_SNTP_OPMODE_POLL);
@@ -412,8 +730,8 @@ void wifi_mgr_init()
         set_status(eWifiConnected);
         ESP_LOGI(TAG, "Device is provisioned and connected.");
     } else {
-        // Error handling is for chumps
-        ESP_LOGE(TAG, "Wifi connection timed out. Rebooting...");
-        esp_restart();
+        // The reconnect timer keeps trying, and everything after us copes
+        // with the network not being there yet
+        ESP_LOGW(TAG, "Wifi connection timed out, still trying");
     }
 }
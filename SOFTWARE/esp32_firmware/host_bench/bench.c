@@ -0,0 +1,202 @@
+// Host benchmarks for the firmware's pure logic. See CMakeLists.txt.
+
+#include "bench.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Each run goes on at least this long, and the best of them is kept, so a
+// context switch in one run doesn't show up as a regression
+#define MIN_RUN_NS (20 * 1000 * 1000)
+#define RUNS 5
+
+#define MAX_RESULTS 64
+#define MAX_NAME 48
+
+typedef struct
+{
+    char name[MAX_NAME];
+    double value;
+    bool timed;
+} result_t;
+
+volatile double bench_sink;
+
+static result_t results[MAX_RESULTS];
+static size_t result_count = 0;
+static int failures = 0;
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void add_result(const char *name, double value, bool timed)
+{
+    if (result_count == MAX_RESULTS) {
+        bench_fail("Out of room for results, raise MAX_RESULTS");
+        return;
+    }
+    result_t *result = &results[result_count++];
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    result->value = value;
+    result->timed = timed;
+}
+
+void bench_run(const char *name,
+               const char *unit,
+               size_t (*fn)(void *ctx),
+               void *ctx)
+{
+    // Warm the caches, and find how many passes fill a run
+    int64_t start = now_ns();
+    size_t items = fn(ctx);
+    int64_t pass_ns = now_ns() - start;
+    if (items == 0) {
+        bench_fail("%s did no work", name);
+        return;
+    }
+    size_t passes = pass_ns > 0 ? (size_t)(MIN_RUN_NS / pass_ns) + 1 : 1000;
+
+    double best = 0.0;
+    for (int run = 0; run < RUNS; run++) {
+        size_t total = 0;
+        start = now_ns();
+        for (size_t i = 0; i < passes; i++) {
+            total += fn(ctx);
+        }
+        double ns = (double)(now_ns() - start) / (double)total;
+        if (run == 0 || ns < best) {
+            best = ns;
+        }
+    }
+
+    printf("%-32s %10.1f ns/%s\n", name, best, unit);
+    add_result(name, best, true);
+}
+
+void bench_note(const char *name, double value, const char *unit)
+{
+    printf("%-32s %10.4f %s\n", name, value, unit);
+    add_result(name, value, false);
+}
+
+void bench_fail(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "FAIL: ");
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    failures++;
+}
+
+uint32_t bench_random(uint32_t *seed)
+{
+    *seed = *seed * 1664525 + 1013904223;
+    return *seed >> 8;
+}
+
+static void save_results(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        bench_fail("Can't write %s", path);
+        return;
+    }
+    for (size_t i = 0; i < result_count; i++) {
+        if (results[i].timed) {
+            fprintf(f, "%s %.1f\n", results[i].name, results[i].value);
+        }
+    }
+    fclose(f);
+}
+
+/*
+ * Compare against results saved with -o. Returns how many got slower than
+ * tolerance percent.
+ */
+static int compare_results(const char *path, double tolerance)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        bench_fail("Can't read %s", path);
+        return 0;
+    }
+
+    printf("\nAgainst %s:\n", path);
+    int regressions = 0;
+    char name[MAX_NAME];
+    double before;
+    while (fscanf(f, "%47s %lf", name, &before) == 2) {
+        for (size_t i = 0; i < result_count; i++) {
+            if (!results[i].timed || strcmp(results[i].name, name) != 0) {
+                continue;
+            }
+            double change = (results[i].value - before) / before * 100.0;
+            bool regressed = change > tolerance;
+            printf("%-32s %+9.1f %%%s\n",
+                   name,
+                   change,
+                   regressed ? "  REGRESSION" : "");
+            regressions += regressed;
+        }
+    }
+    fclose(f);
+    return regressions;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "Usage: %s [--ld20 capture.bin] [-o results.txt]\n"
+            "          [--baseline results.txt] [--tolerance percent]\n",
+            argv0);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    const char *ld20_path = NULL;
+    const char *output_path = NULL;
+    const char *baseline_path = NULL;
+    double tolerance = 10.0;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "--ld20") == 0) {
+            ld20_path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "-o") == 0) {
+            output_path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--baseline") == 0) {
+            baseline_path = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--tolerance") == 0) {
+            tolerance = atof(argv[++i]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    bench_lidar(ld20_path);
+    bench_encode();
+    bench_motor();
+
+    if (output_path != NULL) {
+        save_results(output_path);
+    }
+    int regressions = 0;
+    if (baseline_path != NULL) {
+        regressions = compare_results(baseline_path, tolerance);
+    }
+
+    if (failures > 0) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    return regressions > 0 ? 3 : 0;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Results go here, so the compiler can't leave the work out
+extern volatile double bench_sink;
+
+/*
+ * Times fn(ctx) and records the best ns per item over several runs, under
+ * name. fn does one pass and returns how many items (frames, packets,
+ * steps) it got through.
+ */
+void bench_run(const char *name,
+               const char *unit,
+               size_t (*fn)(void *ctx),
+               void *ctx);
+
+/*
+ * Note a result that isn't a time, like an estimate's error. Printed, but
+ * never compared against a baseline.
+ */
+void bench_note(const char *name, double value, const char *unit);
+
+/*
+ * Flag a wrong answer. The run carries on, and exits non-zero at the end.
+ */
+void bench_fail(const char *fmt, ...);
+
+/*
+ * Fast enough to fill test data with, and the same every run.
+ */
+uint32_t bench_random(uint32_t *seed);
+
+/*
+ * Each suite checks its own answers once, then times itself. The lidar
+ * suite uses the raw LD20 capture at ld20_path if there is one, and a
+ * synthetic revolution otherwise.
+ */
+void bench_lidar(const char *ld20_path);
+void bench_encode();
+void bench_motor();
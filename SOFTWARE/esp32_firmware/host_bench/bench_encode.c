@@ -0,0 +1,231 @@
+// Packet encoding both ways the socket manager does it, and decoding what
+// the host sends, per packet
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "fast_encode.h"
+#include "lidar_frame.h"
+#include "messages.pb.h"
+#include "pb_decode.h"
+#include "pb_encode.h"
+#include "pb_utils.h"
+
+typedef struct
+{
+    UdpPacket packet;
+    uint8_t buf[UdpPacket_size];
+    size_t len; // Of what pb_encode wrote
+} encode_bench_t;
+
+static float random_float(uint32_t *seed, float scale)
+{
+    return scale * (float)bench_random(seed) / (float)(1 << 24);
+}
+
+static void fill_stamp(TimeStamp *stamp)
+{
+    stamp->sec = 1700000000;
+    stamp->nanosec = 123456789;
+}
+
+static void fill_scan(UdpPacket *packet, uint32_t *seed)
+{
+    packet->has_laser = true;
+    LaserScan *scan = &packet->laser;
+    scan->has_time = true;
+    fill_stamp(&scan->time);
+    scan->angle_max = 0.5f;
+    scan->angle_increment = 0.5f / 120;
+    scan->time_increment = 1.0f / 4500;
+    scan->scan_time = 0.001f;
+    scan->range_min = 0.1f;
+    scan->range_max = 8.0f;
+    scan->ranges_count = sizeof(scan->ranges) / sizeof(float);
+    scan->intensities_count = scan->ranges_count;
+    for (size_t i = 0; i < scan->ranges_count; i++) {
+        scan->ranges[i] = random_float(seed, 8.0f);
+        scan->intensities[i] = random_float(seed, 255.0f);
+    }
+}
+
+static void fill_compact_scan(UdpPacket *packet, uint32_t *seed)
+{
+    packet->has_compact_laser = true;
+    CompactLaserScan *compact = &packet->compact_laser;
+    compact->has_time = true;
+    fill_stamp(&compact->time);
+    compact->start_angle = 35800;
+    compact->end_angle = 37200;
+    compact->speed = 3600;
+    compact->scan_id = 42;
+    compact->fragment = 3;
+    compact->time_increment = 1.0f / 4500;
+    // As many raw points as a packet takes
+    compact->points.size =
+      sizeof(compact->points.bytes) / sizeof(LidarPoint) * sizeof(LidarPoint);
+    for (size_t i = 0; i < compact->points.size; i++) {
+        compact->points.bytes[i] = (uint8_t)bench_random(seed);
+    }
+}
+
+static void fill_control(UdpPacket *packet, uint32_t *seed)
+{
+    packet->has_joint_states = true;
+    JointStates *joints = &packet->joint_states;
+    joints->has_time = true;
+    fill_stamp(&joints->time);
+    joints->name_count = 2;
+    joints->position_count = 2;
+    joints->velocity_count = 2;
+    joints->effort_count = 2;
+    strcpy(joints->name[0], "wheel_left");
+    strcpy(joints->name[1], "wheel_right");
+    for (size_t i = 0; i < 2; i++) {
+        joints->position[i] = random_float(seed, 100.0f);
+        joints->velocity[i] = random_float(seed, 20.0f) - 10.0f;
+        joints->effort[i] = random_float(seed, 2.0f) - 1.0f;
+    }
+
+    packet->has_odometry = true;
+    Odometry *odom = &packet->odometry;
+    odom->has_time = true;
+    odom->time = joints->time;
+    odom->x = random_float(seed, 5.0f);
+    odom->y = random_float(seed, 5.0f);
+    odom->yaw = random_float(seed, 6.0f) - 3.0f;
+    odom->v = random_float(seed, 1.0f);
+    odom->pose_covariance_count = 9;
+    for (size_t i = 0; i < 9; i++) {
+        odom->pose_covariance[i] = random_float(seed, 0.01f);
+    }
+    odom->twist_covariance_count = 4;
+    odom->twist_covariance[0] = 0.01f;
+    odom->twist_covariance[3] = 0.01f;
+}
+
+static size_t bench_pb_encode(void *ctx)
+{
+    encode_bench_t *b = ctx;
+    pb_ostream_t stream = pb_ostream_from_buffer(b->buf, sizeof(b->buf));
+    pb_encode(&stream, UdpPacket_fields, &b->packet);
+    b->len = stream.bytes_written;
+    return 1;
+}
+
+static size_t bench_fast_encode(void *ctx)
+{
+    encode_bench_t *b = ctx;
+    return fast_encode_packet(&b->packet, b->buf, sizeof(b->buf)) != 0;
+}
+
+/*
+ * Time both encoders on a packet, after checking they write the same bytes.
+ */
+static void bench_packet(const char *name, encode_bench_t *b)
+{
+    char label[48];
+    bench_pb_encode(b);
+    size_t generic_len = b->len;
+    uint8_t generic[UdpPacket_size];
+    memcpy(generic, b->buf, generic_len);
+
+    snprintf(label, sizeof(label), "encode.%s_pb", name);
+    bench_run(label, "packet", bench_pb_encode, b);
+
+    size_t fast_len = fast_encode_packet(&b->packet, b->buf, sizeof(b->buf));
+    if (fast_len == 0) {
+        // Not a shape fast_encode handles, pb_encode is all there is
+        return;
+    }
+    if (fast_len != generic_len || memcmp(generic, b->buf, fast_len) != 0) {
+        bench_fail("%s: fast encoder disagrees with pb_encode", name);
+        return;
+    }
+    snprintf(label, sizeof(label), "encode.%s_fast", name);
+    bench_run(label, "packet", bench_fast_encode, b);
+}
+
+typedef struct
+{
+    uint8_t buf[64];
+    size_t len;
+    Reliable reliable;
+    TwistCmd twist;
+} decode_bench_t;
+
+/*
+ * Walk a datagram the way the RX task does, decoding the submessages it
+ * has handlers for.
+ */
+static size_t bench_decode(void *ctx)
+{
+    decode_bench_t *b = ctx;
+    pb_istream_t stream = pb_istream_from_buffer(b->buf, b->len);
+    pb_wire_type_t wire_type;
+    uint32_t tag;
+    bool eof = false;
+    bool status = true;
+    while (status && pb_decode_tag(&stream, &wire_type, &tag, &eof)) {
+        if (wire_type != PB_WT_STRING) {
+            status = pb_skip_field(&stream, wire_type);
+        } else if (tag == UdpPacket_reliable_tag) {
+            status = decode_unionmessage_contents(
+              &stream, Reliable_fields, &b->reliable);
+        } else if (tag == UdpPacket_cmd_vel_tag) {
+            status = decode_unionmessage_contents(
+              &stream, TwistCmd_fields, &b->twist);
+        } else {
+            status = pb_skip_field(&stream, wire_type);
+        }
+    }
+    return status && eof;
+}
+
+static void bench_cmd_vel_decode()
+{
+    static decode_bench_t b;
+    Reliable reliable = { .session = 0x5eed, .seq = 1234, .base = 1230 };
+    TwistCmd twist = { .has_time = true, .v = 0.25f, .w = -0.5f };
+    fill_stamp(&twist.time);
+
+    pb_ostream_t stream = pb_ostream_from_buffer(b.buf, sizeof(b.buf));
+    if (!encode_unionmessage(&stream, Reliable_fields, &reliable) ||
+        !encode_unionmessage(&stream, TwistCmd_fields, &twist)) {
+        bench_fail("Couldn't encode a cmd_vel datagram");
+        return;
+    }
+    b.len = stream.bytes_written;
+
+    if (!bench_decode(&b) || b.reliable.seq != reliable.seq ||
+        b.twist.v != twist.v || b.twist.w != twist.w) {
+        bench_fail("cmd_vel didn't survive a round trip");
+        return;
+    }
+    bench_run("decode.cmd_vel", "packet", bench_decode, &b);
+}
+
+void bench_encode()
+{
+    static encode_bench_t b;
+    uint32_t seed = 0x2C54;
+
+    memset(&b.packet, 0, sizeof(b.packet));
+    b.packet.robot_id = 0x2c54a1;
+    fill_scan(&b.packet, &seed);
+    bench_packet("laser", &b);
+
+    memset(&b.packet, 0, sizeof(b.packet));
+    b.packet.robot_id = 0x2c54a1;
+    fill_compact_scan(&b.packet, &seed);
+    bench_packet("compact_laser", &b);
+
+    memset(&b.packet, 0, sizeof(b.packet));
+    b.packet.robot_id = 0x2c54a1;
+    fill_control(&b.packet, &seed);
+    bench_packet("control", &b);
+
+    bench_cmd_vel_decode();
+}
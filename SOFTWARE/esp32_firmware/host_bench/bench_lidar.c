@@ -0,0 +1,262 @@
+// LD20 stream parsing, checksums and point conversion, per frame
+
+#include "bench.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lidar_frame.h"
+#include "point_codec.h"
+
+// Ten revolutions at 10 Hz, about what the LD20 sends in a second
+#define SYNTH_REVOLUTIONS 10
+#define SYNTH_FRAMES_PER_REV 38
+#define SYNTH_SPEED 3600 // Degrees per second, as the LD20 reports it
+// Every so often the UART drops or mangles bytes, which the parser has to
+// resync past
+#define SYNTH_GARBAGE_EVERY 40
+#define SYNTH_GARBAGE_BYTES 5
+#define SYNTH_CORRUPT_EVERY 97
+
+// Bytes per read, about what a UART_DATA event carries
+#define UART_CHUNK 120
+
+typedef struct
+{
+    uint8_t *data;
+    size_t len;
+    LiDARFrame *frames; // Every frame that passed its checksum
+    size_t frame_count;
+} lidar_bench_t;
+
+/*
+ * Range in mm to the walls of a 4 x 3 m room, from a point a bit off its
+ * middle.
+ */
+static uint16_t room_distance(float angle)
+{
+    const float x0 = 0.4f, y0 = -0.3f;
+    float dx = cosf(angle), dy = sinf(angle);
+    float tx = dx > 0 ? (2.0f - x0) / dx : (-2.0f - x0) / dx;
+    float ty = dy > 0 ? (1.5f - y0) / dy : (-1.5f - y0) / dy;
+    float t = fabsf(dx) < 1e-6f ? ty : (fabsf(dy) < 1e-6f ? tx : fminf(tx, ty));
+    return (uint16_t)(t * 1000.0f);
+}
+
+/*
+ * Fill b with a synthetic stream: evenly spaced frames of a room, with some
+ * garbage and a few bad checksums mixed in. Returns how many frames should
+ * come out of the parser.
+ */
+static size_t synthesize_stream(lidar_bench_t *b)
+{
+    size_t frames = SYNTH_REVOLUTIONS * SYNTH_FRAMES_PER_REV;
+    size_t frames_garbage = frames / SYNTH_GARBAGE_EVERY + 1;
+    b->data = malloc(frames * sizeof(LiDARFrame) +
+                     frames_garbage * SYNTH_GARBAGE_BYTES);
+    b->len = 0;
+
+    uint32_t seed = 0x2C54;
+    uint32_t span = 36000 / SYNTH_FRAMES_PER_REV;
+    double time_ms = 0.0;
+    size_t good = 0;
+    for (size_t f = 0; f < frames; f++) {
+        if (f % SYNTH_GARBAGE_EVERY == SYNTH_GARBAGE_EVERY - 1) {
+            for (size_t i = 0; i < SYNTH_GARBAGE_BYTES; i++) {
+                b->data[b->len++] = (uint8_t)bench_random(&seed);
+            }
+        }
+
+        LiDARFrame frame = {
+            .header = HEADER,
+            .ver_len = VERLEN,
+            .speed = SYNTH_SPEED,
+            .start_angle = (f % SYNTH_FRAMES_PER_REV) * span,
+            .timestamp = (uint16_t)((uint32_t)time_ms % 30000),
+        };
+        frame.end_angle =
+          (frame.start_angle + span * (POINT_PER_UART_PACKET - 1) /
+                                 POINT_PER_UART_PACKET) %
+          36000;
+        for (size_t i = 0; i < POINT_PER_UART_PACKET; i++) {
+            float angle =
+              (float)lidar_point_angle(&frame, i) * (float)M_PI / 18000.0f;
+            uint16_t distance = room_distance(angle);
+            frame.points[i].distance = distance + bench_random(&seed) % 8;
+            frame.points[i].intensity = 255 - (distance >> 5);
+        }
+        frame.crc8 = CalCRC8((const uint8_t *)&frame, sizeof(frame) - 1);
+        if (f % SYNTH_CORRUPT_EVERY == SYNTH_CORRUPT_EVERY - 1) {
+            frame.points[3].intensity ^= 0x10;
+        } else {
+            good++;
+        }
+
+        memcpy(b->data + b->len, &frame, sizeof(frame));
+        b->len += sizeof(frame);
+        time_ms += 1000.0 / (SYNTH_SPEED / 360.0 * SYNTH_FRAMES_PER_REV);
+    }
+    return good;
+}
+
+static bool load_stream(lidar_bench_t *b, const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        bench_fail("Can't read %s", path);
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    b->data = malloc(size > 0 ? (size_t)size : 1);
+    b->len = fread(b->data, 1, size > 0 ? (size_t)size : 0, f);
+    fclose(f);
+    return true;
+}
+
+/*
+ * Run the whole stream through a parser the way the lidar task reads the
+ * UART. Keeps the frames if out is set.
+ */
+static size_t parse_stream(const lidar_bench_t *b,
+                           lidar_parser_t *parser,
+                           LiDARFrame *out)
+{
+    size_t frames = 0;
+    size_t offset = 0;
+    lidar_parser_init(parser);
+    while (offset < b->len) {
+        size_t space;
+        uint8_t *dest = lidar_parser_write_ptr(parser, &space);
+        size_t len = b->len - offset;
+        len = len < UART_CHUNK ? len : UART_CHUNK;
+        len = len < space ? len : space;
+        memcpy(dest, b->data + offset, len);
+        lidar_parser_commit(parser, len);
+        offset += len;
+
+        const LiDARFrame *frame;
+        while ((frame = lidar_parser_next(parser)) != NULL) {
+            if (out != NULL) {
+                out[frames] = *frame;
+            }
+            frames++;
+        }
+    }
+    return frames;
+}
+
+static size_t bench_parse(void *ctx)
+{
+    static lidar_parser_t parser;
+    return parse_stream(ctx, &parser, NULL);
+}
+
+static size_t bench_crc_table(void *ctx)
+{
+    lidar_bench_t *b = ctx;
+    uint8_t crc = 0;
+    for (size_t i = 0; i < b->frame_count; i++) {
+        crc ^= CalCRC8((const uint8_t *)&b->frames[i], sizeof(LiDARFrame) - 1);
+    }
+    bench_sink = crc;
+    return b->frame_count;
+}
+
+static size_t bench_crc_sliced(void *ctx)
+{
+    lidar_bench_t *b = ctx;
+    uint8_t crc = 0;
+    for (size_t i = 0; i < b->frame_count; i++) {
+        crc ^= lidar_frame_crc((const uint8_t *)&b->frames[i],
+                               sizeof(LiDARFrame) - 1);
+    }
+    bench_sink = crc;
+    return b->frame_count;
+}
+
+// What add_to_packet does per frame for a float LaserScan
+static size_t bench_convert(void *ctx)
+{
+    lidar_bench_t *b = ctx;
+    static float ranges[POINT_PER_UART_PACKET];
+    static float intensities[POINT_PER_UART_PACKET];
+    for (size_t i = 0; i < b->frame_count; i++) {
+        lidar_frame_convert(&b->frames[i], ranges, intensities);
+        bench_sink =
+          ranges[POINT_PER_UART_PACKET - 1] +
+          lidar_point_angle(&b->frames[i], POINT_PER_UART_PACKET - 1);
+    }
+    return b->frame_count;
+}
+
+// And for a CompactLaserScan under POINT_ENCODING_DELTA_VARINT
+static size_t bench_delta_varint(void *ctx)
+{
+    lidar_bench_t *b = ctx;
+    static uint8_t out[POINT_PER_UART_PACKET * POINT_CODEC_MAX_DISTANCE_BYTES];
+    uint16_t previous = 0;
+    for (size_t i = 0; i < b->frame_count; i++) {
+        size_t len = 0;
+        for (size_t p = 0; p < POINT_PER_UART_PACKET; p++) {
+            len += point_codec_put_distance(
+              out + len, b->frames[i].points[p].distance, &previous);
+        }
+        bench_sink = len;
+    }
+    return b->frame_count;
+}
+
+void bench_lidar(const char *ld20_path)
+{
+    lidar_bench_t b = {};
+    size_t expected = 0;
+    if (ld20_path != NULL) {
+        if (!load_stream(&b, ld20_path)) {
+            return;
+        }
+    } else {
+        expected = synthesize_stream(&b);
+    }
+
+    lidar_crc_init();
+    static lidar_parser_t parser;
+    b.frames = malloc((b.len / sizeof(LiDARFrame) + 1) * sizeof(LiDARFrame));
+    b.frame_count = parse_stream(&b, &parser, b.frames);
+    if (ld20_path == NULL && b.frame_count != expected) {
+        bench_fail("Parsed %zu frames, expected %zu", b.frame_count, expected);
+    }
+    if (b.frame_count == 0) {
+        bench_fail("No frames in the LD20 stream");
+        return;
+    }
+    for (size_t i = 0; i < b.frame_count; i++) {
+        const uint8_t *data = (const uint8_t *)&b.frames[i];
+        if (lidar_frame_crc(data, sizeof(LiDARFrame) - 1) !=
+            CalCRC8(data, sizeof(LiDARFrame) - 1)) {
+            bench_fail("Sliced CRC disagrees with the table CRC");
+            break;
+        }
+    }
+
+    printf("LD20 %s: %zu bytes, %zu frames, %u CRC errors, %u resyncs\n",
+           ld20_path != NULL ? ld20_path : "synthetic",
+           b.len,
+           b.frame_count,
+           (unsigned)parser.crc_errors,
+           (unsigned)parser.resyncs);
+
+    // Parsing is per byte really, but per good frame is what the lidar task
+    // pays for
+    bench_run("lidar.parse", "frame", bench_parse, &b);
+    bench_run("lidar.crc_table", "frame", bench_crc_table, &b);
+    bench_run("lidar.crc_sliced", "frame", bench_crc_sliced, &b);
+    bench_run("lidar.convert_float", "frame", bench_convert, &b);
+    bench_run("lidar.delta_varint", "frame", bench_delta_varint, &b);
+
+    free(b.frames);
+    free(b.data);
+}
@@ -0,0 +1,164 @@
+// The velocity loop's arithmetic on synthetic encoder traces, per control
+// step
+
+#include "bench.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "motor_control.h"
+#include "sdkconfig.h"
+#include "setpoint_profile.h"
+
+#define CONTROL_DT (1.0f / (float)CONFIG_LRR_CONTROL_LOOP_HZ)
+// The wheels are integrated this finely between samples, to place edges
+#define TRACE_SUBSTEP_US 10
+// MCPWM capture runs off the 80 MHz APB clock
+#define CAPTURE_HZ 80000000
+#define CAPTURE_TICKS_PER_US (CAPTURE_HZ / 1000000)
+
+// Stock 60 mm wheels, for turning cmd_vel into wheel speed
+#define WHEEL_RADIUS 0.03048f
+
+#define EDGES_PER_ROTATION (PULSES_PER_ROTATION / 2.0)
+
+typedef struct
+{
+    float at_s;
+    float v; // m/s
+} command_t;
+
+// Drive off, cruise, reverse, stop, then creep slowly enough that most
+// samples see no edge
+static const command_t commands[] = {
+    { 0.0f, 0.0f },  { 0.5f, 0.4f },  { 3.0f, -0.25f },
+    { 5.0f, 0.0f },  { 6.0f, 0.02f }, { 8.0f, 0.0f },
+};
+#define COMMAND_COUNT (sizeof(commands) / sizeof(commands[0]))
+#define TRACE_SECONDS 9.0f
+
+typedef struct
+{
+    encoder_sample_t *samples;
+    float *truth; // Wheel velocity when each sample was taken, rad / s
+    float *targets; // cmd_vel as given, m/s
+    size_t steps;
+    motor_model_t model;
+} motor_bench_t;
+
+static float command_at(float t)
+{
+    float v = 0.0f;
+    for (size_t i = 0; i < COMMAND_COUNT && commands[i].at_s <= t; i++) {
+        v = commands[i].v;
+    }
+    return v;
+}
+
+/*
+ * Drive one wheel through the commands the way the base would, and record
+ * what its encoder shows at every control step.
+ */
+static void synthesize_trace(motor_bench_t *b)
+{
+    b->steps = (size_t)(TRACE_SECONDS / CONTROL_DT);
+    b->samples = calloc(b->steps, sizeof(encoder_sample_t));
+    b->truth = calloc(b->steps, sizeof(float));
+    b->targets = calloc(b->steps, sizeof(float));
+
+    setpoint_profile_t profile;
+    setpoint_profile_init(&profile,
+                          CONFIG_LRR_CMD_VEL_MAX_ACCEL / 1000.0f,
+                          CONFIG_LRR_CMD_VEL_MAX_JERK / 1000.0f);
+
+    int64_t step_us = (int64_t)(CONTROL_DT * 1e6f);
+    int64_t t_us = 0;
+    double angle = 0.0;
+    float wheel_velocity = 0.0f;
+    encoder_sample_t encoder = { .last_edge_us = -1000000 };
+    for (size_t k = 0; k < b->steps; k++) {
+        float target = command_at((float)t_us / 1e6f);
+        b->targets[k] = target;
+        wheel_velocity =
+          setpoint_profile_update(&profile, target, CONTROL_DT) / WHEEL_RADIUS;
+
+        for (int64_t end_us = t_us + step_us; t_us < end_us;
+             t_us += TRACE_SUBSTEP_US) {
+            angle += wheel_velocity * TRACE_SUBSTEP_US * 1e-6;
+            double turns = angle / (2 * M_PI);
+            int32_t edges = (int32_t)floor(turns * EDGES_PER_ROTATION);
+            if (edges != encoder.edges) {
+                encoder.edges = edges;
+                encoder.last_edge_us = t_us;
+                encoder.last_edge_ticks =
+                  (uint32_t)(t_us * CAPTURE_TICKS_PER_US);
+            }
+            encoder.count = (int)floor(turns * PULSES_PER_ROTATION);
+        }
+
+        encoder.sample_us = t_us;
+        b->samples[k] = encoder;
+        b->truth[k] = wheel_velocity;
+    }
+}
+
+static size_t bench_estimate(void *ctx)
+{
+    motor_bench_t *b = ctx;
+    velocity_estimate_t estimate;
+    velocity_estimate_init(&estimate, b->samples[0].last_edge_us);
+    double velocity = 0.0;
+    for (size_t k = 0; k < b->steps; k++) {
+        velocity = velocity_estimate_update(
+          &estimate, velocity, &b->samples[k], CAPTURE_HZ, CONTROL_DT);
+        bench_sink =
+          motor_feedforward(&b->model, b->targets[k] / WHEEL_RADIUS);
+    }
+    return b->steps;
+}
+
+static size_t bench_profile(void *ctx)
+{
+    motor_bench_t *b = ctx;
+    setpoint_profile_t profile;
+    setpoint_profile_init(&profile,
+                          CONFIG_LRR_CMD_VEL_MAX_ACCEL / 1000.0f,
+                          CONFIG_LRR_CMD_VEL_MAX_JERK / 1000.0f);
+    for (size_t k = 0; k < b->steps; k++) {
+        bench_sink =
+          setpoint_profile_update(&profile, b->targets[k], CONTROL_DT);
+    }
+    return b->steps;
+}
+
+void bench_motor()
+{
+    motor_bench_t b = { .model = MOTOR_MODEL_DEFAULT() };
+    synthesize_trace(&b);
+
+    // How far the filtered estimate is from the wheel. It lags by design,
+    // so this is for spotting changes, not a target.
+    velocity_estimate_t estimate;
+    velocity_estimate_init(&estimate, b.samples[0].last_edge_us);
+    double velocity = 0.0;
+    double sum_squares = 0.0;
+    for (size_t k = 0; k < b.steps; k++) {
+        velocity = velocity_estimate_update(
+          &estimate, velocity, &b.samples[k], CAPTURE_HZ, CONTROL_DT);
+        double error = velocity - b.truth[k];
+        sum_squares += error * error;
+        if (!isfinite(velocity)) {
+            bench_fail("Velocity estimate went to %f at step %zu", velocity, k);
+            break;
+        }
+    }
+    bench_note(
+      "motor.estimate_rms_error", sqrt(sum_squares / b.steps), "rad/s");
+
+    bench_run("motor.estimate_feedforward", "step", bench_estimate, &b);
+    bench_run("drive.setpoint_profile", "step", bench_profile, &b);
+
+    free(b.samples);
+    free(b.truth);
+    free(b.targets);
+}
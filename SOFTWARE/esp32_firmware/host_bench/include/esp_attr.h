@@ -0,0 +1,6 @@
+#pragma once
+
+// Placement attributes mean nothing off target
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define EXT_RAM_BSS_ATTR
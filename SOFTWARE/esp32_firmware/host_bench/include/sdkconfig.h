@@ -0,0 +1,10 @@
+#pragma once
+
+// Stands in for the generated sdkconfig.h. Only what the host build reads,
+// at the Kconfig defaults. The on-target benchmarks and CONFIG_LRR_TRACE
+// stay off, they need the Xtensa cycle counter.
+
+#define CONFIG_LRR_CONTROL_LOOP_HZ 200
+#define CONFIG_LRR_ENCODER_VELOCITY_CUTOFF_HZ 25
+#define CONFIG_LRR_CMD_VEL_MAX_ACCEL 3000
+#define CONFIG_LRR_CMD_VEL_MAX_JERK 60000
@@ -0,0 +1,169 @@
+#include "diagnostics.h"
+
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#include <string.h>
+
+#include "LSM6DS3_imu_driver.h"
+#include "drive_base_driver.h"
+#include "lidar_driver.h"
+#include "messages.pb.h"
+#include "power_mgr.h"
+#include "socket_mgr.h"
+#include "task_stats.h"
+#include "time_sync.h"
+#include "wifi_mgr.h"
+
+#define DIAGNOSTICS_STACK_SIZE 4096
+#define DIAGNOSTICS_PRIO 1
+
+// Bounded by TaskUsage's max_count in messages.proto
+#define MAX_TASKS                                                              \
+    (sizeof(((Diagnostics *)0)->tasks) / sizeof(((Diagnostics *)0)->tasks[0]))
+
+static const char *TAG = "diagnostics";
+
+static void fill_comms(Diagnostics *diag)
+{
+    socket_mgr_stats_t stats;
+    socket_mgr_get_stats(&stats);
+
+    diag->sendto_failures = stats.sendto_failures;
+    diag->rx_decode_errors = stats.rx_decode_errors;
+    diag->tx_pool_exhausted = stats.pool_exhausted;
+    diag->lane_dropped_count = eTxLaneCount;
+    diag->lane_high_water_count = eTxLaneCount;
+    for (size_t lane = 0; lane < eTxLaneCount; lane++) {
+        diag->lane_dropped[lane] = stats.lane_dropped[lane];
+        diag->lane_high_water[lane] = stats.lane_high_water[lane];
+    }
+
+    time_sync_stats_t sync;
+    time_sync_get_stats(&sync);
+    diag->time_sync_samples = sync.samples;
+    diag->time_sync_rejected = sync.rejected;
+    diag->time_sync_round_trip_us = sync.round_trip_us;
+
+    wifi_mgr_stats_t wifi;
+    wifi_mgr_get_stats(&wifi);
+    diag->wifi_rssi = wifi.rssi;
+    diag->wifi_reconnects = wifi.reconnects;
+    diag->wifi_poor_link_events = wifi.poor_link_events;
+    diag->lidar_shed = stats.lidar_shed;
+    diag->espnow_sent = stats.espnow_sent;
+    diag->espnow_received = stats.espnow_received;
+    diag->reliable_retransmits = stats.reliable_retransmits;
+    diag->reliable_expired = stats.reliable_expired;
+    diag->reliable_duplicates = stats.reliable_duplicates;
+}
+
+static void fill_sensors(Diagnostics *diag)
+{
+    lidar_stats_t lidar;
+    lidar_driver_get_stats(&lidar);
+    diag->lidar_frames = lidar.frames;
+    diag->lidar_crc_errors = lidar.crc_errors;
+    diag->lidar_resyncs = lidar.resyncs;
+    diag->lidar_uart_overflows = lidar.uart_overflows;
+
+    drive_base_stats_t drive_base;
+    drive_base_driver_get_stats(&drive_base);
+    diag->control_loops = drive_base.loops;
+    diag->control_overruns = drive_base.overruns;
+    diag->control_max_jitter_us = drive_base.max_jitter_us;
+
+    imu_stats_t imu;
+    LSM6DS3_imu_driver_get_stats(&imu);
+    diag->imu_samples = imu.samples;
+    diag->imu_fifo_overruns = imu.fifo_overruns;
+    diag->imu_dropped_batches = imu.dropped_batches;
+    diag->imu_i2c_errors = imu.i2c_errors;
+}
+
+static void fill_power(Diagnostics *diag)
+{
+    power_stats_t power;
+    power_mgr_get_stats(&power);
+    diag->power_state = (PowerState)power.state;
+    diag->cpu_freq_mhz = power.cpu_freq_mhz;
+    diag->power_state_ms_count = ePowerStateCount;
+    for (size_t i = 0; i < ePowerStateCount; i++) {
+        diag->power_state_ms[i] = power.state_ms[i];
+    }
+}
+
+static void fill_tasks(Diagnostics *diag,
+                       const task_usage_t *usage,
+                       size_t count)
+{
+    diag->tasks_count = count;
+    for (size_t i = 0; i < count; i++) {
+        TaskUsage *task = &diag->tasks[i];
+        strlcpy(task->name, usage[i].name, sizeof(task->name));
+        task->core = usage[i].core == tskNO_AFFINITY ? -1 : usage[i].core;
+        task->priority = usage[i].priority;
+        task->cpu_percent = usage[i].cpu_percent;
+        task->stack_free = usage[i].stack_free;
+    }
+}
+
+static void diagnostics_task(void *arg)
+{
+    static task_usage_t usage[MAX_TASKS];
+    task_stats_sample(usage, MAX_TASKS);
+
+#if CONFIG_LRR_TASK_STATS
+    int64_t last_log_us = esp_timer_get_time();
+#endif
+
+    while (1) {
+        vTaskDelay(CONFIG_LRR_DIAGNOSTICS_PERIOD_MS / portTICK_PERIOD_MS);
+
+        size_t task_count = task_stats_sample(usage, MAX_TASKS);
+
+#if CONFIG_LRR_TASK_STATS
+        int64_t now_us = esp_timer_get_time();
+        if (now_us - last_log_us >= CONFIG_LRR_TASK_STATS_PERIOD_MS * 1000) {
+            task_stats_log(usage, task_count);
+            last_log_us = now_us;
+        }
+#endif
+
+        UdpPacket *packet = socket_mgr_acquire_packet(0);
+        if (packet == NULL) {
+            // Counted in tx_pool_exhausted, which the next report carries
+            continue;
+        }
+
+        packet->has_diagnostics = true;
+        Diagnostics *diag = &packet->diagnostics;
+        diag->uptime_ms = (uint32_t)(esp_timer_get_time() / 1000);
+        fill_comms(diag);
+        fill_sensors(diag);
+        fill_power(diag);
+        diag->free_heap = esp_get_free_heap_size();
+        diag->min_free_heap = esp_get_minimum_free_heap_size();
+        fill_tasks(diag, usage, task_count);
+
+        socket_mgr_commit_packet(eTxLaneDiagnostics, packet);
+    }
+
+    vTaskDelete(NULL);
+}
+
+void diagnostics_init()
+{
+    if (xTaskCreate(diagnostics_task,
+                    "diagnostics",
+                    DIAGNOSTICS_STACK_SIZE,
+                    NULL,
+                    DIAGNOSTICS_PRIO,
+                    NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start diagnostics task");
+    }
+}
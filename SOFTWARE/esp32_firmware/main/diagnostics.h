@@ -0,0 +1,9 @@
+#pragma once
+
+/*
+ * Start a low priority task that gathers counters from every driver and
+ * sends them to the host as a Diagnostics packet every
+ * CONFIG_LRR_DIAGNOSTICS_PERIOD_MS. Also logs per-task CPU usage when
+ * CONFIG_LRR_TASK_STATS is set.
+ */
+void diagnostics_init();
@@ -1,26 +1,113 @@
 #include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
 #include "freertos/task.h"
 
+#include "esp_log.h"
+#include "esp_timer.h"
+
 #include "LSM6DS3_imu_driver.h"
+#include "diagnostics.h"
 #include "drive_base_driver.h"
+#include "flight_recorder.h"
 #include "lidar_driver.h"
+#include "memory_map.h"
+#include "nvs_flash.h"
+#include "power_mgr.h"
 #include "socket_mgr.h"
 #include "status_led_driver.h"
 #include "wifi_mgr.h"
 
+// Each boot step runs in its own short lived task. Above app_main, below
+// every driver task it starts.
+#define BOOT_TASK_STACK_SIZE 4096
+#define BOOT_TASK_PRIO 2
+
+static const char *TAG = "boot";
+
+typedef struct
+{
+    const char *name;
+    void (*init)();
+    int64_t start_us;
+    int64_t end_us;
+} boot_step_t;
+
+static void network_init()
+{
+    wifi_mgr_init();
+    socket_mgr_init();
+}
+
+// Started in this order, and all run at once. Wi-Fi goes first because
+// association takes far longer than anything else, and none of the drivers
+// need the network to come up. Producers that start early find no packets
+// to fill until the socket manager is running.
+static boot_step_t boot_steps[] = {
+    { .name = "network", .init = network_init },
+    { .name = "imu", .init = LSM6DS3_imu_driver_init },
+    { .name = "drive base", .init = drive_base_driver_init },
+    { .name = "lidar", .init = lidar_driver_init },
+};
+#define BOOT_STEP_COUNT (sizeof(boot_steps) / sizeof(boot_steps[0]))
+
+static EventGroupHandle_t boot_events;
+
+static void boot_step_task(void *arg)
+{
+    boot_step_t *step = (boot_step_t *)arg;
+    step->start_us = esp_timer_get_time();
+    step->init();
+    step->end_us = esp_timer_get_time();
+    xEventGroupSetBits(boot_events, BIT(step - boot_steps));
+    vTaskDelete(NULL);
+}
+
 void app_main(void)
 {
+    // Before anything that keeps settings in flash
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES ||
+        ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        ESP_ERROR_CHECK(nvs_flash_init());
+    }
+
+    // Before the drivers that feed them
+    flight_recorder_init();
+    power_mgr_init();
+
     status_led_driver_init();
 
     set_status(eSystemGood);
 
-    LSM6DS3_imu_driver_init();
+    boot_events = xEventGroupCreate();
+    for (size_t i = 0; i < BOOT_STEP_COUNT; i++) {
+        xTaskCreate(boot_step_task,
+                    boot_steps[i].name,
+                    BOOT_TASK_STACK_SIZE,
+                    &boot_steps[i],
+                    BOOT_TASK_PRIO,
+                    NULL);
+    }
+    xEventGroupWaitBits(boot_events,
+                        BIT(BOOT_STEP_COUNT) - 1,
+                        pdFALSE,
+                        pdTRUE,
+                        portMAX_DELAY);
 
-    drive_base_driver_init();
+    diagnostics_init();
 
-    lidar_driver_init();
+    // Times since esp_timer started, which is early in the bootloader's
+    // hand-off
+    for (size_t i = 0; i < BOOT_STEP_COUNT; i++) {
+        ESP_LOGI(TAG,
+                 "%-10s %5lld ms to %5lld ms",
+                 boot_steps[i].name,
+                 (long long)(boot_steps[i].start_us / 1000),
+                 (long long)(boot_steps[i].end_us / 1000));
+    }
+    ESP_LOGI(
+      TAG, "Up after %lld ms", (long long)(esp_timer_get_time() / 1000));
 
-    wifi_mgr_init();
-
-    socket_mgr_init();
+    memory_map_log();
 }
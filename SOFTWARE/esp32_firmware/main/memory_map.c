@@ -0,0 +1,52 @@
+#include "memory_map.h"
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+static const char *TAG = "memory";
+
+// Section bounds from the linker script
+extern int _data_start, _data_end, _bss_start, _bss_end;
+#if CONFIG_SPIRAM_ALLOW_BSS_SEG_EXTERNAL_MEMORY
+extern int _ext_ram_bss_start, _ext_ram_bss_end;
+#endif
+
+static unsigned section_size(const int *start, const int *end)
+{
+    return (unsigned)((const char *)end - (const char *)start);
+}
+
+static void log_heap(const char *name, uint32_t caps)
+{
+    size_t total = heap_caps_get_total_size(caps);
+    if (total == 0) {
+        ESP_LOGI(TAG, "%-8s heap: none", name);
+        return;
+    }
+    ESP_LOGI(TAG,
+             "%-8s heap: %7u total, %7u free, %7u largest block, %7u lowest",
+             name,
+             (unsigned)total,
+             (unsigned)heap_caps_get_free_size(caps),
+             (unsigned)heap_caps_get_largest_free_block(caps),
+             (unsigned)heap_caps_get_minimum_free_size(caps));
+}
+
+void memory_map_log()
+{
+    ESP_LOGI(TAG,
+             "Internal static: %u data, %u bss",
+             section_size(&_data_start, &_data_end),
+             section_size(&_bss_start, &_bss_end));
+#if CONFIG_SPIRAM_ALLOW_BSS_SEG_EXTERNAL_MEMORY
+    ESP_LOGI(TAG,
+             "PSRAM static: %u bss",
+             section_size(&_ext_ram_bss_start, &_ext_ram_bss_end));
+#endif
+    // Wi-Fi and lwIP allocate from here, and so does anything that has to
+    // be reachable from an ISR
+    log_heap("internal", MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    log_heap("dma", MALLOC_CAP_DMA);
+    log_heap("psram", MALLOC_CAP_SPIRAM);
+}
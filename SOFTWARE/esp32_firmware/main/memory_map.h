@@ -0,0 +1,8 @@
+#pragma once
+
+/*
+ * Log how much of each kind of RAM is taken by static data and what's left
+ * on the heap. Run once at the end of boot, when Wi-Fi and every driver
+ * have made their allocations.
+ */
+void memory_map_log();
@@ -0,0 +1,97 @@
+#include "task_stats.h"
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/idf_additions.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#if CONFIG_LRR_TASK_STATS
+
+#define MAX_TASKS 32
+
+static const char *TAG = "task stats";
+
+static TaskStatus_t previous[MAX_TASKS];
+static TaskStatus_t current[MAX_TASKS];
+static UBaseType_t previous_count = 0;
+static uint32_t previous_total = 0;
+
+static uint32_t previous_run_time(const TaskStatus_t *task)
+{
+    for (UBaseType_t i = 0; i < previous_count; i++) {
+        if (previous[i].xTaskNumber == task->xTaskNumber) {
+            return previous[i].ulRunTimeCounter;
+        }
+    }
+    // Started since the last sample
+    return 0;
+}
+
+size_t task_stats_sample(task_usage_t *usage, size_t max_tasks)
+{
+    uint32_t total = 0;
+    UBaseType_t count = uxTaskGetSystemState(current, MAX_TASKS, &total);
+    if (count == 0) {
+        ESP_LOGW(TAG, "More than %d tasks, can't take a snapshot", MAX_TASKS);
+        return 0;
+    }
+
+    // The run time counter is esp_timer time, so a task that had a core
+    // to itself the whole period shows up as 100%.
+    uint32_t elapsed = total - previous_total;
+    bool first = previous_count == 0;
+    size_t written = 0;
+
+    for (UBaseType_t i = 0; i < count && !first && elapsed > 0; i++) {
+        if (written == max_tasks) {
+            break;
+        }
+
+        const TaskStatus_t *task = &current[i];
+        uint32_t run_time = task->ulRunTimeCounter - previous_run_time(task);
+
+        usage[written++] = (task_usage_t){
+            .name = task->pcTaskName,
+            .core = xTaskGetCoreID(task->xHandle),
+            .priority = task->uxCurrentPriority,
+            .cpu_percent = 100.0f * (float)run_time / (float)elapsed,
+            .stack_free = task->usStackHighWaterMark,
+        };
+    }
+
+    for (UBaseType_t i = 0; i < count; i++) {
+        previous[i] = current[i];
+    }
+    previous_count = count;
+    previous_total = total;
+    return written;
+}
+
+void task_stats_log(const task_usage_t *usage, size_t count)
+{
+    ESP_LOGI(TAG, "%-16s core prio   cpu%%  stack free", "task");
+    for (size_t i = 0; i < count; i++) {
+        const task_usage_t *task = &usage[i];
+        ESP_LOGI(TAG,
+                 "%-16s %4s %4u %5.1f %11lu",
+                 task->name,
+                 task->core == tskNO_AFFINITY ? "any"
+                 : task->core == 0            ? "0"
+                                              : "1",
+                 (unsigned)task->priority,
+                 task->cpu_percent,
+                 (unsigned long)task->stack_free);
+    }
+}
+
+#else
+
+size_t task_stats_sample(task_usage_t *usage, size_t max_tasks)
+{
+    return 0;
+}
+
+void task_stats_log(const task_usage_t *usage, size_t count) {}
+
+#endif
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+
+/*
+ * One task's share of the CPU between two samples
+ */
+typedef struct
+{
+    const char *name;
+    BaseType_t core; // tskNO_AFFINITY if it can run on either
+    UBaseType_t priority;
+    float cpu_percent; // Of one core
+    uint32_t stack_free; // Least ever left, in bytes
+} task_usage_t;
+
+/*
+ * Snapshot every task and work out how much of a core each one used since
+ * the previous call. Returns the number of tasks written to usage, or 0 if
+ * CONFIG_LRR_TASK_STATS is off or this is the first call. Only call this
+ * from one task.
+ */
+size_t task_stats_sample(task_usage_t *usage, size_t max_tasks);
+
+/*
+ * Log a table of the usage from task_stats_sample.
+ */
+void task_stats_log(const task_usage_t *usage, size_t count);
@@ -0,0 +1,247 @@
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+#include "driver/uart.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_netif.h"
+#include "esp_now.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "nvs_flash.h"
+#include "sdkconfig.h"
+
+// LRR ESP-NOW dongle
+// Bridges ESP-NOW frames from rovers to the HAL over a serial port, and
+// back. Both ways a frame is the rover's MAC address followed by the
+// payload, SLIP framed. The payloads are encoded UdpPackets, which the
+// dongle never looks inside.
+//
+// Flash with idf.py build flash from this directory, plug the UART port into
+// the host and start the HAL with espnow_port set to it (/dev/ttyUSB0 or
+// similar). Rovers need LRR_SOCKET_ESPNOW.
+
+#define BRIDGE_UART UART_NUM_0
+#define UART_BUFFER_SIZE 4096
+#define RX_QUEUE_DEPTH 16
+#define BRIDGE_TASK_STACK_SIZE 4096
+#define BRIDGE_TASK_PRIO 10
+
+// Rovers broadcast discovery requests every 200 ms while they're looking,
+// so this dwell catches at least one on the right channel
+#define HOP_PERIOD_US (250 * 1000)
+#define ROVER_TIMEOUT_US (3 * 1000 * 1000)
+#define MAX_CHANNEL 13
+
+#define SLIP_END 0xC0
+#define SLIP_ESC 0xDB
+#define SLIP_ESC_END 0xDC
+#define SLIP_ESC_ESC 0xDD
+
+static const char *TAG = "dongle";
+
+typedef struct
+{
+    uint8_t mac[ESP_NOW_ETH_ALEN];
+    uint8_t len;
+    uint8_t data[ESP_NOW_MAX_DATA_LEN];
+} frame_t;
+
+static QueueHandle_t rx_queue;
+
+static uint8_t channel = 1;
+static volatile int64_t last_heard_us = 0;
+
+/*
+ * Runs in the Wi-Fi task, so only copies the frame out.
+ */
+static void espnow_receive_callback(const esp_now_recv_info_t *info,
+                                    const uint8_t *data,
+                                    int len)
+{
+    if (len <= 0 || len > ESP_NOW_MAX_DATA_LEN) {
+        return;
+    }
+    frame_t frame;
+    memcpy(frame.mac, info->src_addr, sizeof(frame.mac));
+    frame.len = (uint8_t)len;
+    memcpy(frame.data, data, len);
+    last_heard_us = esp_timer_get_time();
+    xQueueSend(rx_queue, &frame, 0);
+}
+
+static size_t slip_escape(uint8_t *out, const uint8_t *data, size_t len)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] == SLIP_END) {
+            out[n++] = SLIP_ESC;
+            out[n++] = SLIP_ESC_END;
+        } else if (data[i] == SLIP_ESC) {
+            out[n++] = SLIP_ESC;
+            out[n++] = SLIP_ESC_ESC;
+        } else {
+            out[n++] = data[i];
+        }
+    }
+    return n;
+}
+
+static void uart_tx_task(void *arg)
+{
+    frame_t frame;
+    // Every byte could need escaping, plus an END on each side
+    static uint8_t out[2 * (ESP_NOW_ETH_ALEN + ESP_NOW_MAX_DATA_LEN) + 2];
+    while (1) {
+        if (xQueueReceive(rx_queue, &frame, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        // The leading END flushes any line noise out of the host's decoder
+        size_t n = 0;
+        out[n++] = SLIP_END;
+        n += slip_escape(out + n, frame.mac, sizeof(frame.mac));
+        n += slip_escape(out + n, frame.data, frame.len);
+        out[n++] = SLIP_END;
+        uart_write_bytes(BRIDGE_UART, out, n);
+    }
+}
+
+static void send_to_rover(const uint8_t *frame, size_t len)
+{
+    if (len <= ESP_NOW_ETH_ALEN ||
+        len > ESP_NOW_ETH_ALEN + ESP_NOW_MAX_DATA_LEN) {
+        return;
+    }
+    const uint8_t *mac = frame;
+    if (!esp_now_is_peer_exist(mac)) {
+        esp_now_peer_info_t peer = {
+            .channel = 0,
+            .ifidx = WIFI_IF_STA,
+            .encrypt = false,
+        };
+        memcpy(peer.peer_addr, mac, sizeof(peer.peer_addr));
+        if (esp_now_add_peer(&peer) != ESP_OK) {
+            return;
+        }
+        ESP_LOGI(TAG, "Talking to rover " MACSTR, MAC2STR(mac));
+    }
+    esp_now_send(mac, frame + ESP_NOW_ETH_ALEN, len - ESP_NOW_ETH_ALEN);
+}
+
+static void uart_rx_task(void *arg)
+{
+    static uint8_t in[256];
+    static uint8_t frame[ESP_NOW_ETH_ALEN + ESP_NOW_MAX_DATA_LEN];
+    size_t len = 0;
+    bool escaped = false;
+    bool overflow = false;
+    while (1) {
+        int n = uart_read_bytes(BRIDGE_UART, in, sizeof(in), portMAX_DELAY);
+        for (int i = 0; i < n; i++) {
+            uint8_t byte = in[i];
+            if (byte == SLIP_END) {
+                if (!overflow) {
+                    send_to_rover(frame, len);
+                }
+                len = 0;
+                escaped = false;
+                overflow = false;
+                continue;
+            }
+            if (byte == SLIP_ESC) {
+                escaped = true;
+                continue;
+            }
+            if (escaped) {
+                byte = byte == SLIP_ESC_END ? SLIP_END : SLIP_ESC;
+                escaped = false;
+            }
+            if (len < sizeof(frame)) {
+                frame[len++] = byte;
+            } else {
+                overflow = true;
+            }
+        }
+    }
+}
+
+static void hop_timer_callback(void *arg)
+{
+    if (esp_timer_get_time() - last_heard_us < ROVER_TIMEOUT_US) {
+        return;
+    }
+    channel = channel % MAX_CHANNEL + 1;
+    esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
+}
+
+void app_main(void)
+{
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES ||
+        ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        ret = nvs_flash_init();
+    }
+    ESP_ERROR_CHECK(ret);
+
+    uart_config_t uart_config = {
+        .baud_rate = CONFIG_LRR_DONGLE_BAUD,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+        .source_clk = UART_SCLK_DEFAULT,
+    };
+    ESP_ERROR_CHECK(uart_driver_install(
+      BRIDGE_UART, UART_BUFFER_SIZE, UART_BUFFER_SIZE, 0, NULL, 0));
+    ESP_ERROR_CHECK(uart_param_config(BRIDGE_UART, &uart_config));
+
+    // A station that never connects, only there for the radio
+    ESP_ERROR_CHECK(esp_netif_init());
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+    ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+    ESP_ERROR_CHECK(esp_wifi_start());
+    ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_NONE));
+    if (CONFIG_LRR_DONGLE_CHANNEL != 0) {
+        channel = CONFIG_LRR_DONGLE_CHANNEL;
+    }
+    ESP_ERROR_CHECK(esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE));
+
+    rx_queue = xQueueCreate(RX_QUEUE_DEPTH, sizeof(frame_t));
+    ESP_ERROR_CHECK(esp_now_init());
+    ESP_ERROR_CHECK(esp_now_register_recv_cb(espnow_receive_callback));
+
+    uint8_t mac[ESP_NOW_ETH_ALEN];
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    ESP_LOGI(TAG, "ESP-NOW dongle " MACSTR " up", MAC2STR(mac));
+
+    xTaskCreate(uart_tx_task,
+                "uart_tx_task",
+                BRIDGE_TASK_STACK_SIZE,
+                NULL,
+                BRIDGE_TASK_PRIO,
+                NULL);
+    xTaskCreate(uart_rx_task,
+                "uart_rx_task",
+                BRIDGE_TASK_STACK_SIZE,
+                NULL,
+                BRIDGE_TASK_PRIO,
+                NULL);
+
+    if (CONFIG_LRR_DONGLE_CHANNEL == 0) {
+        const esp_timer_create_args_t hop_timer_args = {
+            .callback = hop_timer_callback,
+            .name = "channel_hop",
+        };
+        esp_timer_handle_t hop_timer;
+        ESP_ERROR_CHECK(esp_timer_create(&hop_timer_args, &hop_timer));
+        ESP_ERROR_CHECK(esp_timer_start_periodic(hop_timer, HOP_PERIOD_US));
+    }
+}
@@ -0,0 +1,55 @@
+from ament_index_python.packages import get_package_share_directory
+from launch import LaunchDescription
+from launch.substitutions import PathJoinSubstitution
+from launch_ros.actions import ComposableNodeContainer
+from launch_ros.descriptions import ComposableNode
+
+
+# The native HAL, odometry relay and EKF in one process, so /joint_states,
+# /odom/wheel, /twist and /imu are handed over as pointers instead of going
+# through DDS. Used by lrr.launch.py composable:=True in place of
+# hardware.launch.py and its odometry nodes. Measure with latency_probe.
+def generate_launch_description():
+    intra_process = [{"use_intra_process_comms": True}]
+
+    container = [
+        ComposableNodeContainer(
+            name="lrr_container",
+            namespace="",
+            package="rclcpp_components",
+            # The HAL receives on its own thread, the rest share the executor
+            executable="component_container_mt",
+            output="both",
+            composable_node_descriptions=[
+                ComposableNode(
+                    package="little_red_rover_hal",
+                    plugin="little_red_rover::Hal",
+                    name="hal",
+                    extra_arguments=intra_process,
+                ),
+                ComposableNode(
+                    package="little_red_rover_hal",
+                    plugin="little_red_rover::OdometryRelay",
+                    name="odom_publisher",
+                    extra_arguments=intra_process,
+                ),
+                ComposableNode(
+                    package="little_red_rover_hal",
+                    plugin="little_red_rover::Ekf",
+                    name="ekf_filter_node",
+                    parameters=[
+                        PathJoinSubstitution(
+                            [
+                                get_package_share_directory("little_red_rover"),
+                                "config",
+                                "ekf.yaml",
+                            ]
+                        ),
+                    ],
+                    extra_arguments=intra_process,
+                ),
+            ],
+        ),
+    ]
+
+    return LaunchDescription(container)
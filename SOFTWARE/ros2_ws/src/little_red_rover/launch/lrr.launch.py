@@ -8,6 +8,7 @@ from launch.substitutions import (
     Command,
     FindExecutable,
     PathJoinSubstitution,
+    PythonExpression,
     LaunchConfiguration,
 )
 from launch_ros.substitutions import FindPackageShare
@@ -18,11 +19,19 @@ from launch_ros.descriptions import ParameterValue
 
 def generate_launch_description():
     run_sim = LaunchConfiguration("sim")
+    composable = LaunchConfiguration("composable")
+    # The hardware stack as components in one process, see composable.launch.py
+    run_composable = PythonExpression(["not ", run_sim, " and ", composable])
 
     config = [
         DeclareLaunchArgument(
             "sim", default_value="False", description="Run a simulation"
-        )
+        ),
+        DeclareLaunchArgument(
+            "composable",
+            default_value="False",
+            description="Run the native HAL, odometry and EKF in one process",
+        ),
     ]
 
     robot_launch = [
@@ -42,7 +51,18 @@ def generate_launch_description():
                     "/launch/hardware.launch.py",
                 ]
             ),
-            condition=UnlessCondition(run_sim),
+            condition=IfCondition(
+                PythonExpression(["not ", run_sim, " and not ", composable])
+            ),
+        ),
+        IncludeLaunchDescription(
+            PythonLaunchDescriptionSource(
+                [
+                    get_package_share_directory("little_red_rover"),
+                    "/launch/composable.launch.py",
+                ]
+            ),
+            condition=IfCondition(run_composable),
         ),
     ]
 
@@ -120,6 +140,7 @@ def generate_launch_description():
                     "use_sim_time": run_sim,
                 }
             ],
+            condition=UnlessCondition(run_composable),
         ),
         Node(
             package="robot_localization",
@@ -138,6 +159,7 @@ def generate_launch_description():
                     "use_sim_time": run_sim,
                 },
             ],
+            condition=UnlessCondition(run_composable),
         ),
     ]
 
@@ -3,7 +3,8 @@ from ament_index_python.packages import get_package_share_directory
 from launch import LaunchDescription
 from launch.actions import ExecuteProcess
 from launch.actions import DeclareLaunchArgument
-from launch.substitutions import LaunchConfiguration
+from launch.substitutions import LaunchConfiguration, PythonExpression
+from launch.conditions import IfCondition
 from launch.actions import IncludeLaunchDescription
 from launch_xml.launch_description_sources import XMLLaunchDescriptionSource
 from launch.launch_description_sources import PythonLaunchDescriptionSource
@@ -13,6 +14,8 @@ from launch_ros.actions import Node
 
 def generate_launch_description():
     use_sim_time = LaunchConfiguration("use_sim_time")
+    udp = LaunchConfiguration("udp")
+    robots = LaunchConfiguration("robots")
 
     pkg_lrr = get_package_share_directory("little_red_rover")
     pkg_ros_gz_sim = get_package_share_directory("ros_gz_sim")
@@ -62,4 +65,74 @@ def generate_launch_description():
         ),
     ]
 
-    return LaunchDescription(gazebo_launch)
+    # The rover's sensors and drive reach ROS through the HAL, over the same
+    # UDP protocol and a link as lossy as asked for. Topics are what the lrr
+    # model in testing.sdf publishes and listens on.
+    udp_launch = [
+        DeclareLaunchArgument(
+            "udp",
+            default_value="false",
+            description="Go through the HAL and sim_bridge, like the real rover",
+        ),
+        DeclareLaunchArgument(
+            "robots", default_value="1", description="Simulated rovers for the HAL"
+        ),
+        DeclareLaunchArgument("loss", default_value="0.0"),
+        DeclareLaunchArgument("latency_ms", default_value="2.0"),
+        DeclareLaunchArgument("jitter_ms", default_value="1.0"),
+        DeclareLaunchArgument(
+            "link_kbps", default_value="0.0", description="0 is unlimited"
+        ),
+        Node(
+            package="ros_gz_bridge",
+            executable="parameter_bridge",
+            name="sim_sensor_bridge",
+            arguments=[
+                # What use_sim_time runs the bridge and the HAL on
+                "/clock@rosgraph_msgs/msg/Clock[gz.msgs.Clock",
+                "/lidar@sensor_msgs/msg/LaserScan[gz.msgs.LaserScan",
+                "/model/lrr/joint_state@sensor_msgs/msg/JointState[gz.msgs.Model",
+                "/model/lrr/odometry@nav_msgs/msg/Odometry[gz.msgs.Odometry",
+                "/model/lrr/cmd_vel@geometry_msgs/msg/Twist]gz.msgs.Twist",
+            ],
+            remappings=[
+                ("/lidar", "sim/scan"),
+                ("/model/lrr/joint_state", "sim/joint_states"),
+                ("/model/lrr/odometry", "sim/odom"),
+                ("/model/lrr/cmd_vel", "sim/cmd_vel"),
+            ],
+            condition=IfCondition(udp),
+        ),
+        Node(
+            package="little_red_rover",
+            executable="sim_bridge",
+            output="both",
+            parameters=[
+                {
+                    "use_sim_time": use_sim_time,
+                    "robots": robots,
+                    "loss": LaunchConfiguration("loss"),
+                    "latency_ms": LaunchConfiguration("latency_ms"),
+                    "jitter_ms": LaunchConfiguration("jitter_ms"),
+                    "link_kbps": LaunchConfiguration("link_kbps"),
+                }
+            ],
+            condition=IfCondition(udp),
+        ),
+        # sim_bridge stamps on the simulation clock, so the HAL has to be on it
+        # too
+        Node(
+            package="little_red_rover",
+            executable="hal",
+            output="both",
+            parameters=[
+                {
+                    "use_sim_time": use_sim_time,
+                    "fleet": PythonExpression([robots, " > 1"]),
+                }
+            ],
+            condition=IfCondition(udp),
+        ),
+    ]
+
+    return LaunchDescription(gazebo_launch + udp_launch)
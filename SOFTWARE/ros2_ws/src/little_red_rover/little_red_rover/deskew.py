@@ -0,0 +1,111 @@
+from collections import deque
+from math import pi
+import threading
+
+import numpy as np
+
+# LRR scan deskew
+# The LD20 takes a tenth of a second to sweep a revolution, and the rover
+# can turn a good way in that time. This moves every beam to where it would
+# have landed had the whole revolution been measured at the scan's stamp,
+# using the wheel odometry the firmware integrates.
+
+# Odometry messages kept for interpolation, a few seconds at the publish rate
+HISTORY_DEPTH = 256
+# How far the end of a scan may be past the newest pose. Beyond that the
+# scan goes out as measured.
+MAX_EXTRAPOLATION_NS = 50_000_000
+
+
+class ScanDeskew:
+    """Wheel odometry history, and the per-beam correction it drives."""
+
+    def __init__(self, lidar_x=0.0, lidar_y=0.0, lidar_yaw=0.0, lidar_inverted=False):
+        # Where the lidar sits on base_link. An inverted lidar (rolled over,
+        # z down) sees its y axis mirrored, then lidar_yaw turns it.
+        self.mount_x = lidar_x
+        self.mount_y = lidar_y
+        self.mount_cos = np.cos(lidar_yaw)
+        self.mount_sin = np.sin(lidar_yaw)
+        self.mirror = -1.0 if lidar_inverted else 1.0
+
+        # Written by the decode thread, read when a scan is published
+        self.lock = threading.Lock()
+        self.history = deque(maxlen=HISTORY_DEPTH)
+        self.last_yaw = 0.0
+
+    def add_pose(self, stamp_ns, x, y, yaw):
+        with self.lock:
+            # Unwrapped, so interpolating across +-pi doesn't spin the scan
+            if self.history:
+                yaw = self.last_yaw + (yaw - self.last_yaw + pi) % (2 * pi) - pi
+                if stamp_ns <= self.history[-1][0]:
+                    # Out of order or a clock step, start over
+                    self.history.clear()
+            self.last_yaw = yaw
+            self.history.append((stamp_ns, x, y, yaw))
+
+    def apply(self, ranges, intensities, stamp_ns, scan_time, range_min):
+        """Correct a scan in place. Returns False if it was left as is."""
+        count = len(ranges)
+        if scan_time <= 0.0 or count == 0:
+            return False
+
+        with self.lock:
+            if len(self.history) < 2:
+                return False
+            history = np.array(self.history)
+
+        # Beams are swept in bin order, starting at the stamp
+        end_ns = stamp_ns + int(scan_time * 1e9)
+        if history[0, 0] > stamp_ns or history[-1, 0] < end_ns - MAX_EXTRAPOLATION_NS:
+            return False
+
+        beams = np.flatnonzero(np.isfinite(ranges) & (ranges >= range_min))
+        if len(beams) == 0:
+            return True
+
+        # Pose of base_link when each beam was measured, relative to where
+        # it was at the stamp
+        times = history[:, 0] - stamp_ns
+        beam_times = beams * (scan_time * 1e9 / count)
+        x = np.interp(beam_times, times, history[:, 1])
+        y = np.interp(beam_times, times, history[:, 2])
+        yaw = np.interp(beam_times, times, history[:, 3])
+        x0, y0, yaw0 = (np.interp(0.0, times, history[:, i]) for i in (1, 2, 3))
+        c0, s0 = np.cos(yaw0), np.sin(yaw0)
+        dx = c0 * (x - x0) + s0 * (y - y0)
+        dy = -s0 * (x - x0) + c0 * (y - y0)
+        dyaw = yaw - yaw0
+
+        # Beam to base_link as it was then, then to base_link at the stamp
+        angles = beams * (2 * pi / count)
+        r = ranges[beams]
+        lx = r * np.cos(angles)
+        ly = self.mirror * r * np.sin(angles)
+        px = self.mount_cos * lx - self.mount_sin * ly + self.mount_x
+        py = self.mount_sin * lx + self.mount_cos * ly + self.mount_y
+        c, s = np.cos(dyaw), np.sin(dyaw)
+        bx = c * px - s * py + dx - self.mount_x
+        by = s * px + c * py + dy - self.mount_y
+        qx = self.mount_cos * bx + self.mount_sin * by
+        qy = self.mirror * (-self.mount_sin * bx + self.mount_cos * by)
+
+        new_ranges = np.hypot(qx, qy).astype(np.float32)
+        new_angles = np.arctan2(qy, qx) % (2 * pi)
+        bins = np.rint(new_angles * (count / (2 * pi))).astype(np.intp) % count
+
+        # Where two beams now share a bin the nearer one hides the other
+        order = np.lexsort((new_ranges, bins))
+        bins = bins[order]
+        first = np.empty(len(bins), dtype=bool)
+        first[0] = True
+        np.not_equal(bins[1:], bins[:-1], out=first[1:])
+        keep = order[first]
+
+        moved_intensities = intensities[beams]
+        ranges[beams] = np.inf
+        intensities[beams] = 0.0
+        ranges[bins[first]] = new_ranges[keep]
+        intensities[bins[first]] = moved_intensities[keep]
+        return True
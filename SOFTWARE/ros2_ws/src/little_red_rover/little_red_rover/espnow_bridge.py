@@ -0,0 +1,75 @@
+import threading
+
+# LRR ESP-NOW bridge
+# Talks to the ESP-NOW dongle (SOFTWARE/espnow_dongle) over its serial port.
+# Each frame is a rover's MAC address followed by one encoded UdpPacket,
+# SLIP framed, in both directions.
+
+SLIP_END = 0xC0
+SLIP_ESC = 0xDB
+SLIP_ESC_END = 0xDC
+SLIP_ESC_ESC = 0xDD
+
+MAC_LEN = 6
+# Largest ESP-NOW payload
+MAX_PAYLOAD = 250
+
+
+def slip_encode(data):
+    escaped = data.replace(bytes([SLIP_ESC]), bytes([SLIP_ESC, SLIP_ESC_ESC]))
+    escaped = escaped.replace(bytes([SLIP_END]), bytes([SLIP_ESC, SLIP_ESC_END]))
+    return bytes([SLIP_END]) + escaped + bytes([SLIP_END])
+
+
+def slip_decode(frame):
+    out = bytearray()
+    escaped = False
+    for byte in frame:
+        if escaped:
+            out.append(SLIP_END if byte == SLIP_ESC_END else SLIP_ESC)
+            escaped = False
+        elif byte == SLIP_ESC:
+            escaped = True
+        else:
+            out.append(byte)
+    return bytes(out)
+
+
+class EspNowBridge:
+    """Serial link to the dongle. Frames come back through on_frame(mac, data)."""
+
+    def __init__(self, port, baud, on_frame):
+        # Only needed when there's a dongle
+        import serial
+
+        self.serial = serial.Serial(port, baud, timeout=None)
+        self.on_frame = on_frame
+        self.write_lock = threading.Lock()
+        self.frames_received = 0
+        self.frames_dropped = 0
+        threading.Thread(target=self.run_loop, name="hal_espnow", daemon=True).start()
+
+    def send(self, mac, data):
+        if len(data) > MAX_PAYLOAD:
+            return False
+        frame = slip_encode(mac + data)
+        with self.write_lock:
+            self.serial.write(frame)
+        return True
+
+    def run_loop(self):
+        pending = bytearray()
+        while True:
+            # Block for a byte, then take whatever else has arrived with it
+            pending += self.serial.read(max(1, self.serial.in_waiting))
+            *frames, rest = pending.split(bytes([SLIP_END]))
+            pending = bytearray(rest)
+            for frame in frames:
+                if not frame:
+                    continue
+                data = slip_decode(frame)
+                if len(data) <= MAC_LEN:
+                    self.frames_dropped += 1
+                    continue
+                self.frames_received += 1
+                self.on_frame(data[:MAC_LEN], data[MAC_LEN:])
@@ -0,0 +1,115 @@
+import argparse
+from collections import Counter
+import os
+import struct
+import urllib.request
+
+# LRR flight recording
+# Downloads and decodes the rover's flight recorder (CONFIG_LRR_RECORDER),
+# the raw lidar frames, encoder samples and cmd_vel it saw most recently.
+# Layout is in SOFTWARE/esp32_firmware/components/flight_recorder.
+# E.g. `ros2 run little_red_rover flight_recording 192.168.4.1 -o run.bin`,
+# then `ros2 run little_red_rover flight_recording run.bin --records`.
+# `--ld20 scan.bin` writes the lidar frames out as the LD20 sent them, for
+# the firmware's host benchmarks (SOFTWARE/esp32_firmware/host_bench).
+
+MAGIC = 0x4652524C
+VERSION = 1
+# magic, version, used, seq, boot, start_us, crc
+SECTOR = struct.Struct("<IHHIIqI")
+# type, len, low half of the rover's time in us
+RECORD = struct.Struct("<BBI")
+
+LIDAR_FRAME = 1
+ENCODERS = 2
+TWIST_CMD = 3
+
+# header, ver_len, speed, start_angle, 12 x (distance, intensity),
+# end_angle, timestamp, crc8
+LIDAR = struct.Struct("<BBHH" + "HB" * 12 + "HHB")
+# left and right edges, then left and right last edge ticks
+ENCODER = struct.Struct("<iiII")
+# host stamp sec and nanosec, v, w
+TWIST = struct.Struct("<iIff")
+
+TYPE_NAMES = {LIDAR_FRAME: "lidar", ENCODERS: "encoders", TWIST_CMD: "cmd_vel"}
+
+
+def read_recording(data):
+    """Decode a download into a list of (boot, time_us, type, fields) tuples,
+    oldest first. Fields are the unpacked payload, or the raw bytes for a type
+    this doesn't know."""
+    records = []
+    offset = 0
+    while offset + SECTOR.size <= len(data):
+        magic, version, used, _, boot, start_us, _ = SECTOR.unpack_from(data, offset)
+        if magic != MAGIC or version != VERSION:
+            raise ValueError(f"Not a flight recorder sector at byte {offset}")
+        offset += SECTOR.size
+        end = offset + used
+
+        while offset + RECORD.size <= end:
+            kind, length, low_us = RECORD.unpack_from(data, offset)
+            offset += RECORD.size
+            payload = data[offset : offset + length]
+            offset += length
+            # Times are never before the sector started
+            time_us = start_us + ((low_us - start_us) & 0xFFFFFFFF)
+
+            if kind == LIDAR_FRAME and length == LIDAR.size:
+                fields = LIDAR.unpack(payload)
+            elif kind == ENCODERS and length == ENCODER.size:
+                fields = ENCODER.unpack(payload)
+            elif kind == TWIST_CMD and length == TWIST.size:
+                fields = TWIST.unpack(payload)
+            else:
+                fields = payload
+            records.append((boot, time_us, kind, fields))
+        offset = end
+    return records
+
+
+def main(args=None):
+    parser = argparse.ArgumentParser(description="Fetch and decode a flight recording")
+    parser.add_argument("source", help="rover address, or a recording saved with -o")
+    parser.add_argument("-o", "--output", help="save the download here")
+    parser.add_argument("--records", action="store_true", help="print every record")
+    parser.add_argument("--ld20", help="write the raw lidar frames here")
+    args = parser.parse_args(args)
+
+    if not os.path.isfile(args.source):
+        url = args.source if "://" in args.source else f"http://{args.source}"
+        with urllib.request.urlopen(f"{url}/recording") as response:
+            data = response.read()
+        if args.output is not None:
+            with open(args.output, "wb") as f:
+                f.write(data)
+    else:
+        with open(args.source, "rb") as f:
+            data = f.read()
+
+    records = read_recording(data)
+    if args.records:
+        for boot, time_us, kind, fields in records:
+            print(f"{boot:4d} {time_us / 1e6:12.6f} {TYPE_NAMES.get(kind, kind)} {fields}")
+
+    if args.ld20 is not None:
+        frames = [fields for _, _, kind, fields in records if kind == LIDAR_FRAME]
+        with open(args.ld20, "wb") as f:
+            for fields in frames:
+                f.write(LIDAR.pack(*fields))
+        print(f"{len(frames)} lidar frames written to {args.ld20}")
+
+    boots = sorted(set(record[0] for record in records))
+    for boot in boots:
+        times = [record[1] for record in records if record[0] == boot]
+        counts = Counter(
+            TYPE_NAMES.get(record[2], record[2]) for record in records if record[0] == boot
+        )
+        summary = ", ".join(f"{count} {name}" for name, count in sorted(counts.items()))
+        print(f"Boot {boot}: {min(times) / 1e6:.3f} s to {max(times) / 1e6:.3f} s, {summary}")
+    print(f"{len(records)} records, {len(data)} bytes")
+
+
+if __name__ == "__main__":
+    main()
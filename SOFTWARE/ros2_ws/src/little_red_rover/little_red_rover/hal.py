@@ -1,119 +1,1053 @@
-from math import floor, inf, pi
+from array import array
+from math import cos, inf, pi, sin
+import numpy as np
 import rclpy
 from rclpy.node import Node
+from rclpy.parameter import Parameter
 from rclpy.qos import qos_profile_sensor_data
+from rclpy.time import Time
 
+from sensor_msgs.msg._imu import Imu
 from sensor_msgs.msg._joint_state import JointState
 from sensor_msgs.msg._laser_scan import LaserScan
 from geometry_msgs.msg._twist import Twist
+from nav_msgs.msg import Odometry
+from diagnostic_msgs.msg import DiagnosticArray, DiagnosticStatus, KeyValue
+from rcl_interfaces.msg import SetParametersResult
+from std_srvs.srv import Trigger
 
+from little_red_rover.deskew import ScanDeskew
+from little_red_rover.espnow_bridge import EspNowBridge
+from little_red_rover.reliable import ReliableChannel
 import little_red_rover.pb.messages_pb2 as messages
 
+import queue
 import threading
 import socket
+import time
+import traceback
 
 # LRR Hardware Abstraction Layer (HAL)
 
-robot_ip = "192.168.4.1"
+PORT = 8001
 
+SCAN_BINS = 720
+CENTIDEG_PER_BIN = 36000 // SCAN_BINS
 
-class HAL(Node):
-    def __init__(self):
-        super().__init__("hal")
+# Where Odometry.pose_covariance (x, y, yaw) and twist_covariance (v, w)
+# land in the 6x6 ROS covariances
+POSE_AXES = (0, 1, 5)
+TWIST_AXES = (0, 5)
 
-        self.socket = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
-        self.socket.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
-        self.socket.bind(("0.0.0.0", 8001))
+# Layout of CompactLaserScan.points
+COMPACT_POINT = np.dtype([("distance", "<u2"), ("intensity", "u1")])
 
-        self.subscription = self.create_subscription(
-            Twist, "cmd_vel", self.cmd_vel_callback, qos_profile_sensor_data
-        )
+# ControlConfig fields exposed as control.<name> parameters
+CONTROL_FIELDS = ("kp", "ki", "kd", "integral_limit", "max_jerk", "hysteresis")
+# ControlConfig.models entries, exposed as control.<side>_<field>
+MOTOR_SIDES = ("left", "right")
+MODEL_FIELDS = ("ks", "kv")
+
+# Most datagrams handed from the receive thread to decode at once
+RX_BATCH = 32
+# Scans being assembled, waiting or publishing at once, per rover
+SCAN_BUFFERS = 3
+# Rovers served at once in fleet mode, anyone else is ignored
+MAX_ROBOTS = 16
+# UdpPacket fields that don't say what a packet carries
+PACKET_ENVELOPE = ("robot_id", "batch", "reliable")
+# Stands in for the IP in the source address of frames from the dongle
+ESPNOW = "espnow"
+# The rover goes back to UDP once the dongle has been quiet this long
+ESPNOW_TIMEOUT_NS = 3_000_000_000
+
+
+def to_nanoseconds(stamp: messages.TimeStamp):
+    return stamp.sec * 1_000_000_000 + stamp.nanosec
 
-        self.joint_state_publisher = self.create_publisher(
-            JointState, "joint_states", qos_profile_sensor_data
-        )
 
-        self.scan_publisher = self.create_publisher(
-            LaserScan, "scan", qos_profile_sensor_data
+def decode_compact_points(packet: messages.CompactLaserScan):
+    """Distances (mm) and intensities, or None if the payload is malformed."""
+    if packet.encoding == messages.POINT_ENCODING_RAW:
+        if len(packet.points) % COMPACT_POINT.itemsize != 0:
+            return None
+        points = np.frombuffer(packet.points, dtype=COMPACT_POINT)
+        return points["distance"], points["intensity"]
+
+    # Zigzag varint distance deltas, then one intensity byte per point
+    count = packet.point_count
+    data = np.frombuffer(packet.points, dtype=np.uint8)
+    if packet.encoding != messages.POINT_ENCODING_DELTA_VARINT:
+        return None
+    if count == 0:
+        # Everything in the packet was filtered out
+        return data[:0].astype(np.int32), data[:0]
+    if len(data) < 2 * count:
+        return None
+    varints = data[: len(data) - count]
+    intensities = data[len(data) - count :]
+
+    # Each varint ends at the first byte without the continuation bit, and
+    # none is longer than three bytes
+    ends = np.flatnonzero(varints < 0x80)
+    if len(ends) != count or ends[-1] != len(varints) - 1:
+        return None
+    starts = np.zeros_like(ends)
+    starts[1:] = ends[:-1] + 1
+    lengths = ends - starts + 1
+    if lengths.max() > 3:
+        return None
+    values = (varints[starts] & 0x7F).astype(np.int32)
+    for byte in (1, 2):
+        more = lengths > byte
+        values[more] |= (varints[starts[more] + byte] & 0x7F).astype(np.int32) << (
+            7 * byte
         )
-        self.laser_msg = LaserScan()
-        self.laser_msg.header.frame_id = "lidar"
-        self.laser_msg.range_min = 0.1
-        self.laser_msg.range_max = 8.0
-        self.laser_msg.angle_min = 0.0
-        self.laser_msg.angle_max = 2.0 * pi
-        self.laser_msg.ranges.fromlist([0.0] * 720)
-        self.laser_msg.intensities.fromlist([0.0] * 720)
-        self.laser_msg.angle_increment = (2 * pi) / (len(self.laser_msg.ranges))
 
-        threading.Thread(target=self.run_loop).start()
+    deltas = (values >> 1) ^ -(values & 1)
+    return np.cumsum(deltas), intensities
 
-    def run_loop(self):
+
+def packet_kind(packet: messages.UdpPacket):
+    """What a packet mainly carries, e.g. joint_states when odometry rides
+    along, for timing handle_packet by message type."""
+    for field, _ in packet.ListFields():
+        if field.name not in PACKET_ENVELOPE:
+            return field.name
+    return "empty"
+
+
+def diagnostic_status(hardware_id, name, values):
+    # Counters are totals since boot, so level only reflects whether the
+    # report arrived. Trends are for the host side to judge.
+    status = DiagnosticStatus()
+    status.name = f"{hardware_id}: {name}"
+    status.hardware_id = hardware_id
+    status.level = DiagnosticStatus.OK
+    status.message = "OK"
+    for key, value in values.items():
+        status.values.append(KeyValue(key=key, value=str(value)))
+    return status
+
+
+class Stage:
+    """Bounded queue feeding a worker thread, dropping work when it's full.
+    An item the handler raises on is counted and skipped, so one bad packet
+    can't stop the stage."""
+
+    def __init__(self, name, handler, depth, logger):
+        self.name = name
+        self.handler = handler
+        self.logger = logger
+        self.queue = queue.Queue(maxsize=depth)
+        # put can come from more than one thread (the decode stage is fed by
+        # the receive thread and the ESP-NOW bridge), so dropped and
+        # high_water are updated under put_lock
+        self.put_lock = threading.Lock()
+        self.dropped = 0
+        self.high_water = 0
+        self.failures = 0
+        # Where handlers have failed, so each is only logged the first time
+        self.failure_sites = set()
+        threading.Thread(target=self.run, name=name, daemon=True).start()
+
+    def put(self, item):
+        with self.put_lock:
+            try:
+                self.queue.put_nowait(item)
+            except queue.Full:
+                self.dropped += 1
+                return
+            self.high_water = max(self.high_water, self.queue.qsize())
+
+    def run(self):
         while True:
-            data = self.socket.recv(1500)
-            packet = messages.UdpPacket()
+            item = self.queue.get()
             try:
-                packet.ParseFromString(data)
+                self.handler(item)
             except Exception as e:
-                print(e)
-                continue
+                self.failures += 1
+                frame = traceback.extract_tb(e.__traceback__)[-1]
+                site = (type(e), frame.filename, frame.lineno)
+                if site not in self.failure_sites:
+                    self.failure_sites.add(site)
+                    self.logger.error(
+                        f"{self.name} failed, counting any more like this:\n"
+                        f"{traceback.format_exc()}"
+                    )
+
+
+class Rover:
+    """What the HAL keeps per robot: its topics, scan assembly and address."""
+
+    def __init__(self, hal, robot_id, namespace, address):
+        self.hal = hal
+        self.robot_id = robot_id
+        self.namespace = namespace
+        # Updated from every datagram, so a rover can change address. None
+        # until it's been heard over UDP, if it turned up through the dongle.
+        self.address = address
+        # Its MAC, when it's talking through the ESP-NOW dongle as well
+        self.espnow_mac = None
+        self.espnow_heard_ns = 0
+        # Whether the packet being handled came through the dongle, so
+        # answers go back the same way
+        self.via_espnow = False
+
+        prefix = f"{namespace}/" if namespace else ""
+        self.hardware_id = f"little_red_rover/{namespace}" if namespace else "little_red_rover"
+        self.body_frame = f"{prefix}robot_body"
+        self.odom_frame = f"{prefix}odom"
+        self.base_frame = f"{prefix}base_link"
+
+        self.subscription = hal.create_subscription(
+            Twist, f"{prefix}cmd_vel", self.cmd_vel_callback, qos_profile_sensor_data
+        )
+
+        self.joint_state_publisher = hal.create_publisher(
+            JointState, f"{prefix}joint_states", qos_profile_sensor_data
+        )
+
+        # Integrated on the robot from every control step
+        self.odometry_publisher = hal.create_publisher(
+            Odometry, f"{prefix}odom/wheel", qos_profile_sensor_data
+        )
+
+        self.imu_publisher = hal.create_publisher(
+            Imu, f"{prefix}imu", qos_profile_sensor_data
+        )
+
+        # Only sent when the firmware runs its own attitude filter
+        self.attitude_publisher = hal.create_publisher(
+            Imu, f"{prefix}imu/attitude", qos_profile_sensor_data
+        )
 
-            if packet.HasField("laser"):
-                self.handle_laser_scan(packet.laser)
-            elif packet.HasField("joint_states"):
-                self.handle_joint_states(packet.joint_states)
+        self.scan_publisher = hal.create_publisher(
+            LaserScan, f"{prefix}scan", qos_profile_sensor_data
+        )
+
+        # Fits control.*_ks and control.*_kv on the rover, honouring
+        # control.save. The wheels spin, so lift them first.
+        hal.create_service(Trigger, f"{prefix}calibrate_motors", self.calibrate_motors)
+
+        # Scans rotate through a few fixed buffers, so they're never
+        # reallocated. The numpy views write straight into each message's
+        # arrays. Buffers go back on free_scans once they've been published.
+        self.laser_msgs = [self.make_laser_msg(prefix) for _ in range(SCAN_BUFFERS)]
+        self.free_scans = queue.Queue()
+        for index in range(1, SCAN_BUFFERS):
+            self.free_scans.put(index)
+        self.laser_index = 0
+        self.laser_msg = self.laser_msgs[0]
+        self.views = [
+            (np.frombuffer(msg.ranges, dtype=np.float32),
+             np.frombuffer(msg.intensities, dtype=np.float32))
+            for msg in self.laser_msgs
+        ]
+
+        # Revolution currently being assembled from compact scan fragments
+        self.scan_id = -1
+        self.scan_done = True
+        self.scans_dropped = 0
+        self.scans_not_deskewed = 0
+
+        self.deskew = None
+        if hal.deskew_mount is not None:
+            self.deskew = ScanDeskew(*hal.deskew_mount)
+
+        # What the rover last said it's using
+        self.control_config = None
+
+        # Config and commands, which have to arrive
+        self.reliable = ReliableChannel(self.send_reliable_data)
+
+    def handle_packet(self, packet: messages.UdpPacket, received_ns):
+        if packet.HasField("compact_laser"):
+            self.handle_compact_laser_scan(packet.compact_laser)
+        elif packet.HasField("laser"):
+            self.handle_laser_scan(packet.laser)
+        elif packet.HasField("joint_states"):
+            self.handle_joint_states(packet.joint_states)
+        elif packet.HasField("imu"):
+            self.handle_imu(packet.imu)
+        elif packet.HasField("command_stats"):
+            self.handle_command_stats(packet.command_stats)
+        elif packet.HasField("diagnostics"):
+            self.handle_diagnostics(packet.diagnostics)
+        elif packet.HasField("control_config"):
+            self.handle_control_config(packet.control_config)
+        elif packet.HasField("time_sync"):
+            self.handle_time_sync(packet.time_sync, received_ns)
+        elif packet.HasField("discovery"):
+            self.handle_discovery(packet.discovery)
+
+        # Ride along in the same packet as an IMU batch or joint states
+        if packet.HasField("attitude"):
+            self.handle_attitude(packet.attitude)
+        if packet.HasField("odometry"):
+            self.handle_odometry(packet.odometry)
 
     def handle_joint_states(self, packet: messages.JointStates):
         msg = JointState()
-        msg.header.frame_id = "robot_body"
-        msg.header.stamp = self.get_clock().now().to_msg()
+        msg.header.frame_id = self.body_frame
+        msg.header.stamp = Time(nanoseconds=to_nanoseconds(packet.time)).to_msg()
         msg.name = packet.name
         msg.effort = packet.effort
         msg.position = packet.position
         msg.velocity = packet.velocity
-        self.joint_state_publisher.publish(msg)
+        self.hal.joint_state_stage.put((self.joint_state_publisher, msg))
+
+    def handle_odometry(self, packet: messages.Odometry):
+        msg = Odometry()
+        msg.header.frame_id = self.odom_frame
+        msg.header.stamp = Time(nanoseconds=to_nanoseconds(packet.time)).to_msg()
+        msg.child_frame_id = self.base_frame
+
+        msg.pose.pose.position.x = packet.x
+        msg.pose.pose.position.y = packet.y
+        msg.pose.pose.orientation.z = sin(packet.yaw / 2)
+        msg.pose.pose.orientation.w = cos(packet.yaw / 2)
+        msg.twist.twist.linear.x = packet.v
+        msg.twist.twist.angular.z = packet.w
+
+        if len(packet.pose_covariance) == 9:
+            for i, row in enumerate(POSE_AXES):
+                for j, col in enumerate(POSE_AXES):
+                    msg.pose.covariance[row * 6 + col] = packet.pose_covariance[i * 3 + j]
+        if len(packet.twist_covariance) == 4:
+            for i, row in enumerate(TWIST_AXES):
+                for j, col in enumerate(TWIST_AXES):
+                    msg.twist.covariance[row * 6 + col] = packet.twist_covariance[i * 2 + j]
+        self.hal.odometry_stage.put((self.odometry_publisher, msg))
+
+        if self.deskew is not None:
+            self.deskew.add_pose(
+                to_nanoseconds(packet.time), packet.x, packet.y, packet.yaw
+            )
+
+    def handle_imu(self, packet: messages.Imu):
+        start_ns = to_nanoseconds(packet.time)
+        batch = []
+        for sample in packet.samples:
+            msg = Imu()
+            msg.header.frame_id = self.body_frame
+            msg.header.stamp = Time(
+                nanoseconds=start_ns + sample.time_offset_us * 1000
+            ).to_msg()
+            # No orientation estimate
+            msg.orientation_covariance[0] = -1.0
+            msg.angular_velocity.x = sample.gyro_x * packet.gyro_scale
+            msg.angular_velocity.y = sample.gyro_y * packet.gyro_scale
+            msg.angular_velocity.z = sample.gyro_z * packet.gyro_scale
+            msg.linear_acceleration.x = sample.accel_x * packet.accel_scale
+            msg.linear_acceleration.y = sample.accel_y * packet.accel_scale
+            msg.linear_acceleration.z = sample.accel_z * packet.accel_scale
+            batch.append(msg)
+        self.hal.imu_stage.put((self.imu_publisher, batch))
+
+    def handle_attitude(self, packet: messages.Attitude):
+        msg = Imu()
+        msg.header.frame_id = self.body_frame
+        msg.header.stamp = Time(nanoseconds=to_nanoseconds(packet.time)).to_msg()
+
+        # Fixed axis roll, pitch, yaw to a quaternion
+        cr, sr = cos(packet.roll / 2), sin(packet.roll / 2)
+        cp, sp = cos(packet.pitch / 2), sin(packet.pitch / 2)
+        cy, sy = cos(packet.yaw / 2), sin(packet.yaw / 2)
+        msg.orientation.w = cr * cp * cy + sr * sp * sy
+        msg.orientation.x = sr * cp * cy - cr * sp * sy
+        msg.orientation.y = cr * sp * cy + sr * cp * sy
+        msg.orientation.z = cr * cp * sy - sr * sp * cy
+
+        # Only the yaw rate is estimated, and there's no acceleration
+        msg.angular_velocity.z = packet.yaw_rate
+        msg.angular_velocity_covariance[0] = -1.0
+        msg.linear_acceleration_covariance[0] = -1.0
+        self.hal.imu_stage.put((self.attitude_publisher, [msg]))
+
+    def handle_command_stats(self, packet: messages.CommandStats):
+        status = DiagnosticStatus()
+        status.name = f"{self.hardware_id}: cmd_vel"
+        status.hardware_id = self.hardware_id
+        if packet.timeouts > 0:
+            status.level = DiagnosticStatus.WARN
+            status.message = "Commands timed out"
+        elif packet.rejected > 0:
+            status.level = DiagnosticStatus.WARN
+            status.message = "Stale commands rejected"
+        else:
+            status.level = DiagnosticStatus.OK
+            status.message = "OK"
+
+        edges = ["2", "5", "10", "20", "50", "100", "200", "inf"]
+        for edge, count in zip(edges, packet.age_histogram):
+            status.values.append(
+                KeyValue(key=f"age < {edge} ms", value=str(count))
+            )
+        status.values.append(
+            KeyValue(key="unstamped", value=str(packet.unstamped))
+        )
+        status.values.append(
+            KeyValue(key="rejected", value=str(packet.rejected))
+        )
+        status.values.append(
+            KeyValue(key="timeouts", value=str(packet.timeouts))
+        )
+
+        msg = DiagnosticArray()
+        msg.header.stamp = self.hal.get_clock().now().to_msg()
+        msg.status.append(status)
+        self.hal.diagnostics_stage.put(msg)
+
+    def handle_control_config(self, packet: messages.ControlConfig):
+        if packet != self.control_config:
+            values = ", ".join(f"{name} {getattr(packet, name):.4g}" for name in CONTROL_FIELDS)
+            for side, model in zip(MOTOR_SIDES, packet.models):
+                values += f", {side} ks {model.ks:.4g} kv {model.kv:.4g}"
+            self.hal.get_logger().info(
+                f"{self.hardware_id} control loop at {packet.loop_hz} Hz: {values}"
+            )
+        self.control_config = packet
+
+    def handle_time_sync(self, packet: messages.TimeSync, received_ns):
+        # The rover puts every stamp it sends on this clock, so answer
+        # straight away. Time spent here is taken out of the round trip.
+        answer = messages.UdpPacket()
+        answer.time_sync.rover_send_us = packet.rover_send_us
+        answer.time_sync.host_receive_ns = received_ns
+        answer.time_sync.host_send_ns = time.time_ns()
+        self.send_packet(answer, espnow=self.via_espnow)
+
+    def handle_discovery(self, packet: messages.Discovery):
+        # The rover broadcasts until someone answers, and sends everything
+        # to whoever does
+        if not packet.answer:
+            answer = messages.UdpPacket()
+            answer.discovery.answer = True
+            self.send_packet(answer, espnow=self.via_espnow)
+
+    def handle_diagnostics(self, packet: messages.Diagnostics):
+        lanes = ["control", "imu", "lidar", "diagnostics"]
+        comms = {
+            "sendto failures": packet.sendto_failures,
+            "rx decode errors": packet.rx_decode_errors,
+            "tx pool exhausted": packet.tx_pool_exhausted,
+        }
+        for lane, dropped in zip(lanes, packet.lane_dropped):
+            comms[f"{lane} lane dropped"] = dropped
+        for lane, high_water in zip(lanes, packet.lane_high_water):
+            comms[f"{lane} lane high water"] = high_water
+        comms["time sync samples"] = packet.time_sync_samples
+        comms["time sync rejected"] = packet.time_sync_rejected
+        comms["time sync round trip (us)"] = packet.time_sync_round_trip_us
+        comms["wifi rssi (dBm)"] = packet.wifi_rssi
+        comms["wifi reconnects"] = packet.wifi_reconnects
+        comms["wifi poor link events"] = packet.wifi_poor_link_events
+        comms["lidar packets shed"] = packet.lidar_shed
+        comms["espnow sent"] = packet.espnow_sent
+        comms["espnow received"] = packet.espnow_received
+        comms["reliable retransmits"] = packet.reliable_retransmits
+        comms["reliable expired"] = packet.reliable_expired
+        comms["reliable duplicates"] = packet.reliable_duplicates
+
+        lidar = {
+            "frames": packet.lidar_frames,
+            "crc errors": packet.lidar_crc_errors,
+            "resyncs": packet.lidar_resyncs,
+            "uart overflows": packet.lidar_uart_overflows,
+        }
+        control = {
+            "loops": packet.control_loops,
+            "overruns": packet.control_overruns,
+            "max jitter (us)": packet.control_max_jitter_us,
+        }
+        imu = {
+            "samples": packet.imu_samples,
+            "fifo overruns": packet.imu_fifo_overruns,
+            "dropped batches": packet.imu_dropped_batches,
+            "i2c errors": packet.imu_i2c_errors,
+        }
+        system = {
+            "robot id": f"{self.robot_id:06x}",
+            "uptime (ms)": packet.uptime_ms,
+            "free heap": packet.free_heap,
+            "min free heap": packet.min_free_heap,
+        }
+        for task in packet.tasks:
+            system[f"{task.name} cpu %"] = f"{task.cpu_percent:.1f}"
+            system[f"{task.name} stack free"] = task.stack_free
+        power = {
+            "state": messages.PowerState.Name(packet.power_state),
+            "cpu freq (MHz)": packet.cpu_freq_mhz,
+        }
+        for state, ms in enumerate(packet.power_state_ms):
+            name = messages.PowerState.Name(state).removeprefix("POWER_STATE_").lower()
+            power[f"{name} (s)"] = f"{ms / 1000:.1f}"
+
+        msg = DiagnosticArray()
+        msg.header.stamp = self.hal.get_clock().now().to_msg()
+        msg.status.append(diagnostic_status(self.hardware_id, "comms", comms))
+        msg.status.append(diagnostic_status(self.hardware_id, "lidar", lidar))
+        msg.status.append(diagnostic_status(self.hardware_id, "control loop", control))
+        msg.status.append(diagnostic_status(self.hardware_id, "imu", imu))
+        msg.status.append(diagnostic_status(self.hardware_id, "system", system))
+        msg.status.append(diagnostic_status(self.hardware_id, "power", power))
+        self.hal.diagnostics_stage.put(msg)
+
+    def make_laser_msg(self, prefix):
+        msg = LaserScan()
+        msg.header.frame_id = f"{prefix}lidar"
+        msg.range_min = 0.1
+        msg.range_max = 8.0
+        msg.angle_min = 0.0
+        msg.angle_max = 2.0 * pi
+        msg.ranges = array("f", bytes(4 * SCAN_BINS))
+        msg.intensities = array("f", bytes(4 * SCAN_BINS))
+        msg.angle_increment = (2 * pi) / SCAN_BINS
+        return msg
 
     def handle_laser_scan(self, packet: messages.LaserScan):
-        break_in_packet = False
+        count = len(packet.ranges)
+        if count < 2 or len(packet.intensities) != count:
+            return
+
+        angles = np.linspace(packet.angle_min, packet.angle_max, count)
+        indices = (np.mod(angles, 2.0 * pi) / (2.0 * pi) * SCAN_BINS).astype(
+            np.intp
+        ) % SCAN_BINS
+        distances = np.asarray(packet.ranges, dtype=np.float32)
+        intensities = np.asarray(packet.intensities, dtype=np.float32)
+
+        # Everything past a full turn belongs to the next scan
+        wrapped = np.flatnonzero(angles > 2.0 * pi)
+        if len(wrapped) == 0:
+            self.add_scan_points(indices, distances, intensities)
+            return
+
+        i = wrapped[0]
+        self.add_scan_points(indices[:i], distances[:i], intensities[:i])
+
+        self.laser_msg.time_increment = packet.time_increment
+        self.laser_msg.scan_time = packet.scan_time
+        self.publish_scan()
+        self.laser_msg.header.stamp = Time(
+            nanoseconds=to_nanoseconds(packet.time)
+            + int(i * packet.time_increment * 1e9)
+        ).to_msg()
+
+        self.add_scan_points(indices[i:], distances[i:], intensities[i:])
+
+    def handle_compact_laser_scan(self, packet: messages.CompactLaserScan):
+        # Anything from a revolution we've already moved past is stale. The
+        # window keeps a firmware restart (scan_id back to 0) from looking
+        # like an old fragment.
+        age = (self.scan_id - packet.scan_id) & 0xFFFFFFFF
+        if 0 < age < 16 or (age == 0 and self.scan_done):
+            return
 
-        for i in range(len(packet.ranges)):
-            angle = packet.angle_min + (packet.angle_max - packet.angle_min) * (
-                i / (len(packet.ranges) - 1)
+        # Points are (distance mm, intensity), straight off the LD20 or
+        # compressed. When the firmware filtered some out, kept marks which
+        # of the points it swept made it.
+        decoded = decode_compact_points(packet)
+        if decoded is None:
+            return
+        distances, intensities = decoded
+        swept = len(distances)
+        kept = None
+        if len(packet.kept) > 0:
+            swept = packet.swept_points
+            # The mask needs a bit for every point swept
+            if swept > 8 * len(packet.kept):
+                return
+            kept = np.unpackbits(
+                np.frombuffer(packet.kept, dtype=np.uint8), bitorder="little"
+            )[:swept].astype(bool)
+            if np.count_nonzero(kept) != len(distances):
+                return
+        if swept < 2 or packet.end_angle <= packet.start_angle:
+            return
+
+        if packet.scan_id != self.scan_id:
+            if not self.scan_done:
+                self.publish_scan()
+            self.scan_id = packet.scan_id
+            self.scan_done = False
+
+            # The scan starts at 0 degrees, which was measured a little
+            # before the first point we got (more if fragment 0 was lost).
+            points_per_centideg = (swept - 1) / (
+                packet.end_angle - packet.start_angle
             )
-            index = int(((angle % (2.0 * pi)) / (2.0 * pi)) * 720.0)
+            lead = packet.start_angle * points_per_centideg * packet.time_increment
+            self.laser_msg.header.stamp = Time(
+                nanoseconds=to_nanoseconds(packet.time) - int(lead * 1e9)
+            ).to_msg()
+
+        # end_angle is unwrapped, so the bins wrap along with the angle
+        angles = np.linspace(packet.start_angle, packet.end_angle, swept)
+        if kept is not None:
+            angles = angles[kept]
+        indices = (angles // CENTIDEG_PER_BIN).astype(np.intp) % SCAN_BINS
+        self.add_scan_points(
+            indices,
+            distances.astype(np.float32) * np.float32(0.001),
+            intensities.astype(np.float32),
+        )
+
+        self.laser_msg.time_increment = packet.time_increment
+        if packet.speed > 0:
+            self.laser_msg.scan_time = 360.0 / packet.speed
 
-            if angle > pi * 2.0 and not break_in_packet:
-                self.laser_msg.time_increment = packet.time_increment
-                self.laser_msg.scan_time = packet.scan_time
+        if packet.end_of_scan:
+            self.publish_scan()
+            self.scan_done = True
 
-                break_in_packet = True
-                self.scan_publisher.publish(self.laser_msg)
-                self.laser_msg.ranges = [0.0] * 720
-                self.laser_msg.intensities = [0.0] * 720
+    def add_scan_points(self, indices, distances, intensities):
+        valid = (distances <= 8.0) & (distances >= 0.1) & (intensities != 0)
+        ranges, intensity_bins = self.views[self.laser_index]
+        ranges[indices] = np.where(valid, distances, inf)
+        intensity_bins[indices] = np.where(valid, intensities, 0.0)
 
-                self.laser_msg.header.stamp = self.get_clock().now().to_msg()
+    def publish_scan(self):
+        # With no free buffer the publisher is behind, so this scan is
+        # dropped and its buffer reused
+        try:
+            next_index = self.free_scans.get_nowait()
+        except queue.Empty:
+            self.scans_dropped += 1
+        else:
+            self.hal.scan_stage.put((self, self.laser_index))
+            self.laser_index = next_index
+            self.laser_msg = self.laser_msgs[self.laser_index]
 
-            self.laser_msg.ranges[index] = packet.ranges[i]
-            self.laser_msg.intensities[index] = packet.intensities[i]
+        for view in self.views[self.laser_index]:
+            view.fill(0.0)
 
-            if (
-                self.laser_msg.ranges[index] > 8.0
-                or self.laser_msg.ranges[index] < 0.1
-                or self.laser_msg.intensities[index] == 0
+    def publish_scan_buffer(self, index):
+        msg = self.laser_msgs[index]
+        if self.deskew is not None:
+            ranges, intensities = self.views[index]
+            stamp_ns = Time.from_msg(msg.header.stamp).nanoseconds
+            if self.deskew.apply(
+                ranges, intensities, stamp_ns, msg.scan_time, msg.range_min
             ):
-                self.laser_msg.ranges[index] = inf
-                self.laser_msg.intensities[index] = 0
-                pass
+                # Every beam is now as seen from the stamp, so consumers
+                # mustn't correct for the sweep again
+                msg.time_increment = 0.0
+            else:
+                self.scans_not_deskewed += 1
+        self.scan_publisher.publish(msg)
+        self.free_scans.put(index)
+
+    def query_control_config(self):
+        # Only needed until the first answer, every change gets one anyway
+        if self.control_config is None:
+            packet = messages.UdpPacket()
+            packet.control_config.query = True
+            self.send_reliable(packet)
+
+    def calibrate_motors(self, request, response):
+        packet = messages.UdpPacket()
+        packet.calibrate_motors.save = self.hal.get_parameter("control.save").value
+        self.send_reliable(packet)
+        # The rover answers with a ControlConfig once it's done, which
+        # handle_control_config logs
+        response.success = True
+        response.message = "Calibrating, the wheels spin for about 7 s"
+        return response
+
+    def espnow_current(self):
+        return (
+            self.espnow_mac is not None
+            and time.time_ns() - self.espnow_heard_ns < ESPNOW_TIMEOUT_NS
+        )
+
+    def send_packet(self, packet: messages.UdpPacket, espnow=False):
+        self.send_data(packet.SerializeToString(), espnow)
+
+    def send_data(self, data, espnow=False):
+        if espnow and self.hal.espnow is not None and self.espnow_current():
+            if self.hal.espnow.send(self.espnow_mac, data):
+                return
+        if self.address is not None:
+            self.hal.socket.sendto(data, self.address)
+
+    def send_reliable(self, packet: messages.UdpPacket):
+        if not self.reliable.send_packet(packet):
+            self.hal.get_logger().warn(
+                f"{self.hardware_id}: too many packets waiting on the rover, dropping one",
+                throttle_duration_sec=1.0,
+            )
+
+    def send_reliable_data(self, data):
+        # Same way as control traffic, through the dongle when it can
+        self.send_data(data, espnow=True)
+
+    def retransmit_reliable(self):
+        expired = self.reliable.retransmit()
+        if expired is not None:
+            fields = ", ".join(
+                field.name for field, _ in expired.ListFields() if field.name != "reliable"
+            )
+            self.hal.get_logger().warn(
+                f"{self.hardware_id} never acknowledged {fields}, giving up on it",
+                throttle_duration_sec=10.0,
+            )
 
     def cmd_vel_callback(self, msg: Twist):
         packet = messages.UdpPacket()
+        # Wall clock, so the firmware can tell how long this took to arrive
+        now_ns = time.time_ns()
+        packet.cmd_vel.time.sec = now_ns // 1_000_000_000
+        packet.cmd_vel.time.nanosec = now_ns % 1_000_000_000
         packet.cmd_vel.v = msg.linear.x
         packet.cmd_vel.w = msg.angular.z
 
-        self.socket.sendto(
-            packet.SerializeToString(),
-            ("192.168.4.1", 8001),
+        # Skips the AP whenever the rover is in reach of the dongle
+        self.send_packet(packet, espnow=True)
+
+
+class HAL(Node):
+    def __init__(self):
+        super().__init__("hal")
+
+        # Where to reach the rover before it has been heard from. After
+        # that, replies go wherever its datagrams come from.
+        self.declare_parameter("robot_ip", "192.168.4.1")
+        # Serve every rover that talks to this host, each under its own
+        # namespace, rather than treating them all as one. Namespaces are
+        # rover_<robot id> unless robot_namespaces has an "<id>=<namespace>"
+        # entry for it, the id being the six hex digits the rover logs.
+        self.declare_parameter("fleet", False)
+        self.declare_parameter("robot_namespaces", Parameter.Type.STRING_ARRAY)
+        # Points per scan datagram, see LidarConfig. -1 leaves each rover on
+        # its CONFIG_LRR_LIDAR_POINTS_PER_PACKET.
+        self.declare_parameter("lidar_points_per_packet", -1)
+        # Scan rate and what the rover sends of each scan. 0 leaves the LD20
+        # flat out, and each filter off. Sectors are start_deg, end_deg,
+        # keep_every triples, see LidarSector.
+        self.declare_parameter("lidar_scan_hz", 0.0)
+        self.declare_parameter("lidar_min_range_mm", 0)
+        self.declare_parameter("lidar_max_range_mm", 0)
+        self.declare_parameter("lidar_min_intensity", 0)
+        self.declare_parameter("lidar_sectors", Parameter.Type.INTEGER_ARRAY)
+        # Have the rover delta encode scan distances, about a third smaller
+        self.declare_parameter("lidar_compress", True)
+        # Undo the rover's motion during each revolution using wheel
+        # odometry. The mount defaults match the lidar joint in robot.urdf.
+        self.declare_parameter("deskew", True)
+        self.declare_parameter("deskew.lidar_x", 0.0862)
+        self.declare_parameter("deskew.lidar_y", 0.0)
+        self.declare_parameter("deskew.lidar_yaw", -pi)
+        self.declare_parameter("deskew.lidar_inverted", True)
+        self.deskew_mount = None
+        if self.get_parameter("deskew").value:
+            self.deskew_mount = tuple(
+                self.get_parameter(f"deskew.{name}").value
+                for name in ("lidar_x", "lidar_y", "lidar_yaw", "lidar_inverted")
+            )
+        # Room in the kernel for bursts while the receive thread is behind.
+        # Linux caps this at net.core.rmem_max.
+        self.declare_parameter("rx_buffer_bytes", 4 * 1024 * 1024)
+        # Serial port of an ESP-NOW dongle, empty for none. Rovers built with
+        # LRR_SOCKET_ESPNOW send control traffic through it, and get cmd_vel
+        # back the same way, while they're in range of it.
+        self.declare_parameter("espnow_port", "")
+        self.declare_parameter("espnow_baud", 921600)
+        # Velocity loop tuning, sent to every rover. Left unset the rovers
+        # keep what they have, each one set is sent over straight away. With
+        # control.save the rovers also keep it across reboots.
+        for name in CONTROL_FIELDS:
+            self.declare_parameter(f"control.{name}", Parameter.Type.DOUBLE)
+        for side in MOTOR_SIDES:
+            for name in MODEL_FIELDS:
+                self.declare_parameter(f"control.{side}_{name}", Parameter.Type.DOUBLE)
+        self.declare_parameter("control.save", False)
+        self.add_on_set_parameters_callback(self.set_control_parameters)
+
+        self.socket = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.socket.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.socket.setsockopt(
+            socket.SOL_SOCKET,
+            socket.SO_RCVBUF,
+            self.get_parameter("rx_buffer_bytes").get_parameter_value().integer_value,
+        )
+        self.rx_buffer_bytes = self.socket.getsockopt(
+            socket.SOL_SOCKET, socket.SO_RCVBUF
+        )
+        self.socket.bind(("0.0.0.0", PORT))
+
+        self.diagnostics_publisher = self.create_publisher(
+            DiagnosticArray, "diagnostics", 10
+        )
+
+        # recv -> decode -> one publisher per topic, so a slow publish never
+        # holds up the socket. Every rover shares the stages.
+        self.datagrams_received = 0
+        self.decode_errors = 0
+        self.robots_ignored = 0
+        # [count, total ns, max ns] of Rover.handle_packet per packet_kind,
+        # since startup. Written by the decode thread, reported from a timer.
+        self.handle_ns = {}
+        self.handle_lock = threading.Lock()
+        logger = self.get_logger()
+        self.decode_stage = Stage("hal_decode", self.decode, 64, logger)
+        self.scan_stage = Stage(
+            "hal_scan", self.publish_scan_buffer, SCAN_BUFFERS * MAX_ROBOTS, logger
+        )
+        self.joint_state_stage = Stage(
+            "hal_joint_states", self.publish_message, 8, logger
+        )
+        self.odometry_stage = Stage("hal_odometry", self.publish_message, 8, logger)
+        self.imu_stage = Stage("hal_imu", self.publish_imu_batch, 8, logger)
+        self.diagnostics_stage = Stage(
+            "hal_diagnostics", self.diagnostics_publisher.publish, 8, logger
+        )
+        self.stages = [
+            self.decode_stage,
+            self.scan_stage,
+            self.joint_state_stage,
+            self.odometry_stage,
+            self.imu_stage,
+            self.diagnostics_stage,
+        ]
+        self.create_timer(1.0, self.report_pipeline)
+
+        # Rovers by robot id. Created by the decode thread as they turn up,
+        # read from timers on the executor.
+        self.fleet = self.get_parameter("fleet").value
+        self.namespaces = self.parse_namespaces()
+        self.rovers_lock = threading.Lock()
+        self.rovers = {}
+        if not self.fleet:
+            # One rover at the root namespace, reachable straight away
+            address = (self.get_parameter("robot_ip").value, PORT)
+            self.rovers[None] = Rover(self, 0, "", address)
+
+        self.espnow = None
+        espnow_port = self.get_parameter("espnow_port").value
+        if espnow_port:
+            self.espnow = EspNowBridge(
+                espnow_port, self.get_parameter("espnow_baud").value, self.espnow_frame
+            )
+
+        # Resent periodically so it sticks across firmware restarts
+        self.create_timer(2.0, self.send_lidar_config)
+        self.create_timer(2.0, self.query_control_config)
+        self.create_timer(0.025, self.retransmit_reliable)
+
+        threading.Thread(target=self.run_loop, name="hal_receive").start()
+
+    def parse_namespaces(self):
+        namespaces = {}
+        for entry in self.get_parameter("robot_namespaces").value or []:
+            robot_id, _, namespace = entry.partition("=")
+            try:
+                namespaces[int(robot_id, 16)] = namespace.strip("/")
+            except ValueError:
+                self.get_logger().warn(f"Ignoring robot_namespaces entry {entry!r}")
+        return namespaces
+
+    def rover_list(self):
+        with self.rovers_lock:
+            return list(self.rovers.values())
+
+    def find_rover(self, robot_id, address):
+        if not self.fleet:
+            return self.rovers[None]
+
+        with self.rovers_lock:
+            rover = self.rovers.get(robot_id)
+            if rover is not None or len(self.rovers) >= MAX_ROBOTS:
+                return rover
+            namespace = self.namespaces.get(robot_id, f"rover_{robot_id:06x}")
+            espnow = address[0] == ESPNOW
+            rover = Rover(self, robot_id, namespace, None if espnow else address)
+            self.rovers[robot_id] = rover
+        where = "through the ESP-NOW dongle" if espnow else f"at {address[0]}"
+        self.get_logger().info(
+            f"Rover {robot_id:06x} {where}, publishing under /{namespace}"
         )
+        return rover
+
+    def run_loop(self):
+        while True:
+            # Block for one datagram, then take whatever else is already
+            # waiting so decode gets them in a single hand-off. Arrival
+            # times are kept for answering time sync requests, and sources
+            # to tell rovers apart and reply to them.
+            data, address = self.socket.recvfrom(1500)
+            batch = [(time.time_ns(), data, address)]
+            while len(batch) < RX_BATCH:
+                try:
+                    data, address = self.socket.recvfrom(1500, socket.MSG_DONTWAIT)
+                except BlockingIOError:
+                    break
+                batch.append((time.time_ns(), data, address))
+
+            self.datagrams_received += len(batch)
+            self.decode_stage.put(batch)
+
+    def espnow_frame(self, mac, data):
+        self.decode_stage.put([(time.time_ns(), data, (ESPNOW, mac))])
+
+    def decode(self, batch):
+        for received_ns, data, address in batch:
+            packet = messages.UdpPacket()
+            try:
+                packet.ParseFromString(data)
+            except Exception as e:
+                self.decode_errors += 1
+                print(e)
+                continue
+
+            # The firmware puts its id on batches as well as on each packet
+            rover = self.find_rover(packet.robot_id, address)
+            if rover is None:
+                self.robots_ignored += 1
+                continue
+            rover.via_espnow = address[0] == ESPNOW
+            if rover.via_espnow:
+                rover.espnow_mac = address[1]
+                rover.espnow_heard_ns = received_ns
+            else:
+                rover.address = address
+            # Only news when every rover is treated as one
+            rover.robot_id = packet.robot_id
+
+            # Repeats, and anything that arrives ahead of one still missing,
+            # are only acknowledged
+            if packet.HasField("reliable") and not rover.reliable.receive(packet.reliable):
+                continue
+
+            # The firmware coalesces packets into one datagram when it can
+            if len(packet.batch) > 0:
+                for sub_packet in packet.batch:
+                    self.handle_timed(rover, sub_packet, received_ns)
+            else:
+                self.handle_timed(rover, packet, received_ns)
+
+    def handle_timed(self, rover, packet, received_ns):
+        start = time.perf_counter_ns()
+        rover.handle_packet(packet, received_ns)
+        elapsed = time.perf_counter_ns() - start
+
+        kind = packet_kind(packet)
+        with self.handle_lock:
+            timing = self.handle_ns.setdefault(kind, [0, 0, 0])
+            timing[0] += 1
+            timing[1] += elapsed
+            timing[2] = max(timing[2], elapsed)
+
+    def publish_message(self, item):
+        publisher, msg = item
+        publisher.publish(msg)
+
+    def publish_imu_batch(self, item):
+        publisher, batch = item
+        for msg in batch:
+            publisher.publish(msg)
+
+    def publish_scan_buffer(self, item):
+        rover, index = item
+        rover.publish_scan_buffer(index)
+
+    def report_pipeline(self):
+        values = {
+            "datagrams received": self.datagrams_received,
+            "decode errors": self.decode_errors,
+            "rx buffer bytes": self.rx_buffer_bytes,
+        }
+        if self.fleet:
+            values["robots ignored"] = self.robots_ignored
+        if self.espnow is not None:
+            values["espnow frames received"] = self.espnow.frames_received
+            values["espnow frames dropped"] = self.espnow.frames_dropped
+        for rover in self.rover_list():
+            prefix = f"{rover.namespace} " if rover.namespace else ""
+            values[f"{prefix}scans dropped"] = rover.scans_dropped
+            values[f"{prefix}scans not deskewed"] = rover.scans_not_deskewed
+            values[f"{prefix}reliable retransmits"] = rover.reliable.retransmits
+            values[f"{prefix}reliable expired"] = rover.reliable.expired
+            values[f"{prefix}reliable duplicates"] = rover.reliable.duplicates
+        for stage in self.stages:
+            values[f"{stage.name} dropped"] = stage.dropped
+            values[f"{stage.name} high water"] = stage.high_water
+            values[f"{stage.name} failures"] = stage.failures
+        with self.handle_lock:
+            timings = sorted((kind, list(t)) for kind, t in self.handle_ns.items())
+        for kind, (count, total_ns, max_ns) in timings:
+            values[f"handle {kind} count"] = count
+            values[f"handle {kind} mean us"] = f"{total_ns / count / 1e3:.1f}"
+            values[f"handle {kind} max us"] = f"{max_ns / 1e3:.1f}"
+
+        msg = DiagnosticArray()
+        msg.header.stamp = self.get_clock().now().to_msg()
+        msg.status.append(diagnostic_status("little_red_rover", "host pipeline", values))
+        # Runs on the executor, not the decode thread, so skip the stage
+        self.diagnostics_publisher.publish(msg)
+
+    def send_lidar_config(self):
+        packet = messages.UdpPacket()
+        config = packet.lidar_config
+        points_per_packet = self.get_parameter("lidar_points_per_packet").value
+        if points_per_packet >= 0:
+            config.points_per_packet = points_per_packet
+        config.scan_hz = self.get_parameter("lidar_scan_hz").value
+        config.min_range_mm = self.get_parameter("lidar_min_range_mm").value
+        config.max_range_mm = self.get_parameter("lidar_max_range_mm").value
+        config.min_intensity = self.get_parameter("lidar_min_intensity").value
+        if self.get_parameter("lidar_compress").value:
+            config.encoding = messages.POINT_ENCODING_DELTA_VARINT
+        sectors = self.get_parameter("lidar_sectors").value or []
+        for i in range(0, len(sectors) - 2, 3):
+            sector = config.sectors.add()
+            sector.start_deg, sector.end_deg, sector.keep_every = sectors[i : i + 3]
+        for rover in self.rover_list():
+            rover.send_reliable(packet)
+
+    def query_control_config(self):
+        for rover in self.rover_list():
+            rover.query_control_config()
+
+    def retransmit_reliable(self):
+        for rover in self.rover_list():
+            rover.retransmit_reliable()
+
+    def set_control_parameters(self, params):
+        changes = {
+            param.name.removeprefix("control."): param.value
+            for param in params
+            if param.name.startswith("control.")
+            and param.name != "control.save"
+            and param.value is not None
+        }
+        if not changes:
+            return SetParametersResult(successful=True)
+        rovers = [rover for rover in self.rover_list() if rover.control_config is not None]
+        if not rovers:
+            return SetParametersResult(
+                successful=False, reason="No rover has reported its tuning yet"
+            )
+
+        save = self.get_parameter("control.save").value
+        for param in params:
+            if param.name == "control.save":
+                save = param.value
+        for rover in rovers:
+            # Everything not being set stays as that rover has it
+            packet = messages.UdpPacket()
+            packet.control_config.CopyFrom(rover.control_config)
+            for name, value in changes.items():
+                if name in CONTROL_FIELDS:
+                    setattr(packet.control_config, name, value)
+                else:
+                    side, field = name.split("_", 1)
+                    model = packet.control_config.models[MOTOR_SIDES.index(side)]
+                    setattr(model, field, value)
+            packet.control_config.save = save
+            rover.send_reliable(packet)
+        return SetParametersResult(successful=True)
 
 
 def main(args=None):
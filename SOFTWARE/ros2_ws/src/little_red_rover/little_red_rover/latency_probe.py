@@ -0,0 +1,80 @@
+import argparse
+import time
+
+import rclpy
+from rclpy.node import Node
+from rclpy.qos import qos_profile_sensor_data
+
+from nav_msgs.msg import Odometry
+from tf2_msgs.msg import TFMessage
+
+# LRR latency probe
+# How old the wheel odometry and the EKF's odom -> base_link transform are
+# when they get here, by wall clock against their stamps. The rover stamps
+# on its synced clock, so both include the WiFi link, and the gap between
+# them is what the host stack adds. Compare
+# `ros2 launch little_red_rover lrr.launch.py` against `... composable:=True`
+# with `ros2 run little_red_rover latency_probe --duration 60` running.
+# The EKF only publishes at its frequency (config/ekf.yaml), which adds up
+# to a period to every transform in both modes.
+
+
+class LatencyProbe(Node):
+    def __init__(self):
+        super().__init__("latency_probe")
+        self.latencies = {"odom/wheel": [], "tf": []}
+        self.create_subscription(
+            Odometry, "odom/wheel", self.odometry_callback, qos_profile_sensor_data
+        )
+        self.create_subscription(TFMessage, "tf", self.tf_callback, 100)
+
+    def record(self, topic, stamp):
+        stamp_ns = stamp.sec * 1000000000 + stamp.nanosec
+        self.latencies[topic].append((time.time_ns() - stamp_ns) / 1e6)
+
+    def odometry_callback(self, msg: Odometry):
+        self.record("odom/wheel", msg.header.stamp)
+
+    def tf_callback(self, msg: TFMessage):
+        for transform in msg.transforms:
+            if transform.child_frame_id == "base_link":
+                self.record("tf", transform.header.stamp)
+
+    def report(self):
+        for topic, latencies in self.latencies.items():
+            if not latencies:
+                print(f"{topic:12s} nothing received")
+                continue
+            ordered = sorted(latencies)
+            mean = sum(ordered) / len(ordered)
+            p50 = ordered[len(ordered) // 2]
+            p99 = ordered[min(len(ordered) - 1, len(ordered) * 99 // 100)]
+            print(
+                f"{topic:12s} {len(ordered):6d} msgs, mean {mean:7.2f} ms, "
+                f"p50 {p50:7.2f} ms, p99 {p99:7.2f} ms, max {ordered[-1]:7.2f} ms"
+            )
+
+
+def main(args=None):
+    parser = argparse.ArgumentParser(description="Measure odometry and TF latency")
+    parser.add_argument(
+        "--duration", type=float, default=0.0, help="seconds, 0 runs until Ctrl-C"
+    )
+    parsed, _ = parser.parse_known_args(args)
+
+    rclpy.init(args=args)
+    probe = LatencyProbe()
+    deadline = time.monotonic() + parsed.duration if parsed.duration > 0 else None
+    try:
+        while rclpy.ok() and (deadline is None or time.monotonic() < deadline):
+            rclpy.spin_once(probe, timeout_sec=0.1)
+    except KeyboardInterrupt:
+        pass
+    probe.report()
+
+    probe.destroy_node()
+    rclpy.try_shutdown()
+
+
+if __name__ == "__main__":
+    main()
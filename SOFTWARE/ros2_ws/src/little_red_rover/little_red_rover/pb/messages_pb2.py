@@ -24,21 +24,57 @@ _sym_db = _symbol_database.Default()
 
 
 
-DESCRIPTOR = _descriptor_pool.Default().AddSerializedFile(b'\n\x0emessages.proto\")\n\tTimeStamp\x12\x0b\n\x03sec\x18\x01 \x01(\x05\x12\x0f\n\x07nanosec\x18\x02 \x01(\r\":\n\x08TwistCmd\x12\x18\n\x04time\x18\x01 \x01(\x0b\x32\n.TimeStamp\x12\t\n\x01v\x18\x02 \x01(\x02\x12\t\n\x01w\x18\x03 \x01(\x02\"\xda\x01\n\tLaserScan\x12\x18\n\x04time\x18\x01 \x01(\x0b\x32\n.TimeStamp\x12\x11\n\tangle_min\x18\x02 \x01(\x02\x12\x11\n\tangle_max\x18\x03 \x01(\x02\x12\x17\n\x0f\x61ngle_increment\x18\x04 \x01(\x02\x12\x16\n\x0etime_increment\x18\x05 \x01(\x02\x12\x11\n\tscan_time\x18\x06 \x01(\x02\x12\x11\n\trange_min\x18\x07 \x01(\x02\x12\x11\n\trange_max\x18\x08 \x01(\x02\x12\x0e\n\x06ranges\x18\t \x03(\x02\x12\x13\n\x0bintensities\x18\n \x03(\x02\"i\n\x0bJointStates\x12\x18\n\x04time\x18\x01 \x01(\x0b\x32\n.TimeStamp\x12\x0c\n\x04name\x18\x02 \x03(\t\x12\x10\n\x08position\x18\x03 \x03(\x01\x12\x10\n\x08velocity\x18\x04 \x03(\x01\x12\x0e\n\x06\x65\x66\x66ort\x18\x05 \x03(\x01\"\x9c\x01\n\tUdpPacket\x12\x1e\n\x05laser\x18\x01 \x01(\x0b\x32\n.LaserScanH\x00\x88\x01\x01\x12\'\n\x0cjoint_states\x18\x02 \x01(\x0b\x32\x0c.JointStatesH\x01\x88\x01\x01\x12\x1f\n\x07\x63md_vel\x18\x03 \x01(\x0b\x32\t.TwistCmdH\x02\x88\x01\x01\x42\x08\n\x06_laserB\x0f\n\r_joint_statesB\n\n\x08_cmd_velb\x06proto3')
+DESCRIPTOR = _descriptor_pool.Default().AddSerializedFile(b'\n\x0emessages.proto\")\n\tTimeStamp\x12\x0b\n\x03sec\x18\x01 \x01(\x05\x12\x0f\n\x07nanosec\x18\x02 \x01(\r\"P\n\x08TimeSync\x12\x15\n\rrover_send_us\x18\x01 \x01(\x03\x12\x17\n\x0fhost_receive_ns\x18\x02 \x01(\x03\x12\x14\n\x0chost_send_ns\x18\x03 \x01(\x03\"\x1b\n\tDiscovery\x12\x0e\n\x06\x61nswer\x18\x01 \x01(\x08\":\n\x08TwistCmd\x12\x18\n\x04time\x18\x01 \x01(\x0b\x32\n.TimeStamp\x12\t\n\x01v\x18\x02 \x01(\x02\x12\t\n\x01w\x18\x03 \x01(\x02\"\xda\x01\n\tLaserScan\x12\x18\n\x04time\x18\x01 \x01(\x0b\x32\n.TimeStamp\x12\x11\n\tangle_min\x18\x02 \x01(\x02\x12\x11\n\tangle_max\x18\x03 \x01(\x02\x12\x17\n\x0f\x61ngle_increment\x18\x04 \x01(\x02\x12\x16\n\x0etime_increment\x18\x05 \x01(\x02\x12\x11\n\tscan_time\x18\x06 \x01(\x02\x12\x11\n\trange_min\x18\x07 \x01(\x02\x12\x11\n\trange_max\x18\x08 \x01(\x02\x12\x0e\n\x06ranges\x18\t \x03(\x02\x12\x13\n\x0bintensities\x18\n \x03(\x02\"\x9e\x02\n\x10\x43ompactLaserScan\x12\x18\n\x04time\x18\x01 \x01(\x0b\x32\n.TimeStamp\x12\x13\n\x0bstart_angle\x18\x02 \x01(\r\x12\x11\n\tend_angle\x18\x03 \x01(\r\x12\r\n\x05speed\x18\x04 \x01(\r\x12\x0e\n\x06points\x18\x05 \x01(\x0c\x12\x0f\n\x07scan_id\x18\x06 \x01(\r\x12\x10\n\x08\x66ragment\x18\x07 \x01(\r\x12\x13\n\x0b\x65nd_of_scan\x18\x08 \x01(\x08\x12\x16\n\x0etime_increment\x18\t \x01(\x02\x12\x0c\n\x04kept\x18\n \x01(\x0c\x12\x14\n\x0cswept_points\x18\x0b \x01(\r\x12 \n\x08\x65ncoding\x18\x0c \x01(\x0e\x32\x0e.PointEncoding\x12\x13\n\x0bpoint_count\x18\r \x01(\r\"E\n\x0bLidarSector\x12\x11\n\tstart_deg\x18\x01 \x01(\r\x12\x0f\n\x07\x65nd_deg\x18\x02 \x01(\r\x12\x12\n\nkeep_every\x18\x03 \x01(\r\"\xd8\x01\n\x0bLidarConfig\x12\x1e\n\x11points_per_packet\x18\x01 \x01(\rH\x00\x88\x01\x01\x12\x0f\n\x07scan_hz\x18\x02 \x01(\x02\x12\x14\n\x0cmin_range_mm\x18\x03 \x01(\r\x12\x14\n\x0cmax_range_mm\x18\x04 \x01(\r\x12\x15\n\rmin_intensity\x18\x05 \x01(\r\x12\x1d\n\x07sectors\x18\x06 \x03(\x0b\x32\x0c.LidarSector\x12 \n\x08\x65ncoding\x18\x07 \x01(\x0e\x32\x0e.PointEncodingB\x14\n\x12_points_per_packet\"$\n\nMotorModel\x12\n\n\x02ks\x18\x01 \x01(\x02\x12\n\n\x02kv\x18\x02 \x01(\x02\"\xbc\x01\n\rControlConfig\x12\r\n\x05query\x18\x01 \x01(\x08\x12\x0c\n\x04save\x18\x02 \x01(\x08\x12\n\n\x02kp\x18\x03 \x01(\x02\x12\n\n\x02ki\x18\x04 \x01(\x02\x12\n\n\x02kd\x18\x05 \x01(\x02\x12\x16\n\x0eintegral_limit\x18\x06 \x01(\x02\x12\x10\n\x08max_jerk\x18\x07 \x01(\x02\x12\x12\n\nhysteresis\x18\x08 \x01(\x02\x12\x0f\n\x07loop_hz\x18\t \x01(\r\x12\x1b\n\x06models\x18\n \x03(\x0b\x32\x0b.MotorModel\"\x1f\n\x0f\x43\x61librateMotors\x12\x0c\n\x04save\x18\x01 \x01(\x08\"\\\n\x0c\x43ommandStats\x12\x15\n\rage_histogram\x18\x01 \x03(\r\x12\x11\n\tunstamped\x18\x02 \x01(\r\x12\x10\n\x08rejected\x18\x03 \x01(\r\x12\x10\n\x08timeouts\x18\x04 \x01(\r\"b\n\tTaskUsage\x12\x0c\n\x04name\x18\x01 \x01(\t\x12\x0c\n\x04\x63ore\x18\x02 \x01(\x11\x12\x10\n\x08priority\x18\x03 \x01(\r\x12\x13\n\x0b\x63pu_percent\x18\x04 \x01(\x02\x12\x12\n\nstack_free\x18\x05 \x01(\r\"\x86\x07\n\x0b\x44iagnostics\x12\x11\n\tuptime_ms\x18\x01 \x01(\r\x12\x17\n\x0fsendto_failures\x18\x02 \x01(\r\x12\x18\n\x10rx_decode_errors\x18\x03 \x01(\r\x12\x19\n\x11tx_pool_exhausted\x18\x04 \x01(\r\x12\x14\n\x0clane_dropped\x18\x05 \x03(\r\x12\x17\n\x0flane_high_water\x18\x06 \x03(\r\x12\x14\n\x0clidar_frames\x18\x07 \x01(\r\x12\x18\n\x10lidar_crc_errors\x18\x08 \x01(\r\x12\x15\n\rlidar_resyncs\x18\t \x01(\r\x12\x1c\n\x14lidar_uart_overflows\x18\n \x01(\r\x12\x15\n\rcontrol_loops\x18\x0b \x01(\r\x12\x18\n\x10\x63ontrol_overruns\x18\x0c \x01(\r\x12\x1d\n\x15\x63ontrol_max_jitter_us\x18\r \x01(\r\x12\x11\n\tfree_heap\x18\x0e \x01(\r\x12\x15\n\rmin_free_heap\x18\x0f \x01(\r\x12\x19\n\x05tasks\x18\x10 \x03(\x0b\x32\n.TaskUsage\x12\x13\n\x0bimu_samples\x18\x11 \x01(\r\x12\x19\n\x11imu_fifo_overruns\x18\x12 \x01(\r\x12\x1b\n\x13imu_dropped_batches\x18\x13 \x01(\r\x12\x16\n\x0eimu_i2c_errors\x18\x14 \x01(\r\x12\x19\n\x11time_sync_samples\x18\x15 \x01(\r\x12\x1a\n\x12time_sync_rejected\x18\x16 \x01(\r\x12\x1f\n\x17time_sync_round_trip_us\x18\x17 \x01(\r\x12\x11\n\twifi_rssi\x18\x18 \x01(\x11\x12\x17\n\x0fwifi_reconnects\x18\x19 \x01(\r\x12\x1d\n\x15wifi_poor_link_events\x18\x1a \x01(\r\x12\x12\n\nlidar_shed\x18\x1b \x01(\r\x12\x13\n\x0b\x65spnow_sent\x18\x1c \x01(\r\x12\x17\n\x0f\x65spnow_received\x18\x1d \x01(\r\x12\x1c\n\x14reliable_retransmits\x18\x1e \x01(\r\x12\x18\n\x10reliable_expired\x18\x1f \x01(\r\x12\x1b\n\x13reliable_duplicates\x18  \x01(\r\x12 \n\x0bpower_state\x18! \x01(\x0e\x32\x0b.PowerState\x12\x14\n\x0c\x63pu_freq_mhz\x18\" \x01(\r\x12\x16\n\x0epower_state_ms\x18# \x03(\r\"\x86\x01\n\tImuSample\x12\x16\n\x0etime_offset_us\x18\x01 \x01(\r\x12\x0e\n\x06gyro_x\x18\x02 \x01(\x11\x12\x0e\n\x06gyro_y\x18\x03 \x01(\x11\x12\x0e\n\x06gyro_z\x18\x04 \x01(\x11\x12\x0f\n\x07\x61\x63\x63\x65l_x\x18\x05 \x01(\x11\x12\x0f\n\x07\x61\x63\x63\x65l_y\x18\x06 \x01(\x11\x12\x0f\n\x07\x61\x63\x63\x65l_z\x18\x07 \x01(\x11\"e\n\x03Imu\x12\x18\n\x04time\x18\x01 \x01(\x0b\x32\n.TimeStamp\x12\x12\n\ngyro_scale\x18\x02 \x01(\x02\x12\x13\n\x0b\x61\x63\x63\x65l_scale\x18\x03 \x01(\x02\x12\x1b\n\x07samples\x18\x04 \x03(\x0b\x32\n.ImuSample\"u\n\x08\x41ttitude\x12\x18\n\x04time\x18\x01 \x01(\x0b\x32\n.TimeStamp\x12\x0c\n\x04roll\x18\x02 \x01(\x02\x12\r\n\x05pitch\x18\x03 \x01(\x02\x12\x0b\n\x03yaw\x18\x04 \x01(\x02\x12\x10\n\x08yaw_rate\x18\x05 \x01(\x02\x12\x13\n\x0bgyro_bias_z\x18\x06 \x01(\x02\"\x90\x01\n\x08Odometry\x12\x18\n\x04time\x18\x01 \x01(\x0b\x32\n.TimeStamp\x12\t\n\x01x\x18\x02 \x01(\x02\x12\t\n\x01y\x18\x03 \x01(\x02\x12\x0b\n\x03yaw\x18\x04 \x01(\x02\x12\t\n\x01v\x18\x05 \x01(\x02\x12\t\n\x01w\x18\x06 \x01(\x02\x12\x17\n\x0fpose_covariance\x18\x07 \x03(\x02\x12\x18\n\x10twist_covariance\x18\x08 \x03(\x02\"i\n\x0bJointStates\x12\x18\n\x04time\x18\x01 \x01(\x0b\x32\n.TimeStamp\x12\x0c\n\x04name\x18\x02 \x03(\t\x12\x10\n\x08position\x18\x03 \x03(\x01\x12\x10\n\x08velocity\x18\x04 \x03(\x01\x12\x0e\n\x06\x65\x66\x66ort\x18\x05 \x03(\x01\"X\n\x08Reliable\x12\x0f\n\x07session\x18\x01 \x01(\r\x12\x0b\n\x03seq\x18\x02 \x01(\r\x12\x0c\n\x04\x62\x61se\x18\x03 \x01(\r\x12\x13\n\x0b\x61\x63k_session\x18\x04 \x01(\r\x12\x0b\n\x03\x61\x63k\x18\x05 \x01(\r\"\xcf\x06\n\tUdpPacket\x12\x1e\n\x05laser\x18\x01 \x01(\x0b\x32\n.LaserScanH\x00\x88\x01\x01\x12\'\n\x0cjoint_states\x18\x02 \x01(\x0b\x32\x0c.JointStatesH\x01\x88\x01\x01\x12\x1f\n\x07\x63md_vel\x18\x03 \x01(\x0b\x32\t.TwistCmdH\x02\x88\x01\x01\x12-\n\rcompact_laser\x18\x04 \x01(\x0b\x32\x11.CompactLaserScanH\x03\x88\x01\x01\x12\'\n\x0clidar_config\x18\x05 \x01(\x0b\x32\x0c.LidarConfigH\x04\x88\x01\x01\x12)\n\rcommand_stats\x18\x06 \x01(\x0b\x32\r.CommandStatsH\x05\x88\x01\x01\x12&\n\x0b\x64iagnostics\x18\x07 \x01(\x0b\x32\x0c.DiagnosticsH\x06\x88\x01\x01\x12\x16\n\x03imu\x18\x08 \x01(\x0b\x32\x04.ImuH\x07\x88\x01\x01\x12 \n\x08\x61ttitude\x18\t \x01(\x0b\x32\t.AttitudeH\x08\x88\x01\x01\x12 \n\x08odometry\x18\n \x01(\x0b\x32\t.OdometryH\t\x88\x01\x01\x12+\n\x0e\x63ontrol_config\x18\x0b \x01(\x0b\x32\x0e.ControlConfigH\n\x88\x01\x01\x12/\n\x10\x63\x61librate_motors\x18\x0c \x01(\x0b\x32\x10.CalibrateMotorsH\x0b\x88\x01\x01\x12!\n\ttime_sync\x18\r \x01(\x0b\x32\t.TimeSyncH\x0c\x88\x01\x01\x12\x10\n\x08robot_id\x18\x0e \x01(\r\x12\x19\n\x05\x62\x61tch\x18\x0f \x03(\x0b\x32\n.UdpPacket\x12\"\n\tdiscovery\x18\x10 \x01(\x0b\x32\n.DiscoveryH\r\x88\x01\x01\x12 \n\x08reliable\x18\x11 \x01(\x0b\x32\t.ReliableH\x0e\x88\x01\x01\x42\x08\n\x06_laserB\x0f\n\r_joint_statesB\n\n\x08_cmd_velB\x10\n\x0e_compact_laserB\x0f\n\r_lidar_configB\x10\n\x0e_command_statsB\x0e\n\x0c_diagnosticsB\x06\n\x04_imuB\x0b\n\t_attitudeB\x0b\n\t_odometryB\x11\n\x0f_control_configB\x13\n\x11_calibrate_motorsB\x0c\n\n_time_syncB\x0c\n\n_discoveryB\x0b\n\t_reliable*H\n\rPointEncoding\x12\x16\n\x12POINT_ENCODING_RAW\x10\x00\x12\x1f\n\x1bPOINT_ENCODING_DELTA_VARINT\x10\x01*S\n\nPowerState\x12\x14\n\x10POWER_STATE_IDLE\x10\x00\x12\x16\n\x12POWER_STATE_PARKED\x10\x01\x12\x17\n\x13POWER_STATE_DRIVING\x10\x02\x62\x06proto3')
 
 _globals = globals()
 _builder.BuildMessageAndEnumDescriptors(DESCRIPTOR, _globals)
 _builder.BuildTopDescriptorsAndMessages(DESCRIPTOR, 'messages_pb2', _globals)
 if not _descriptor._USE_C_DESCRIPTORS:
   DESCRIPTOR._loaded_options = None
+  _globals['_POINTENCODING']._serialized_start=3946
+  _globals['_POINTENCODING']._serialized_end=4018
+  _globals['_POWERSTATE']._serialized_start=4020
+  _globals['_POWERSTATE']._serialized_end=4103
   _globals['_TIMESTAMP']._serialized_start=18
   _globals['_TIMESTAMP']._serialized_end=59
-  _globals['_TWISTCMD']._serialized_start=61
-  _globals['_TWISTCMD']._serialized_end=119
-  _globals['_LASERSCAN']._serialized_start=122
-  _globals['_LASERSCAN']._serialized_end=340
-  _globals['_JOINTSTATES']._serialized_start=342
-  _globals['_JOINTSTATES']._serialized_end=447
-  _globals['_UDPPACKET']._serialized_start=450
-  _globals['_UDPPACKET']._serialized_end=606
+  _globals['_TIMESYNC']._serialized_start=61
+  _globals['_TIMESYNC']._serialized_end=141
+  _globals['_DISCOVERY']._serialized_start=143
+  _globals['_DISCOVERY']._serialized_end=170
+  _globals['_TWISTCMD']._serialized_start=172
+  _globals['_TWISTCMD']._serialized_end=230
+  _globals['_LASERSCAN']._serialized_start=233
+  _globals['_LASERSCAN']._serialized_end=451
+  _globals['_COMPACTLASERSCAN']._serialized_start=454
+  _globals['_COMPACTLASERSCAN']._serialized_end=740
+  _globals['_LIDARSECTOR']._serialized_start=742
+  _globals['_LIDARSECTOR']._serialized_end=811
+  _globals['_LIDARCONFIG']._serialized_start=814
+  _globals['_LIDARCONFIG']._serialized_end=1030
+  _globals['_MOTORMODEL']._serialized_start=1032
+  _globals['_MOTORMODEL']._serialized_end=1068
+  _globals['_CONTROLCONFIG']._serialized_start=1071
+  _globals['_CONTROLCONFIG']._serialized_end=1259
+  _globals['_CALIBRATEMOTORS']._serialized_start=1261
+  _globals['_CALIBRATEMOTORS']._serialized_end=1292
+  _globals['_COMMANDSTATS']._serialized_start=1294
+  _globals['_COMMANDSTATS']._serialized_end=1386
+  _globals['_TASKUSAGE']._serialized_start=1388
+  _globals['_TASKUSAGE']._serialized_end=1486
+  _globals['_DIAGNOSTICS']._serialized_start=1489
+  _globals['_DIAGNOSTICS']._serialized_end=2391
+  _globals['_IMUSAMPLE']._serialized_start=2394
+  _globals['_IMUSAMPLE']._serialized_end=2528
+  _globals['_IMU']._serialized_start=2530
+  _globals['_IMU']._serialized_end=2631
+  _globals['_ATTITUDE']._serialized_start=2633
+  _globals['_ATTITUDE']._serialized_end=2750
+  _globals['_ODOMETRY']._serialized_start=2753
+  _globals['_ODOMETRY']._serialized_end=2897
+  _globals['_JOINTSTATES']._serialized_start=2899
+  _globals['_JOINTSTATES']._serialized_end=3004
+  _globals['_RELIABLE']._serialized_start=3006
+  _globals['_RELIABLE']._serialized_end=3094
+  _globals['_UDPPACKET']._serialized_start=3097
+  _globals['_UDPPACKET']._serialized_end=3944
 # @@protoc_insertion_point(module_scope)
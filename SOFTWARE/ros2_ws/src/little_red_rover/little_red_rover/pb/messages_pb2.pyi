@@ -1,10 +1,27 @@
 from google.protobuf.internal import containers as _containers
+from google.protobuf.internal import enum_type_wrapper as _enum_type_wrapper
 from google.protobuf import descriptor as _descriptor
 from google.protobuf import message as _message
 from typing import ClassVar as _ClassVar, Iterable as _Iterable, Mapping as _Mapping, Optional as _Optional, Union as _Union
 
 DESCRIPTOR: _descriptor.FileDescriptor
 
+class PointEncoding(int, metaclass=_enum_type_wrapper.EnumTypeWrapper):
+    __slots__ = ()
+    POINT_ENCODING_RAW: _ClassVar[PointEncoding]
+    POINT_ENCODING_DELTA_VARINT: _ClassVar[PointEncoding]
+
+class PowerState(int, metaclass=_enum_type_wrapper.EnumTypeWrapper):
+    __slots__ = ()
+    POWER_STATE_IDLE: _ClassVar[PowerState]
+    POWER_STATE_PARKED: _ClassVar[PowerState]
+    POWER_STATE_DRIVING: _ClassVar[PowerState]
+POINT_ENCODING_RAW: PointEncoding
+POINT_ENCODING_DELTA_VARINT: PointEncoding
+POWER_STATE_IDLE: PowerState
+POWER_STATE_PARKED: PowerState
+POWER_STATE_DRIVING: PowerState
+
 class TimeStamp(_message.Message):
     __slots__ = ("sec", "nanosec")
     SEC_FIELD_NUMBER: _ClassVar[int]
@@ -13,6 +30,22 @@ class TimeStamp(_message.Message):
     nanosec: int
     def __init__(self, sec: _Optional[int] = ..., nanosec: _Optional[int] = ...) -> None: ...
 
+class TimeSync(_message.Message):
+    __slots__ = ("rover_send_us", "host_receive_ns", "host_send_ns")
+    ROVER_SEND_US_FIELD_NUMBER: _ClassVar[int]
+    HOST_RECEIVE_NS_FIELD_NUMBER: _ClassVar[int]
+    HOST_SEND_NS_FIELD_NUMBER: _ClassVar[int]
+    rover_send_us: int
+    host_receive_ns: int
+    host_send_ns: int
+    def __init__(self, rover_send_us: _Optional[int] = ..., host_receive_ns: _Optional[int] = ..., host_send_ns: _Optional[int] = ...) -> None: ...
+
+class Discovery(_message.Message):
+    __slots__ = ("answer",)
+    ANSWER_FIELD_NUMBER: _ClassVar[int]
+    answer: bool
+    def __init__(self, answer: bool = ...) -> None: ...
+
 class TwistCmd(_message.Message):
     __slots__ = ("time", "v", "w")
     TIME_FIELD_NUMBER: _ClassVar[int]
@@ -47,6 +80,268 @@ class LaserScan(_message.Message):
     intensities: _containers.RepeatedScalarFieldContainer[float]
     def __init__(self, time: _Optional[_Union[TimeStamp, _Mapping]] = ..., angle_min: _Optional[float] = ..., angle_max: _Optional[float] = ..., angle_increment: _Optional[float] = ..., time_increment: _Optional[float] = ..., scan_time: _Optional[float] = ..., range_min: _Optional[float] = ..., range_max: _Optional[float] = ..., ranges: _Optional[_Iterable[float]] = ..., intensities: _Optional[_Iterable[float]] = ...) -> None: ...
 
+class CompactLaserScan(_message.Message):
+    __slots__ = ("time", "start_angle", "end_angle", "speed", "points", "scan_id", "fragment", "end_of_scan", "time_increment", "kept", "swept_points", "encoding", "point_count")
+    TIME_FIELD_NUMBER: _ClassVar[int]
+    START_ANGLE_FIELD_NUMBER: _ClassVar[int]
+    END_ANGLE_FIELD_NUMBER: _ClassVar[int]
+    SPEED_FIELD_NUMBER: _ClassVar[int]
+    POINTS_FIELD_NUMBER: _ClassVar[int]
+    SCAN_ID_FIELD_NUMBER: _ClassVar[int]
+    FRAGMENT_FIELD_NUMBER: _ClassVar[int]
+    END_OF_SCAN_FIELD_NUMBER: _ClassVar[int]
+    TIME_INCREMENT_FIELD_NUMBER: _ClassVar[int]
+    KEPT_FIELD_NUMBER: _ClassVar[int]
+    SWEPT_POINTS_FIELD_NUMBER: _ClassVar[int]
+    ENCODING_FIELD_NUMBER: _ClassVar[int]
+    POINT_COUNT_FIELD_NUMBER: _ClassVar[int]
+    time: TimeStamp
+    start_angle: int
+    end_angle: int
+    speed: int
+    points: bytes
+    scan_id: int
+    fragment: int
+    end_of_scan: bool
+    time_increment: float
+    kept: bytes
+    swept_points: int
+    encoding: PointEncoding
+    point_count: int
+    def __init__(self, time: _Optional[_Union[TimeStamp, _Mapping]] = ..., start_angle: _Optional[int] = ..., end_angle: _Optional[int] = ..., speed: _Optional[int] = ..., points: _Optional[bytes] = ..., scan_id: _Optional[int] = ..., fragment: _Optional[int] = ..., end_of_scan: bool = ..., time_increment: _Optional[float] = ..., kept: _Optional[bytes] = ..., swept_points: _Optional[int] = ..., encoding: _Optional[_Union[PointEncoding, str]] = ..., point_count: _Optional[int] = ...) -> None: ...
+
+class LidarSector(_message.Message):
+    __slots__ = ("start_deg", "end_deg", "keep_every")
+    START_DEG_FIELD_NUMBER: _ClassVar[int]
+    END_DEG_FIELD_NUMBER: _ClassVar[int]
+    KEEP_EVERY_FIELD_NUMBER: _ClassVar[int]
+    start_deg: int
+    end_deg: int
+    keep_every: int
+    def __init__(self, start_deg: _Optional[int] = ..., end_deg: _Optional[int] = ..., keep_every: _Optional[int] = ...) -> None: ...
+
+class LidarConfig(_message.Message):
+    __slots__ = ("points_per_packet", "scan_hz", "min_range_mm", "max_range_mm", "min_intensity", "sectors", "encoding")
+    POINTS_PER_PACKET_FIELD_NUMBER: _ClassVar[int]
+    SCAN_HZ_FIELD_NUMBER: _ClassVar[int]
+    MIN_RANGE_MM_FIELD_NUMBER: _ClassVar[int]
+    MAX_RANGE_MM_FIELD_NUMBER: _ClassVar[int]
+    MIN_INTENSITY_FIELD_NUMBER: _ClassVar[int]
+    SECTORS_FIELD_NUMBER: _ClassVar[int]
+    ENCODING_FIELD_NUMBER: _ClassVar[int]
+    points_per_packet: int
+    scan_hz: float
+    min_range_mm: int
+    max_range_mm: int
+    min_intensity: int
+    sectors: _containers.RepeatedCompositeFieldContainer[LidarSector]
+    encoding: PointEncoding
+    def __init__(self, points_per_packet: _Optional[int] = ..., scan_hz: _Optional[float] = ..., min_range_mm: _Optional[int] = ..., max_range_mm: _Optional[int] = ..., min_intensity: _Optional[int] = ..., sectors: _Optional[_Iterable[_Union[LidarSector, _Mapping]]] = ..., encoding: _Optional[_Union[PointEncoding, str]] = ...) -> None: ...
+
+class MotorModel(_message.Message):
+    __slots__ = ("ks", "kv")
+    KS_FIELD_NUMBER: _ClassVar[int]
+    KV_FIELD_NUMBER: _ClassVar[int]
+    ks: float
+    kv: float
+    def __init__(self, ks: _Optional[float] = ..., kv: _Optional[float] = ...) -> None: ...
+
+class ControlConfig(_message.Message):
+    __slots__ = ("query", "save", "kp", "ki", "kd", "integral_limit", "max_jerk", "hysteresis", "loop_hz", "models")
+    QUERY_FIELD_NUMBER: _ClassVar[int]
+    SAVE_FIELD_NUMBER: _ClassVar[int]
+    KP_FIELD_NUMBER: _ClassVar[int]
+    KI_FIELD_NUMBER: _ClassVar[int]
+    KD_FIELD_NUMBER: _ClassVar[int]
+    INTEGRAL_LIMIT_FIELD_NUMBER: _ClassVar[int]
+    MAX_JERK_FIELD_NUMBER: _ClassVar[int]
+    HYSTERESIS_FIELD_NUMBER: _ClassVar[int]
+    LOOP_HZ_FIELD_NUMBER: _ClassVar[int]
+    MODELS_FIELD_NUMBER: _ClassVar[int]
+    query: bool
+    save: bool
+    kp: float
+    ki: float
+    kd: float
+    integral_limit: float
+    max_jerk: float
+    hysteresis: float
+    loop_hz: int
+    models: _containers.RepeatedCompositeFieldContainer[MotorModel]
+    def __init__(self, query: bool = ..., save: bool = ..., kp: _Optional[float] = ..., ki: _Optional[float] = ..., kd: _Optional[float] = ..., integral_limit: _Optional[float] = ..., max_jerk: _Optional[float] = ..., hysteresis: _Optional[float] = ..., loop_hz: _Optional[int] = ..., models: _Optional[_Iterable[_Union[MotorModel, _Mapping]]] = ...) -> None: ...
+
+class CalibrateMotors(_message.Message):
+    __slots__ = ("save",)
+    SAVE_FIELD_NUMBER: _ClassVar[int]
+    save: bool
+    def __init__(self, save: bool = ...) -> None: ...
+
+class CommandStats(_message.Message):
+    __slots__ = ("age_histogram", "unstamped", "rejected", "timeouts")
+    AGE_HISTOGRAM_FIELD_NUMBER: _ClassVar[int]
+    UNSTAMPED_FIELD_NUMBER: _ClassVar[int]
+    REJECTED_FIELD_NUMBER: _ClassVar[int]
+    TIMEOUTS_FIELD_NUMBER: _ClassVar[int]
+    age_histogram: _containers.RepeatedScalarFieldContainer[int]
+    unstamped: int
+    rejected: int
+    timeouts: int
+    def __init__(self, age_histogram: _Optional[_Iterable[int]] = ..., unstamped: _Optional[int] = ..., rejected: _Optional[int] = ..., timeouts: _Optional[int] = ...) -> None: ...
+
+class TaskUsage(_message.Message):
+    __slots__ = ("name", "core", "priority", "cpu_percent", "stack_free")
+    NAME_FIELD_NUMBER: _ClassVar[int]
+    CORE_FIELD_NUMBER: _ClassVar[int]
+    PRIORITY_FIELD_NUMBER: _ClassVar[int]
+    CPU_PERCENT_FIELD_NUMBER: _ClassVar[int]
+    STACK_FREE_FIELD_NUMBER: _ClassVar[int]
+    name: str
+    core: int
+    priority: int
+    cpu_percent: float
+    stack_free: int
+    def __init__(self, name: _Optional[str] = ..., core: _Optional[int] = ..., priority: _Optional[int] = ..., cpu_percent: _Optional[float] = ..., stack_free: _Optional[int] = ...) -> None: ...
+
+class Diagnostics(_message.Message):
+    __slots__ = ("uptime_ms", "sendto_failures", "rx_decode_errors", "tx_pool_exhausted", "lane_dropped", "lane_high_water", "lidar_frames", "lidar_crc_errors", "lidar_resyncs", "lidar_uart_overflows", "control_loops", "control_overruns", "control_max_jitter_us", "free_heap", "min_free_heap", "tasks", "imu_samples", "imu_fifo_overruns", "imu_dropped_batches", "imu_i2c_errors", "time_sync_samples", "time_sync_rejected", "time_sync_round_trip_us", "wifi_rssi", "wifi_reconnects", "wifi_poor_link_events", "lidar_shed", "espnow_sent", "espnow_received", "reliable_retransmits", "reliable_expired", "reliable_duplicates", "power_state", "cpu_freq_mhz", "power_state_ms")
+    UPTIME_MS_FIELD_NUMBER: _ClassVar[int]
+    SENDTO_FAILURES_FIELD_NUMBER: _ClassVar[int]
+    RX_DECODE_ERRORS_FIELD_NUMBER: _ClassVar[int]
+    TX_POOL_EXHAUSTED_FIELD_NUMBER: _ClassVar[int]
+    LANE_DROPPED_FIELD_NUMBER: _ClassVar[int]
+    LANE_HIGH_WATER_FIELD_NUMBER: _ClassVar[int]
+    LIDAR_FRAMES_FIELD_NUMBER: _ClassVar[int]
+    LIDAR_CRC_ERRORS_FIELD_NUMBER: _ClassVar[int]
+    LIDAR_RESYNCS_FIELD_NUMBER: _ClassVar[int]
+    LIDAR_UART_OVERFLOWS_FIELD_NUMBER: _ClassVar[int]
+    CONTROL_LOOPS_FIELD_NUMBER: _ClassVar[int]
+    CONTROL_OVERRUNS_FIELD_NUMBER: _ClassVar[int]
+    CONTROL_MAX_JITTER_US_FIELD_NUMBER: _ClassVar[int]
+    FREE_HEAP_FIELD_NUMBER: _ClassVar[int]
+    MIN_FREE_HEAP_FIELD_NUMBER: _ClassVar[int]
+    TASKS_FIELD_NUMBER: _ClassVar[int]
+    IMU_SAMPLES_FIELD_NUMBER: _ClassVar[int]
+    IMU_FIFO_OVERRUNS_FIELD_NUMBER: _ClassVar[int]
+    IMU_DROPPED_BATCHES_FIELD_NUMBER: _ClassVar[int]
+    IMU_I2C_ERRORS_FIELD_NUMBER: _ClassVar[int]
+    TIME_SYNC_SAMPLES_FIELD_NUMBER: _ClassVar[int]
+    TIME_SYNC_REJECTED_FIELD_NUMBER: _ClassVar[int]
+    TIME_SYNC_ROUND_TRIP_US_FIELD_NUMBER: _ClassVar[int]
+    WIFI_RSSI_FIELD_NUMBER: _ClassVar[int]
+    WIFI_RECONNECTS_FIELD_NUMBER: _ClassVar[int]
+    WIFI_POOR_LINK_EVENTS_FIELD_NUMBER: _ClassVar[int]
+    LIDAR_SHED_FIELD_NUMBER: _ClassVar[int]
+    ESPNOW_SENT_FIELD_NUMBER: _ClassVar[int]
+    ESPNOW_RECEIVED_FIELD_NUMBER: _ClassVar[int]
+    RELIABLE_RETRANSMITS_FIELD_NUMBER: _ClassVar[int]
+    RELIABLE_EXPIRED_FIELD_NUMBER: _ClassVar[int]
+    RELIABLE_DUPLICATES_FIELD_NUMBER: _ClassVar[int]
+    POWER_STATE_FIELD_NUMBER: _ClassVar[int]
+    CPU_FREQ_MHZ_FIELD_NUMBER: _ClassVar[int]
+    POWER_STATE_MS_FIELD_NUMBER: _ClassVar[int]
+    uptime_ms: int
+    sendto_failures: int
+    rx_decode_errors: int
+    tx_pool_exhausted: int
+    lane_dropped: _containers.RepeatedScalarFieldContainer[int]
+    lane_high_water: _containers.RepeatedScalarFieldContainer[int]
+    lidar_frames: int
+    lidar_crc_errors: int
+    lidar_resyncs: int
+    lidar_uart_overflows: int
+    control_loops: int
+    control_overruns: int
+    control_max_jitter_us: int
+    free_heap: int
+    min_free_heap: int
+    tasks: _containers.RepeatedCompositeFieldContainer[TaskUsage]
+    imu_samples: int
+    imu_fifo_overruns: int
+    imu_dropped_batches: int
+    imu_i2c_errors: int
+    time_sync_samples: int
+    time_sync_rejected: int
+    time_sync_round_trip_us: int
+    wifi_rssi: int
+    wifi_reconnects: int
+    wifi_poor_link_events: int
+    lidar_shed: int
+    espnow_sent: int
+    espnow_received: int
+    reliable_retransmits: int
+    reliable_expired: int
+    reliable_duplicates: int
+    power_state: PowerState
+    cpu_freq_mhz: int
+    power_state_ms: _containers.RepeatedScalarFieldContainer[int]
+    def __init__(self, uptime_ms: _Optional[int] = ..., sendto_failures: _Optional[int] = ..., rx_decode_errors: _Optional[int] = ..., tx_pool_exhausted: _Optional[int] = ..., lane_dropped: _Optional[_Iterable[int]] = ..., lane_high_water: _Optional[_Iterable[int]] = ..., lidar_frames: _Optional[int] = ..., lidar_crc_errors: _Optional[int] = ..., lidar_resyncs: _Optional[int] = ..., lidar_uart_overflows: _Optional[int] = ..., control_loops: _Optional[int] = ..., control_overruns: _Optional[int] = ..., control_max_jitter_us: _Optional[int] = ..., free_heap: _Optional[int] = ..., min_free_heap: _Optional[int] = ..., tasks: _Optional[_Iterable[_Union[TaskUsage, _Mapping]]] = ..., imu_samples: _Optional[int] = ..., imu_fifo_overruns: _Optional[int] = ..., imu_dropped_batches: _Optional[int] = ..., imu_i2c_errors: _Optional[int] = ..., time_sync_samples: _Optional[int] = ..., time_sync_rejected: _Optional[int] = ..., time_sync_round_trip_us: _Optional[int] = ..., wifi_rssi: _Optional[int] = ..., wifi_reconnects: _Optional[int] = ..., wifi_poor_link_events: _Optional[int] = ..., lidar_shed: _Optional[int] = ..., espnow_sent: _Optional[int] = ..., espnow_received: _Optional[int] = ..., reliable_retransmits: _Optional[int] = ..., reliable_expired: _Optional[int] = ..., reliable_duplicates: _Optional[int] = ..., power_state: _Optional[_Union[PowerState, str]] = ..., cpu_freq_mhz: _Optional[int] = ..., power_state_ms: _Optional[_Iterable[int]] = ...) -> None: ...
+
+class ImuSample(_message.Message):
+    __slots__ = ("time_offset_us", "gyro_x", "gyro_y", "gyro_z", "accel_x", "accel_y", "accel_z")
+    TIME_OFFSET_US_FIELD_NUMBER: _ClassVar[int]
+    GYRO_X_FIELD_NUMBER: _ClassVar[int]
+    GYRO_Y_FIELD_NUMBER: _ClassVar[int]
+    GYRO_Z_FIELD_NUMBER: _ClassVar[int]
+    ACCEL_X_FIELD_NUMBER: _ClassVar[int]
+    ACCEL_Y_FIELD_NUMBER: _ClassVar[int]
+    ACCEL_Z_FIELD_NUMBER: _ClassVar[int]
+    time_offset_us: int
+    gyro_x: int
+    gyro_y: int
+    gyro_z: int
+    accel_x: int
+    accel_y: int
+    accel_z: int
+    def __init__(self, time_offset_us: _Optional[int] = ..., gyro_x: _Optional[int] = ..., gyro_y: _Optional[int] = ..., gyro_z: _Optional[int] = ..., accel_x: _Optional[int] = ..., accel_y: _Optional[int] = ..., accel_z: _Optional[int] = ...) -> None: ...
+
+class Imu(_message.Message):
+    __slots__ = ("time", "gyro_scale", "accel_scale", "samples")
+    TIME_FIELD_NUMBER: _ClassVar[int]
+    GYRO_SCALE_FIELD_NUMBER: _ClassVar[int]
+    ACCEL_SCALE_FIELD_NUMBER: _ClassVar[int]
+    SAMPLES_FIELD_NUMBER: _ClassVar[int]
+    time: TimeStamp
+    gyro_scale: float
+    accel_scale: float
+    samples: _containers.RepeatedCompositeFieldContainer[ImuSample]
+    def __init__(self, time: _Optional[_Union[TimeStamp, _Mapping]] = ..., gyro_scale: _Optional[float] = ..., accel_scale: _Optional[float] = ..., samples: _Optional[_Iterable[_Union[ImuSample, _Mapping]]] = ...) -> None: ...
+
+class Attitude(_message.Message):
+    __slots__ = ("time", "roll", "pitch", "yaw", "yaw_rate", "gyro_bias_z")
+    TIME_FIELD_NUMBER: _ClassVar[int]
+    ROLL_FIELD_NUMBER: _ClassVar[int]
+    PITCH_FIELD_NUMBER: _ClassVar[int]
+    YAW_FIELD_NUMBER: _ClassVar[int]
+    YAW_RATE_FIELD_NUMBER: _ClassVar[int]
+    GYRO_BIAS_Z_FIELD_NUMBER: _ClassVar[int]
+    time: TimeStamp
+    roll: float
+    pitch: float
+    yaw: float
+    yaw_rate: float
+    gyro_bias_z: float
+    def __init__(self, time: _Optional[_Union[TimeStamp, _Mapping]] = ..., roll: _Optional[float] = ..., pitch: _Optional[float] = ..., yaw: _Optional[float] = ..., yaw_rate: _Optional[float] = ..., gyro_bias_z: _Optional[float] = ...) -> None: ...
+
+class Odometry(_message.Message):
+    __slots__ = ("time", "x", "y", "yaw", "v", "w", "pose_covariance", "twist_covariance")
+    TIME_FIELD_NUMBER: _ClassVar[int]
+    X_FIELD_NUMBER: _ClassVar[int]
+    Y_FIELD_NUMBER: _ClassVar[int]
+    YAW_FIELD_NUMBER: _ClassVar[int]
+    V_FIELD_NUMBER: _ClassVar[int]
+    W_FIELD_NUMBER: _ClassVar[int]
+    POSE_COVARIANCE_FIELD_NUMBER: _ClassVar[int]
+    TWIST_COVARIANCE_FIELD_NUMBER: _ClassVar[int]
+    time: TimeStamp
+    x: float
+    y: float
+    yaw: float
+    v: float
+    w: float
+    pose_covariance: _containers.RepeatedScalarFieldContainer[float]
+    twist_covariance: _containers.RepeatedScalarFieldContainer[float]
+    def __init__(self, time: _Optional[_Union[TimeStamp, _Mapping]] = ..., x: _Optional[float] = ..., y: _Optional[float] = ..., yaw: _Optional[float] = ..., v: _Optional[float] = ..., w: _Optional[float] = ..., pose_covariance: _Optional[_Iterable[float]] = ..., twist_covariance: _Optional[_Iterable[float]] = ...) -> None: ...
+
 class JointStates(_message.Message):
     __slots__ = ("time", "name", "position", "velocity", "effort")
     TIME_FIELD_NUMBER: _ClassVar[int]
@@ -61,12 +356,54 @@ class JointStates(_message.Message):
     effort: _containers.RepeatedScalarFieldContainer[float]
     def __init__(self, time: _Optional[_Union[TimeStamp, _Mapping]] = ..., name: _Optional[_Iterable[str]] = ..., position: _Optional[_Iterable[float]] = ..., velocity: _Optional[_Iterable[float]] = ..., effort: _Optional[_Iterable[float]] = ...) -> None: ...
 
+class Reliable(_message.Message):
+    __slots__ = ("session", "seq", "base", "ack_session", "ack")
+    SESSION_FIELD_NUMBER: _ClassVar[int]
+    SEQ_FIELD_NUMBER: _ClassVar[int]
+    BASE_FIELD_NUMBER: _ClassVar[int]
+    ACK_SESSION_FIELD_NUMBER: _ClassVar[int]
+    ACK_FIELD_NUMBER: _ClassVar[int]
+    session: int
+    seq: int
+    base: int
+    ack_session: int
+    ack: int
+    def __init__(self, session: _Optional[int] = ..., seq: _Optional[int] = ..., base: _Optional[int] = ..., ack_session: _Optional[int] = ..., ack: _Optional[int] = ...) -> None: ...
+
 class UdpPacket(_message.Message):
-    __slots__ = ("laser", "joint_states", "cmd_vel")
+    __slots__ = ("laser", "joint_states", "cmd_vel", "compact_laser", "lidar_config", "command_stats", "diagnostics", "imu", "attitude", "odometry", "control_config", "calibrate_motors", "time_sync", "robot_id", "batch", "discovery", "reliable")
     LASER_FIELD_NUMBER: _ClassVar[int]
     JOINT_STATES_FIELD_NUMBER: _ClassVar[int]
     CMD_VEL_FIELD_NUMBER: _ClassVar[int]
+    COMPACT_LASER_FIELD_NUMBER: _ClassVar[int]
+    LIDAR_CONFIG_FIELD_NUMBER: _ClassVar[int]
+    COMMAND_STATS_FIELD_NUMBER: _ClassVar[int]
+    DIAGNOSTICS_FIELD_NUMBER: _ClassVar[int]
+    IMU_FIELD_NUMBER: _ClassVar[int]
+    ATTITUDE_FIELD_NUMBER: _ClassVar[int]
+    ODOMETRY_FIELD_NUMBER: _ClassVar[int]
+    CONTROL_CONFIG_FIELD_NUMBER: _ClassVar[int]
+    CALIBRATE_MOTORS_FIELD_NUMBER: _ClassVar[int]
+    TIME_SYNC_FIELD_NUMBER: _ClassVar[int]
+    ROBOT_ID_FIELD_NUMBER: _ClassVar[int]
+    BATCH_FIELD_NUMBER: _ClassVar[int]
+    DISCOVERY_FIELD_NUMBER: _ClassVar[int]
+    RELIABLE_FIELD_NUMBER: _ClassVar[int]
     laser: LaserScan
     joint_states: JointStates
     cmd_vel: TwistCmd
-    def __init__(self, laser: _Optional[_Union[LaserScan, _Mapping]] = ..., joint_states: _Optional[_Union[JointStates, _Mapping]] = ..., cmd_vel: _Optional[_Union[TwistCmd, _Mapping]] = ...) -> None: ...
+    compact_laser: CompactLaserScan
+    lidar_config: LidarConfig
+    command_stats: CommandStats
+    diagnostics: Diagnostics
+    imu: Imu
+    attitude: Attitude
+    odometry: Odometry
+    control_config: ControlConfig
+    calibrate_motors: CalibrateMotors
+    time_sync: TimeSync
+    robot_id: int
+    batch: _containers.RepeatedCompositeFieldContainer[UdpPacket]
+    discovery: Discovery
+    reliable: Reliable
+    def __init__(self, laser: _Optional[_Union[LaserScan, _Mapping]] = ..., joint_states: _Optional[_Union[JointStates, _Mapping]] = ..., cmd_vel: _Optional[_Union[TwistCmd, _Mapping]] = ..., compact_laser: _Optional[_Union[CompactLaserScan, _Mapping]] = ..., lidar_config: _Optional[_Union[LidarConfig, _Mapping]] = ..., command_stats: _Optional[_Union[CommandStats, _Mapping]] = ..., diagnostics: _Optional[_Union[Diagnostics, _Mapping]] = ..., imu: _Optional[_Union[Imu, _Mapping]] = ..., attitude: _Optional[_Union[Attitude, _Mapping]] = ..., odometry: _Optional[_Union[Odometry, _Mapping]] = ..., control_config: _Optional[_Union[ControlConfig, _Mapping]] = ..., calibrate_motors: _Optional[_Union[CalibrateMotors, _Mapping]] = ..., time_sync: _Optional[_Union[TimeSync, _Mapping]] = ..., robot_id: _Optional[int] = ..., batch: _Optional[_Iterable[_Union[UdpPacket, _Mapping]]] = ..., discovery: _Optional[_Union[Discovery, _Mapping]] = ..., reliable: _Optional[_Union[Reliable, _Mapping]] = ...) -> None: ...
@@ -0,0 +1,128 @@
+import random
+import threading
+import time
+
+import little_red_rover.pb.messages_pb2 as messages
+
+# LRR reliable channel
+# The host's half of Reliable in messages.proto, one per rover. Config and
+# commands go through it, and get sent again until the rover acknowledges
+# them. Sensor streams and cmd_vel never do.
+
+# Packets waiting on the rover at once
+WINDOW = 4
+# Everything in flight goes out again once the oldest has waited this long
+RETRANSMIT_NS = 100_000_000
+# About two seconds of trying before a packet is given up on
+MAX_TRIES = 20
+
+SEQ_MASK = 0xFFFFFFFF
+
+
+def after(a, b):
+    """Whether sequence number a comes after b, allowing for wrap around."""
+    return 0 < (a - b) & SEQ_MASK < 0x80000000
+
+
+class ReliableChannel:
+    """Sequence numbers, acknowledgements and retransmits for one rover."""
+
+    def __init__(self, send):
+        # Called with each serialized datagram, acknowledgements included
+        self.send = send
+        self.lock = threading.Lock()
+
+        self.session = random.randrange(1, 1 << 32)
+        self.next_seq = 1
+        # (seq, packet), oldest first
+        self.in_flight = []
+        # When the window last went out, and how often the oldest has
+        self.sent_ns = 0
+        self.tries = 0
+
+        self.peer_session = None
+        # Next seq to handle
+        self.expected = 0
+
+        self.retransmits = 0
+        self.expired = 0
+        self.duplicates = 0
+
+    def transmit(self, packet, seq):
+        # Only called with the lock held
+        header = packet.reliable
+        header.session = self.session
+        header.seq = seq
+        header.base = self.in_flight[0][0] if self.in_flight else self.next_seq
+        if self.peer_session is not None:
+            header.ack_session = self.peer_session
+            header.ack = (self.expected - 1) & SEQ_MASK
+        self.send(packet.SerializeToString())
+
+    def send_packet(self, packet: messages.UdpPacket):
+        """Send a packet until it's acknowledged. False if the window is full."""
+        copy = messages.UdpPacket()
+        copy.CopyFrom(packet)
+        with self.lock:
+            if len(self.in_flight) >= WINDOW:
+                return False
+            seq = self.next_seq
+            self.next_seq = (self.next_seq + 1) & SEQ_MASK
+            if not self.in_flight:
+                self.sent_ns = time.monotonic_ns()
+                self.tries = 0
+            self.in_flight.append((seq, copy))
+            self.transmit(copy, seq)
+        return True
+
+    def receive(self, header: messages.Reliable):
+        """Acknowledge the header on a rover's packet, returning whether the
+        rest of the packet should be handled."""
+        with self.lock:
+            if header.ack_session == self.session:
+                while self.in_flight and not after(self.in_flight[0][0], header.ack):
+                    self.in_flight.pop(0)
+                    # The next one gets a full timeout of its own
+                    self.sent_ns = time.monotonic_ns()
+                    self.tries = 0
+
+            if header.seq == 0:
+                return True
+            if header.session != self.peer_session:
+                # A new rover, or the same one rebooted
+                self.peer_session = header.session
+                self.expected = header.base
+            elif after(header.base, self.expected):
+                # The rover gave up on those
+                self.expected = header.base
+
+            handle = header.seq == self.expected
+            if handle:
+                self.expected = (self.expected + 1) & SEQ_MASK
+            elif not after(header.seq, self.expected):
+                self.duplicates += 1
+            # Repeats get answered too, it may be the acknowledgement that
+            # was lost
+            self.transmit(messages.UdpPacket(), 0)
+        return handle
+
+    def retransmit(self):
+        """Called periodically. Sends the window again once the oldest has
+        waited too long, and returns the packet given up on, if any."""
+        expired = None
+        with self.lock:
+            now_ns = time.monotonic_ns()
+            if not self.in_flight or now_ns - self.sent_ns < RETRANSMIT_NS:
+                return None
+            self.tries += 1
+            if self.tries >= MAX_TRIES:
+                # The rover stops waiting for it once base moves past
+                expired = self.in_flight.pop(0)[1]
+                self.expired += 1
+                self.tries = 0
+            # Anything after a lost packet was dropped too, so send them all
+            for seq, packet in self.in_flight:
+                self.transmit(packet, seq)
+                self.retransmits += 1
+            self.sent_ns = now_ns
+        return expired
@@ -0,0 +1,223 @@
+import argparse
+from math import inf, pi, radians, sin
+import queue
+import struct
+import time
+
+import numpy as np
+
+import little_red_rover.pb.messages_pb2 as messages
+from little_red_rover.hal import SCAN_BUFFERS, Rover
+from little_red_rover.udp_capture import read_capture
+
+# LRR scan binning benchmark
+# Times the HAL's scan assembly on its own, without ROS or a socket: the
+# numpy path in Rover.handle_compact_laser_scan for raw and delta varint
+# points, against the per-point loop it replaced. Fragments come from a
+# udp_capture file if given, otherwise a synthetic LD20 revolution like the
+# firmware sends. e.g. `ros2 run little_red_rover scan_bench cap.bin`.
+# Under load, replay the same capture with `udp_replay cap.bin --speed 0`
+# into each HAL being compared: /scan drops show whether it keeps up, and
+# its "HAL handle compact_laser" rows how long binning takes.
+
+# LD20 at 10 Hz
+POINTS_PER_REV = 450
+SPEED = 3600
+
+
+def zigzag_varint(delta):
+    """Same bytes as point_codec_put_distance in the firmware."""
+    value = ((delta << 1) ^ (delta >> 31)) & 0xFFFFFFFF
+    out = bytearray()
+    while value >= 0x80:
+        out.append((value & 0x7F) | 0x80)
+        value >>= 7
+    out.append(value)
+    return out
+
+
+def synthetic_fragments(revolutions, points_per_packet, encoding):
+    fragments = []
+    step = 36000 / POINTS_PER_REV
+    for scan_id in range(revolutions):
+        for start in range(0, POINTS_PER_REV, points_per_packet):
+            indices = range(start, min(start + points_per_packet, POINTS_PER_REV))
+            # A room a couple of metres across, with some dropouts
+            points = [
+                (int(2000 + 800 * sin(i * 2 * pi / POINTS_PER_REV) + (i * 37) % 11),
+                 0 if i % 29 == 0 else 150 + i % 50)
+                for i in indices
+            ]
+            packet = messages.CompactLaserScan()
+            packet.start_angle = int(indices[0] * step)
+            packet.end_angle = int(indices[-1] * step)
+            packet.speed = SPEED
+            packet.scan_id = scan_id
+            packet.fragment = start // points_per_packet
+            packet.end_of_scan = indices[-1] == POINTS_PER_REV - 1
+            packet.time_increment = 1.0 / (POINTS_PER_REV * SPEED / 360)
+            packet.encoding = encoding
+            if encoding == messages.POINT_ENCODING_DELTA_VARINT:
+                data = bytearray()
+                previous = 0
+                for distance, _ in points:
+                    data += zigzag_varint(distance - previous)
+                    previous = distance
+                data += bytes(intensity for _, intensity in points)
+                packet.points = bytes(data)
+                packet.point_count = len(points)
+            else:
+                packet.points = b"".join(struct.pack("<HB", *p) for p in points)
+            fragments.append(packet)
+    return fragments
+
+
+def captured_fragments(path):
+    fragments = []
+    for _, data in read_capture(path):
+        packet = messages.UdpPacket()
+        packet.ParseFromString(data)
+        for p in packet.batch if len(packet.batch) > 0 else [packet]:
+            if p.HasField("compact_laser"):
+                fragments.append(p.compact_laser)
+    return fragments
+
+
+class ScanStage:
+    """Stands in for the publisher thread, handing buffers straight back."""
+
+    def __init__(self):
+        self.rover = None
+        self.published = 0
+
+    def put(self, item):
+        _, index = item
+        self.published += 1
+        self.rover.free_scans.put(index)
+
+
+class BenchHal:
+    def __init__(self):
+        self.scan_stage = ScanStage()
+
+
+class BenchRover(Rover):
+    """Only the scan assembly state of a Rover, so no node is needed."""
+
+    def __init__(self):
+        self.hal = BenchHal()
+        self.hal.scan_stage.rover = self
+        self.laser_msgs = [self.make_laser_msg("") for _ in range(SCAN_BUFFERS)]
+        self.free_scans = queue.Queue()
+        for index in range(1, SCAN_BUFFERS):
+            self.free_scans.put(index)
+        self.laser_index = 0
+        self.laser_msg = self.laser_msgs[0]
+        self.views = [
+            (np.frombuffer(msg.ranges, dtype=np.float32),
+             np.frombuffer(msg.intensities, dtype=np.float32))
+            for msg in self.laser_msgs
+        ]
+        self.scan_id = -1
+        self.scan_done = True
+        self.scans_dropped = 0
+
+
+class LoopRover:
+    """The per-point loop Rover.handle_compact_laser_scan used to run."""
+
+    def __init__(self):
+        self.ranges = [0.0] * 720
+        self.intensities = [0.0] * 720
+        self.scan_id = -1
+        self.scan_done = True
+        self.published = 0
+
+    def handle_compact_laser_scan(self, packet: messages.CompactLaserScan):
+        age = (self.scan_id - packet.scan_id) & 0xFFFFFFFF
+        if 0 < age < 16 or (age == 0 and self.scan_done):
+            return
+        points = list(struct.iter_unpack("<HB", packet.points))
+        if len(points) < 2 or packet.end_angle <= packet.start_angle:
+            return
+        if packet.scan_id != self.scan_id:
+            if not self.scan_done:
+                self.publish_scan()
+            self.scan_id = packet.scan_id
+            self.scan_done = False
+
+        angle_min = radians(packet.start_angle / 100.0)
+        angle_max = radians(packet.end_angle / 100.0)
+        for i, (distance, intensity) in enumerate(points):
+            angle = angle_min + (angle_max - angle_min) * (i / (len(points) - 1))
+            self.add_scan_point(angle, distance / 1000.0, float(intensity))
+
+        if packet.end_of_scan:
+            self.publish_scan()
+            self.scan_done = True
+
+    def add_scan_point(self, angle, distance, intensity):
+        index = int(((angle % (2.0 * pi)) / (2.0 * pi)) * 720.0)
+        if distance > 8.0 or distance < 0.1 or intensity == 0:
+            self.ranges[index] = inf
+            self.intensities[index] = 0
+        else:
+            self.ranges[index] = distance
+            self.intensities[index] = intensity
+
+    def publish_scan(self):
+        self.published += 1
+        self.ranges = [0.0] * 720
+        self.intensities = [0.0] * 720
+
+
+def run(name, rover, fragments, repeat):
+    best_ns = None
+    for _ in range(repeat):
+        # Each pass starts a fresh revolution sequence
+        rover.scan_id = -1
+        rover.scan_done = True
+        start = time.perf_counter_ns()
+        for packet in fragments:
+            rover.handle_compact_laser_scan(packet)
+        elapsed = time.perf_counter_ns() - start
+        best_ns = elapsed if best_ns is None else min(best_ns, elapsed)
+    revolutions = len({packet.scan_id for packet in fragments})
+    print(
+        f"{name:24s} {best_ns / len(fragments) / 1e3:8.1f} us/fragment "
+        f"{best_ns / max(revolutions, 1) / 1e3:8.1f} us/revolution"
+    )
+
+
+def main(args=None):
+    parser = argparse.ArgumentParser(description="Benchmark HAL scan binning")
+    parser.add_argument("capture", nargs="?", help="file written by udp_capture")
+    parser.add_argument("--revolutions", type=int, default=100)
+    parser.add_argument("--points-per-packet", type=int, default=120)
+    parser.add_argument("--repeat", type=int, default=5, help="best of this many")
+    args = parser.parse_args(args)
+
+    if args.capture:
+        fragments = captured_fragments(args.capture)
+        if not fragments:
+            print("No compact scans in capture")
+            return
+        raw = [p for p in fragments if p.encoding == messages.POINT_ENCODING_RAW]
+        run("numpy, captured", BenchRover(), fragments, args.repeat)
+        if raw and len(raw) == len(fragments) and not any(p.kept for p in raw):
+            run("per-point loop, captured", LoopRover(), raw, args.repeat)
+        return
+
+    raw = synthetic_fragments(
+        args.revolutions, args.points_per_packet, messages.POINT_ENCODING_RAW
+    )
+    delta = synthetic_fragments(
+        args.revolutions, args.points_per_packet, messages.POINT_ENCODING_DELTA_VARINT
+    )
+    run("per-point loop, raw", LoopRover(), raw, args.repeat)
+    run("numpy, raw", BenchRover(), raw, args.repeat)
+    run("numpy, delta varint", BenchRover(), delta, args.repeat)
+
+
+if __name__ == "__main__":
+    main()
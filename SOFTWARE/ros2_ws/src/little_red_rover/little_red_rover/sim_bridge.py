@@ -0,0 +1,410 @@
+import heapq
+from math import atan2, degrees
+import random
+import socket
+import threading
+import time
+
+import numpy as np
+import rclpy
+from rclpy.node import Node
+from rclpy.qos import qos_profile_sensor_data
+
+from geometry_msgs.msg._twist import Twist
+from nav_msgs.msg import Odometry
+from sensor_msgs.msg._joint_state import JointState
+from sensor_msgs.msg._laser_scan import LaserScan
+
+from little_red_rover.reliable import ReliableChannel
+import little_red_rover.pb.messages_pb2 as messages
+
+# LRR simulation bridge
+# Stands in for the firmware in simulation. Gazebo's lidar, wheel joints and
+# odometry (sim/scan, sim/joint_states, sim/odom) go to the HAL as the same
+# UdpPacket datagrams the rover sends: compact scan fragments paced over each
+# revolution, and joint states with odometry at the control rate. cmd_vel
+# from the HAL drives sim/cmd_vel. Both directions go through a link with
+# the loss, latency, jitter and bandwidth set here, and robots > 1 serves the
+# same simulated rover to a fleet mode HAL under several ids.
+# Everything is stamped on the node's clock, so it and the HAL run on
+# use_sim_time. E.g. `ros2 launch little_red_rover sim.launch.py udp:=true`,
+# which drives the lrr model in worlds/testing.sdf.
+# Scan angles pass through as they are, so the simulated lidar should sit on
+# the URDF's lidar link the way the LD20 does.
+
+PORT = 8001
+
+# What the LD20 reports when the simulated scan doesn't say
+LD20_SPEED = 3600
+# Datagrams hold whole LD20 frames, as on the rover
+LD20_FRAME_POINTS = 12
+# CompactLaserScan.points max_size
+MAX_POINTS_BYTES = 1404
+RAW_POINT = np.dtype([("distance", "<u2"), ("intensity", "u1")])
+# Gazebo's ray sensors often report no intensity, which the HAL would take for
+# no return
+DEFAULT_INTENSITY = 200
+# Names the firmware gives its wheel joints
+WHEEL_NAMES = ("wheel_left", "wheel_right")
+# Where Odometry.pose_covariance (x, y, yaw) and twist_covariance (v, w)
+# come from in the 6x6 ROS covariances
+POSE_AXES = (0, 1, 5)
+TWIST_AXES = (0, 5)
+# A datagram that would wait longer than this for the link is dropped, the
+# way a full socket buffer drops them on the rover
+LINK_QUEUE_NS = 200_000_000
+
+
+def encode_delta_varint(distances, intensities):
+    """CompactLaserScan.points for POINT_ENCODING_DELTA_VARINT: zigzag varint
+    distance deltas, then one intensity byte per point."""
+    deltas = np.diff(distances.astype(np.int32), prepend=0)
+    zigzag = (deltas << 1) ^ (deltas >> 31)
+    lengths = 1 + (zigzag >= 0x80) + (zigzag >= 0x4000)
+    groups = np.stack(
+        [
+            (zigzag & 0x7F) | ((zigzag >= 0x80) << 7),
+            ((zigzag >> 7) & 0x7F) | ((zigzag >= 0x4000) << 7),
+            zigzag >> 14,
+        ],
+        axis=1,
+    ).astype(np.uint8)
+    varints = groups[np.arange(3) < lengths[:, None]]
+    return varints.tobytes() + intensities.astype(np.uint8).tobytes()
+
+
+class Link:
+    """One direction of the simulated WiFi link, delivering datagrams on its
+    own thread once they've been delayed, or never if they're lost."""
+
+    def __init__(self, deliver, loss, latency_ms, jitter_ms, kbps):
+        self.deliver = deliver
+        self.loss = loss
+        self.latency_ns = latency_ms * 1e6
+        self.jitter_ns = jitter_ms * 1e6
+        self.kbps = kbps
+
+        # (due_ns, order, data), soonest first
+        self.queue = []
+        self.order = 0
+        # When the link is done sending what it already has
+        self.free_ns = 0
+        self.condition = threading.Condition()
+
+        self.sent = 0
+        self.dropped = 0
+        self.overflowed = 0
+        self.bytes = 0
+        threading.Thread(target=self.run, daemon=True).start()
+
+    def send(self, data, at_ns=None):
+        """Send now, or once the monotonic clock reaches at_ns."""
+        now_ns = time.monotonic_ns()
+        at_ns = now_ns if at_ns is None else max(at_ns, now_ns)
+        with self.condition:
+            self.sent += 1
+            if random.random() < self.loss:
+                self.dropped += 1
+                return
+            due_ns = at_ns
+            if self.kbps > 0:
+                # Datagrams go out one after another at the link rate
+                start_ns = max(self.free_ns, at_ns)
+                if start_ns - at_ns > LINK_QUEUE_NS:
+                    self.overflowed += 1
+                    return
+                self.free_ns = start_ns + int(len(data) * 8e6 / self.kbps)
+                due_ns = self.free_ns
+            due_ns += max(0, int(random.gauss(self.latency_ns, self.jitter_ns)))
+
+            self.bytes += len(data)
+            heapq.heappush(self.queue, (due_ns, self.order, data))
+            self.order += 1
+            self.condition.notify()
+
+    def run(self):
+        while True:
+            with self.condition:
+                while True:
+                    wait_ns = None
+                    if self.queue:
+                        wait_ns = self.queue[0][0] - time.monotonic_ns()
+                        if wait_ns <= 0:
+                            break
+                    self.condition.wait(None if wait_ns is None else wait_ns / 1e9)
+                _, _, data = heapq.heappop(self.queue)
+            self.deliver(data)
+
+
+class SimRover:
+    """One simulated rover: its socket, both halves of its link, and the
+    packets the firmware would build."""
+
+    def __init__(self, bridge, robot_id, address, link):
+        self.bridge = bridge
+        self.robot_id = robot_id
+        self.address = address
+
+        self.socket = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.socket.bind(("0.0.0.0", 0))
+        self.uplink = Link(self.send_data, *link)
+        self.downlink = Link(self.handle_datagram, *link)
+        # The rover's half of the channel the HAL sends its config over
+        self.reliable = ReliableChannel(self.send_reliable_data)
+
+        # What the HAL last asked for, the firmware defaults until then
+        self.points_per_packet = 120
+        self.encoding = messages.POINT_ENCODING_RAW
+        self.scan_id = 0
+        self.commands = 0
+
+        threading.Thread(target=self.run_loop, daemon=True).start()
+
+    def send_data(self, data):
+        try:
+            self.socket.sendto(data, self.address)
+        except OSError:
+            # Nobody listening yet, which the rover doesn't hear about either
+            pass
+
+    def send_reliable_data(self, data):
+        # The channel builds acknowledgements without an id, and a field
+        # that turns up twice is merged, so it can go on the end
+        tail = messages.UdpPacket(robot_id=self.robot_id).SerializeToString()
+        self.uplink.send(data + tail)
+
+    def send_packet(self, packet: messages.UdpPacket, at_ns=None):
+        packet.robot_id = self.robot_id
+        self.uplink.send(packet.SerializeToString(), at_ns)
+
+    def run_loop(self):
+        while True:
+            data, _ = self.socket.recvfrom(1500)
+            self.downlink.send(data)
+
+    def handle_datagram(self, data):
+        packet = messages.UdpPacket()
+        try:
+            packet.ParseFromString(data)
+        except Exception:
+            return
+        if packet.HasField("reliable") and not self.reliable.receive(packet.reliable):
+            return
+
+        if packet.HasField("lidar_config"):
+            config = packet.lidar_config
+            if config.HasField("points_per_packet"):
+                self.points_per_packet = config.points_per_packet
+            self.encoding = config.encoding
+        elif packet.HasField("cmd_vel"):
+            self.commands += 1
+            self.bridge.command(self, packet.cmd_vel)
+        # Range filters, sectors, scan rate, control tuning and time sync
+        # are the firmware's business, and not simulated
+
+    def fragment_points(self):
+        """Points per compact scan datagram, as the firmware rounds it."""
+        bytes_per_point = 4 if self.encoding == messages.POINT_ENCODING_DELTA_VARINT else 3
+        most = MAX_POINTS_BYTES // bytes_per_point // LD20_FRAME_POINTS * LD20_FRAME_POINTS
+        points = self.points_per_packet // LD20_FRAME_POINTS * LD20_FRAME_POINTS
+        return most if points == 0 else max(LD20_FRAME_POINTS, min(points, most))
+
+    def send_scan(self, distances, intensities, angles, time_increment, speed):
+        """Send a revolution as compact fragments, each once the last of its
+        points would have been measured. Angles are unwrapped centidegrees."""
+        start_ns = time.monotonic_ns()
+        # Pacing is on the monotonic clock, stamps on the node's
+        start_stamp_ns = self.bridge.get_clock().now().nanoseconds
+        count = len(distances)
+        step = self.fragment_points()
+
+        # A single point left over goes on the end of the last fragment
+        firsts = list(range(0, count, step))
+        if count - firsts[-1] < 2:
+            firsts.pop()
+        for fragment, first in enumerate(firsts):
+            last = firsts[fragment + 1] - 1 if fragment + 1 < len(firsts) else count - 1
+            packet = messages.UdpPacket()
+            compact = packet.compact_laser
+            first_ns = start_stamp_ns + int(first * time_increment * 1e9)
+            compact.time.sec = first_ns // 1_000_000_000
+            compact.time.nanosec = first_ns % 1_000_000_000
+            compact.start_angle = int(angles[first]) % 36000
+            compact.end_angle = compact.start_angle + int(angles[last] - angles[first])
+            compact.speed = speed
+            compact.scan_id = self.scan_id
+            compact.fragment = fragment
+            compact.end_of_scan = last == count - 1
+            compact.time_increment = time_increment
+
+            d = distances[first : last + 1]
+            i = intensities[first : last + 1]
+            if self.encoding == messages.POINT_ENCODING_DELTA_VARINT:
+                compact.encoding = messages.POINT_ENCODING_DELTA_VARINT
+                compact.point_count = len(d)
+                compact.points = encode_delta_varint(d, i)
+            else:
+                points = np.empty(len(d), dtype=RAW_POINT)
+                points["distance"] = d
+                points["intensity"] = i
+                compact.points = points.tobytes()
+
+            sent_ns = start_ns + int((last + 1) * time_increment * 1e9)
+            self.send_packet(packet, sent_ns)
+        self.scan_id = (self.scan_id + 1) & 0xFFFFFFFF
+
+
+class SimBridge(Node):
+    def __init__(self):
+        super().__init__("sim_bridge")
+
+        # Where the HAL is listening
+        self.declare_parameter("hal_host", "127.0.0.1")
+        # Simulated rovers, with ids from robot_id up. More than one needs
+        # the HAL's fleet mode, and only the first drives the simulation.
+        self.declare_parameter("robots", 1)
+        self.declare_parameter("robot_id", 0x51B000)
+        # The firmware sends joint states and odometry every control step
+        self.declare_parameter("joint_states_hz", 50.0)
+        # Which simulated joints are the left and right wheel
+        self.declare_parameter("sim_joints", list(WHEEL_NAMES))
+        # Link impairments, applied each way. Latency is normally
+        # distributed with jitter as its standard deviation. kbps 0 is
+        # unlimited.
+        self.declare_parameter("loss", 0.0)
+        self.declare_parameter("latency_ms", 2.0)
+        self.declare_parameter("jitter_ms", 1.0)
+        self.declare_parameter("link_kbps", 0.0)
+
+        address = (self.get_parameter("hal_host").value, PORT)
+        link = (
+            self.get_parameter("loss").value,
+            self.get_parameter("latency_ms").value,
+            self.get_parameter("jitter_ms").value,
+            self.get_parameter("link_kbps").value,
+        )
+        first_id = self.get_parameter("robot_id").value
+        self.rovers = [
+            SimRover(self, first_id + i, address, link)
+            for i in range(self.get_parameter("robots").value)
+        ]
+        self.sim_joints = self.get_parameter("sim_joints").value
+
+        self.joint_state = None
+        self.odometry = None
+
+        self.create_subscription(
+            LaserScan, "sim/scan", self.scan_callback, qos_profile_sensor_data
+        )
+        self.create_subscription(
+            JointState, "sim/joint_states", self.joint_state_callback, qos_profile_sensor_data
+        )
+        self.create_subscription(
+            Odometry, "sim/odom", self.odometry_callback, qos_profile_sensor_data
+        )
+        self.cmd_vel_publisher = self.create_publisher(Twist, "sim/cmd_vel", 10)
+
+        self.create_timer(1.0 / self.get_parameter("joint_states_hz").value, self.send_control)
+        self.create_timer(5.0, self.report)
+
+    def scan_callback(self, msg: LaserScan):
+        count = len(msg.ranges)
+        if count < 2:
+            return
+        ranges = np.asarray(msg.ranges, dtype=np.float32)
+        valid = np.isfinite(ranges) & (ranges >= msg.range_min) & (ranges <= msg.range_max)
+        distances = np.clip(np.where(valid, ranges * 1000.0, 0), 0, 0xFFFF).astype(np.uint16)
+
+        intensities = np.full(count, DEFAULT_INTENSITY, dtype=np.uint8)
+        if len(msg.intensities) == count and max(msg.intensities) > 0:
+            intensities = np.clip(np.asarray(msg.intensities), 1, 255).astype(np.uint8)
+        intensities[~valid] = 0
+
+        first = degrees(msg.angle_min) * 100.0 % 36000.0
+        angles = first + np.arange(count) * degrees(msg.angle_increment) * 100.0
+
+        scan_time = msg.scan_time if msg.scan_time > 0 else 360.0 / LD20_SPEED
+        time_increment = msg.time_increment if msg.time_increment > 0 else scan_time / count
+        speed = int(round(360.0 / scan_time))
+
+        for rover in self.rovers:
+            rover.send_scan(distances, intensities, angles, time_increment, speed)
+
+    def joint_state_callback(self, msg: JointState):
+        self.joint_state = msg
+
+    def odometry_callback(self, msg: Odometry):
+        self.odometry = msg
+
+    def send_control(self):
+        if self.joint_state is None:
+            return
+        now_ns = self.get_clock().now().nanoseconds
+        packet = messages.UdpPacket()
+        joints = packet.joint_states
+        joints.time.sec = now_ns // 1_000_000_000
+        joints.time.nanosec = now_ns % 1_000_000_000
+        for name, sim_name in zip(WHEEL_NAMES, self.sim_joints):
+            if sim_name not in self.joint_state.name:
+                return
+            i = self.joint_state.name.index(sim_name)
+            joints.name.append(name)
+            for field in ("position", "velocity", "effort"):
+                values = getattr(self.joint_state, field)
+                getattr(joints, field).append(values[i] if i < len(values) else 0.0)
+
+        # Rides along with the joint states, as on the rover
+        if self.odometry is not None:
+            odom = packet.odometry
+            odom.time.CopyFrom(joints.time)
+            pose = self.odometry.pose.pose
+            odom.x = pose.position.x
+            odom.y = pose.position.y
+            odom.yaw = 2.0 * atan2(pose.orientation.z, pose.orientation.w)
+            odom.v = self.odometry.twist.twist.linear.x
+            odom.w = self.odometry.twist.twist.angular.z
+            for i in POSE_AXES:
+                for j in POSE_AXES:
+                    odom.pose_covariance.append(self.odometry.pose.covariance[i * 6 + j])
+            for i in TWIST_AXES:
+                for j in TWIST_AXES:
+                    odom.twist_covariance.append(self.odometry.twist.covariance[i * 6 + j])
+
+        for rover in self.rovers:
+            sent = messages.UdpPacket()
+            sent.CopyFrom(packet)
+            rover.send_packet(sent)
+
+    def command(self, rover, cmd: messages.TwistCmd):
+        # Called from the rover's link thread
+        if rover is not self.rovers[0]:
+            return
+        msg = Twist()
+        msg.linear.x = cmd.v
+        msg.angular.z = cmd.w
+        self.cmd_vel_publisher.publish(msg)
+
+    def report(self):
+        sent = sum(rover.uplink.sent for rover in self.rovers)
+        dropped = sum(rover.uplink.dropped + rover.uplink.overflowed for rover in self.rovers)
+        sent_bytes = sum(rover.uplink.bytes for rover in self.rovers)
+        commands = sum(rover.commands for rover in self.rovers)
+        self.get_logger().info(
+            f"{len(self.rovers)} rover(s): {sent} datagrams up, {dropped} lost, "
+            f"{sent_bytes / 1024:.0f} KiB, {commands} commands down"
+        )
+
+
+def main(args=None):
+    rclpy.init(args=args)
+
+    bridge = SimBridge()
+
+    rclpy.spin(bridge)
+
+    bridge.destroy_node()
+    rclpy.shutdown()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,77 @@
+import argparse
+import socket
+import struct
+import time
+
+# LRR UDP capture
+# Records every datagram the rover sends to port 8001, with its arrival time,
+# so it can be fed back into the HAL later with udp_replay.
+# Stop the HAL first, only one process can have the port.
+
+MAGIC = b"LRRCAP1\n"
+# Nanoseconds since the first datagram, then the datagram length
+RECORD = struct.Struct("<qI")
+
+
+def read_capture(path):
+    """Load a capture as a list of (time_ns, datagram) tuples."""
+    records = []
+    with open(path, "rb") as f:
+        if f.read(len(MAGIC)) != MAGIC:
+            raise ValueError(f"{path} is not an LRR capture")
+
+        while True:
+            header = f.read(RECORD.size)
+            if len(header) < RECORD.size:
+                break
+            time_ns, length = RECORD.unpack(header)
+            data = f.read(length)
+            if len(data) < length:
+                break
+            records.append((time_ns, data))
+    return records
+
+
+def main(args=None):
+    parser = argparse.ArgumentParser(description="Record rover UDP traffic")
+    parser.add_argument("output", help="capture file to write")
+    parser.add_argument("--port", type=int, default=8001)
+    parser.add_argument(
+        "--duration", type=float, default=0.0, help="seconds, 0 runs until Ctrl-C"
+    )
+    args = parser.parse_args(args)
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(("0.0.0.0", args.port))
+    sock.settimeout(0.5)
+
+    count = 0
+    total_bytes = 0
+    start_ns = None
+    deadline = time.monotonic() + args.duration if args.duration > 0 else None
+
+    with open(args.output, "wb") as f:
+        f.write(MAGIC)
+        try:
+            while deadline is None or time.monotonic() < deadline:
+                try:
+                    data = sock.recv(65535)
+                except socket.timeout:
+                    continue
+
+                now_ns = time.monotonic_ns()
+                if start_ns is None:
+                    start_ns = now_ns
+                f.write(RECORD.pack(now_ns - start_ns, len(data)))
+                f.write(data)
+                count += 1
+                total_bytes += len(data)
+        except KeyboardInterrupt:
+            pass
+
+    print(f"Captured {count} datagrams, {total_bytes} bytes, to {args.output}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,216 @@
+import argparse
+from collections import defaultdict, deque
+import socket
+import threading
+import time
+
+import rclpy
+from rclpy.executors import SingleThreadedExecutor
+from rclpy.node import Node
+from rclpy.qos import qos_profile_sensor_data
+
+from diagnostic_msgs.msg import DiagnosticArray
+from sensor_msgs.msg._joint_state import JointState
+from sensor_msgs.msg._laser_scan import LaserScan
+
+from little_red_rover.hal import packet_kind
+import little_red_rover.pb.messages_pb2 as messages
+from little_red_rover.udp_capture import read_capture
+
+# LRR UDP replay
+# Plays a capture from udp_capture into a running HAL and measures what comes
+# out the other side: how long the HAL spends handling each message type (as
+# it reports on /diagnostics), how long from sending the datagram that
+# completes a message to seeing it published, and how many /scan and
+# /joint_states messages never showed up. The HAL's timings are since it
+# started, so restart it for a clean run.
+# Run the HAL first, then e.g. `ros2 run little_red_rover udp_replay cap.bin
+# --speed 10`.
+
+
+def percentile(values, fraction):
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(len(ordered) * fraction))]
+
+
+class Replay(Node):
+    def __init__(self):
+        super().__init__("udp_replay")
+
+        # Send times of datagrams that should each lead to one publish
+        self.pending = {"scan": deque(), "joint_states": deque()}
+        self.sent = defaultdict(int)
+        self.latency_ns = defaultdict(list)
+        self.received = defaultdict(int)
+        self.lock = threading.Lock()
+        # Latest host pipeline report from the HAL
+        self.pipeline = {}
+
+        self.create_subscription(
+            LaserScan,
+            "scan",
+            lambda msg: self.on_publish("scan"),
+            qos_profile_sensor_data,
+        )
+        self.create_subscription(
+            JointState,
+            "joint_states",
+            lambda msg: self.on_publish("joint_states"),
+            qos_profile_sensor_data,
+        )
+        self.create_subscription(
+            DiagnosticArray, "diagnostics", self.on_diagnostics, 10
+        )
+
+    def on_diagnostics(self, msg: DiagnosticArray):
+        for status in msg.status:
+            if status.name.endswith("host pipeline"):
+                with self.lock:
+                    self.pipeline = {v.key: v.value for v in status.values}
+
+    def handle_timings(self):
+        """(kind, count, mean us, max us) from the HAL's latest report."""
+        with self.lock:
+            pipeline = dict(self.pipeline)
+        timings = []
+        for key, count in pipeline.items():
+            if key.startswith("handle ") and key.endswith(" count"):
+                kind = key[len("handle ") : -len(" count")]
+                timings.append((
+                    kind,
+                    count,
+                    pipeline.get(f"handle {kind} mean us", "?"),
+                    pipeline.get(f"handle {kind} max us", "?"),
+                ))
+        return sorted(timings)
+
+    def expect(self, topic, sent_ns):
+        with self.lock:
+            self.pending[topic].append(sent_ns)
+            self.sent[topic] += 1
+
+    def on_publish(self, topic):
+        now_ns = time.monotonic_ns()
+        with self.lock:
+            self.received[topic] += 1
+            # Match with the oldest outstanding send. If something was dropped
+            # this pairs later messages with earlier sends, so drops inflate
+            # the latency numbers rather than hide.
+            if self.pending[topic]:
+                sent_ns = self.pending[topic].popleft()
+                self.latency_ns[topic].append(now_ns - sent_ns)
+
+
+def outputs(packet: messages.UdpPacket):
+    """Topics the HAL should publish on after handling this datagram.
+
+    Only compact scans are counted, legacy scans publish on angle wrap.
+    """
+    topics = []
+    for p in packet.batch if len(packet.batch) > 0 else [packet]:
+        if p.HasField("joint_states"):
+            topics.append("joint_states")
+        elif p.HasField("compact_laser") and p.compact_laser.end_of_scan:
+            topics.append("scan")
+    return topics
+
+
+def main(args=None):
+    parser = argparse.ArgumentParser(description="Replay rover UDP traffic")
+    parser.add_argument("capture", help="file written by udp_capture")
+    parser.add_argument(
+        "--speed", type=float, default=1.0, help="1 for real time, 0 for flat out"
+    )
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=8001)
+    parser.add_argument(
+        "--settle", type=float, default=1.0, help="seconds to wait for stragglers"
+    )
+    args, ros_args = parser.parse_known_args(args)
+
+    records = read_capture(args.capture)
+    if not records:
+        print("Capture is empty")
+        return
+
+    # Parse everything up front to know what to expect back. Only the
+    # protobuf parse is timed, once per datagram, what the HAL does with it
+    # comes from its own report.
+    parse_ns = defaultdict(list)
+    packets = []
+    for _, data in records:
+        start = time.perf_counter_ns()
+        packet = messages.UdpPacket()
+        packet.ParseFromString(data)
+        elapsed = time.perf_counter_ns() - start
+        parse_ns["batch" if len(packet.batch) > 0 else packet_kind(packet)].append(elapsed)
+        packets.append(packet)
+
+    rclpy.init(args=ros_args)
+    node = Replay()
+    executor = SingleThreadedExecutor()
+    executor.add_node(node)
+    threading.Thread(target=executor.spin, daemon=True).start()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    target = (args.host, args.port)
+
+    start_ns = time.monotonic_ns()
+    for (time_ns, data), packet in zip(records, packets):
+        if args.speed > 0:
+            due_ns = start_ns + time_ns / args.speed
+            delay = (due_ns - time.monotonic_ns()) / 1e9
+            if delay > 0:
+                time.sleep(delay)
+
+        sent_ns = time.monotonic_ns()
+        sock.sendto(data, target)
+        for topic in outputs(packet):
+            node.expect(topic, sent_ns)
+    send_s = (time.monotonic_ns() - start_ns) / 1e9
+
+    time.sleep(args.settle)
+
+    print(
+        f"Sent {len(records)} datagrams in {send_s:.2f} s "
+        f"({len(records) / send_s:.0f}/s)"
+    )
+    print()
+    print(f"{'parse (us)':<16} {'count':>7} {'mean':>8} {'p99':>8} {'max':>8}")
+    for name, values in sorted(parse_ns.items()):
+        print(
+            f"{name:<16} {len(values):>7} {sum(values) / len(values) / 1e3:>8.1f} "
+            f"{percentile(values, 0.99) / 1e3:>8.1f} {max(values) / 1e3:>8.1f}"
+        )
+    print()
+    timings = node.handle_timings()
+    if timings:
+        print(f"{'HAL handle (us)':<16} {'count':>7} {'mean':>8} {'max':>8}")
+        for kind, count, mean, most in timings:
+            print(f"{kind:<16} {count:>7} {mean:>8} {most:>8}")
+    else:
+        print("No host pipeline report from the HAL on /diagnostics")
+    print()
+    print(
+        f"{'publish (ms)':<16} {'sent':>7} {'seen':>7} {'dropped':>7} "
+        f"{'mean':>8} {'p99':>8}"
+    )
+    with node.lock:
+        for topic in ["scan", "joint_states"]:
+            latencies = node.latency_ns[topic]
+            seen = node.received[topic]
+            expected = node.sent[topic]
+            mean = sum(latencies) / len(latencies) / 1e6 if latencies else 0.0
+            p99 = percentile(latencies, 0.99) / 1e6 if latencies else 0.0
+            print(
+                f"{topic:<16} {expected:>7} {seen:>7} {expected - seen:>7} "
+                f"{mean:>8.2f} {p99:>8.2f}"
+            )
+
+    executor.shutdown()
+    node.destroy_node()
+    rclpy.shutdown()
+
+
+if __name__ == "__main__":
+    main()
@@ -13,6 +13,7 @@ setup(
         ("share/" + package_name, ["package.xml"]),
         (os.path.join("share", package_name, "launch"), glob("launch/*.launch.py")),
         (os.path.join("share", package_name, "config"), glob("config/*")),
+        (os.path.join("share", package_name), glob("worlds/*.sdf")),
         (
             os.path.join("share", package_name, "description"),
             [f for f in glob("description/*") if os.path.isfile(f)],
@@ -32,8 +33,14 @@ setup(
     entry_points={
         "console_scripts": [
             "base = little_red_rover.base:main",
+            "flight_recording = little_red_rover.flight_recording:main",
             "odometry_publisher = little_red_rover.odometry_publisher:main",
+            "sim_bridge = little_red_rover.sim_bridge:main",
             "hal = little_red_rover.hal:main",
+            "latency_probe = little_red_rover.latency_probe:main",
+            "scan_bench = little_red_rover.scan_bench:main",
+            "udp_capture = little_red_rover.udp_capture:main",
+            "udp_replay = little_red_rover.udp_replay:main",
         ],
     },
 )
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "messages.pb.h"
+
+namespace little_red_rover {
+
+// Same resolution as the Python HAL, half a degree per bin
+constexpr size_t kScanBins = 720;
+
+/*
+ * One revolution, binned by angle. Bins nothing landed in are 0.
+ */
+struct Scan
+{
+    std::array<float, kScanBins> ranges;      // m, inf if out of range
+    std::array<float, kScanBins> intensities; // 0 to 255
+    int64_t stamp_ns;                         // When 0 degrees was measured
+    float time_increment;                     // s between points
+    float scan_time;                          // s per revolution
+};
+
+/*
+ * Puts scan packets back together into whole revolutions. Mirrors
+ * handle_compact_laser_scan and handle_laser_scan in hal.py, but bins
+ * compact points with integer math in a single pass.
+ */
+class ScanAssembler
+{
+  public:
+    using ScanCallback = std::function<void(const Scan &)>;
+
+    explicit ScanAssembler(ScanCallback on_scan);
+
+    void add(const CompactLaserScan &packet);
+    void add(const LaserScan &packet);
+
+  private:
+    void finish();
+
+    ScanCallback on_scan_;
+    Scan scan_;
+    uint32_t scan_id_;
+    bool scan_done_;
+    // Delta encoded points, expanded back to the raw layout
+    std::string decoded_;
+};
+
+} // namespace little_red_rover
@@ -0,0 +1,34 @@
+#include <memory>
+
+#include "rclcpp/rclcpp.hpp"
+#include "rclcpp_components/register_node_macro.hpp"
+#include "robot_localization/ros_filter_types.hpp"
+
+// robot_localization's EKF as a component. Its filter has to be initialized
+// once it's owned by a shared_ptr, which ekf_node does in main(), so this
+// does the same for the component container.
+
+namespace little_red_rover {
+
+class Ekf
+{
+  public:
+    explicit Ekf(const rclcpp::NodeOptions &options)
+      : filter_(std::make_shared<robot_localization::RosEkf>(options))
+    {
+        filter_->initialize();
+    }
+
+    rclcpp::node_interfaces::NodeBaseInterface::SharedPtr
+    get_node_base_interface() const
+    {
+        return filter_->get_node_base_interface();
+    }
+
+  private:
+    std::shared_ptr<robot_localization::RosEkf> filter_;
+};
+
+} // namespace little_red_rover
+
+RCLCPP_COMPONENTS_REGISTER_NODE(little_red_rover::Ekf)
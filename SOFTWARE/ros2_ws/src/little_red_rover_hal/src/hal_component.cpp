@@ -0,0 +1,431 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "geometry_msgs/msg/twist.hpp"
+#include "nav_msgs/msg/odometry.hpp"
+#include "rclcpp/rclcpp.hpp"
+#include "rclcpp_components/register_node_macro.hpp"
+#include "sensor_msgs/msg/imu.hpp"
+#include "sensor_msgs/msg/joint_state.hpp"
+#include "sensor_msgs/msg/laser_scan.hpp"
+
+#include "little_red_rover_hal/scan_assembler.hpp"
+#include "messages.pb.h"
+
+// LRR Hardware Abstraction Layer (HAL), native version of hal.py. Load it
+// into a component container next to its consumers to skip serialization.
+
+namespace little_red_rover {
+
+namespace {
+
+constexpr uint16_t kPort = 8001;
+constexpr size_t kMaxDatagram = 1500;
+// How often the receive thread checks whether it should stop
+constexpr int kReceiveTimeoutMs = 100;
+constexpr int64_t kNanosPerSecond = 1000000000;
+// Where Odometry.pose_covariance (x, y, yaw) and twist_covariance (v, w)
+// land in the 6x6 ROS covariances
+constexpr size_t kPoseAxes[] = { 0, 1, 5 };
+constexpr size_t kTwistAxes[] = { 0, 5 };
+
+int64_t to_nanoseconds(const TimeStamp &stamp)
+{
+    return static_cast<int64_t>(stamp.sec()) * kNanosPerSecond +
+           stamp.nanosec();
+}
+
+// The clock the rover syncs to and stamps everything on
+int64_t wall_clock_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+} // namespace
+
+class Hal : public rclcpp::Node
+{
+  public:
+    explicit Hal(const rclcpp::NodeOptions &options)
+      : Node("hal", options)
+      , assembler_([this](const Scan &scan) { publish_scan(scan); })
+      , running_(true)
+    {
+        declare_parameter("robot_ip", "192.168.4.1");
+        // Only serve the rover with this id, 0 serves whoever is talking.
+        // hal.py handles several rovers at once (its fleet parameter).
+        declare_parameter("robot_id", 0);
+        // -1 leaves the rover on CONFIG_LRR_LIDAR_POINTS_PER_PACKET
+        declare_parameter("lidar_points_per_packet", -1);
+        // Same meaning as in hal.py
+        declare_parameter("lidar_scan_hz", 0.0);
+        declare_parameter("lidar_min_range_mm", 0);
+        declare_parameter("lidar_max_range_mm", 0);
+        declare_parameter("lidar_min_intensity", 0);
+        declare_parameter("lidar_sectors", std::vector<int64_t>{});
+        declare_parameter("lidar_compress", true);
+
+        open_socket();
+
+        auto qos = rclcpp::SensorDataQoS();
+        subscription_ = create_subscription<geometry_msgs::msg::Twist>(
+          "cmd_vel",
+          qos,
+          [this](geometry_msgs::msg::Twist::ConstSharedPtr msg) {
+              cmd_vel_callback(*msg);
+          });
+        joint_state_publisher_ =
+          create_publisher<sensor_msgs::msg::JointState>("joint_states", qos);
+        scan_publisher_ =
+          create_publisher<sensor_msgs::msg::LaserScan>("scan", qos);
+        // Integrated on the robot from every control step
+        odometry_publisher_ =
+          create_publisher<nav_msgs::msg::Odometry>("odom/wheel", qos);
+        imu_publisher_ = create_publisher<sensor_msgs::msg::Imu>("imu", qos);
+        // Only sent when the firmware runs its own attitude filter
+        attitude_publisher_ =
+          create_publisher<sensor_msgs::msg::Imu>("imu/attitude", qos);
+
+        // Resent periodically so it sticks across firmware restarts
+        config_timer_ = create_wall_timer(std::chrono::seconds(2),
+                                          [this]() { send_lidar_config(); });
+
+        receive_thread_ = std::thread([this]() { run_loop(); });
+    }
+
+    ~Hal() override
+    {
+        running_ = false;
+        if (receive_thread_.joinable()) {
+            receive_thread_.join();
+        }
+        if (socket_ >= 0) {
+            close(socket_);
+        }
+    }
+
+  private:
+    void open_socket()
+    {
+        socket_ = socket(AF_INET, SOCK_DGRAM, 0);
+        if (socket_ < 0) {
+            throw std::runtime_error(std::string("socket: ") +
+                                     std::strerror(errno));
+        }
+
+        int reuse = 1;
+        setsockopt(socket_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        timeval timeout = {};
+        timeout.tv_usec = kReceiveTimeoutMs * 1000;
+        setsockopt(socket_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        sockaddr_in local = {};
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = htonl(INADDR_ANY);
+        local.sin_port = htons(kPort);
+        if (bind(socket_, reinterpret_cast<sockaddr *>(&local),
+                 sizeof(local)) < 0) {
+            throw std::runtime_error(std::string("bind: ") +
+                                     std::strerror(errno));
+        }
+
+        robot_id_ = static_cast<uint32_t>(get_parameter("robot_id").as_int());
+        std::string robot_ip = get_parameter("robot_ip").as_string();
+        robot_ = {};
+        robot_.sin_family = AF_INET;
+        robot_.sin_port = htons(kPort);
+        if (inet_pton(AF_INET, robot_ip.c_str(), &robot_.sin_addr) != 1) {
+            throw std::invalid_argument("Bad robot_ip: " + robot_ip);
+        }
+    }
+
+    void run_loop()
+    {
+        char data[kMaxDatagram];
+        UdpPacket packet;
+
+        while (running_ && rclcpp::ok()) {
+            sockaddr_in source = {};
+            socklen_t source_len = sizeof(source);
+            ssize_t len = recvfrom(socket_, data, sizeof(data), 0,
+                                   reinterpret_cast<sockaddr *>(&source),
+                                   &source_len);
+            if (len <= 0) {
+                continue;
+            }
+            // For answering time sync requests
+            int64_t received_ns = wall_clock_ns();
+
+            if (!packet.ParseFromArray(data, static_cast<int>(len))) {
+                RCLCPP_WARN(get_logger(), "Failed to decode packet");
+                continue;
+            }
+            // The firmware puts its id on batches as well as on each packet
+            if (robot_id_ != 0 && packet.robot_id() != robot_id_) {
+                continue;
+            }
+            {
+                // Replies go wherever the rover is talking from
+                std::lock_guard<std::mutex> lock(robot_lock_);
+                robot_ = source;
+            }
+
+            // The firmware coalesces packets into one datagram when it can
+            if (packet.batch_size() > 0) {
+                for (const UdpPacket &sub_packet : packet.batch()) {
+                    handle_packet(sub_packet, received_ns);
+                }
+            } else {
+                handle_packet(packet, received_ns);
+            }
+        }
+    }
+
+    void handle_packet(const UdpPacket &packet, int64_t received_ns)
+    {
+        if (packet.has_compact_laser()) {
+            assembler_.add(packet.compact_laser());
+        } else if (packet.has_laser()) {
+            assembler_.add(packet.laser());
+        } else if (packet.has_joint_states()) {
+            handle_joint_states(packet.joint_states());
+        } else if (packet.has_imu()) {
+            handle_imu(packet.imu());
+        } else if (packet.has_time_sync()) {
+            handle_time_sync(packet.time_sync(), received_ns);
+        } else if (packet.has_discovery() && !packet.discovery().answer()) {
+            // The rover sends everything to whoever answers
+            UdpPacket answer;
+            answer.mutable_discovery()->set_answer(true);
+            send_packet(answer);
+        }
+        // Diagnostics, command stats and control tuning are still only handled
+        // by hal.py
+
+        // Ride along in the same packet as an IMU batch or joint states
+        if (packet.has_attitude()) {
+            handle_attitude(packet.attitude());
+        }
+        if (packet.has_odometry()) {
+            handle_odometry(packet.odometry());
+        }
+    }
+
+    void handle_joint_states(const JointStates &packet)
+    {
+        auto msg = std::make_unique<sensor_msgs::msg::JointState>();
+        msg->header.frame_id = "robot_body";
+        msg->header.stamp = rclcpp::Time(to_nanoseconds(packet.time()));
+        msg->name.assign(packet.name().begin(), packet.name().end());
+        msg->effort.assign(packet.effort().begin(), packet.effort().end());
+        msg->position.assign(packet.position().begin(),
+                             packet.position().end());
+        msg->velocity.assign(packet.velocity().begin(),
+                             packet.velocity().end());
+        joint_state_publisher_->publish(std::move(msg));
+    }
+
+    void handle_time_sync(const TimeSync &packet, int64_t received_ns)
+    {
+        // The rover puts every stamp it sends on this clock, so answer
+        // straight away. Time spent here is taken out of the round trip.
+        UdpPacket answer;
+        TimeSync *sync = answer.mutable_time_sync();
+        sync->set_rover_send_us(packet.rover_send_us());
+        sync->set_host_receive_ns(received_ns);
+        sync->set_host_send_ns(wall_clock_ns());
+        send_packet(answer);
+    }
+
+    void handle_odometry(const Odometry &packet)
+    {
+        auto msg = std::make_unique<nav_msgs::msg::Odometry>();
+        msg->header.frame_id = "odom";
+        msg->header.stamp = rclcpp::Time(to_nanoseconds(packet.time()));
+        msg->child_frame_id = "base_link";
+
+        msg->pose.pose.position.x = packet.x();
+        msg->pose.pose.position.y = packet.y();
+        msg->pose.pose.orientation.z = std::sin(packet.yaw() / 2);
+        msg->pose.pose.orientation.w = std::cos(packet.yaw() / 2);
+        msg->twist.twist.linear.x = packet.v();
+        msg->twist.twist.angular.z = packet.w();
+
+        if (packet.pose_covariance_size() == 9) {
+            for (size_t i = 0; i < 3; i++) {
+                for (size_t j = 0; j < 3; j++) {
+                    msg->pose.covariance[kPoseAxes[i] * 6 + kPoseAxes[j]] =
+                      packet.pose_covariance(i * 3 + j);
+                }
+            }
+        }
+        if (packet.twist_covariance_size() == 4) {
+            for (size_t i = 0; i < 2; i++) {
+                for (size_t j = 0; j < 2; j++) {
+                    msg->twist.covariance[kTwistAxes[i] * 6 + kTwistAxes[j]] =
+                      packet.twist_covariance(i * 2 + j);
+                }
+            }
+        }
+        odometry_publisher_->publish(std::move(msg));
+    }
+
+    void handle_imu(const Imu &packet)
+    {
+        int64_t start_ns = to_nanoseconds(packet.time());
+        for (const ImuSample &sample : packet.samples()) {
+            auto msg = std::make_unique<sensor_msgs::msg::Imu>();
+            msg->header.frame_id = "robot_body";
+            msg->header.stamp = rclcpp::Time(
+              start_ns + static_cast<int64_t>(sample.time_offset_us()) * 1000);
+            // No orientation estimate
+            msg->orientation_covariance[0] = -1.0;
+            msg->angular_velocity.x = sample.gyro_x() * packet.gyro_scale();
+            msg->angular_velocity.y = sample.gyro_y() * packet.gyro_scale();
+            msg->angular_velocity.z = sample.gyro_z() * packet.gyro_scale();
+            msg->linear_acceleration.x =
+              sample.accel_x() * packet.accel_scale();
+            msg->linear_acceleration.y =
+              sample.accel_y() * packet.accel_scale();
+            msg->linear_acceleration.z =
+              sample.accel_z() * packet.accel_scale();
+            imu_publisher_->publish(std::move(msg));
+        }
+    }
+
+    void handle_attitude(const Attitude &packet)
+    {
+        auto msg = std::make_unique<sensor_msgs::msg::Imu>();
+        msg->header.frame_id = "robot_body";
+        msg->header.stamp = rclcpp::Time(to_nanoseconds(packet.time()));
+
+        // Fixed axis roll, pitch, yaw to a quaternion
+        double cr = std::cos(packet.roll() / 2);
+        double sr = std::sin(packet.roll() / 2);
+        double cp = std::cos(packet.pitch() / 2);
+        double sp = std::sin(packet.pitch() / 2);
+        double cy = std::cos(packet.yaw() / 2);
+        double sy = std::sin(packet.yaw() / 2);
+        msg->orientation.w = cr * cp * cy + sr * sp * sy;
+        msg->orientation.x = sr * cp * cy - cr * sp * sy;
+        msg->orientation.y = cr * sp * cy + sr * cp * sy;
+        msg->orientation.z = cr * cp * sy - sr * sp * cy;
+
+        // Only the yaw rate is estimated, and there's no acceleration
+        msg->angular_velocity.z = packet.yaw_rate();
+        msg->angular_velocity_covariance[0] = -1.0;
+        msg->linear_acceleration_covariance[0] = -1.0;
+        attitude_publisher_->publish(std::move(msg));
+    }
+
+    void publish_scan(const Scan &scan)
+    {
+        auto msg = std::make_unique<sensor_msgs::msg::LaserScan>();
+        msg->header.frame_id = "lidar";
+        msg->header.stamp = rclcpp::Time(scan.stamp_ns);
+        msg->range_min = 0.1f;
+        msg->range_max = 8.0f;
+        msg->angle_min = 0.0f;
+        msg->angle_max = 2.0f * static_cast<float>(M_PI);
+        msg->angle_increment = msg->angle_max / kScanBins;
+        msg->time_increment = scan.time_increment;
+        msg->scan_time = scan.scan_time;
+        msg->ranges.assign(scan.ranges.begin(), scan.ranges.end());
+        msg->intensities.assign(scan.intensities.begin(),
+                                scan.intensities.end());
+        scan_publisher_->publish(std::move(msg));
+    }
+
+    void send_lidar_config()
+    {
+        UdpPacket packet;
+        LidarConfig *config = packet.mutable_lidar_config();
+        int64_t points_per_packet =
+          get_parameter("lidar_points_per_packet").as_int();
+        if (points_per_packet >= 0) {
+            config->set_points_per_packet(points_per_packet);
+        }
+        config->set_scan_hz(
+          static_cast<float>(get_parameter("lidar_scan_hz").as_double()));
+        config->set_min_range_mm(get_parameter("lidar_min_range_mm").as_int());
+        config->set_max_range_mm(get_parameter("lidar_max_range_mm").as_int());
+        config->set_min_intensity(
+          get_parameter("lidar_min_intensity").as_int());
+        // start_deg, end_deg, keep_every triples
+        std::vector<int64_t> sectors =
+          get_parameter("lidar_sectors").as_integer_array();
+        for (size_t i = 0; i + 2 < sectors.size(); i += 3) {
+            LidarSector *sector = config->add_sectors();
+            sector->set_start_deg(sectors[i]);
+            sector->set_end_deg(sectors[i + 1]);
+            sector->set_keep_every(sectors[i + 2]);
+        }
+        if (get_parameter("lidar_compress").as_bool()) {
+            config->set_encoding(POINT_ENCODING_DELTA_VARINT);
+        }
+        send_packet(packet);
+    }
+
+    void send_packet(const UdpPacket &packet)
+    {
+        std::string data = packet.SerializeAsString();
+        std::lock_guard<std::mutex> lock(robot_lock_);
+        sendto(socket_, data.data(), data.size(), 0,
+               reinterpret_cast<const sockaddr *>(&robot_), sizeof(robot_));
+    }
+
+    void cmd_vel_callback(const geometry_msgs::msg::Twist &msg)
+    {
+        UdpPacket packet;
+        TwistCmd *cmd = packet.mutable_cmd_vel();
+
+        // Wall clock, so the firmware can tell how long this took to arrive
+        int64_t now_ns = wall_clock_ns();
+        cmd->mutable_time()->set_sec(static_cast<int32_t>(now_ns /
+                                                          kNanosPerSecond));
+        cmd->mutable_time()->set_nanosec(
+          static_cast<uint32_t>(now_ns % kNanosPerSecond));
+        cmd->set_v(static_cast<float>(msg.linear.x));
+        cmd->set_w(static_cast<float>(msg.angular.z));
+
+        send_packet(packet);
+    }
+
+    ScanAssembler assembler_;
+    std::atomic<bool> running_;
+    int socket_ = -1;
+    uint32_t robot_id_ = 0;
+    std::mutex robot_lock_; // robot_ is updated by the receive thread
+    sockaddr_in robot_;
+    std::thread receive_thread_;
+
+    rclcpp::Subscription<geometry_msgs::msg::Twist>::SharedPtr subscription_;
+    rclcpp::Publisher<sensor_msgs::msg::JointState>::SharedPtr
+      joint_state_publisher_;
+    rclcpp::Publisher<sensor_msgs::msg::LaserScan>::SharedPtr scan_publisher_;
+    rclcpp::Publisher<nav_msgs::msg::Odometry>::SharedPtr odometry_publisher_;
+    rclcpp::Publisher<sensor_msgs::msg::Imu>::SharedPtr imu_publisher_;
+    rclcpp::Publisher<sensor_msgs::msg::Imu>::SharedPtr attitude_publisher_;
+    rclcpp::TimerBase::SharedPtr config_timer_;
+};
+
+} // namespace little_red_rover
+
+RCLCPP_COMPONENTS_REGISTER_NODE(little_red_rover::Hal)
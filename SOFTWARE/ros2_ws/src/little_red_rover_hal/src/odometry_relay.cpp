@@ -0,0 +1,49 @@
+#include <memory>
+
+#include "geometry_msgs/msg/twist_with_covariance_stamped.hpp"
+#include "nav_msgs/msg/odometry.hpp"
+#include "rclcpp/rclcpp.hpp"
+#include "rclcpp_components/register_node_macro.hpp"
+
+// LRR Odometry Relay, native version of odometry_publisher.py. Forwards the
+// twist from the rover's wheel odometry, with its covariance, to the EKF.
+
+namespace little_red_rover {
+
+class OdometryRelay : public rclcpp::Node
+{
+  public:
+    explicit OdometryRelay(const rclcpp::NodeOptions &options)
+      : Node("odom_publisher", options)
+    {
+        auto qos = rclcpp::SensorDataQoS();
+        publisher_ =
+          create_publisher<geometry_msgs::msg::TwistWithCovarianceStamped>(
+            "twist", qos);
+        subscription_ = create_subscription<nav_msgs::msg::Odometry>(
+          "odom/wheel",
+          qos,
+          [this](nav_msgs::msg::Odometry::ConstSharedPtr msg) {
+              odometry_callback(*msg);
+          });
+    }
+
+  private:
+    void odometry_callback(const nav_msgs::msg::Odometry &msg)
+    {
+        auto twist =
+          std::make_unique<geometry_msgs::msg::TwistWithCovarianceStamped>();
+        twist->header.frame_id = msg.child_frame_id;
+        twist->header.stamp = msg.header.stamp;
+        twist->twist = msg.twist;
+        publisher_->publish(std::move(twist));
+    }
+
+    rclcpp::Subscription<nav_msgs::msg::Odometry>::SharedPtr subscription_;
+    rclcpp::Publisher<geometry_msgs::msg::TwistWithCovarianceStamped>::SharedPtr
+      publisher_;
+};
+
+} // namespace little_red_rover
+
+RCLCPP_COMPONENTS_REGISTER_NODE(little_red_rover::OdometryRelay)
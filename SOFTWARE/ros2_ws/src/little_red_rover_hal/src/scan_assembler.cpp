@@ -0,0 +1,212 @@
+#include "little_red_rover_hal/scan_assembler.hpp"
+
+#include <cmath>
+#include <limits>
+
+namespace little_red_rover {
+
+namespace {
+
+constexpr int64_t kNanosPerSecond = 1000000000;
+constexpr uint32_t kCentidegPerRev = 36000;
+constexpr uint32_t kCentidegPerBin = kCentidegPerRev / kScanBins;
+constexpr uint16_t kMinRangeMm = 100;
+constexpr uint16_t kMaxRangeMm = 8000;
+constexpr size_t kBytesPerPoint = 3;
+constexpr size_t kMaxVarintBytes = 3;
+// Fraction bits when stepping the angle from point to point
+constexpr int kAngleFractionBits = 16;
+
+// Fragments of revolutions we've moved past are stale. The window keeps a
+// firmware restart (scan_id back to 0) from looking like an old fragment.
+constexpr uint32_t kStaleWindow = 16;
+
+int64_t to_nanoseconds(const TimeStamp &stamp)
+{
+    return static_cast<int64_t>(stamp.sec()) * kNanosPerSecond +
+           stamp.nanosec();
+}
+
+/*
+ * Expands POINT_ENCODING_DELTA_VARINT points to the raw 3 byte layout.
+ * False if they don't add up to count points.
+ */
+bool decode_delta_varint(const std::string &points,
+                         uint32_t count,
+                         std::string &out)
+{
+    if (points.size() < 2 * static_cast<size_t>(count)) {
+        return false;
+    }
+    const auto *bytes = reinterpret_cast<const uint8_t *>(points.data());
+    const uint8_t *intensities = bytes + points.size() - count;
+
+    out.resize(static_cast<size_t>(count) * kBytesPerPoint);
+    auto *point = reinterpret_cast<uint8_t *>(&out[0]);
+    uint16_t distance = 0;
+    const uint8_t *in = bytes;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t zigzag = 0;
+        for (size_t shift = 0;; shift += 7) {
+            if (in == intensities || shift == 7 * kMaxVarintBytes) {
+                return false;
+            }
+            uint8_t byte = *in++;
+            zigzag |= static_cast<uint32_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                break;
+            }
+        }
+        int32_t delta = static_cast<int32_t>(zigzag >> 1) ^
+                        -static_cast<int32_t>(zigzag & 1);
+        distance = static_cast<uint16_t>(distance + delta);
+        *point++ = static_cast<uint8_t>(distance);
+        *point++ = static_cast<uint8_t>(distance >> 8);
+        *point++ = intensities[i];
+    }
+    return in == intensities;
+}
+
+} // namespace
+
+ScanAssembler::ScanAssembler(ScanCallback on_scan)
+  : on_scan_(std::move(on_scan))
+  , scan_()
+  , scan_id_(UINT32_MAX)
+  , scan_done_(true)
+{
+}
+
+void ScanAssembler::add(const CompactLaserScan &packet)
+{
+    uint32_t age = scan_id_ - packet.scan_id();
+    if ((age > 0 && age < kStaleWindow) || (age == 0 && scan_done_)) {
+        return;
+    }
+
+    // Points are (distance mm, intensity), straight off the LD20. When the
+    // firmware filtered some out, kept has a bit for each point it swept,
+    // set for the ones that made it.
+    const std::string *raw = &packet.points();
+    if (packet.encoding() == POINT_ENCODING_DELTA_VARINT) {
+        if (!decode_delta_varint(*raw, packet.point_count(), decoded_)) {
+            return;
+        }
+        raw = &decoded_;
+    }
+    const std::string &points = *raw;
+    const std::string &kept = packet.kept();
+    size_t count = points.size() / kBytesPerPoint;
+    size_t swept = count;
+    if (!kept.empty()) {
+        swept = packet.swept_points();
+        if (swept > kept.size() * 8) {
+            return;
+        }
+    }
+    uint32_t start = packet.start_angle();
+    uint32_t end = packet.end_angle();
+    if (swept < 2 || end <= start) {
+        return;
+    }
+
+    if (packet.scan_id() != scan_id_) {
+        if (!scan_done_) {
+            finish();
+        }
+        scan_id_ = packet.scan_id();
+        scan_done_ = false;
+
+        // The scan starts at 0 degrees, which was measured a little before
+        // the first point we got (more if fragment 0 was lost).
+        double lead_s = static_cast<double>(start) * (swept - 1) /
+                        (end - start) * packet.time_increment();
+        scan_.stamp_ns = to_nanoseconds(packet.time()) -
+                         static_cast<int64_t>(lead_s * kNanosPerSecond);
+    }
+
+    // Centidegrees in fixed point. end is unwrapped, so the angle can run
+    // past a full turn and the bin wraps with it.
+    uint64_t step =
+      (static_cast<uint64_t>(end - start) << kAngleFractionBits) / (swept - 1);
+    uint64_t angle = static_cast<uint64_t>(start) << kAngleFractionBits;
+    const auto *bytes = reinterpret_cast<const uint8_t *>(points.data());
+    const auto *mask = reinterpret_cast<const uint8_t *>(kept.data());
+    const float inf = std::numeric_limits<float>::infinity();
+
+    size_t next = 0; // Next point in points
+    for (size_t i = 0; i < swept; i++, angle += step) {
+        if (!kept.empty() && !(mask[i / 8] & (1u << (i % 8)))) {
+            continue;
+        }
+        if (next == count) {
+            break;
+        }
+        size_t bin =
+          ((angle >> kAngleFractionBits) / kCentidegPerBin) % kScanBins;
+        const uint8_t *point = bytes + next++ * kBytesPerPoint;
+        uint16_t distance = static_cast<uint16_t>(point[0] | (point[1] << 8));
+        uint8_t intensity = point[2];
+
+        bool valid = distance >= kMinRangeMm && distance <= kMaxRangeMm &&
+                     intensity != 0;
+        scan_.ranges[bin] = valid ? distance * 0.001f : inf;
+        scan_.intensities[bin] = valid ? intensity : 0.0f;
+    }
+
+    scan_.time_increment = packet.time_increment();
+    if (packet.speed() > 0) {
+        scan_.scan_time = 360.0f / packet.speed();
+    }
+
+    if (packet.end_of_scan()) {
+        finish();
+        scan_done_ = true;
+    }
+}
+
+void ScanAssembler::add(const LaserScan &packet)
+{
+    int count = packet.ranges_size();
+    if (count < 2 || packet.intensities_size() != count) {
+        return;
+    }
+
+    const float two_pi = 2.0f * static_cast<float>(M_PI);
+    const float inf = std::numeric_limits<float>::infinity();
+    float span = packet.angle_max() - packet.angle_min();
+    bool break_in_packet = false;
+
+    for (int i = 0; i < count; i++) {
+        float angle = packet.angle_min() + span * i / (count - 1);
+
+        if (angle > two_pi && !break_in_packet) {
+            scan_.time_increment = packet.time_increment();
+            scan_.scan_time = packet.scan_time();
+            break_in_packet = true;
+            finish();
+            scan_.stamp_ns =
+              to_nanoseconds(packet.time()) +
+              static_cast<int64_t>(i * packet.time_increment() *
+                                   kNanosPerSecond);
+        }
+
+        size_t bin =
+          static_cast<size_t>(std::fmod(angle, two_pi) / two_pi * kScanBins) %
+          kScanBins;
+        float distance = packet.ranges(i);
+        float intensity = packet.intensities(i);
+        bool valid = distance <= 8.0f && distance >= 0.1f && intensity != 0;
+        scan_.ranges[bin] = valid ? distance : inf;
+        scan_.intensities[bin] = valid ? intensity : 0.0f;
+    }
+}
+
+void ScanAssembler::finish()
+{
+    on_scan_(scan_);
+    scan_.ranges.fill(0.0f);
+    scan_.intensities.fill(0.0f);
+}
+
+} // namespace little_red_rover
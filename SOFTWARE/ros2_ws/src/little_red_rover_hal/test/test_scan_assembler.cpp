@@ -0,0 +1,154 @@
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "little_red_rover_hal/scan_assembler.hpp"
+
+extern "C"
+{
+#include "point_codec.h"
+}
+
+// Packets as the firmware builds them, points encoded by its own codec, so
+// the two ends of POINT_ENCODING_DELTA_VARINT are checked against each other.
+
+namespace little_red_rover {
+namespace {
+
+constexpr uint32_t kCentidegPerBin = 50;
+
+struct Point
+{
+    uint16_t distance;
+    uint8_t intensity;
+};
+
+// Out of range, no return, and jumps that need two and three varint bytes
+const std::vector<Point> kPoints = {
+    { 500, 200 },  { 502, 201 }, { 498, 199 }, { 50, 10 },   { 7999, 180 },
+    { 8000, 181 }, { 8001, 90 }, { 120, 0 },   { 100, 255 }, { 65535, 1 },
+    { 0, 5 },      { 3000, 60 }, { 2990, 61 }, { 3010, 62 },
+};
+
+CompactLaserScan make_packet(const std::vector<Point> &points)
+{
+    CompactLaserScan packet;
+    packet.set_start_angle(0);
+    packet.set_end_angle(kCentidegPerBin * (points.size() - 1));
+    packet.set_speed(3600);
+    packet.set_scan_id(0);
+    packet.set_fragment(0);
+    packet.set_end_of_scan(true);
+    packet.set_time_increment(0.0002f);
+    return packet;
+}
+
+CompactLaserScan encode_delta_varint(const std::vector<Point> &points)
+{
+    std::string bytes;
+    uint16_t previous = 0;
+    for (const Point &point : points) {
+        uint8_t out[POINT_CODEC_MAX_DISTANCE_BYTES];
+        size_t len = point_codec_put_distance(out, point.distance, &previous);
+        bytes.append(reinterpret_cast<const char *>(out), len);
+    }
+    for (const Point &point : points) {
+        bytes.push_back(static_cast<char>(point.intensity));
+    }
+
+    CompactLaserScan packet = make_packet(points);
+    packet.set_points(bytes);
+    packet.set_encoding(POINT_ENCODING_DELTA_VARINT);
+    packet.set_point_count(points.size());
+    return packet;
+}
+
+CompactLaserScan encode_raw(const std::vector<Point> &points)
+{
+    std::string bytes;
+    for (const Point &point : points) {
+        bytes.push_back(static_cast<char>(point.distance & 0xff));
+        bytes.push_back(static_cast<char>(point.distance >> 8));
+        bytes.push_back(static_cast<char>(point.intensity));
+    }
+
+    CompactLaserScan packet = make_packet(points);
+    packet.set_points(bytes);
+    packet.set_encoding(POINT_ENCODING_RAW);
+    return packet;
+}
+
+std::vector<Scan> assemble(const CompactLaserScan &packet)
+{
+    std::vector<Scan> scans;
+    ScanAssembler assembler([&scans](const Scan &scan) {
+        scans.push_back(scan);
+    });
+    assembler.add(packet);
+    return scans;
+}
+
+void expect_points(const Scan &scan, const std::vector<Point> &points)
+{
+    for (size_t i = 0; i < points.size(); i++) {
+        const Point &point = points[i];
+        bool valid = point.distance >= 100 && point.distance <= 8000 &&
+                     point.intensity != 0;
+        if (valid) {
+            EXPECT_FLOAT_EQ(scan.ranges[i], point.distance * 0.001f)
+              << "bin " << i;
+            EXPECT_FLOAT_EQ(scan.intensities[i], point.intensity)
+              << "bin " << i;
+        } else {
+            EXPECT_TRUE(std::isinf(scan.ranges[i])) << "bin " << i;
+            EXPECT_FLOAT_EQ(scan.intensities[i], 0.0f) << "bin " << i;
+        }
+    }
+    for (size_t i = points.size(); i < kScanBins; i++) {
+        EXPECT_FLOAT_EQ(scan.ranges[i], 0.0f) << "bin " << i;
+    }
+}
+
+TEST(ScanAssembler, DecodesFirmwareDeltaVarint)
+{
+    std::vector<Scan> scans = assemble(encode_delta_varint(kPoints));
+    ASSERT_EQ(scans.size(), 1u);
+    expect_points(scans[0], kPoints);
+}
+
+TEST(ScanAssembler, DeltaVarintMatchesRaw)
+{
+    std::vector<Scan> delta = assemble(encode_delta_varint(kPoints));
+    std::vector<Scan> raw = assemble(encode_raw(kPoints));
+    ASSERT_EQ(delta.size(), 1u);
+    ASSERT_EQ(raw.size(), 1u);
+    expect_points(raw[0], kPoints);
+    for (size_t i = 0; i < kScanBins; i++) {
+        EXPECT_EQ(std::isinf(delta[0].ranges[i]), std::isinf(raw[0].ranges[i]));
+        if (!std::isinf(raw[0].ranges[i])) {
+            EXPECT_FLOAT_EQ(delta[0].ranges[i], raw[0].ranges[i]);
+        }
+        EXPECT_FLOAT_EQ(delta[0].intensities[i], raw[0].intensities[i]);
+    }
+}
+
+TEST(ScanAssembler, DropsTruncatedDeltaVarint)
+{
+    CompactLaserScan packet = encode_delta_varint(kPoints);
+    // The last point loses its distance byte
+    std::string points = packet.points();
+    points.erase(points.size() - kPoints.size() - 1, 1);
+    packet.set_points(points);
+    EXPECT_TRUE(assemble(packet).empty());
+
+    // More points claimed than were sent
+    packet = encode_delta_varint(kPoints);
+    packet.set_point_count(kPoints.size() + 1);
+    EXPECT_TRUE(assemble(packet).empty());
+}
+
+} // namespace
+} // namespace little_red_rover